@@ -0,0 +1,333 @@
+/* corpus.c - write the packets "make bench" replays
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Writes a pcap file of the NFLOG link type, i.e. the packets along with
+ *  what the kernel hands to the NFLOG plugin (prefix, mark, interfaces,
+ *  hardware header, and for the locally generated ones the UID and GID).
+ *  Replayed by the PCAP plugin, the records look like the ones of the NFLOG
+ *  plugin.  The packets are always the same mix of TCP, UDP and ICMP over
+ *  IPv4 and IPv6 with varying addresses and ports, so the results of two
+ *  runs can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define LINKTYPE_NFLOG		239
+
+#define NFULA_PACKET_HDR	1
+#define NFULA_MARK		2
+#define NFULA_IFINDEX_INDEV	4
+#define NFULA_IFINDEX_OUTDEV	5
+#define NFULA_HWADDR		8
+#define NFULA_PAYLOAD		9
+#define NFULA_PREFIX		10
+#define NFULA_UID		11
+#define NFULA_GID		14
+#define NFULA_HWTYPE		15
+#define NFULA_HWHEADER		16
+#define NFULA_HWLEN		17
+
+#define NF_INET_LOCAL_IN	1
+#define NF_INET_LOCAL_OUT	3
+
+struct pcap_file_hdr {
+	uint32_t	magic;
+	uint16_t	version_major;
+	uint16_t	version_minor;
+	int32_t		thiszone;
+	uint32_t	sigfigs;
+	uint32_t	snaplen;
+	uint32_t	linktype;
+};
+
+struct corpus_buf {
+	uint8_t		data[2048];
+	size_t		len;
+};
+
+static void put(struct corpus_buf *b, const void *data, size_t len)
+{
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void put16(struct corpus_buf *b, uint16_t v)
+{
+	v = htons(v);
+	put(b, &v, sizeof(v));
+}
+
+static void put32(struct corpus_buf *b, uint32_t v)
+{
+	v = htonl(v);
+	put(b, &v, sizeof(v));
+}
+
+/* netlink attribute, the header is in host byte order like in the kernel */
+static void put_attr(struct corpus_buf *b, uint16_t type, const void *data,
+		     size_t len)
+{
+	uint16_t hdr[2] = { len + 4, type };
+	static const uint8_t pad[4];
+
+	put(b, hdr, sizeof(hdr));
+	put(b, data, len);
+	put(b, pad, (4 - (len & 3)) & 3);
+}
+
+static void put_attr32(struct corpus_buf *b, uint16_t type, uint32_t v)
+{
+	v = htonl(v);
+	put_attr(b, type, &v, sizeof(v));
+}
+
+static uint16_t csum(const uint8_t *p, size_t len)
+{
+	uint32_t sum = 0;
+
+	for (; len > 1; p += 2, len -= 2)
+		sum += (p[0] << 8) | p[1];
+	if (len)
+		sum += p[0] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* transport header of packet 'n', and a little payload */
+static void put_l4(struct corpus_buf *b, unsigned int n, uint8_t proto)
+{
+	static const uint16_t ports[] = { 22, 53, 80, 123, 443, 993, 3306,
+					  8080 };
+	uint16_t sport = 32768 + n % 28000;
+	uint16_t dport = ports[n % 8];
+
+	switch (proto) {
+	case IPPROTO_TCP:
+		put16(b, sport);
+		put16(b, dport);
+		put32(b, n * 2654435761u);
+		put32(b, n & 1 ? n * 40503u : 0);
+		/* data offset 5, SYN or ACK/PSH */
+		put16(b, n & 1 ? 0x5018 : 0x5002);
+		put16(b, 29200);
+		put16(b, 0);
+		put16(b, 0);
+		put(b, "GET / HTTP/1.1\r\n", n & 1 ? 16 : 0);
+		break;
+	case IPPROTO_UDP:
+		put16(b, sport);
+		put16(b, dport);
+		put16(b, 8 + 24);
+		put16(b, 0);
+		put(b, "benchmark udp payload...", 24);
+		break;
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		/* echo request */
+		b->data[b->len++] = proto == IPPROTO_ICMP ? 8 : 128;
+		b->data[b->len++] = 0;
+		put16(b, 0);
+		put16(b, n & 0xffff);
+		put16(b, n >> 16);
+		put(b, "ping ping ping ping ping", 24);
+		break;
+	}
+}
+
+static void put_ipv4(struct corpus_buf *b, unsigned int n, uint8_t proto)
+{
+	size_t start = b->len;
+	uint16_t sum;
+
+	put16(b, 0x4500);
+	put16(b, 0);
+	put16(b, n & 0xffff);
+	put16(b, 0x4000);
+	b->data[b->len++] = 64;
+	b->data[b->len++] = proto;
+	put16(b, 0);
+	put32(b, 0x0a000000 | (n * 7919) % 0xffffff);
+	put32(b, 0xc0a80000 | (n % 254 + 1));
+	put_l4(b, n, proto);
+
+	b->data[start + 2] = (b->len - start) >> 8;
+	b->data[start + 3] = (b->len - start) & 0xff;
+	sum = csum(b->data + start, 20);
+	b->data[start + 10] = sum >> 8;
+	b->data[start + 11] = sum & 0xff;
+}
+
+static void put_ipv6(struct corpus_buf *b, unsigned int n, uint8_t proto)
+{
+	size_t start = b->len;
+	uint16_t plen;
+
+	put32(b, 0x60000000 | n % 0xfffff);
+	put16(b, 0);
+	b->data[b->len++] = proto;
+	b->data[b->len++] = 64;
+	put32(b, 0x20010db8);
+	put32(b, n % 16);
+	put32(b, 0);
+	put32(b, n * 7919);
+	put32(b, 0x20010db8);
+	put32(b, 0xffff);
+	put32(b, 0);
+	put32(b, n % 254 + 1);
+	put_l4(b, n, proto);
+
+	plen = b->len - start - 40;
+	b->data[start + 4] = plen >> 8;
+	b->data[start + 5] = plen & 0xff;
+}
+
+/* NFLOG record of packet 'n' */
+static void put_record(struct corpus_buf *b, unsigned int n)
+{
+	static const uint8_t protos[] = {
+		IPPROTO_TCP, IPPROTO_TCP, IPPROTO_UDP, IPPROTO_TCP,
+		IPPROTO_ICMP, IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMPV6,
+	};
+	static const char *prefixes[] = {
+		"INPUT DROP: ", "INPUT ACCEPT: ", "FORWARD REJECT: ",
+		"OUTPUT: ",
+	};
+	uint8_t proto = protos[n % 8];
+	int ipv6 = (n % 8) >= 5;
+	int local_out = n % 4 == 3;
+	uint8_t pkt_hdr[4];
+	uint8_t hwaddr[12];
+	uint8_t hwhdr[14];
+	struct corpus_buf pkt;
+	const char *prefix;
+
+	/* nfgenmsg: family, version, resource id */
+	b->data[b->len++] = ipv6 ? AF_INET6 : AF_INET;
+	b->data[b->len++] = 0;
+	put16(b, 1);
+
+	pkt_hdr[0] = ipv6 ? 0x86 : 0x08;
+	pkt_hdr[1] = ipv6 ? 0xdd : 0x00;
+	pkt_hdr[2] = local_out ? NF_INET_LOCAL_OUT : NF_INET_LOCAL_IN;
+	pkt_hdr[3] = 0;
+	put_attr(b, NFULA_PACKET_HDR, pkt_hdr, sizeof(pkt_hdr));
+	put_attr32(b, NFULA_MARK, n % 16);
+
+	prefix = prefixes[n % 4];
+	put_attr(b, NFULA_PREFIX, prefix, strlen(prefix) + 1);
+
+	if (local_out) {
+		put_attr32(b, NFULA_IFINDEX_OUTDEV, 2);
+		put_attr32(b, NFULA_UID, 1000 + n % 8);
+		put_attr32(b, NFULA_GID, 100);
+	} else {
+		put_attr32(b, NFULA_IFINDEX_INDEV, 2 + n % 2);
+
+		/* hw_addrlen, pad, the address padded to 8 bytes */
+		memset(hwaddr, 0, sizeof(hwaddr));
+		hwaddr[1] = 6;
+		memcpy(hwaddr + 4, "\x00\x16\x3e\x00\x00", 5);
+		hwaddr[9] = n & 0xff;
+		put_attr(b, NFULA_HWADDR, hwaddr, sizeof(hwaddr));
+
+		memcpy(hwhdr, "\x52\x54\x00\x12\x34\x56", 6);
+		memcpy(hwhdr + 6, hwaddr + 4, 6);
+		hwhdr[12] = pkt_hdr[0];
+		hwhdr[13] = pkt_hdr[1];
+		put_attr(b, NFULA_HWHEADER, hwhdr, sizeof(hwhdr));
+		put_attr(b, NFULA_HWTYPE, "\x00\x01", 2);
+		put_attr(b, NFULA_HWLEN, "\x00\x0e", 2);
+	}
+
+	pkt.len = 0;
+	if (ipv6)
+		put_ipv6(&pkt, n, proto);
+	else
+		put_ipv4(&pkt, n, proto);
+	put_attr(b, NFULA_PAYLOAD, pkt.data, pkt.len);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n packets] file\n", name);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	/* in host byte order, the reader tells by the magic */
+	struct pcap_file_hdr file_hdr = {
+		.magic		= 0xa1b2c3d4,
+		.version_major	= 2,
+		.version_minor	= 4,
+		.snaplen	= 65535,
+		.linktype	= LINKTYPE_NFLOG,
+	};
+	unsigned int num = 100000, n;
+	struct corpus_buf rec;
+	uint32_t rec_hdr[4];
+	FILE *f;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	f = fopen(argv[optind], "w");
+	if (f == NULL) {
+		fprintf(stderr, "can't open `%s': %s\n", argv[optind],
+			strerror(errno));
+		return 1;
+	}
+
+	fwrite(&file_hdr, sizeof(file_hdr), 1, f);
+
+	for (n = 0; n < num; n++) {
+		rec.len = 0;
+		put_record(&rec, n);
+
+		/* a millisecond apart */
+		rec_hdr[0] = 1700000000 + n / 1000;
+		rec_hdr[1] = (n % 1000) * 1000;
+		rec_hdr[2] = rec.len;
+		rec_hdr[3] = rec.len;
+		fwrite(rec_hdr, sizeof(rec_hdr), 1, f);
+		fwrite(rec.data, rec.len, 1, f);
+	}
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "can't write `%s': %s\n", argv[optind],
+			strerror(errno));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,315 @@
+/* hashbench.c - compare the hash table of src/hash.c to the chained one
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Run by "make bench", this fills both tables with conntrack like entries
+ *  (the tuple NFCT hashes) and measures adding them, finding them, missing
+ *  them, replacing them one after the other (flows ending and starting)
+ *  and deleting them.  The chained table is the one src/hash.c was before
+ *  it used open addressing, with a fixed number of buckets (the default
+ *  hash_buckets of NFCT unless -b is given) and no limit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ulogd/linuxlist.h>
+#include <ulogd/jhash.h>
+#include <ulogd/hash.h>
+
+struct tuple {
+	uint32_t	saddr;
+	uint32_t	daddr;
+	uint16_t	sport;
+	uint16_t	dport;
+	uint32_t	proto;
+};
+
+struct entry {
+	struct hashtable_node	hashnode;
+	struct llist_head	chain;
+	struct tuple		t;
+};
+
+static uint32_t tuple_hash(const struct tuple *t)
+{
+	uint32_t a, b;
+
+	a = jhash(&t->saddr, sizeof(uint32_t), t->proto);
+	b = jhash(&t->daddr, sizeof(uint32_t),
+		  (uint32_t)t->sport << 16 | t->dport);
+	return jhash_2words(a, b, 0);
+}
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t xorshift(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+static void make_tuple(struct tuple *t)
+{
+	uint64_t r = xorshift();
+
+	t->saddr = 0x0a000000 | (r & 0xffffff);
+	t->daddr = 0xc0a80000 | ((r >> 24) & 0xffff);
+	t->sport = 1024 + ((r >> 40) % 64512);
+	t->dport = (r >> 56) & 1 ? 443 : 53;
+	t->proto = (r >> 57) & 1 ? 6 : 17;
+}
+
+static int tuple_cmp(const struct tuple *t1, const struct tuple *t2)
+{
+	return !memcmp(t1, t2, sizeof(*t1));
+}
+
+/* the chained table */
+
+struct chained {
+	uint32_t		hashsize;
+	struct llist_head	*members;
+};
+
+static struct chained *chained_create(uint32_t hashsize)
+{
+	struct chained *c = malloc(sizeof(*c));
+	uint32_t i;
+
+	c->hashsize = hashsize;
+	c->members = malloc(hashsize * sizeof(struct llist_head));
+	for (i = 0; i < hashsize; i++)
+		INIT_LLIST_HEAD(&c->members[i]);
+	return c;
+}
+
+static uint32_t chained_id(const struct chained *c, const struct tuple *t)
+{
+	return ((uint64_t)tuple_hash(t) * c->hashsize) >> 32;
+}
+
+static struct entry *chained_find(struct chained *c, const struct tuple *t)
+{
+	struct entry *e;
+
+	llist_for_each_entry(e, &c->members[chained_id(c, t)], chain) {
+		if (tuple_cmp(&e->t, t))
+			return e;
+	}
+	return NULL;
+}
+
+static void chained_add(struct chained *c, struct entry *e)
+{
+	llist_add(&e->chain, &c->members[chained_id(c, &e->t)]);
+}
+
+static void chained_del(struct chained *c, struct entry *e)
+{
+	llist_del(&e->chain);
+}
+
+/* the table of src/hash.c */
+
+static uint32_t oa_hash(const void *data, const struct hashtable *table)
+{
+	return tuple_hash(data);
+}
+
+static int oa_cmp(const void *data1, const void *data2)
+{
+	const struct entry *e = data1;
+
+	return tuple_cmp(&e->t, data2);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *table, const char *op, uint64_t start,
+		   unsigned int ops)
+{
+	printf("%-8s %-8s %10u %10.1f\n", table, op, ops,
+	       (double)(now_ns() - start) / ops);
+}
+
+static unsigned int num, buckets = 8192;
+static struct entry *entries, *others;
+static unsigned int *order;
+
+static void run_chained(void)
+{
+	struct chained *c = chained_create(buckets);
+	unsigned int i, found = 0;
+	uint64_t start;
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		chained_add(c, &entries[i]);
+	report("chained", "add", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		found += chained_find(c, &entries[order[i]].t) != NULL;
+	report("chained", "find", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		found += chained_find(c, &others[i].t) != NULL;
+	report("chained", "miss", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++) {
+		struct entry *e = chained_find(c, &entries[order[i]].t);
+
+		if (e)
+			chained_del(c, e);
+		chained_add(c, &others[i]);
+	}
+	report("chained", "replace", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		chained_del(c, &others[i]);
+	report("chained", "del", start, num);
+
+	if (found != num)
+		fprintf(stderr, "chained: found %u of %u\n", found, num);
+	free(c->members);
+	free(c);
+}
+
+static void run_oa(void)
+{
+	struct hashtable *h;
+	struct hashtable_stats hs;
+	unsigned int i, found = 0;
+	uint64_t start;
+
+	h = hashtable_create(buckets, num, oa_hash, oa_cmp);
+	if (h == NULL) {
+		perror("hashtable_create");
+		exit(1);
+	}
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		hashtable_add(h, &entries[i].hashnode,
+			      hashtable_hash(h, &entries[i].t));
+	report("open", "add", start, num);
+	hashtable_stats(h, &hs);
+
+	start = now_ns();
+	for (i = 0; i < num; i++) {
+		struct tuple *t = &entries[order[i]].t;
+
+		found += hashtable_find(h, t, hashtable_hash(h, t)) != NULL;
+	}
+	report("open", "find", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++) {
+		struct tuple *t = &others[i].t;
+
+		found += hashtable_find(h, t, hashtable_hash(h, t)) != NULL;
+	}
+	report("open", "miss", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++) {
+		struct tuple *t = &entries[order[i]].t;
+		struct hashtable_node *n;
+
+		n = hashtable_find(h, t, hashtable_hash(h, t));
+		if (n)
+			hashtable_del(h, n);
+		hashtable_add(h, &others[i].hashnode,
+			      hashtable_hash(h, &others[i].t));
+	}
+	report("open", "replace", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		hashtable_del(h, &others[i].hashnode);
+	report("open", "del", start, num);
+
+	if (found != num)
+		fprintf(stderr, "open: found %u of %u\n", found, num);
+	printf("\nopen: %u entries in %u slots (%u%% load), %.2f probes on "
+	       "average, %u at most\n", hs.entries, hs.slots, hs.load,
+	       hs.probe_avg, hs.probe_max);
+	hashtable_destroy(h);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int opt;
+
+	num = 1000000;
+	while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			buckets = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n entries] [-b buckets]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (num == 0 || buckets == 0)
+		return 2;
+
+	entries = calloc(num, sizeof(struct entry));
+	others = calloc(num, sizeof(struct entry));
+	order = malloc(num * sizeof(unsigned int));
+	if (!entries || !others || !order) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i = 0; i < num; i++) {
+		make_tuple(&entries[i].t);
+		make_tuple(&others[i].t);
+		order[i] = i;
+	}
+	for (i = num - 1; i > 0; i--) {
+		unsigned int j = xorshift() % (i + 1), tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	printf("%-8s %-8s %10s %10s\n", "table", "op", "ops", "ns/op");
+	run_chained();
+	run_oa();
+
+	return 0;
+}
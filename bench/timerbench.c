@@ -0,0 +1,341 @@
+/* timerbench.c - compare the timing wheel of src/timer.c to the rbtree one
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Run by "make bench", this queues a million timers (unless -n is given)
+ *  with conntrack like timeouts of one second to an hour and measures
+ *  adding them, rearming them one after the other (as NFCT does on every
+ *  update of a flow), asking for the next expiry, deleting them, and at
+ *  last running them once they all expired within 100 ms.  The rbtree
+ *  timers are the ones src/timer.c had before it used the wheel, on top of
+ *  the red black tree of rbtree.c, a copy of what src/rbtree.c was.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <ulogd/linuxlist.h>
+#include <ulogd/timer.h>
+#include "rbtree.h"
+
+/* the rbtree timers */
+
+struct rb_timer {
+	struct rb_node		node;
+	struct llist_head	list;
+	struct timeval		tv;
+	void			*data;
+	void			(*cb)(struct rb_timer *a, void *data);
+};
+
+static struct rb_root rb_timers = RB_ROOT;
+
+static void rb_init_timer(struct rb_timer *t, void *data,
+			  void (*cb)(struct rb_timer *a, void *data))
+{
+	RB_CLEAR_NODE(&t->node);
+	timerclear(&t->tv);
+	t->data = data;
+	t->cb = cb;
+}
+
+static void __rb_add_timer(struct rb_timer *alarm)
+{
+	struct rb_node **new = &rb_timers.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new) {
+		struct rb_timer *this;
+
+		this = container_of(*new, struct rb_timer, node);
+
+		parent = *new;
+		if (timercmp(&alarm->tv, &this->tv, <))
+			new = &((*new)->rb_left);
+		else
+			new = &((*new)->rb_right);
+	}
+
+	rb_link_node(&alarm->node, parent, new);
+	rb_insert_color(&alarm->node, &rb_timers);
+}
+
+static void rb_del_timer(struct rb_timer *alarm)
+{
+	if (!RB_EMPTY_NODE(&alarm->node)) {
+		rb_erase(&alarm->node, &rb_timers);
+		RB_CLEAR_NODE(&alarm->node);
+	}
+}
+
+/* the old code only took seconds, the expiry test needs milliseconds */
+static void rb_add_timer_usec(struct rb_timer *alarm, unsigned long usec)
+{
+	struct timeval tv;
+
+	rb_del_timer(alarm);
+	alarm->tv.tv_sec = usec / 1000000;
+	alarm->tv.tv_usec = usec % 1000000;
+	gettimeofday(&tv, NULL);
+	timeradd(&alarm->tv, &tv, &alarm->tv);
+	__rb_add_timer(alarm);
+}
+
+static void rb_add_timer(struct rb_timer *alarm, unsigned long sc)
+{
+	rb_add_timer_usec(alarm, sc * 1000000);
+}
+
+static struct timeval *rb_get_next_timer_run(struct timeval *next_run)
+{
+	struct rb_node *node;
+	struct rb_timer *this;
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	node = rb_first(&rb_timers);
+	if (node == NULL)
+		return NULL;
+
+	this = container_of(node, struct rb_timer, node);
+	if (timercmp(&this->tv, &tv, >))
+		timersub(&this->tv, &tv, next_run);
+	else
+		timerclear(next_run);
+	return next_run;
+}
+
+static struct timeval *rb_do_timer_run(struct timeval *next_run)
+{
+	struct llist_head alarm_run_queue;
+	struct rb_node *node;
+	struct rb_timer *this;
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	INIT_LLIST_HEAD(&alarm_run_queue);
+	for (node = rb_first(&rb_timers); node; node = rb_next(node)) {
+		this = container_of(node, struct rb_timer, node);
+
+		if (timercmp(&this->tv, &tv, >))
+			break;
+
+		llist_add(&this->list, &alarm_run_queue);
+	}
+
+	llist_for_each_entry(this, &alarm_run_queue, list) {
+		rb_erase(&this->node, &rb_timers);
+		RB_CLEAR_NODE(&this->node);
+		this->cb(this, this->data);
+	}
+
+	return rb_get_next_timer_run(next_run);
+}
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t xorshift(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *timers, const char *op, uint64_t start,
+		   unsigned int ops)
+{
+	printf("%-8s %-8s %10u %10.1f\n", timers, op, ops,
+	       (double)(now_ns() - start) / ops);
+}
+
+/* wait until every timer of the expiry test is due */
+static void wait_expiry(void)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 110 * 1000000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static unsigned int num;
+static unsigned int *timeouts, *msecs, *order;
+static unsigned int fired;
+
+static void rb_fire(struct rb_timer *t, void *data)
+{
+	fired++;
+}
+
+static void wheel_fire(struct ulogd_timer *t, void *data)
+{
+	fired++;
+}
+
+static void run_rbtree(void)
+{
+	struct rb_timer *timers = calloc(num, sizeof(struct rb_timer));
+	struct timeval next;
+	unsigned int i, found = 0;
+	uint64_t start;
+
+	if (timers == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < num; i++)
+		rb_init_timer(&timers[i], NULL, rb_fire);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		rb_add_timer(&timers[i], timeouts[i]);
+	report("rbtree", "add", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		rb_add_timer(&timers[order[i]], timeouts[i]);
+	report("rbtree", "rearm", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		found += rb_get_next_timer_run(&next) != NULL;
+	report("rbtree", "next", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		rb_del_timer(&timers[order[i]]);
+	report("rbtree", "del", start, num);
+
+	for (i = 0; i < num; i++)
+		rb_add_timer_usec(&timers[i], msecs[i] * 1000);
+	wait_expiry();
+	fired = 0;
+	start = now_ns();
+	rb_do_timer_run(&next);
+	report("rbtree", "expire", start, num);
+
+	if (found != num || fired != num)
+		fprintf(stderr, "rbtree: next %u, fired %u of %u\n",
+			found, fired, num);
+	free(timers);
+}
+
+static void run_wheel(void)
+{
+	struct ulogd_timer *timers = calloc(num, sizeof(struct ulogd_timer));
+	struct timeval next;
+	unsigned int i, found = 0;
+	uint64_t start;
+
+	if (timers == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < num; i++)
+		ulogd_init_timer(&timers[i], NULL, wheel_fire);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		ulogd_add_timer(&timers[i], timeouts[i]);
+	report("wheel", "add", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		ulogd_add_timer(&timers[order[i]], timeouts[i]);
+	report("wheel", "rearm", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		found += ulogd_get_next_timer_run(&next) != NULL;
+	report("wheel", "next", start, num);
+
+	start = now_ns();
+	for (i = 0; i < num; i++)
+		ulogd_del_timer(&timers[order[i]]);
+	report("wheel", "del", start, num);
+
+	for (i = 0; i < num; i++)
+		ulogd_add_timer_msec(&timers[i], msecs[i]);
+	wait_expiry();
+	fired = 0;
+	start = now_ns();
+	ulogd_do_timer_run(&next);
+	report("wheel", "expire", start, num);
+
+	if (found != num || fired != num)
+		fprintf(stderr, "wheel: next %u, fired %u of %u\n",
+			found, fired, num);
+	free(timers);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int opt;
+
+	num = 1000000;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n timers]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (num == 0)
+		return 2;
+
+	timeouts = malloc(num * sizeof(unsigned int));
+	msecs = malloc(num * sizeof(unsigned int));
+	order = malloc(num * sizeof(unsigned int));
+	if (!timeouts || !msecs || !order) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (i = 0; i < num; i++) {
+		uint64_t r = xorshift();
+
+		timeouts[i] = 1 + r % 3600;
+		msecs[i] = (r >> 32) % 100;
+		order[i] = i;
+	}
+	for (i = num - 1; i > 0; i--) {
+		unsigned int j = xorshift() % (i + 1), tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	printf("%-8s %-8s %10s %10s\n", "timers", "op", "ops", "ns/op");
+	run_rbtree();
+	run_wheel();
+
+	return 0;
+}
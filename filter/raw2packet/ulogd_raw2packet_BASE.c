@@ -538,12 +538,11 @@ static struct ulogd_key iphdr_rets[] = {
  * 			TCP HEADER
  ***********************************************************************/
 
-static int _interp_tcp(struct ulogd_pluginstance *pi, struct tcphdr *tcph,
+static int _interp_tcp(struct ulogd_key *ret, struct tcphdr *tcph,
 		       uint32_t len)
 {
-	struct ulogd_key *ret = pi->output.keys;
-
-	if (len < sizeof(struct tcphdr))
+	if (len < sizeof(struct tcphdr) ||
+	    !okeys_needed(ret, KEY_TCP_SPORT, KEY_TCP_CSUM))
 		return ULOGD_IRET_OK;
 	
 	okey_set_u16(&ret[KEY_TCP_SPORT], ntohs(tcph->source));
@@ -573,13 +572,12 @@ static int _interp_tcp(struct ulogd_pluginstance *pi, struct tcphdr *tcph,
  * 			UDP HEADER
  ***********************************************************************/
 
-static int _interp_udp(struct ulogd_pluginstance *pi, struct udphdr *udph,
+static int _interp_udp(struct ulogd_key *ret, struct udphdr *udph,
 		       uint32_t len)
 		
 {
-	struct ulogd_key *ret = pi->output.keys;
-
-	if (len < sizeof(struct udphdr))
+	if (len < sizeof(struct udphdr) ||
+	    !okeys_needed(ret, KEY_UDP_SPORT, KEY_UDP_CSUM))
 		return ULOGD_IRET_OK;
 
 	okey_set_u16(&ret[KEY_UDP_SPORT], ntohs(udph->source));
@@ -602,21 +600,17 @@ typedef struct sctphdr {
 	__be32 checksum;
 } __attribute__((packed)) sctp_sctphdr_t;
 
-static int _interp_sctp(struct ulogd_pluginstance *pi, struct sctphdr *sctph,
+static int _interp_sctp(struct ulogd_key *ret, struct sctphdr *sctph,
 		       uint32_t len)
 		
 {
-	struct ulogd_key *ret = pi->output.keys;
-
-	if (len < sizeof(struct sctphdr))
+	if (len < sizeof(struct sctphdr) ||
+	    !okeys_needed(ret, KEY_SCTP_SPORT, KEY_SCTP_CSUM))
 		return ULOGD_IRET_OK;
 
-	ret[KEY_SCTP_SPORT].u.value.ui16 = ntohs(sctph->source);
-	ret[KEY_SCTP_SPORT].flags |= ULOGD_RETF_VALID;
-	ret[KEY_SCTP_DPORT].u.value.ui16 = ntohs(sctph->dest);
-	ret[KEY_SCTP_DPORT].flags |= ULOGD_RETF_VALID;
-	ret[KEY_SCTP_CSUM].u.value.ui32 = ntohl(sctph->checksum);
-	ret[KEY_SCTP_CSUM].flags |= ULOGD_RETF_VALID;
+	okey_set_u16(&ret[KEY_SCTP_SPORT], ntohs(sctph->source));
+	okey_set_u16(&ret[KEY_SCTP_DPORT], ntohs(sctph->dest));
+	okey_set_u32(&ret[KEY_SCTP_CSUM], ntohl(sctph->checksum));
 	
 	return ULOGD_IRET_OK;
 }
@@ -625,12 +619,12 @@ static int _interp_sctp(struct ulogd_pluginstance *pi, struct sctphdr *sctph,
  * 			ICMP HEADER
  ***********************************************************************/
 
-static int _interp_icmp(struct ulogd_pluginstance *pi, struct icmphdr *icmph,
+static int _interp_icmp(struct ulogd_key *ret, struct icmphdr *icmph,
 			uint32_t len)
 {
-	struct ulogd_key *ret = pi->output.keys;
 
-	if (len < sizeof(struct icmphdr))
+	if (len < sizeof(struct icmphdr) ||
+	    !okeys_needed(ret, KEY_ICMP_TYPE, KEY_ICMP_CSUM))
 		return ULOGD_IRET_OK;
 
 	okey_set_u8(&ret[KEY_ICMP_TYPE], icmph->type);
@@ -663,12 +657,12 @@ static int _interp_icmp(struct ulogd_pluginstance *pi, struct icmphdr *icmph,
  * 			ICMPv6 HEADER
  ***********************************************************************/
 
-static int _interp_icmpv6(struct ulogd_pluginstance *pi, struct icmp6_hdr *icmph,
+static int _interp_icmpv6(struct ulogd_key *ret, struct icmp6_hdr *icmph,
 			  uint32_t len)
 {
-	struct ulogd_key *ret = pi->output.keys;
 
-	if (len < sizeof(struct icmp6_hdr))
+	if (len < sizeof(struct icmp6_hdr) ||
+	    !okeys_needed(ret, KEY_ICMPV6_TYPE, KEY_ICMPV6_CSUM))
 		return ULOGD_IRET_OK;
 
 	okey_set_u8(&ret[KEY_ICMPV6_TYPE], icmph->icmp6_type);
@@ -691,18 +685,16 @@ static int _interp_icmpv6(struct ulogd_pluginstance *pi, struct icmp6_hdr *icmph
 /***********************************************************************
  * 			IPSEC HEADER 
  ***********************************************************************/
-static int _interp_ahesp(struct ulogd_pluginstance *pi, void *protoh,
+static int _interp_ahesp(struct ulogd_key *ret, void *protoh,
 			 uint32_t len)
 {
 #if 0
-	struct ulogd_key *ret = pi->output.keys;
 	struct esphdr *esph = protoh;
 
 	if (len < sizeof(struct esphdr))
 		return 0;
 
-	ret[KEY_AHESP_SPI].u.value.ui32 = ntohl(esph->spi);
-	ret[KEY_AHESP_SPI].flags |= ULOGD_RETF_VALID;
+	okey_set_u32(&ret[KEY_AHESP_SPI], ntohl(esph->spi));
 #endif
 
 	return ULOGD_IRET_OK;
@@ -712,45 +704,47 @@ static int _interp_ahesp(struct ulogd_pluginstance *pi, void *protoh,
  * 			IP HEADER
  ***********************************************************************/
 
-static int _interp_iphdr(struct ulogd_pluginstance *pi, uint32_t len)
+static int _interp_iphdr(struct ulogd_key *inp, struct ulogd_key *ret,
+			 uint32_t len)
 {
-	struct ulogd_key *ret = pi->output.keys;
 	struct iphdr *iph =
-		ikey_get_ptr(&pi->input.keys[INKEY_RAW_PCKT]);
+		ikey_get_ptr(&inp[INKEY_RAW_PCKT]);
 	void *nexthdr;
 
 	if (len < sizeof(struct iphdr) || len <= (uint32_t)(iph->ihl * 4))
 		return ULOGD_IRET_OK;
 	len -= iph->ihl * 4;
 
-	okey_set_u32(&ret[KEY_IP_SADDR], iph->saddr);
-	okey_set_u32(&ret[KEY_IP_DADDR], iph->daddr);
-	okey_set_u8(&ret[KEY_IP_PROTOCOL], iph->protocol);
-	okey_set_u8(&ret[KEY_IP_TOS], iph->tos);
-	okey_set_u8(&ret[KEY_IP_TTL], iph->ttl);
-	okey_set_u16(&ret[KEY_IP_TOTLEN], ntohs(iph->tot_len));
-	okey_set_u8(&ret[KEY_IP_IHL], iph->ihl);
-	okey_set_u16(&ret[KEY_IP_CSUM], ntohs(iph->check));
-	okey_set_u16(&ret[KEY_IP_ID], ntohs(iph->id));
-	okey_set_u16(&ret[KEY_IP_FRAGOFF], ntohs(iph->frag_off));
+	if (okeys_needed(ret, KEY_IP_SADDR, KEY_IP_FRAGOFF)) {
+		okey_set_u32(&ret[KEY_IP_SADDR], iph->saddr);
+		okey_set_u32(&ret[KEY_IP_DADDR], iph->daddr);
+		okey_set_u8(&ret[KEY_IP_PROTOCOL], iph->protocol);
+		okey_set_u8(&ret[KEY_IP_TOS], iph->tos);
+		okey_set_u8(&ret[KEY_IP_TTL], iph->ttl);
+		okey_set_u16(&ret[KEY_IP_TOTLEN], ntohs(iph->tot_len));
+		okey_set_u8(&ret[KEY_IP_IHL], iph->ihl);
+		okey_set_u16(&ret[KEY_IP_CSUM], ntohs(iph->check));
+		okey_set_u16(&ret[KEY_IP_ID], ntohs(iph->id));
+		okey_set_u16(&ret[KEY_IP_FRAGOFF], ntohs(iph->frag_off));
+	}
 
 	nexthdr = (uint32_t *)iph + iph->ihl;
 	switch (iph->protocol) {
 	case IPPROTO_TCP:
-		_interp_tcp(pi, nexthdr, len);
+		_interp_tcp(ret, nexthdr, len);
 		break;
 	case IPPROTO_UDP:
-		_interp_udp(pi, nexthdr, len);
+		_interp_udp(ret, nexthdr, len);
 		break;
 	case IPPROTO_ICMP:
-		_interp_icmp(pi, nexthdr, len);
+		_interp_icmp(ret, nexthdr, len);
 		break;
 	case IPPROTO_SCTP:
-		_interp_sctp(pi, nexthdr, len);
+		_interp_sctp(ret, nexthdr, len);
 		break;
 	case IPPROTO_AH:
 	case IPPROTO_ESP:
-		_interp_ahesp(pi, nexthdr, len);
+		_interp_ahesp(ret, nexthdr, len);
 		break;
 	}
 
@@ -776,10 +770,10 @@ static int ip6_ext_hdr(uint8_t nexthdr)
 	}
 }
 
-static int _interp_ipv6hdr(struct ulogd_pluginstance *pi, uint32_t len)
+static int _interp_ipv6hdr(struct ulogd_key *inp, struct ulogd_key *ret,
+			   uint32_t len)
 {
-	struct ulogd_key *ret = pi->output.keys;
-	struct ip6_hdr *ipv6h = ikey_get_ptr(&pi->input.keys[INKEY_RAW_PCKT]);
+	struct ip6_hdr *ipv6h = ikey_get_ptr(&inp[INKEY_RAW_PCKT]);
 	unsigned int ptr, hdrlen = 0;
 	uint8_t curhdr;
 	int fragment = 0;
@@ -787,14 +781,17 @@ static int _interp_ipv6hdr(struct ulogd_pluginstance *pi, uint32_t len)
 	if (len < sizeof(struct ip6_hdr))
 		return ULOGD_IRET_OK;
 
-	okey_set_u128(&ret[KEY_IP_SADDR], &ipv6h->ip6_src);
-	okey_set_u128(&ret[KEY_IP_DADDR], &ipv6h->ip6_dst);
-	okey_set_u16(&ret[KEY_IP6_PAYLOAD_LEN], ntohs(ipv6h->ip6_plen));
-	okey_set_u8(&ret[KEY_IP6_PRIORITY],
-		    (ntohl(ipv6h->ip6_flow) & 0x0ff00000) >> 20);
-	okey_set_u32(&ret[KEY_IP6_FLOWLABEL],
-		     ntohl(ipv6h->ip6_flow) & 0x000fffff);
-	okey_set_u8(&ret[KEY_IP6_HOPLIMIT], ipv6h->ip6_hlim);
+	if (okeys_needed(ret, KEY_IP_SADDR, KEY_IP6_FRAG_ID)) {
+		okey_set_u128(&ret[KEY_IP_SADDR], &ipv6h->ip6_src);
+		okey_set_u128(&ret[KEY_IP_DADDR], &ipv6h->ip6_dst);
+		okey_set_u16(&ret[KEY_IP6_PAYLOAD_LEN],
+			     ntohs(ipv6h->ip6_plen));
+		okey_set_u8(&ret[KEY_IP6_PRIORITY],
+			    (ntohl(ipv6h->ip6_flow) & 0x0ff00000) >> 20);
+		okey_set_u32(&ret[KEY_IP6_FLOWLABEL],
+			     ntohl(ipv6h->ip6_flow) & 0x000fffff);
+		okey_set_u8(&ret[KEY_IP6_HOPLIMIT], ipv6h->ip6_hlim);
+	}
 
 	curhdr = ipv6h->ip6_nxt;
 	ptr = sizeof(struct ip6_hdr);
@@ -844,7 +841,7 @@ static int _interp_ipv6hdr(struct ulogd_pluginstance *pi, uint32_t len)
 				return ULOGD_IRET_OK;
 			len -= hdrlen;
 
-			_interp_ahesp(pi, (void *)ext, len);
+			_interp_ahesp(ret, (void *)ext, len);
 			break;
 		case IPPROTO_ESP:
 			if (fragment)
@@ -855,7 +852,7 @@ static int _interp_ipv6hdr(struct ulogd_pluginstance *pi, uint32_t len)
 				return ULOGD_IRET_OK;
 			len -= hdrlen;
 
-			_interp_ahesp(pi, (void *)ext, len);
+			_interp_ahesp(ret, (void *)ext, len);
 			goto out;
 		default:
 			return ULOGD_IRET_OK;
@@ -873,13 +870,13 @@ static int _interp_ipv6hdr(struct ulogd_pluginstance *pi, uint32_t len)
 
 	switch (curhdr) {
 	case IPPROTO_TCP:
-		_interp_tcp(pi, (void *)ipv6h + ptr, len);
+		_interp_tcp(ret, (void *)ipv6h + ptr, len);
 		break;
 	case IPPROTO_UDP:
-		_interp_udp(pi, (void *)ipv6h + ptr, len);
+		_interp_udp(ret, (void *)ipv6h + ptr, len);
 		break;
 	case IPPROTO_ICMPV6:
-		_interp_icmpv6(pi, (void *)ipv6h + ptr, len);
+		_interp_icmpv6(ret, (void *)ipv6h + ptr, len);
 		break;
 	}
 
@@ -891,23 +888,29 @@ out:
 /***********************************************************************
  * 			ARP HEADER
  ***********************************************************************/
-static int _interp_arp(struct ulogd_pluginstance *pi, uint32_t len)
+static int _interp_arp(struct ulogd_key *inp, struct ulogd_key *ret,
+		       uint32_t len)
 {
-	struct ulogd_key *ret = pi->output.keys;
 	const struct ether_arp *arph =
-		ikey_get_ptr(&pi->input.keys[INKEY_RAW_PCKT]);
+		ikey_get_ptr(&inp[INKEY_RAW_PCKT]);
+	uint32_t addr;
 
-	if (len < sizeof(struct ether_arp))
+	if (len < sizeof(struct ether_arp) ||
+	    !okeys_needed(ret, KEY_ARP_HTYPE, KEY_ARP_TPA))
 		return ULOGD_IRET_OK;
 
 	okey_set_u16(&ret[KEY_ARP_HTYPE], ntohs(arph->arp_hrd));
 	okey_set_u16(&ret[KEY_ARP_PTYPE], ntohs(arph->arp_pro));
 	okey_set_u16(&ret[KEY_ARP_OPCODE], ntohs(arph->arp_op));
 
-	okey_set_ptr(&ret[KEY_ARP_SHA], (void *)&arph->arp_sha);
-	okey_set_ptr(&ret[KEY_ARP_SPA], (void *)&arph->arp_spa),
-	okey_set_ptr(&ret[KEY_ARP_THA], (void *)&arph->arp_tha);
-	okey_set_ptr(&ret[KEY_ARP_TPA], (void *)&arph->arp_tpa);
+	okey_set_raw(&ret[KEY_ARP_SHA], (void *)&arph->arp_sha,
+		     sizeof(arph->arp_sha));
+	memcpy(&addr, arph->arp_spa, sizeof(addr));
+	okey_set_u32(&ret[KEY_ARP_SPA], addr);
+	okey_set_raw(&ret[KEY_ARP_THA], (void *)&arph->arp_tha,
+		     sizeof(arph->arp_tha));
+	memcpy(&addr, arph->arp_tpa, sizeof(addr));
+	okey_set_u32(&ret[KEY_ARP_TPA], addr);
 
 	return ULOGD_IRET_OK;
 }
@@ -916,20 +919,21 @@ static int _interp_arp(struct ulogd_pluginstance *pi, uint32_t len)
  * 			ETHER HEADER
  ***********************************************************************/
 
-static int _interp_bridge(struct ulogd_pluginstance *pi, uint32_t len)
+static int _interp_bridge(struct ulogd_key *inp, struct ulogd_key *ret,
+			  uint32_t len)
 {
 	const uint16_t proto =
-		ikey_get_u16(&pi->input.keys[INKEY_OOB_PROTOCOL]);
+		ikey_get_u16(&inp[INKEY_OOB_PROTOCOL]);
 
 	switch (proto) {
 	case ETH_P_IP:
-		_interp_iphdr(pi, len);
+		_interp_iphdr(inp, ret, len);
 		break;
 	case ETH_P_IPV6:
-		_interp_ipv6hdr(pi, len);
+		_interp_ipv6hdr(inp, ret, len);
 		break;
 	case ETH_P_ARP:
-		_interp_arp(pi, len);
+		_interp_arp(inp, ret, len);
 		break;
 	/* ETH_P_8021Q ?? others? */
 	};
@@ -938,22 +942,47 @@ static int _interp_bridge(struct ulogd_pluginstance *pi, uint32_t len)
 }
 
 
-static int _interp_pkt(struct ulogd_pluginstance *pi)
+static int __interp_pkt(struct ulogd_key *inp, struct ulogd_key *ret)
 {
-	uint32_t len = ikey_get_u32(&pi->input.keys[INKEY_RAW_PCKTLEN]);
-	uint8_t family = ikey_get_u8(&pi->input.keys[INKEY_OOB_FAMILY]);
-	struct ulogd_key *ret = pi->output.keys;
+	uint32_t len = ikey_get_u32(&inp[INKEY_RAW_PCKTLEN]);
+	uint8_t family = ikey_get_u8(&inp[INKEY_OOB_FAMILY]);
 
 	okey_set_u16(&ret[KEY_OOB_PROTOCOL],
-		     ikey_get_u16(&pi->input.keys[INKEY_OOB_PROTOCOL]));
+		     ikey_get_u16(&inp[INKEY_OOB_PROTOCOL]));
 
 	switch (family) {
 	case AF_INET:
-		return _interp_iphdr(pi, len);
+		return _interp_iphdr(inp, ret, len);
 	case AF_INET6:
-		return _interp_ipv6hdr(pi, len);
+		return _interp_ipv6hdr(inp, ret, len);
 	case AF_BRIDGE:
-		return _interp_bridge(pi, len);
+		return _interp_bridge(inp, ret, len);
+	}
+	return ULOGD_IRET_OK;
+}
+
+static int _interp_pkt(struct ulogd_pluginstance *pi)
+{
+	return __interp_pkt(pi->input.keys, pi->output.keys);
+}
+
+static int _interp_pkt_batch(struct ulogd_pluginstance *pi,
+			     struct ulogd_batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->num; i++) {
+		struct ulogd_key *inp = ulogd_batch_ikeys(pi, i);
+
+		if (batch->ret[i] != ULOGD_IRET_OK)
+			continue;
+
+		/* fetch the next packet while this one is parsed */
+		if (i + 1 < batch->num)
+			__builtin_prefetch(ikey_get_ptr(
+				&ulogd_batch_ikeys(pi, i + 1)[INKEY_RAW_PCKT]));
+
+		batch->ret[i] = __interp_pkt(inp, ulogd_batch_okeys(pi, i));
 	}
 	return ULOGD_IRET_OK;
 }
@@ -999,6 +1028,7 @@ static struct ulogd_plugin base_plugin = {
 		.type = ULOGD_DTYPE_PACKET,
 		},
 	.interp = &_interp_pkt,
+	.interp_batch = &_interp_pkt_batch,
 	.version = VERSION,
 };
 
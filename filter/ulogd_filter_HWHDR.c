@@ -109,14 +109,22 @@ static struct ulogd_key mac2str_keys[] = {
 	},
 };
 
-static char hwmac_str[MAX_KEY - START_KEY][HWADDR_LENGTH];
+struct hwhdr_priv {
+	/* one string per address key, mac.str (MAX_KEY) included */
+	char hwmac_str[MAX_KEY - START_KEY + 1][HWADDR_LENGTH];
+};
 
-static int parse_mac2str(struct ulogd_key *ret, unsigned char *mac,
-			 int okey, int len)
+static int parse_mac2str(struct hwhdr_priv *priv, struct ulogd_key *ret,
+			 unsigned char *mac, int okey, int len)
 {
+	char (*hwmac_str)[HWADDR_LENGTH] = priv->hwmac_str;
 	char *buf_cur;
 	int i;
 
+	/* nobody reads this string */
+	if (!IS_NEEDED(ret[okey]))
+		return ULOGD_IRET_OK;
+
 	if (len * 3 + 1 > HWADDR_LENGTH)
 		return ULOGD_IRET_ERR;
 
@@ -148,16 +156,17 @@ static uint16_t hwhdr_get_len(struct ulogd_key *inp)
 	void *len = ikey_get_ptr(&inp[KEY_RAW_MAC]) + 2 * ETH_ALEN;
 	return ntohs(*(uint16_t *) len);
 }
-static int parse_ethernet(struct ulogd_key *ret, struct ulogd_key *inp)
+static int parse_ethernet(struct hwhdr_priv *priv, struct ulogd_key *ret,
+			  struct ulogd_key *inp)
 {
 	int fret;
 	if (!pp_is_valid(inp, KEY_RAW_MAC_SADDR)) {
-		fret = parse_mac2str(ret, hwhdr_get_saddr(inp),
+		fret = parse_mac2str(priv, ret, hwhdr_get_saddr(inp),
 				     KEY_MAC_SADDR, ETH_ALEN);
 		if (fret != ULOGD_IRET_OK)
 			return fret;
 	}
-	fret = parse_mac2str(ret, hwhdr_get_daddr(inp),
+	fret = parse_mac2str(priv, ret, hwhdr_get_daddr(inp),
 			     KEY_MAC_DADDR, ETH_ALEN);
 	if (fret != ULOGD_IRET_OK)
 		return fret;
@@ -169,6 +178,7 @@ static int parse_ethernet(struct ulogd_key *ret, struct ulogd_key *inp)
 
 static int interp_mac2str(struct ulogd_pluginstance *pi)
 {
+	struct hwhdr_priv *priv = (struct hwhdr_priv *)pi->private;
 	struct ulogd_key *ret = pi->output.keys;
 	struct ulogd_key *inp = pi->input.keys;
 	uint16_t type = 0;
@@ -181,7 +191,7 @@ static int interp_mac2str(struct ulogd_pluginstance *pi)
 		int fret;
 		if (! pp_is_valid(inp, KEY_RAW_MAC_ADDRLEN))
 			return ULOGD_IRET_ERR;
-		fret = parse_mac2str(ret,
+		fret = parse_mac2str(priv, ret,
 				     ikey_get_ptr(&inp[KEY_RAW_MAC_SADDR]),
 				     KEY_MAC_SADDR,
 				     ikey_get_u16(&inp[KEY_RAW_MAC_ADDRLEN]));
@@ -209,12 +219,13 @@ static int interp_mac2str(struct ulogd_pluginstance *pi)
 
 	switch (type) {
 		case ARPHRD_ETHER:
-			parse_ethernet(ret, inp);
+			parse_ethernet(priv, ret, inp);
+			/* fall through */
 		default:
 			if (!pp_is_valid(inp, KEY_RAW_MAC))
 				return ULOGD_IRET_OK;
 			/* convert raw header to string */
-			return parse_mac2str(ret,
+			return parse_mac2str(priv, ret,
 					    ikey_get_ptr(&inp[KEY_RAW_MAC]),
 					    KEY_MAC_ADDR,
 					    ikey_get_u16(&inp[KEY_RAW_MACLEN]));
@@ -237,6 +248,7 @@ static struct ulogd_plugin mac2str_pluging = {
 		.type = ULOGD_DTYPE_PACKET,
 		},
 	.interp = &interp_mac2str,
+	.priv_size = sizeof(struct hwhdr_priv),
 	.version = VERSION,
 };
 
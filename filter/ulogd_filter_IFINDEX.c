@@ -58,12 +58,19 @@ static struct ulogd_fd nlif_u_fd = { .fd = -1 };
 static int nlif_users;
 static struct nlif_handle *nlif_inst;
 
+/* the names handed out are still per instance */
+struct ifindex_priv {
+	char indev[IFNAMSIZ];
+	char outdev[IFNAMSIZ];
+};
+
 static int interp_ifindex(struct ulogd_pluginstance *pi)
 {
+	struct ifindex_priv *priv = (struct ifindex_priv *)pi->private;
 	struct ulogd_key *ret = pi->output.keys;
 	struct ulogd_key *inp = pi->input.keys;
-	static char indev[IFNAMSIZ];
-	static char outdev[IFNAMSIZ];
+	char *indev = priv->indev;
+	char *outdev = priv->outdev;
 
 	nlif_index2name(nlif_inst, ikey_get_u32(&inp[0]), indev);
 	if (indev[0] == '*')
@@ -146,6 +153,7 @@ static struct ulogd_plugin ifindex_plugin = {
 
 	.start = &ifindex_start,
 	.stop = &ifindex_fini,
+	.priv_size = sizeof(struct ifindex_priv),
 	.version = VERSION,
 };
 
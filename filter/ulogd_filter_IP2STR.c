@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <ulogd/ulogd.h>
 #include <netinet/if_ether.h>
@@ -137,9 +138,14 @@ static struct ulogd_key ip2str_keys[] = {
 	},
 };
 
-static char ipstr_array[MAX_KEY-START_KEY][IPADDR_LENGTH];
+#define NUM_ADDR	(MAX_KEY - START_KEY + 1)
 
-static int ip2str(struct ulogd_key *inp, int index, int oindex)
+struct ip2str_priv {
+	/* converted addresses, for each record of a batch */
+	char (*ipstr)[NUM_ADDR][IPADDR_LENGTH];
+};
+
+static int ip2str(struct ulogd_key *inp, int index, char *ipstr)
 {
 	char family = ikey_get_u8(&inp[KEY_OOB_FAMILY]);
 	char convfamily = family;
@@ -172,12 +178,12 @@ static int ip2str(struct ulogd_key *inp, int index, int oindex)
 	case AF_INET6:
 		inet_ntop(AF_INET6,
 			  ikey_get_u128(&inp[index]),
-			  ipstr_array[oindex], sizeof(ipstr_array[oindex]));
+			  ipstr, IPADDR_LENGTH);
 		break;
 	case AF_INET:
 		ip = ikey_get_u32(&inp[index]);
 		inet_ntop(AF_INET, &ip,
-			  ipstr_array[oindex], sizeof(ipstr_array[oindex]));
+			  ipstr, IPADDR_LENGTH);
 		break;
 	default:
 		/* TODO error handling */
@@ -187,27 +193,73 @@ static int ip2str(struct ulogd_key *inp, int index, int oindex)
 	return ULOGD_IRET_OK;
 }
 
-static int interp_ip2str(struct ulogd_pluginstance *pi)
+static int __interp_ip2str(struct ulogd_key *inp, struct ulogd_key *ret,
+			   char ipstr[NUM_ADDR][IPADDR_LENGTH])
 {
-	struct ulogd_key *ret = pi->output.keys;
-	struct ulogd_key *inp = pi->input.keys;
 	int i;
 	int fret;
 
 	/* Iter on all addr fields */
 	for (i = START_KEY; i <= MAX_KEY; i++) {
-		if (pp_is_valid(inp, i)) {
-			fret = ip2str(inp, i, i-START_KEY);
+		/* inet_ntop() only for the addresses being read */
+		if (pp_is_valid(inp, i) && IS_NEEDED(ret[i-START_KEY])) {
+			fret = ip2str(inp, i, ipstr[i-START_KEY]);
 			if (fret != ULOGD_IRET_OK)
 				return fret;
 			okey_set_ptr(&ret[i-START_KEY],
-				     ipstr_array[i-START_KEY]);
+				     ipstr[i-START_KEY]);
 		}
 	}
 
 	return ULOGD_IRET_OK;
 }
 
+static int interp_ip2str(struct ulogd_pluginstance *pi)
+{
+	struct ip2str_priv *priv = (struct ip2str_priv *)pi->private;
+
+	return __interp_ip2str(pi->input.keys, pi->output.keys,
+			       priv->ipstr[0]);
+}
+
+static int interp_ip2str_batch(struct ulogd_pluginstance *pi,
+			       struct ulogd_batch *batch)
+{
+	struct ip2str_priv *priv = (struct ip2str_priv *)pi->private;
+	unsigned int i;
+
+	for (i = 0; i < batch->num; i++) {
+		if (batch->ret[i] != ULOGD_IRET_OK)
+			continue;
+
+		batch->ret[i] = __interp_ip2str(ulogd_batch_ikeys(pi, i),
+						ulogd_batch_okeys(pi, i),
+						priv->ipstr[i]);
+	}
+	return ULOGD_IRET_OK;
+}
+
+static int start_ip2str(struct ulogd_pluginstance *pi)
+{
+	struct ip2str_priv *priv = (struct ip2str_priv *)pi->private;
+
+	priv->ipstr = calloc(pi->stack->batch_size, sizeof(*priv->ipstr));
+	if (priv->ipstr == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int stop_ip2str(struct ulogd_pluginstance *pi)
+{
+	struct ip2str_priv *priv = (struct ip2str_priv *)pi->private;
+
+	free(priv->ipstr);
+	priv->ipstr = NULL;
+
+	return 0;
+}
+
 static struct ulogd_plugin ip2str_pluging = {
 	.name = "IP2STR",
 	.input = {
@@ -221,6 +273,10 @@ static struct ulogd_plugin ip2str_pluging = {
 		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
 		},
 	.interp = &interp_ip2str,
+	.interp_batch = &interp_ip2str_batch,
+	.start = &start_ip2str,
+	.stop = &stop_ip2str,
+	.priv_size = sizeof(struct ip2str_priv),
 	.version = VERSION,
 };
 
@@ -111,6 +111,7 @@ static struct ulogd_plugin mark_pluging = {
 	.interp = &interp_mark,
 	.config_kset = &libulog_kset,
 	.configure = &configure,
+	.flags = ULOGD_PLUGINF_DROP,
 	.version = VERSION,
 };
 
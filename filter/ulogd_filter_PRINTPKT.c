@@ -30,11 +30,21 @@ static struct ulogd_key printpkt_outp[] = {
 	},
 };
 
+struct printpkt_priv {
+	/* the line "print" points to, one per instance as the stacks may
+	 * run in threads of their own */
+	char buf[4096];
+};
+
 static int printpkt_interp(struct ulogd_pluginstance *upi)
 {
+	struct printpkt_priv *priv = (struct printpkt_priv *)upi->private;
 	struct ulogd_key *inp = upi->input.keys;
 	struct ulogd_key *ret = upi->output.keys;
-	static char buf[4096];
+	char *buf = priv->buf;
+
+	if (!IS_NEEDED(ret[0]))
+		return ULOGD_IRET_OK;
 
 	printpkt_print(inp, buf);
 	okey_set_ptr(&ret[0], buf);
@@ -54,6 +64,7 @@ static struct ulogd_plugin printpkt_plugin = {
 		.type = ULOGD_DTYPE_PACKET,
 	},
 	.interp = &printpkt_interp,
+	.priv_size = sizeof(struct printpkt_priv),
 	.version = VERSION,
 };
 
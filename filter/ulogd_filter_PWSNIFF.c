@@ -68,10 +68,10 @@ static int interp_pwsniff(struct ulogd_pluginstance *pi)
 	int len, pw_len, cont = 0;
 	unsigned int i;
 
-	if (!IS_VALID(pi->input.keys[0]))
+	if (!pp_is_valid(pi->input.keys, 0))
 		return ULOGD_IRET_STOP;
 	
-	iph = (struct iphdr *) pi->input.keys[0].u.value.ptr;
+	iph = ikey_get_ptr(&pi->input.keys[0]);
 	protoh = (uint32_t *)iph + iph->ihl;
 	tcph = protoh;
 	tcplen = ntohs(iph->tot_len) - iph->ihl * 4;
@@ -116,7 +116,7 @@ static int interp_pwsniff(struct ulogd_pluginstance *pi)
 
 	if (len) {
 		char *ptr;
-		ptr = (char *) malloc(len+1);
+		ptr = ulogd_alloc(pi, len+1);
 		if (!ptr)
 			return ULOGD_IRET_ERR;
 		strncpy(ptr, (char *)begp, len);
@@ -125,7 +125,7 @@ static int interp_pwsniff(struct ulogd_pluginstance *pi)
 	}
 	if (pw_len) {
 		char *ptr;
-		ptr = (char *) malloc(pw_len+1);
+		ptr = ulogd_alloc(pi, pw_len+1);
 		if (!ptr)
 			return ULOGD_IRET_ERR;
 		strncpy(ptr, (char *)pw_begp, pw_len);
@@ -145,12 +145,10 @@ static struct ulogd_key pwsniff_outp[] = {
 	{
 		.name	= "pwsniff.user",
 		.type	= ULOGD_RET_STRING,
-		.flags	= ULOGD_RETF_FREE,
 	},
 	{
 		.name 	= "pwsniff.pass",
 		.type	= ULOGD_RET_STRING,
-		.flags	= ULOGD_RETF_FREE,
 	},
 };
 
@@ -167,6 +165,7 @@ static struct ulogd_plugin pwsniff_plugin = {
 		.type = ULOGD_DTYPE_PACKET,
 	},
 	.interp = &interp_pwsniff,
+	.flags = ULOGD_PLUGINF_DROP,
 	.version = VERSION,
 };
 
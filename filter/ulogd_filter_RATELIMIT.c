@@ -0,0 +1,464 @@
+/* ulogd_filter_RATELIMIT.c
+ *
+ * ulogd filter plugin limiting the records of each source, e.g. each
+ * ip.saddr, to a budget
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  The values of the input keys listed in "keys" make up the key of a
+ *  token bucket, which is refilled with rate tokens per second up to
+ *  burst.  A record takes one token of its bucket, or is stopped if there
+ *  is none left, so it shows up as "stop" in the stats file.
+ *
+ *  The buckets are kept in the core hash table, at most hash_max_entries
+ *  of them, all allocated at start.  Once they are all in use, the bucket
+ *  used least recently is taken over by the new key, starting full again.
+ *  If the hash table can't take a bucket (it could not grow), the record
+ *  is passed unlimited rather than dropped, and the bucket is kept aside
+ *  for the next new key.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/hash.h>
+#include <ulogd/jhash.h>
+
+/* input keys making up the key of a bucket */
+#define RL_MAX_FIELDS	8
+/* bytes of the key of a bucket, longer ones are cut */
+#define RL_KEY_LEN	128
+
+#define NSEC_PER_SEC	1000000000ULL
+
+enum rl_kset {
+	RL_KEYS,
+	RL_RATE,
+	RL_BURST,
+	RL_HASH_BUCKETS,
+	RL_HASH_MAX_ENTRIES,
+};
+
+static struct config_keyset rl_kset = {
+	.num_ces = 5,
+	.ces = {
+		[RL_KEYS] = {
+			.key	 = "keys",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "ip.saddr",
+		},
+		[RL_RATE] = {
+			.key	 = "rate",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 100,
+		},
+		[RL_BURST] = {
+			.key	 = "burst",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		[RL_HASH_BUCKETS] = {
+			.key	 = "hash_buckets",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 8192,
+		},
+		[RL_HASH_MAX_ENTRIES] = {
+			.key	 = "hash_max_entries",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 65536,
+		},
+	},
+};
+
+#define keys_ce(x)	(x->ces[RL_KEYS])
+#define rate_ce(x)	(x->ces[RL_RATE])
+#define burst_ce(x)	(x->ces[RL_BURST])
+#define buckets_ce(x)	(x->ces[RL_HASH_BUCKETS])
+#define maxentries_ce(x) (x->ces[RL_HASH_MAX_ENTRIES])
+
+struct rl_bucket {
+	struct hashtable_node	hashnode;
+	/* in rl_priv.lru */
+	struct llist_head	lru;
+	/* tokens left, in nanoseconds of refilling */
+	uint64_t		credit;
+	uint64_t		last;
+	unsigned int		len;
+	unsigned char		key[RL_KEY_LEN];
+};
+
+struct rl_lookup {
+	const unsigned char	*key;
+	unsigned int		len;
+};
+
+struct rl_priv {
+	struct hashtable	*hash;
+	struct rl_bucket	*buckets;
+	unsigned int		num_buckets;
+	unsigned int		max_buckets;
+	/* the buckets in use, least recently used first */
+	struct llist_head	lru;
+	/* buckets the hash table failed to take */
+	struct llist_head	free;
+	/* a token and a full bucket, in nanoseconds */
+	uint64_t		cost;
+	uint64_t		burst;
+	uint64_t		evicted;
+	uint64_t		unlimited;
+	/* the configured keys come first, then oob.family */
+	unsigned int		num_fields;
+};
+
+static uint32_t rl_hash(const void *data, const struct hashtable *table)
+{
+	const struct rl_lookup *l = data;
+
+	return jhash(l->key, l->len, table->initval);
+}
+
+static int rl_cmp(const void *data1, const void *data2)
+{
+	const struct rl_bucket *b = data1;
+	const struct rl_lookup *l = data2;
+
+	return b->len == l->len && !memcmp(b->key, l->key, l->len);
+}
+
+static uint64_t rl_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* the bytes of the value of 'src' */
+static int rl_field(struct ulogd_key *src, int v6, const void **val)
+{
+	int size;
+
+	*val = &src->u.value;
+	switch (src->type) {
+	case ULOGD_RET_STRING:
+		*val = src->u.value.ptr;
+		return strlen(*val);
+	case ULOGD_RET_RAW:
+		*val = src->u.value.ptr;
+		return src->len;
+	case ULOGD_RET_IPADDR:
+		return v6 ? 16 : 4;
+	default:
+		size = ulogd_key_size(src);
+		return size < 0 ? 0 : size;
+	}
+}
+
+/* appends the value of every field as its length and its bytes */
+static unsigned int rl_key(struct rl_priv *priv, struct ulogd_key *inp,
+			   unsigned char *buf)
+{
+	unsigned int i, len = 0;
+	int v6 = 0;
+
+	if (pp_is_valid(inp, priv->num_fields))
+		v6 = ikey_get_u8(&inp[priv->num_fields]) == AF_INET6;
+
+	for (i = 0; i < priv->num_fields; i++) {
+		const void *val = NULL;
+		int size = 0;
+
+		if (pp_is_valid(inp, i))
+			size = rl_field(inp[i].u.source, v6, &val);
+
+		if (len + 1 + size > RL_KEY_LEN)
+			size = RL_KEY_LEN - len - 1;
+		buf[len++] = size;
+		if (size)
+			memcpy(buf + len, val, size);
+		len += size;
+		if (len == RL_KEY_LEN)
+			break;
+	}
+	return len;
+}
+
+static struct rl_bucket *rl_bucket_new(struct rl_priv *priv,
+				       struct rl_lookup *l, uint32_t id,
+				       uint64_t now)
+{
+	struct rl_bucket *b;
+
+	if (!llist_empty(&priv->free)) {
+		b = llist_entry(priv->free.next, struct rl_bucket, lru);
+		llist_del(&b->lru);
+	} else if (priv->num_buckets < priv->max_buckets) {
+		b = &priv->buckets[priv->num_buckets++];
+	} else {
+		b = llist_entry(priv->lru.next, struct rl_bucket, lru);
+		llist_del(&b->lru);
+		hashtable_del(priv->hash, &b->hashnode);
+		priv->evicted++;
+	}
+
+	memcpy(b->key, l->key, l->len);
+	b->len = l->len;
+	b->credit = priv->burst;
+	b->last = now;
+	if (hashtable_add(priv->hash, &b->hashnode, id) < 0) {
+		llist_add(&b->lru, &priv->free);
+		return NULL;
+	}
+	llist_add_tail(&b->lru, &priv->lru);
+
+	return b;
+}
+
+static int __interp_ratelimit(struct rl_priv *priv, struct ulogd_key *inp,
+			      uint64_t now)
+{
+	unsigned char key[RL_KEY_LEN];
+	struct rl_lookup l = { .key = key };
+	struct rl_bucket *b;
+	uint32_t id;
+
+	l.len = rl_key(priv, inp, key);
+	id = hashtable_hash(priv->hash, &l);
+	b = (struct rl_bucket *)hashtable_find(priv->hash, &l, id);
+	if (b == NULL) {
+		b = rl_bucket_new(priv, &l, id, now);
+		if (b == NULL) {
+			priv->unlimited++;
+			return ULOGD_IRET_OK;
+		}
+	} else {
+		llist_del(&b->lru);
+		llist_add_tail(&b->lru, &priv->lru);
+
+		if (now > b->last) {
+			b->credit += now - b->last;
+			if (b->credit > priv->burst)
+				b->credit = priv->burst;
+			b->last = now;
+		}
+	}
+
+	if (b->credit < priv->cost)
+		return ULOGD_IRET_STOP;
+
+	b->credit -= priv->cost;
+	return ULOGD_IRET_OK;
+}
+
+static int interp_ratelimit(struct ulogd_pluginstance *pi)
+{
+	struct rl_priv *priv = (struct rl_priv *)pi->private;
+
+	return __interp_ratelimit(priv, pi->input.keys, rl_now());
+}
+
+static int interp_ratelimit_batch(struct ulogd_pluginstance *pi,
+				  struct ulogd_batch *batch)
+{
+	struct rl_priv *priv = (struct rl_priv *)pi->private;
+	uint64_t now = rl_now();
+	unsigned int i;
+
+	for (i = 0; i < batch->num; i++) {
+		if (batch->ret[i] != ULOGD_IRET_OK)
+			continue;
+
+		batch->ret[i] = __interp_ratelimit(priv,
+						   ulogd_batch_ikeys(pi, i),
+						   now);
+	}
+	return ULOGD_IRET_OK;
+}
+
+static void rl_free_keys(struct ulogd_pluginstance *pi)
+{
+	free(pi->input.keys);
+	pi->input.keys = NULL;
+	pi->input.num_keys = 0;
+}
+
+/* one input key for each of the comma separated 'keys', and oob.family to
+ * tell the IPv6 addresses */
+static int rl_alloc_keys(struct ulogd_pluginstance *pi, const char *keys)
+{
+	struct rl_priv *priv = (struct rl_priv *)pi->private;
+	char buf[CONFIG_VAL_STRING_LEN];
+	struct ulogd_key *ikeys;
+	unsigned int num = 0;
+	char *tok;
+
+	ikeys = calloc(RL_MAX_FIELDS + 1, sizeof(struct ulogd_key));
+	if (ikeys == NULL)
+		return -ENOMEM;
+
+	strncpy(buf, keys, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	for (tok = strtok(buf, ", "); tok; tok = strtok(NULL, ", ")) {
+		if (num == RL_MAX_FIELDS) {
+			ulogd_log(ULOGD_ERROR, "%s: more than %d keys\n",
+				  pi->id, RL_MAX_FIELDS);
+			free(ikeys);
+			return -EINVAL;
+		}
+		if (strlen(tok) > ULOGD_MAX_KEYLEN) {
+			ulogd_log(ULOGD_ERROR, "%s: key `%s' too long\n",
+				  pi->id, tok);
+			free(ikeys);
+			return -EINVAL;
+		}
+		strcpy(ikeys[num++].name, tok);
+	}
+	if (num == 0) {
+		ulogd_log(ULOGD_ERROR, "%s: no keys\n", pi->id);
+		free(ikeys);
+		return -EINVAL;
+	}
+
+	ikeys[num].type = ULOGD_RET_UINT8;
+	ikeys[num].flags = ULOGD_KEYF_OPTIONAL;
+	strcpy(ikeys[num].name, "oob.family");
+
+	rl_free_keys(pi);
+	pi->input.keys = ikeys;
+	pi->input.num_keys = num + 1;
+	priv->num_fields = num;
+
+	return 0;
+}
+
+static int configure_ratelimit(struct ulogd_pluginstance *pi,
+			       struct ulogd_pluginstance_stack *stack)
+{
+	struct rl_priv *priv = (struct rl_priv *)pi->private;
+	struct config_keyset *kset = pi->config_kset;
+	int ret;
+
+	ret = config_parse_file(pi->id, kset);
+	if (ret < 0) {
+		rl_free_keys(pi);
+		return ret;
+	}
+
+	if (rate_ce(kset).u.value <= 0 || burst_ce(kset).u.value < 0 ||
+	    buckets_ce(kset).u.value <= 0 ||
+	    maxentries_ce(kset).u.value <= 0) {
+		ulogd_log(ULOGD_ERROR, "%s: rate, hash_buckets and "
+			  "hash_max_entries have to be positive\n", pi->id);
+		rl_free_keys(pi);
+		return -EINVAL;
+	}
+
+	priv->cost = NSEC_PER_SEC / rate_ce(kset).u.value;
+	priv->burst = priv->cost * (burst_ce(kset).u.value ?
+				    burst_ce(kset).u.value :
+				    rate_ce(kset).u.value);
+
+	return rl_alloc_keys(pi, keys_ce(kset).u.string);
+}
+
+static int start_ratelimit(struct ulogd_pluginstance *pi)
+{
+	struct rl_priv *priv = (struct rl_priv *)pi->private;
+	struct config_keyset *kset = pi->config_kset;
+
+	priv->max_buckets = maxentries_ce(kset).u.value;
+	priv->buckets = calloc(priv->max_buckets, sizeof(struct rl_bucket));
+	if (priv->buckets == NULL) {
+		rl_free_keys(pi);
+		return -ENOMEM;
+	}
+
+	priv->hash = hashtable_create(buckets_ce(kset).u.value,
+				      priv->max_buckets, rl_hash, rl_cmp);
+	if (priv->hash == NULL) {
+		free(priv->buckets);
+		priv->buckets = NULL;
+		rl_free_keys(pi);
+		return -ENOMEM;
+	}
+
+	INIT_LLIST_HEAD(&priv->lru);
+	INIT_LLIST_HEAD(&priv->free);
+	priv->num_buckets = 0;
+	priv->evicted = 0;
+	priv->unlimited = 0;
+
+	return 0;
+}
+
+static int stop_ratelimit(struct ulogd_pluginstance *pi)
+{
+	struct rl_priv *priv = (struct rl_priv *)pi->private;
+
+	if (priv->evicted)
+		ulogd_log(ULOGD_NOTICE, "%s: %llu buckets taken over by "
+			  "other keys, hash_max_entries may be too low\n",
+			  pi->id, (unsigned long long)priv->evicted);
+	if (priv->unlimited)
+		ulogd_log(ULOGD_NOTICE, "%s: %llu records passed without "
+			  "a bucket, the hash table could not grow\n",
+			  pi->id, (unsigned long long)priv->unlimited);
+
+	/* the buckets are freed at once, not by hashtable_flush() */
+	hashtable_destroy(priv->hash);
+	priv->hash = NULL;
+	free(priv->buckets);
+	priv->buckets = NULL;
+	/* the input keys were allocated by configure_ratelimit() */
+	rl_free_keys(pi);
+
+	return 0;
+}
+
+static struct ulogd_plugin ratelimit_plugin = {
+	.name = "RATELIMIT",
+	.input = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+		},
+	.output = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+		},
+	.interp = &interp_ratelimit,
+	.interp_batch = &interp_ratelimit_batch,
+	.config_kset = &rl_kset,
+	.configure = &configure_ratelimit,
+	.start = &start_ratelimit,
+	.stop = &stop_ratelimit,
+	.priv_size = sizeof(struct rl_priv),
+	.flags = ULOGD_PLUGINF_DROP,
+	.version = VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&ratelimit_plugin);
+}
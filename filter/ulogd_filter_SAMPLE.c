@@ -0,0 +1,372 @@
+/* ulogd_filter_SAMPLE.c
+ *
+ * ulogd filter plugin letting one out of N packets or flows through
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  With mode "count", every rate-th record goes through.  With mode
+ *  "flow", the addresses, ports and protocol of the record are hashed and
+ *  a flow goes through if its hash is a multiple of rate, so either all of
+ *  its packets (in both directions) and its conntrack events are logged,
+ *  or none of them.  Records without addresses are counted instead.
+ *
+ *  The rate is handed over as sample.rate, the totals computed from the
+ *  sampled records are multiplied by it to get the real ones.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/jhash.h>
+
+enum sample_kset {
+	SAMPLE_MODE,
+	SAMPLE_RATE,
+	SAMPLE_SEED,
+};
+
+static struct config_keyset sample_kset = {
+	.num_ces = 3,
+	.ces = {
+		[SAMPLE_MODE] = {
+			.key	 = "mode",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "count",
+		},
+		[SAMPLE_RATE] = {
+			.key	 = "rate",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 100,
+		},
+		[SAMPLE_SEED] = {
+			.key	 = "seed",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	},
+};
+
+#define mode_ce(x)	(x->ces[SAMPLE_MODE])
+#define rate_ce(x)	(x->ces[SAMPLE_RATE])
+#define seed_ce(x)	(x->ces[SAMPLE_SEED])
+
+enum input_keys {
+	KEY_OOB_FAMILY,
+	KEY_OOB_PROTOCOL,
+	KEY_IP_SADDR,
+	KEY_IP_DADDR,
+	KEY_IP_PROTOCOL,
+	KEY_TCP_SPORT,
+	KEY_TCP_DPORT,
+	KEY_UDP_SPORT,
+	KEY_UDP_DPORT,
+	KEY_SCTP_SPORT,
+	KEY_SCTP_DPORT,
+	KEY_ORIG_IP_SADDR,
+	KEY_ORIG_IP_DADDR,
+	KEY_ORIG_IP_PROTOCOL,
+	KEY_ORIG_L4_SPORT,
+	KEY_ORIG_L4_DPORT,
+};
+
+static struct ulogd_key sample_inp[] = {
+	[KEY_OOB_FAMILY] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "oob.family",
+	},
+	[KEY_OOB_PROTOCOL] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "oob.protocol",
+	},
+	[KEY_IP_SADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "ip.saddr",
+	},
+	[KEY_IP_DADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "ip.daddr",
+	},
+	[KEY_IP_PROTOCOL] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "ip.protocol",
+	},
+	[KEY_TCP_SPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "tcp.sport",
+	},
+	[KEY_TCP_DPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "tcp.dport",
+	},
+	[KEY_UDP_SPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "udp.sport",
+	},
+	[KEY_UDP_DPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "udp.dport",
+	},
+	[KEY_SCTP_SPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "sctp.sport",
+	},
+	[KEY_SCTP_DPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "sctp.dport",
+	},
+	[KEY_ORIG_IP_SADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.ip.saddr",
+	},
+	[KEY_ORIG_IP_DADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.ip.daddr",
+	},
+	[KEY_ORIG_IP_PROTOCOL] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.ip.protocol",
+	},
+	[KEY_ORIG_L4_SPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.l4.sport",
+	},
+	[KEY_ORIG_L4_DPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.l4.dport",
+	},
+};
+
+enum output_keys {
+	KEY_SAMPLE_RATE,
+};
+
+static struct ulogd_key sample_keys[] = {
+	[KEY_SAMPLE_RATE] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sample.rate",
+	},
+};
+
+enum sample_mode {
+	SAMPLE_COUNT,
+	SAMPLE_FLOW,
+};
+
+struct sample_priv {
+	int mode;
+	uint32_t rate;
+	uint32_t seed;
+	/* records counted so far, for mode "count" */
+	uint32_t seen;
+};
+
+static uint32_t hash_addr(struct ulogd_key *inp, int i, int v6, uint32_t seed)
+{
+	if (v6)
+		return jhash(ikey_get_u128(&inp[i]), 16, seed);
+	return jhash_1word(ikey_get_u32(&inp[i]), seed);
+}
+
+/* returns 1 and the hash of the flow of the record in 'hash' if it has
+ * addresses, the ends are sorted so that both directions hash the same */
+static int hash_flow(struct ulogd_key *inp, uint32_t seed, uint32_t *hash)
+{
+	int saddr, daddr, proto, sport = -1, dport = -1;
+	uint32_t a, b, l4proto = 0;
+	int v6 = 0;
+
+	if (pp_is_valid(inp, KEY_OOB_FAMILY)) {
+		switch (ikey_get_u8(&inp[KEY_OOB_FAMILY])) {
+		case AF_INET6:
+			v6 = 1;
+			break;
+		case AF_BRIDGE:
+			if (!pp_is_valid(inp, KEY_OOB_PROTOCOL))
+				return 0;
+			switch (ikey_get_u16(&inp[KEY_OOB_PROTOCOL])) {
+			case ETH_P_IPV6:
+				v6 = 1;
+				break;
+			case ETH_P_IP:
+				break;
+			default:
+				return 0;
+			}
+			break;
+		}
+	}
+
+	if (pp_is_valid(inp, KEY_IP_SADDR) && pp_is_valid(inp, KEY_IP_DADDR)) {
+		saddr = KEY_IP_SADDR;
+		daddr = KEY_IP_DADDR;
+		proto = KEY_IP_PROTOCOL;
+		if (pp_is_valid(inp, KEY_TCP_SPORT)) {
+			sport = KEY_TCP_SPORT;
+			dport = KEY_TCP_DPORT;
+		} else if (pp_is_valid(inp, KEY_UDP_SPORT)) {
+			sport = KEY_UDP_SPORT;
+			dport = KEY_UDP_DPORT;
+		} else if (pp_is_valid(inp, KEY_SCTP_SPORT)) {
+			sport = KEY_SCTP_SPORT;
+			dport = KEY_SCTP_DPORT;
+		}
+	} else if (pp_is_valid(inp, KEY_ORIG_IP_SADDR) &&
+		   pp_is_valid(inp, KEY_ORIG_IP_DADDR)) {
+		saddr = KEY_ORIG_IP_SADDR;
+		daddr = KEY_ORIG_IP_DADDR;
+		proto = KEY_ORIG_IP_PROTOCOL;
+		sport = KEY_ORIG_L4_SPORT;
+		dport = KEY_ORIG_L4_DPORT;
+	} else
+		return 0;
+
+	a = hash_addr(inp, saddr, v6, seed);
+	b = hash_addr(inp, daddr, v6, seed);
+	if (sport >= 0 && pp_is_valid(inp, sport) && pp_is_valid(inp, dport)) {
+		a ^= ikey_get_u16(&inp[sport]);
+		b ^= ikey_get_u16(&inp[dport]);
+	}
+	if (a > b) {
+		uint32_t t = a;
+		a = b;
+		b = t;
+	}
+	if (pp_is_valid(inp, proto))
+		l4proto = ikey_get_u8(&inp[proto]);
+
+	*hash = jhash_3words(a, b, l4proto, seed);
+	return 1;
+}
+
+static int __interp_sample(struct sample_priv *priv, struct ulogd_key *inp,
+			   struct ulogd_key *ret)
+{
+	uint32_t hash;
+
+	if (priv->mode == SAMPLE_FLOW && hash_flow(inp, priv->seed, &hash)) {
+		if (hash % priv->rate)
+			return ULOGD_IRET_STOP;
+	} else if (priv->seen++ % priv->rate)
+		return ULOGD_IRET_STOP;
+
+	okey_set_u32(&ret[KEY_SAMPLE_RATE], priv->rate);
+	return ULOGD_IRET_OK;
+}
+
+static int interp_sample(struct ulogd_pluginstance *pi)
+{
+	struct sample_priv *priv = (struct sample_priv *)pi->private;
+
+	return __interp_sample(priv, pi->input.keys, pi->output.keys);
+}
+
+static int interp_sample_batch(struct ulogd_pluginstance *pi,
+			       struct ulogd_batch *batch)
+{
+	struct sample_priv *priv = (struct sample_priv *)pi->private;
+	unsigned int i;
+
+	for (i = 0; i < batch->num; i++) {
+		if (batch->ret[i] != ULOGD_IRET_OK)
+			continue;
+
+		batch->ret[i] = __interp_sample(priv, ulogd_batch_ikeys(pi, i),
+						ulogd_batch_okeys(pi, i));
+	}
+	return ULOGD_IRET_OK;
+}
+
+static int configure_sample(struct ulogd_pluginstance *pi,
+			    struct ulogd_pluginstance_stack *stack)
+{
+	struct sample_priv *priv = (struct sample_priv *)pi->private;
+	int ret;
+
+	ret = config_parse_file(pi->id, pi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (!strcmp(mode_ce(pi->config_kset).u.string, "count"))
+		priv->mode = SAMPLE_COUNT;
+	else if (!strcmp(mode_ce(pi->config_kset).u.string, "flow"))
+		priv->mode = SAMPLE_FLOW;
+	else {
+		ulogd_log(ULOGD_ERROR, "%s: unknown mode `%s'\n", pi->id,
+			  mode_ce(pi->config_kset).u.string);
+		return -EINVAL;
+	}
+
+	if (rate_ce(pi->config_kset).u.value <= 0) {
+		ulogd_log(ULOGD_ERROR, "%s: rate has to be positive\n",
+			  pi->id);
+		return -EINVAL;
+	}
+	priv->rate = rate_ce(pi->config_kset).u.value;
+	priv->seed = seed_ce(pi->config_kset).u.value;
+	priv->seen = 0;
+
+	return 0;
+}
+
+static struct ulogd_plugin sample_plugin = {
+	.name = "SAMPLE",
+	.input = {
+		.keys = sample_inp,
+		.num_keys = ARRAY_SIZE(sample_inp),
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+		},
+	.output = {
+		.keys = sample_keys,
+		.num_keys = ARRAY_SIZE(sample_keys),
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+		},
+	.interp = &interp_sample,
+	.interp_batch = &interp_sample_batch,
+	.config_kset = &sample_kset,
+	.configure = &configure_sample,
+	.priv_size = sizeof(struct sample_priv),
+	.flags = ULOGD_PLUGINF_DROP,
+	.version = VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&sample_plugin);
+}
@@ -0,0 +1,21 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+struct ulogd_arena_chunk;
+
+/* memory for the results of the records being processed, it is handed out
+ * by bumping a pointer and released all at once when the records are done */
+struct ulogd_arena {
+	/* most recent chunk first */
+	struct ulogd_arena_chunk	*chunks;
+	char				*ptr;
+	char				*end;
+};
+
+void *ulogd_arena_alloc(struct ulogd_arena *arena, size_t size);
+void ulogd_arena_reset(struct ulogd_arena *arena);
+void ulogd_arena_free(struct ulogd_arena *arena);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _BACKPRESSURE_H_
+#define _BACKPRESSURE_H_
+
+#include <ulogd/ulogd.h>
+
+/* what happens to the records of a source while a stack it feeds is busy */
+enum ulogd_bp_policy {
+	ULOGD_BP_NONE,		/* nothing, they are lost wherever it's full */
+	ULOGD_BP_PAUSE,		/* the source stops reading */
+	ULOGD_BP_SAMPLE,	/* one out of backpressure_sample goes through */
+	ULOGD_BP_DROP,		/* they are shed right after the source */
+};
+
+extern int ulogd_bp_policy;
+
+int ulogd_backpressure_start(const char *policy, unsigned int sample,
+			     struct llist_head *stacks);
+/* forget what 'pi' has registered or reported before it is stopped */
+void ulogd_backpressure_release(struct ulogd_pluginstance *pi);
+
+int __ulogd_backpressure_shed(struct ulogd_pluginstance_stack *stack);
+
+/* returns 1 if the record entering 'stack' has to be shed, called by the
+ * main loop only */
+static inline int ulogd_backpressure_shed(struct ulogd_pluginstance_stack *stack)
+{
+	if (ulogd_bp_policy == ULOGD_BP_NONE)
+		return 0;
+	return __ulogd_backpressure_shed(stack);
+}
+
+#endif
@@ -37,6 +37,8 @@ struct db_stmt_ring {
 	pthread_cond_t cond;
 	pthread_mutex_t mutex;
 	int full;
+	/* reported to the core with ulogd_backpressure() */
+	int busy;
 };
 
 struct db_stmt {
@@ -50,7 +52,7 @@ struct db_instance {
 	int stmt_offset; /* offset to the beginning of the "VALUES" part */
 	char *schema;
 	time_t reconnect;
-	int (*interp)(struct ulogd_pluginstance *upi);
+	int (*interp)(struct ulogd_pluginstance *upi, struct ulogd_key *inp);
 	struct db_driver *driver;
 	/* DB ring buffer */
 	struct db_stmt_ring ring;
@@ -116,6 +118,8 @@ void ulogd_db_signal(struct ulogd_pluginstance *upi, int signal);
 int ulogd_db_start(struct ulogd_pluginstance *upi);
 int ulogd_db_stop(struct ulogd_pluginstance *upi);
 int ulogd_db_interp(struct ulogd_pluginstance *upi);
+int ulogd_db_interp_batch(struct ulogd_pluginstance *upi,
+			  struct ulogd_batch *batch);
 int ulogd_db_configure(struct ulogd_pluginstance *upi,
 			struct ulogd_pluginstance_stack *stack);
 
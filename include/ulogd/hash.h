@@ -2,27 +2,61 @@
 #define _NF_SET_HASH_H_
 
 #include <unistd.h>
-#include "linuxlist.h"
 
 #include <stdint.h>
 
 struct hashtable;
 struct hashtable_node;
 
+/* embedded in the entries, hashtable_flush() frees the entries so it has
+ * to be their first member */
+struct hashtable_node {
+	/* set by hashtable_add() */
+	uint32_t hash;
+};
+
+struct hashtable_slot {
+	/* 0 if the slot is empty, else 1 + its distance to the home slot */
+	uint32_t		dist;
+	uint32_t		hash;
+	struct hashtable_node	*node;
+};
+
+struct hashtable_array {
+	struct hashtable_slot	*slots;
+	/* number of slots - 1, a power of two - 1 */
+	uint32_t		mask;
+	uint32_t		count;
+};
+
 struct hashtable {
+	/* slots the table starts with, it doesn't shrink below */
 	uint32_t hashsize;
 	uint32_t limit;
 	uint32_t count;
 	uint32_t initval;
-	
+
 	uint32_t (*hash)(const void *data, const struct hashtable *table);
 	int	 (*compare)(const void *data1, const void *data2);
 
-	struct llist_head 	members[0];
+	/* after a resize, the entries are moved from 'old' to 'cur' a few at
+	 * a time, starting at old.slots[migrated] */
+	struct hashtable_array	cur;
+	struct hashtable_array	old;
+	uint32_t		migrated;
+	int			iterating;
 };
 
-struct hashtable_node {
-	struct llist_head head;
+struct hashtable_stats {
+	uint32_t	entries;
+	uint32_t	slots;
+	/* entries per slot, in percent */
+	unsigned int	load;
+	/* slots looked at to find an entry, on average and at most */
+	double		probe_avg;
+	unsigned int	probe_max;
+	/* are the entries being moved to resized slots */
+	int		resizing;
 };
 
 struct hashtable *
@@ -31,14 +65,15 @@ hashtable_create(int hashsize, int limit,
 		 		  const struct hashtable *table),
 		 int (*compare)(const void *data1, const void *data2));
 void hashtable_destroy(struct hashtable *h);
-int hashtable_hash(const struct hashtable *table, const void *data);
-struct hashtable_node *hashtable_find(const struct hashtable *table, const void *data, int id);
-int hashtable_add(struct hashtable *table, struct hashtable_node *n, int id);
+uint32_t hashtable_hash(const struct hashtable *table, const void *data);
+struct hashtable_node *hashtable_find(const struct hashtable *table, const void *data, uint32_t id);
+int hashtable_add(struct hashtable *table, struct hashtable_node *n, uint32_t id);
 void hashtable_del(struct hashtable *table, struct hashtable_node *node);
 int hashtable_flush(struct hashtable *table);
 int hashtable_iterate(struct hashtable *table, void *data,
 		      int (*iterate)(void *data, void *n));
-int hashtable_iterate_limit(struct hashtable *table, void *data, uint32_t from, uint32_t steps, int (*iterate)(void *data1, void *n));
 unsigned int hashtable_counter(const struct hashtable *table);
+void hashtable_stats(const struct hashtable *table,
+		     struct hashtable_stats *stats);
 
 #endif
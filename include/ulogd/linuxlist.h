@@ -294,6 +294,19 @@ static inline void llist_splice_init(struct llist_head *llist,
 	     pos = llist_entry(pos->member.next, typeof(*pos), member),	\
 		     prefetch(pos->member.next))
 
+/**
+ * llist_for_each_entry_from -	iterate over llist of given type
+ *			starting at existing point
+ * @pos:	the type * to use as a loop counter.
+ * @head:	the head for your llist.
+ * @member:	the name of the llist_struct within the struct.
+ */
+#define llist_for_each_entry_from(pos, head, member) 			\
+	for (prefetch(pos->member.next);				\
+	     &pos->member != (head);					\
+	     pos = llist_entry(pos->member.next, typeof(*pos), member),	\
+		     prefetch(pos->member.next))
+
 /**
  * llist_for_each_entry_safe - iterate over llist of given type safe against removal of llist entry
  * @pos:	the type * to use as a loop counter.
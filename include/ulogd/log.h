@@ -0,0 +1,18 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdarg.h>
+#include <time.h>
+#include <ulogd/ulogd.h>
+
+/* implemented by the core, writes a message to the logfile or syslog */
+void ulogd_log_output(int level, const char *file, int line, time_t tm,
+		      const char *msg);
+
+void ulogd_log_vqueue(struct ulogd_log_site *site, int level,
+		      const char *file, int line, const char *format,
+		      va_list ap);
+int ulogd_log_start(unsigned int burst, unsigned int interval);
+void ulogd_log_stop(void);
+
+#endif
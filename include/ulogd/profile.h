@@ -0,0 +1,25 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <ulogd/ulogd.h>
+
+/* set by ulogd_profile_start(), interp() is called through the wrappers
+ * below then */
+extern int ulogd_profiling;
+
+/* which of the counters of struct ulogd_pluginstance_stats are updated */
+#define ULOGD_PROFILE_TIME	0x0001
+#define ULOGD_PROFILE_ALLOCS	0x0002
+#define ULOGD_PROFILE_MISSES	0x0004
+
+void ulogd_profile_start(void);
+unsigned int ulogd_profile_counters(void);
+
+int ulogd_profile_interp(struct ulogd_pluginstance *pi,
+			 int (*interp)(struct ulogd_pluginstance *pi));
+int ulogd_profile_interp_batch(struct ulogd_pluginstance *pi,
+			       int (*interp_batch)(struct ulogd_pluginstance *pi,
+						   struct ulogd_batch *batch),
+			       struct ulogd_batch *batch);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _ULOGD_SCHED_H_
+#define _ULOGD_SCHED_H_
+
+#include <pthread.h>
+
+/* the threads of the plugins get the CPUs and the scheduling policy set in
+ * the [global] section, only to be called from the main loop */
+void ulogd_thread_register(pthread_t thread);
+void ulogd_thread_unregister(pthread_t thread);
+
+/* implemented by the core, called once the config file has been parsed */
+int ulogd_sched_setup(const char *policy, int priority, const char *cpus,
+		      const char *thread_cpus);
+
+#endif
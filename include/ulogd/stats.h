@@ -0,0 +1,10 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <ulogd/linuxlist.h>
+
+void ulogd_stats_start(const char *path, unsigned int interval,
+		       struct llist_head *stacks);
+void ulogd_stats_stop(void);
+
+#endif
@@ -1,23 +1,48 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
-#include <ulogd/linux_rbtree.h>
 #include <ulogd/linuxlist.h>
 
+#include <stdint.h>
 #include <sys/time.h>
 
+/* hierarchical timing wheel: ULOGD_TIMER_LEVELS levels of 64 slots each,
+ * every level covering 64 times the range of the level below it */
+#define ULOGD_TIMER_HZ		1000
+#define ULOGD_TIMER_BITS	6
+#define ULOGD_TIMER_SLOTS	(1 << ULOGD_TIMER_BITS)
+#define ULOGD_TIMER_LEVELS	6
+
+/* timers are per thread, the main loop uses the default base */
+struct ulogd_timer_base {
+	/* next tick to be processed */
+	uint64_t		clk;
+	unsigned int		count;
+	int			initialized;
+	/* which slots of each level may have timers queued */
+	uint64_t		pending[ULOGD_TIMER_LEVELS];
+	struct llist_head	vec[ULOGD_TIMER_LEVELS][ULOGD_TIMER_SLOTS];
+	/* timers added with an expiry the wheel has already passed */
+	struct llist_head	expired;
+};
+
 struct ulogd_timer {
-	struct rb_node		node;
-	struct llist_head	list;
-	struct timeval		tv;
+	struct llist_head	entry;
+	/* expiry time, in ticks of the monotonic clock */
+	uint64_t		expires;
+	struct ulogd_timer_base	*base;
 	void			*data;
 	void			(*cb)(struct ulogd_timer *a, void *data);
 };
 
+void ulogd_timer_base_init(struct ulogd_timer_base *base);
+void ulogd_timer_set_thread_base(struct ulogd_timer_base *base);
+
 void ulogd_init_timer(struct ulogd_timer *t,
 		     void *data,
 		     void (*cb)(struct ulogd_timer *a, void *data));
 void ulogd_add_timer(struct ulogd_timer *alarm, unsigned long sc);
+void ulogd_add_timer_msec(struct ulogd_timer *alarm, unsigned long msec);
 void ulogd_del_timer(struct ulogd_timer *alarm);
 int ulogd_timer_pending(struct ulogd_timer *alarm);
 struct timeval *ulogd_get_next_timer_run(struct timeval *next_timer);
@@ -14,6 +14,7 @@
 #include <ulogd/linuxlist.h>
 #include <ulogd/conffile.h>
 #include <ulogd/ipfix_protocol.h>
+#include <ulogd/arena.h>
 #include <stdio.h>
 #include <signal.h>	/* need this because of extension-sighandler */
 #include <sys/types.h>
@@ -52,14 +53,14 @@
 
 /* FLAGS */
 #define ULOGD_RETF_NONE		0x0000
-#define ULOGD_RETF_VALID	0x0001	/* contains a valid result */
-#define ULOGD_RETF_FREE		0x0002	/* ptr needs to be free()d */
 #define ULOGD_RETF_NEEDED	0x0004	/* this parameter is actually needed
 					 * by some downstream plugin */
 
 #define ULOGD_KEYF_OPTIONAL	0x0100	/* this key is optional */
 #define ULOGD_KEYF_INACTIVE	0x0200	/* marked as inactive (i.e. totally
 					   to be ignored by everyone */
+#define ULOGD_KEYF_VOLATILE	0x0400	/* value is only valid while the
+					   source plugin is handling it */
 
 
 /* maximum length of ulogd key */
@@ -103,7 +104,7 @@ struct ulogd_key {
 
 	union {
 		/* and finally the returned value */
-		union {
+		union ulogd_key_value {
 			uint8_t	b;
 			uint8_t	ui8;
 			uint16_t	ui16;
@@ -119,8 +120,21 @@ struct ulogd_key {
 		} value;
 		struct ulogd_key *source;
 	} u;
+
+	/* output keys only: word of the valid bitmap of the stack which
+	 * holds the bit of this key, see okey_set_valid() */
+	unsigned long *valid;
+	unsigned long valid_mask;
+
+	/* interned name, see ulogd_keyid() */
+	unsigned int id;
 };
 
+#define ULOGD_BITS_PER_LONG	(8 * sizeof(unsigned long))
+/* number of words of a bitmap with one bit for each of 'n' keys */
+#define ULOGD_VALID_WORDS(n)	\
+	(((n) + ULOGD_BITS_PER_LONG - 1) / ULOGD_BITS_PER_LONG)
+
 struct ulogd_keyset {
 	/* possible input keys of this interpreter */
 	struct ulogd_key *keys;
@@ -130,46 +144,66 @@ struct ulogd_keyset {
 	unsigned int type;
 };
 
+/* the key holds a result, it is cleaned once the record is done */
+static inline void okey_set_valid(struct ulogd_key *key)
+{
+	*key->valid |= key->valid_mask;
+}
+
+static inline int okey_is_valid(const struct ulogd_key *key)
+{
+	return (*key->valid & key->valid_mask) != 0;
+}
+
 static inline void okey_set_b(struct ulogd_key *key, uint8_t value)
 {
 	key->u.value.b = value;
-	key->flags |= ULOGD_RETF_VALID;
+	okey_set_valid(key);
 }
 
 static inline void okey_set_u8(struct ulogd_key *key, uint8_t value)
 {
 	key->u.value.ui8 = value;
-	key->flags |= ULOGD_RETF_VALID;
+	okey_set_valid(key);
 }
 
 static inline void okey_set_u16(struct ulogd_key *key, uint16_t value)
 {
 	key->u.value.ui16 = value;
-	key->flags |= ULOGD_RETF_VALID;
+	okey_set_valid(key);
 }
 
 static inline void okey_set_u32(struct ulogd_key *key, uint32_t value)
 {
 	key->u.value.ui32 = value;
-	key->flags |= ULOGD_RETF_VALID;
+	okey_set_valid(key);
 }
 
 static inline void okey_set_u64(struct ulogd_key *key, uint64_t value)
 {
 	key->u.value.ui64 = value;
-	key->flags |= ULOGD_RETF_VALID;
+	okey_set_valid(key);
 }
 
 static inline void okey_set_u128(struct ulogd_key *key, const void *value)
 {
 	memcpy(key->u.value.ui128, value, 16);
-	key->flags |= ULOGD_RETF_VALID;
+	okey_set_valid(key);
 }
 
 static inline void okey_set_ptr(struct ulogd_key *key, void *value)
 {
 	key->u.value.ptr = value;
-	key->flags |= ULOGD_RETF_VALID;
+	okey_set_valid(key);
+}
+
+/* raw data, 'len' allows the core to copy it (e.g. to a stack thread) */
+static inline void okey_set_raw(struct ulogd_key *key, void *value,
+				uint32_t len)
+{
+	key->u.value.ptr = value;
+	key->len = len;
+	okey_set_valid(key);
 }
 
 static inline uint8_t ikey_get_u8(struct ulogd_key *key)
@@ -204,11 +238,57 @@ static inline void *ikey_get_ptr(struct ulogd_key *key)
 
 struct ulogd_pluginstance_stack;
 struct ulogd_pluginstance;
+struct ulogd_stack_worker;
+
+/* records handed to interp_batch(), the keys of record 'i' are
+ * ulogd_batch_ikeys(pi, i) and ulogd_batch_okeys(pi, i) */
+struct ulogd_batch {
+	/* number of records */
+	unsigned int num;
+	/* ULOGD_IRET_* of each record, only the records which are still
+	 * ULOGD_IRET_OK have to be processed */
+	int *ret;
+};
+
+/* a pluginstance in the execution plan of a stack */
+struct ulogd_plan_step {
+	int (*interp)(struct ulogd_pluginstance *instance);
+	int (*interp_batch)(struct ulogd_pluginstance *instance,
+			    struct ulogd_batch *batch);
+	struct ulogd_pluginstance *pi;
+	/* step to continue with if this one stops the record */
+	unsigned int stop;
+	/* sources of the input keys, starting at ulogd_plan.sources[src] */
+	unsigned int src;
+	unsigned int num_src;
+};
+
+/* flat copy of a stack, records are run through it instead of walking the
+ * list of pluginstances */
+struct ulogd_plan {
+	/* steps[0] is the source */
+	struct ulogd_plan_step *steps;
+	unsigned int num_steps;
+	struct ulogd_key **sources;
+	/* first step that is not called with the whole batch */
+	unsigned int batch_end;
+	/* first step run by the stack thread, num_steps if there is none */
+	unsigned int split;
+};
+
+/* source plugin calls ulogd_propagate_flush() once it is done with the
+ * records it has read, so they can be deferred and handled in batches */
+#define ULOGD_PLUGINF_BATCH	0x0001
+/* interp may stop records depending on the input keys, which are read
+ * even if none of the output keys is */
+#define ULOGD_PLUGINF_DROP	0x0002
 
 struct ulogd_plugin_handle {
 	/* global list of plugins */
 	struct llist_head list;
 	void *handle;
+	/* file it was loaded from, a reload doesn't load it again */
+	char *path;
 };
 
 
@@ -229,6 +309,9 @@ struct ulogd_plugin {
 
 	/* function to call for each packet */
 	int (*interp)(struct ulogd_pluginstance *instance);
+	/* optional, function to call for a batch of packets */
+	int (*interp_batch)(struct ulogd_pluginstance *instance,
+			    struct ulogd_batch *batch);
 
 	int (*configure)(struct ulogd_pluginstance *instance,
 			 struct ulogd_pluginstance_stack *stack);
@@ -241,17 +324,56 @@ struct ulogd_plugin {
 	/* function to receive a signal */
 	void (*signal)(struct ulogd_pluginstance *pi, int signal);
 
+	/* optional, writes counters of its own to the stats file as JSON
+	 * members of the pluginstance, each one preceded by ", " */
+	void (*stats)(struct ulogd_pluginstance *pi, FILE *f);
+
 	/* configuration parameters */
 	struct config_keyset *config_kset;
 
 	/* size of instance->priv */
 	unsigned int priv_size;
+
+	/* ULOGD_PLUGINF_* */
+	unsigned int flags;
 };
 
 #define ULOGD_IRET_ERR		-1
 #define ULOGD_IRET_STOP		-2
 #define ULOGD_IRET_OK		0
 
+/* counters kept by the core for each pluginstance, see stats_file */
+struct ulogd_pluginstance_stats {
+	/* records handed to the plugin */
+	uint64_t	in;
+	/* records passed on (for the source: produced) */
+	uint64_t	out;
+	/* records stopped with ULOGD_IRET_STOP */
+	uint64_t	stop;
+	/* records failed with ULOGD_IRET_ERR */
+	uint64_t	err;
+	/* receive buffer overruns of the source (ENOBUFS) */
+	uint64_t	overrun;
+	/* records the source knows it has lost, e.g. from the gaps in the
+	 * NFLOG sequence numbers */
+	uint64_t	lost;
+	/* receive calls of a source reading several datagrams at once and
+	 * the datagrams they returned, msgs / reads is the effective batch */
+	uint64_t	reads;
+	uint64_t	msgs;
+	/* records lost on a full queue (stack thread, database ring) */
+	uint64_t	dropped;
+	/* records shed because the stack was busy, and how often the source
+	 * was paused, see backpressure */
+	uint64_t	shed;
+	uint64_t	paused;
+	/* with profile=1: nanoseconds spent in interp(), and the heap
+	 * allocations and cache misses meanwhile (see src/profile.c) */
+	uint64_t	ns;
+	uint64_t	allocs;
+	uint64_t	cache_misses;
+};
+
 /* an instance of a plugin, element in a stack */
 struct ulogd_pluginstance {
 	/* local list of plugins in this stack */
@@ -270,6 +392,14 @@ struct ulogd_pluginstance {
 	struct ulogd_keyset output;
 	/* per-instance config parameters (array) */
 	struct config_keyset *config_kset;
+	/* where ulogd_alloc() takes memory from */
+	struct ulogd_arena *arena;
+	struct ulogd_pluginstance_stats stats;
+	/* reported busy by ulogd_backpressure() */
+	int busy;
+	/* this instance was started, it does not just share the source
+	 * of another stack through 'plist' */
+	int started;
 	/* private data */
 	char private[0];
 };
@@ -280,36 +410,121 @@ struct ulogd_pluginstance_stack {
 	/* list of plugins in this stack */
 	struct llist_head list;
 	char *name;
+	/* first pluginstance running in the stack thread (if any) */
+	struct ulogd_pluginstance *split;
+	/* stack thread, NULL if the whole stack runs in the main loop */
+	struct ulogd_stack_worker *worker;
+	/* maximum number of records per batch, 1 if not batched */
+	unsigned int batch_size;
+	/* first pluginstance that is not called with the whole batch */
+	struct ulogd_pluginstance *batch_end;
+	/* records collected so far */
+	struct ulogd_batch batch;
+	/* what is run for each record */
+	struct ulogd_plan plan;
+	/* if the stack begins like another one fed by the same source, that
+	 * 'trunk' runs the steps before 'fork' for both of them */
+	struct ulogd_pluginstance_stack *trunk;
+	unsigned int fork;
+	/* stacks forking off this one, by increasing 'fork' */
+	struct ulogd_pluginstance_stack **branches;
+	unsigned int num_branches;
+	/* memory returned by the plugins running in the main loop */
+	struct ulogd_arena arena;
+	/* number of its pluginstances reporting to be busy */
+	int busy;
+	/* records that found it busy, for backpressure="sample" */
+	unsigned int bp_seen;
+	/* one bit per output key telling whether it holds a result, the
+	 * keys of each pluginstance start at a word boundary and each record
+	 * of a batch has 'valid_words' words of its own */
+	unsigned long *valid;
+	unsigned int valid_words;
 };
 
+static inline struct ulogd_key *
+ulogd_batch_ikeys(struct ulogd_pluginstance *pi, unsigned int i)
+{
+	return pi->input.keys + i * pi->input.num_keys;
+}
+
+static inline struct ulogd_key *
+ulogd_batch_okeys(struct ulogd_pluginstance *pi, unsigned int i)
+{
+	return pi->output.keys + i * pi->output.num_keys;
+}
+
 /***********************************************************************
  * PUBLIC INTERFACE 
  ***********************************************************************/
 
 void ulogd_propagate_results(struct ulogd_pluginstance *pi);
+/* process the records deferred by ulogd_propagate_results() */
+void ulogd_propagate_flush(struct ulogd_pluginstance *pi);
+
+/* a pluginstance that can't keep up, e.g. because its queue is full,
+ * reports it until it has room again (any thread may call it) */
+void ulogd_backpressure(struct ulogd_pluginstance *pi, int busy);
 
 /* register a new interpreter plugin */
 void ulogd_register_plugin(struct ulogd_plugin *me);
 
+/* memory for a result of the current record, it must not be freed and is
+ * only valid until the record has gone through the stack */
+void *ulogd_alloc(struct ulogd_pluginstance *pi, size_t size);
+
+/* id of the key name 'name', keys of the same name have the same id in all
+ * plugins once the stack is built.  Returns 0, never a valid id, if the name
+ * could not be entered in the table (out of memory). */
+unsigned int ulogd_keyid(const char *name);
+/* highest id handed out so far */
+unsigned int ulogd_keyid_max(void);
+void ulogd_keyid_fini(void);
+
 /* allocate a new ulogd_key */
 struct ulogd_key *alloc_ret(const uint16_t type, const char*);
 
+/* rate limiting state of a ulogd_log() call site */
+struct ulogd_log_site {
+	time_t		window;
+	unsigned int	count;
+	unsigned int	suppressed;
+};
+
 /* write a message to the daemons' logfile */
-void __ulogd_log(int level, char *file, int line, const char *message, ...);
-/* macro for logging including filename and line number */
-#define ulogd_log(level, format, args...) \
-	__ulogd_log(level, __FILE__, __LINE__, format, ## args)
+void __ulogd_log(struct ulogd_log_site *site, int level, char *file, int line,
+		 const char *message, ...);
+/* macro for logging including filename and line number, every call site
+ * is rate limited on its own */
+#define ulogd_log(level, format, args...) ({				\
+	static struct ulogd_log_site __ulogd_log_site;			\
+	__ulogd_log(&__ulogd_log_site, level, __FILE__, __LINE__,	\
+		    format, ## args);					\
+})
 /* backwards compatibility */
 #define ulogd_error(format, args...) ulogd_log(ULOGD_ERROR, format, ## args)
 
-#define IS_VALID(x)	((x).flags & ULOGD_RETF_VALID)
-#define SET_VALID(x)	(x.flags |= ULOGD_RETF_VALID)
-#define IS_NEEDED(x)	(x.flags & ULOGD_RETF_NEEDED)
-#define SET_NEEDED(x)	(x.flags |= ULOGD_RETF_NEEDED)
+#define IS_VALID(x)	okey_is_valid(&(x))
+#define SET_VALID(x)	okey_set_valid(&(x))
+#define IS_NEEDED(x)	((x).flags & ULOGD_RETF_NEEDED)
+#define SET_NEEDED(x)	((x).flags |= ULOGD_RETF_NEEDED)
+
+/* is one of the output keys 'first' up to 'last' read by a downstream
+ * plugin, the core marks the keys ULOGD_RETF_NEEDED when building the stack,
+ * walking back from the sink */
+static inline int okeys_needed(const struct ulogd_key *keys,
+			       unsigned int first, unsigned int last)
+{
+	for (; first <= last; first++) {
+		if (keys[first].flags & ULOGD_RETF_NEEDED)
+			return 1;
+	}
+	return 0;
+}
 
 #define GET_FLAGS(res, x)	(res[x].u.source->flags)
 #define pp_is_valid(res, x)	\
-	(res[x].u.source && (GET_FLAGS(res, x) & ULOGD_RETF_VALID))
+	(res[x].u.source && okey_is_valid(res[x].u.source))
 
 int ulogd_key_size(struct ulogd_key *key);
 int ulogd_wildcard_inputkeys(struct ulogd_pluginstance *upi);
@@ -321,6 +536,10 @@ int ulogd_wildcard_inputkeys(struct ulogd_pluginstance *upi);
 #define ULOGD_FD_READ	0x0001
 #define ULOGD_FD_WRITE	0x0002
 #define ULOGD_FD_EXCEPT	0x0004
+#define ULOGD_FD_EDGE	0x0008	/* edge-triggered, callback has to drain the
+				 * fd until EAGAIN (ignored without epoll) */
+#define ULOGD_FD_BUSY	0x0010	/* spin on it before sleeping, see busy_poll */
+#define ULOGD_FD_PAUSED	0x0020	/* not polled for reading, see ulogd_pause_fd() */
 
 struct ulogd_fd {
 	struct llist_head list;
@@ -332,8 +551,25 @@ struct ulogd_fd {
 
 int ulogd_register_fd(struct ulogd_fd *ufd);
 void ulogd_unregister_fd(struct ulogd_fd *ufd);
+/* stop or resume polling a registered descriptor for reading */
+int ulogd_pause_fd(struct ulogd_fd *ufd, int pause);
+/* 'ufd' of the source 'pi' isn't polled anymore while a stack it feeds
+ * can't keep up, with backpressure="pause" */
+int ulogd_backpressure_fd(struct ulogd_pluginstance *pi, struct ulogd_fd *ufd);
+/* has the source 'pi' been paused meanwhile, it had better stop reading */
+int ulogd_backpressure_paused(struct ulogd_pluginstance *pi);
 int ulogd_select_main(struct timeval *tv);
 
+/* how useful busy polling is, zero polls for a hit means it isn't */
+struct ulogd_busy_poll_stats {
+	uint64_t	hits;		/* spinning found a ready descriptor */
+	uint64_t	misses;		/* nothing came, went to sleep */
+	uint64_t	polls;		/* empty polls while spinning */
+};
+
+void ulogd_select_busy_poll(unsigned int usec);
+const struct ulogd_busy_poll_stats *ulogd_select_busy_stats(void);
+
 /***********************************************************************
  * timer handling
  ***********************************************************************/
@@ -0,0 +1,68 @@
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <pthread.h>
+#include <ulogd/ulogd.h>
+
+/* a record as handed over from the main loop to a stack thread */
+struct ulogd_worker_kval {
+	uint32_t			len;
+	uint16_t			flags;
+	union ulogd_key_value		value;
+};
+
+struct ulogd_worker_slot {
+	struct ulogd_worker_kval	*kval;
+	/* which of the keys are valid */
+	unsigned long			*valid;
+	/* storage for copied strings and raw data */
+	char				*buf;
+	size_t				buflen;
+};
+
+struct ulogd_stack_worker {
+	struct ulogd_pluginstance_stack	*stack;
+	/* first pluginstance run by this thread */
+	struct ulogd_pluginstance	*first;
+	pthread_t			thread;
+
+	/* keys of the main loop part that the thread part consumes, and
+	 * the thread side copy the input keys are pointing to instead */
+	unsigned int			num_keys;
+	struct ulogd_key		**okeys;
+	struct ulogd_key		*mirror;
+	unsigned long			*valid;
+
+	/* single producer, single consumer ring */
+	struct ulogd_worker_slot	*ring;
+	unsigned int			size;
+	unsigned int			head;	/* written by main loop */
+	unsigned int			tail;	/* written by thread */
+	/* the queue is filling up, see ulogd_worker_busy() */
+	int				busy;
+
+	pthread_mutex_t			lock;
+	pthread_cond_t			cond;
+	int				sleeping;
+	int				stop;
+	uint64_t			signals;
+
+	struct ulogd_timer_base		timers;
+	/* memory returned by the plugins of the thread part */
+	struct ulogd_arena		arena;
+};
+
+struct ulogd_stack_worker *
+ulogd_worker_create(struct ulogd_pluginstance_stack *stack,
+		    struct ulogd_pluginstance *first, unsigned int qlen);
+int ulogd_worker_start(struct ulogd_stack_worker *w);
+void ulogd_worker_enqueue(struct ulogd_stack_worker *w);
+int ulogd_worker_busy(struct ulogd_stack_worker *w);
+void ulogd_worker_signal(struct ulogd_stack_worker *w, int signal);
+void ulogd_worker_stop(struct ulogd_stack_worker *w);
+void ulogd_worker_destroy(struct ulogd_stack_worker *w);
+
+/* implemented by the core, runs the stack from the split to its end */
+void ulogd_propagate_split(struct ulogd_pluginstance_stack *stack);
+
+#endif
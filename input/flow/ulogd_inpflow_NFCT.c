@@ -432,14 +432,7 @@ __hash4(const struct nf_conntrack *ct, const struct hashtable *table)
 		  ((nfct_get_attr_u16(ct, ATTR_ORIG_PORT_SRC) << 16) |
 		   (nfct_get_attr_u16(ct, ATTR_ORIG_PORT_DST))));
 
-	/*
-	 * Instead of returning hash % table->hashsize (implying a divide)
-	 * we return the high 32 bits of the (hash * table->hashsize) that will
-	 * give results between [0 and hashsize-1] and same hash distribution,
-	 * but using a multiply, less expensive than a divide. See:
-	 * http://www.mail-archive.com/netdev@vger.kernel.org/msg56623.html
-	 */
-	return ((uint64_t)jhash_2words(a, b, 0) * table->hashsize) >> 32;
+	return jhash_2words(a, b, table->initval);
 }
 
 static uint32_t
@@ -455,7 +448,7 @@ __hash6(const struct nf_conntrack *ct, const struct hashtable *table)
 		  ((nfct_get_attr_u16(ct, ATTR_ORIG_PORT_SRC) << 16) |
 		   (nfct_get_attr_u16(ct, ATTR_ORIG_PORT_DST))));
 
-	return ((uint64_t)jhash_2words(a, b, 0) * table->hashsize) >> 32;
+	return jhash_2words(a, b, table->initval);
 }
 
 static uint32_t hash(const void *data, const struct hashtable *table)
@@ -485,6 +478,23 @@ static int compare(const void *data1, const void *data2)
 	return nfct_cmp(u1->ct, ct, NFCT_CMP_ORIG | NFCT_CMP_REPL);
 }
 
+/* a flow which can't be added is not tracked, its destroy event is logged
+ * without the start time */
+static int ct_hash_add(struct ulogd_pluginstance *upi, struct ct_timestamp *ts,
+		       uint32_t id)
+{
+	struct nfct_pluginstance *cpi =
+				(struct nfct_pluginstance *) upi->private;
+
+	if (hashtable_add(cpi->ct_active, &ts->hashnode, id) < 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't track flow: %s\n", upi->id,
+			  errno == ENOSPC ? "hash_max_entries reached" :
+					    strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 /* only the main_upi plugin instance contains the correct private data. */
 static int propagate_ct(struct ulogd_pluginstance *main_upi,
 			struct ulogd_pluginstance *upi,
@@ -656,7 +666,8 @@ event_handler_hashtable(enum nf_conntrack_msg_type type,
 	struct nfct_pluginstance *cpi =
 				(struct nfct_pluginstance *) upi->private;
 	struct ct_timestamp *ts;
-	int ret, id;
+	uint32_t id;
+	int ret;
 
 	switch(type) {
 	case NFCT_T_NEW:
@@ -668,7 +679,7 @@ event_handler_hashtable(enum nf_conntrack_msg_type type,
 
 		set_timestamp_from_ct(ts, ct, START);
 		id = hashtable_hash(cpi->ct_active, ct);
-		ret = hashtable_add(cpi->ct_active, &ts->hashnode, id);
+		ret = ct_hash_add(upi, ts, id);
 		if (ret < 0) {
 			free(ts);
 			return NFCT_CB_CONTINUE;
@@ -687,7 +698,7 @@ event_handler_hashtable(enum nf_conntrack_msg_type type,
 
 			ts->ct = ct;
 			set_timestamp_from_ct(ts, ct, START);
-			ret = hashtable_add(cpi->ct_active, &ts->hashnode, id);
+			ret = ct_hash_add(upi, ts, id);
 			if (ret < 0) {
 				free(ts);
 				return NFCT_CB_CONTINUE;
@@ -761,7 +772,8 @@ polling_handler(enum nf_conntrack_msg_type type,
 	struct nfct_pluginstance *cpi =
 				(struct nfct_pluginstance *) upi->private;
 	struct ct_timestamp *ts;
-	int ret, id;
+	uint32_t id;
+	int ret;
 
 	switch(type) {
 	case NFCT_T_UPDATE:
@@ -778,7 +790,7 @@ polling_handler(enum nf_conntrack_msg_type type,
 			ts->ct = ct;
 			set_timestamp_from_ct(ts, ct, START);
 
-			ret = hashtable_add(cpi->ct_active, &ts->hashnode, id);
+			ret = ct_hash_add(upi, ts, id);
 			if (ret < 0) {
 				free(ts);
 				return NFCT_CB_CONTINUE;
@@ -831,6 +843,7 @@ static int read_cb_nfct(int fd, unsigned int what, void *param)
 
 	if (nfct_catch(cpi->cth) == -1) {
 		if (errno == ENOBUFS) {
+			upi->stats.overrun++;
 			if (nlsockbufmaxsize_ce(upi->config_kset).u.value) {
 				int s = cpi->nlbufsiz * 2;
 				if (setnlbufsiz(upi, s)) {
@@ -902,7 +915,8 @@ static int overrun_handler(enum nf_conntrack_msg_type type,
 	struct nfct_pluginstance *cpi =
 				(struct nfct_pluginstance *) upi->private;
 	struct ct_timestamp *ts;
-	int id, ret;
+	uint32_t id;
+	int ret;
 
 	id = hashtable_hash(cpi->ct_active, ct);
 	ts = (struct ct_timestamp *)
@@ -915,7 +929,7 @@ static int overrun_handler(enum nf_conntrack_msg_type type,
 		ts->ct = ct;
 		set_timestamp_from_ct(ts, ct, START);
 
-		ret = hashtable_add(cpi->ct_active, &ts->hashnode, id);
+		ret = ct_hash_add(upi, ts, id);
 		if (ret < 0) {
 			free(ts);
 			return NFCT_CB_CONTINUE;
@@ -940,6 +954,7 @@ static int read_cb_ovh(int fd, unsigned int what, void *param)
 	if (nfct_catch(cpi->ovh) == -1) {
 		/* enobufs in the overrun buffer? very rare */
 		if (errno == ENOBUFS) {
+			upi->stats.overrun++;
 			if (!ulogd_timer_pending(&cpi->ov_timer)) {
 				ulogd_add_timer(&cpi->ov_timer,
 						nlresynctimeout_ce(upi->config_kset).u.value);
@@ -960,7 +975,8 @@ dump_reset_handler(enum nf_conntrack_msg_type type,
 	struct ulogd_pluginstance *upi = data;
 	struct nfct_pluginstance *cpi =
 			(struct nfct_pluginstance *)upi->private;
-	int ret = NFCT_CB_CONTINUE, rc, id;
+	int ret = NFCT_CB_CONTINUE, rc;
+	uint32_t id;
 	struct ct_timestamp *ts;
 
 	switch(type) {
@@ -978,7 +994,7 @@ dump_reset_handler(enum nf_conntrack_msg_type type,
 			ts->ct = ct;
 			set_timestamp_from_ct(ts, ct, START);
 
-			rc = hashtable_add(cpi->ct_active, &ts->hashnode, id);
+			rc = ct_hash_add(upi, ts, id);
 			if (rc < 0) {
 				free(ts);
 				return NFCT_CB_CONTINUE;
@@ -1332,9 +1348,10 @@ static int constructor_nfct_events(struct ulogd_pluginstance *upi)
 	cpi->nfct_fd.fd = nfct_fd(cpi->cth);
 	cpi->nfct_fd.cb = &read_cb_nfct;
 	cpi->nfct_fd.data = cpi;
-	cpi->nfct_fd.when = ULOGD_FD_READ;
+	cpi->nfct_fd.when = ULOGD_FD_READ | ULOGD_FD_BUSY;
 
 	ulogd_register_fd(&cpi->nfct_fd);
+	ulogd_backpressure_fd(upi, &cpi->nfct_fd);
 
 	cpi->ct = nfct_new();
 	if (cpi->ct == NULL)
@@ -1478,6 +1495,7 @@ static int constructor_nfct(struct ulogd_pluginstance *upi)
 static int destructor_nfct_events(struct ulogd_pluginstance *upi)
 {
 	struct nfct_pluginstance *cpi = (void *) upi->private;
+	struct hashtable_stats hs;
 	int rc;
 
 	ulogd_unregister_fd(&cpi->nfct_fd);
@@ -1500,6 +1518,12 @@ static int destructor_nfct_events(struct ulogd_pluginstance *upi)
 		if (rc < 0)
 			return rc;
 
+		hashtable_stats(cpi->ct_active, &hs);
+		ulogd_log(ULOGD_INFO, "%s: %u flows tracked in %u slots (%u%% "
+			  "load), %.2f probes on average, %u at most\n",
+			  upi->id, hs.entries, hs.slots, hs.load,
+			  hs.probe_avg, hs.probe_max);
+
 		hashtable_iterate(cpi->ct_active, NULL, do_free);
 		hashtable_destroy(cpi->ct_active);
 	}
@@ -0,0 +1,1272 @@
+/* ulogd_inppkt_GENERATOR.c - synthetic packets and flows
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Source plugin for capacity planning without iptables rules or traffic.
+ *  It makes up either packets, with the keys of NFLOG, or the destroy
+ *  events of connections, with the keys of NFCT, so the filters and
+ *  outputs of both kinds of stacks can be loaded.  The mix of protocols,
+ *  the share of IPv6, the networks and the number of different addresses,
+ *  the destination ports and the prefixes are configurable, the records
+ *  are random within these bounds but the same for the same seed.
+ *
+ *  Like PCAP, the records are made in the main loop on a timerfd, at most
+ *  GEN_CHUNK per wakeup, either as fast as possible or at a fixed rate.
+ *  When stopped or once count records are made, the number of records per
+ *  second is logged.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <net/if_arp.h>
+#include <sys/timerfd.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/addr.h>
+
+/* records made per wakeup of the main loop */
+#define GEN_CHUNK		256
+
+#define GEN_MAX_PORTS		64
+#define GEN_MAX_PREFIXES	32
+
+/* what NFCT hands over for the end of a connection, NFCT_T_DESTROY */
+#define GEN_CT_DESTROY		4
+
+#define GEN_HOOK_LOCAL_IN	1
+
+enum gen_mode {
+	GEN_MODE_PACKET,
+	GEN_MODE_FLOW,
+};
+
+struct gen_proto {
+	uint8_t proto;
+	/* upper bound of the weights up to this one */
+	unsigned int weight;
+};
+
+struct gen_net {
+	/* network byte order, the host part is cleared */
+	uint32_t addr[4];
+	/* number of different addresses within the network */
+	uint32_t count;
+};
+
+/* what is made up once and handed to all stacks sharing the source */
+struct gen_event {
+	uint8_t family;
+	uint8_t proto;
+	uint32_t saddr[4];
+	uint32_t daddr[4];
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t mark;
+	uint32_t host;
+	const char *prefix;
+	/* flows only */
+	uint64_t pkts[2];
+	uint32_t duration;	/* milliseconds */
+};
+
+struct gen_input {
+	enum gen_mode mode;
+	struct gen_proto protos[3];
+	unsigned int num_protos;
+	struct gen_net saddr[2];	/* IPv4, IPv6 */
+	struct gen_net daddr[2];
+	/* percentage of IPv6 records */
+	unsigned int ipv6;
+	uint16_t dports[GEN_MAX_PORTS];
+	unsigned int num_dports;
+	char *prefix_buf;
+	const char *prefixes[GEN_MAX_PREFIXES];
+	unsigned int num_prefixes;
+	unsigned int pktlen;
+	uint64_t seed;
+
+	struct ulogd_fd timer_fd;
+	int done;
+	struct gen_event ev;
+	struct timespec now;
+
+	/* monotonic nanoseconds of the first record */
+	uint64_t begin;
+	uint64_t count;
+};
+
+static struct config_keyset gen_kset = {
+	.num_ces = 17,
+	.ces = {
+		{
+			.key	 = "mode",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "packet",
+		},
+		{
+			.key	 = "rate",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "count",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "protocols",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "tcp:70,udp:25,icmp:5",
+		},
+		{
+			.key	 = "ipv6",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "saddr",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "10.0.0.0/8",
+		},
+		{
+			.key	 = "daddr",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "192.168.0.0/16",
+		},
+		{
+			.key	 = "saddr6",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "2001:db8:1::/64",
+		},
+		{
+			.key	 = "daddr6",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "2001:db8:2::/64",
+		},
+		{
+			.key	 = "saddr_count",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 65536,
+		},
+		{
+			.key	 = "daddr_count",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 256,
+		},
+		{
+			.key	 = "dports",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "22,53,80,123,443",
+		},
+		{
+			.key	 = "prefix",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "INPUT ACCEPT: ,INPUT DROP: ",
+		},
+		{
+			.key	 = "pktlen",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 128,
+		},
+		{
+			.key	 = "seed",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		{
+			.key	 = "numeric_label",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "exit_when_done",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	}
+};
+
+#define mode_ce(x)		(x->ces[0])
+#define rate_ce(x)		(x->ces[1])
+#define count_ce(x)		(x->ces[2])
+#define protocols_ce(x)		(x->ces[3])
+#define ipv6_ce(x)		(x->ces[4])
+#define saddr_ce(x)		(x->ces[5])
+#define daddr_ce(x)		(x->ces[6])
+#define saddr6_ce(x)		(x->ces[7])
+#define daddr6_ce(x)		(x->ces[8])
+#define saddr_count_ce(x)	(x->ces[9])
+#define daddr_count_ce(x)	(x->ces[10])
+#define dports_ce(x)		(x->ces[11])
+#define prefix_ce(x)		(x->ces[12])
+#define pktlen_ce(x)		(x->ces[13])
+#define seed_ce(x)		(x->ces[14])
+#define label_ce(x)		(x->ces[15])
+#define exit_ce(x)		(x->ces[16])
+
+/* the keys of NFLOG followed by the ones of NFCT, except for the handles
+ * of the libraries ("raw" and "ct") */
+enum gen_keys {
+	GEN_KEY_RAW_MAC = 0,
+	GEN_KEY_RAW_PCKT,
+	GEN_KEY_RAW_PCKTLEN,
+	GEN_KEY_RAW_PCKTCOUNT,
+	GEN_KEY_OOB_PREFIX,
+	GEN_KEY_OOB_TIME_SEC,
+	GEN_KEY_OOB_TIME_USEC,
+	GEN_KEY_OOB_MARK,
+	GEN_KEY_OOB_IFINDEX_IN,
+	GEN_KEY_OOB_IFINDEX_OUT,
+	GEN_KEY_OOB_HOOK,
+	GEN_KEY_RAW_MAC_LEN,
+	GEN_KEY_OOB_SEQ_LOCAL,
+	GEN_KEY_OOB_SEQ_GLOBAL,
+	GEN_KEY_OOB_FAMILY,
+	GEN_KEY_OOB_PROTOCOL,
+	GEN_KEY_OOB_UID,
+	GEN_KEY_OOB_GID,
+	GEN_KEY_RAW_LABEL,
+	GEN_KEY_RAW_TYPE,
+	GEN_KEY_RAW_MAC_SADDR,
+	GEN_KEY_RAW_MAC_ADDRLEN,
+	GEN_KEY_ORIG_IP_SADDR,
+	GEN_KEY_ORIG_IP_DADDR,
+	GEN_KEY_ORIG_IP_PROTOCOL,
+	GEN_KEY_ORIG_L4_SPORT,
+	GEN_KEY_ORIG_L4_DPORT,
+	GEN_KEY_ORIG_RAW_PKTLEN,
+	GEN_KEY_ORIG_RAW_PKTCOUNT,
+	GEN_KEY_REPLY_IP_SADDR,
+	GEN_KEY_REPLY_IP_DADDR,
+	GEN_KEY_REPLY_IP_PROTOCOL,
+	GEN_KEY_REPLY_L4_SPORT,
+	GEN_KEY_REPLY_L4_DPORT,
+	GEN_KEY_REPLY_RAW_PKTLEN,
+	GEN_KEY_REPLY_RAW_PKTCOUNT,
+	GEN_KEY_ICMP_CODE,
+	GEN_KEY_ICMP_TYPE,
+	GEN_KEY_CT_MARK,
+	GEN_KEY_CT_ID,
+	GEN_KEY_CT_EVENT,
+	GEN_KEY_FLOW_START_SEC,
+	GEN_KEY_FLOW_START_USEC,
+	GEN_KEY_FLOW_END_SEC,
+	GEN_KEY_FLOW_END_USEC,
+};
+
+static struct ulogd_key output_keys[] = {
+	[GEN_KEY_RAW_MAC] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac",
+	},
+	[GEN_KEY_RAW_MAC_SADDR] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac.saddr",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_sourceMacAddress,
+		},
+	},
+	[GEN_KEY_RAW_PCKT] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pkt",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_rawpacket,
+		},
+	},
+	[GEN_KEY_RAW_PCKTLEN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktlen",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_rawpacket_length,
+		},
+	},
+	[GEN_KEY_RAW_PCKTCOUNT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktcount",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_packetDeltaCount,
+		},
+	},
+	[GEN_KEY_OOB_PREFIX] = {
+		.type = ULOGD_RET_STRING,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.prefix",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_prefix,
+		},
+	},
+	[GEN_KEY_OOB_TIME_SEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.sec",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_flowStartSeconds,
+		},
+	},
+	[GEN_KEY_OOB_TIME_USEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.usec",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_flowStartMicroSeconds,
+		},
+	},
+	[GEN_KEY_OOB_MARK] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.mark",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_mark,
+		},
+	},
+	[GEN_KEY_OOB_IFINDEX_IN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.ifindex_in",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_ingressInterface,
+		},
+	},
+	[GEN_KEY_OOB_IFINDEX_OUT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.ifindex_out",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_egressInterface,
+		},
+	},
+	[GEN_KEY_OOB_HOOK] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.hook",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_hook,
+		},
+	},
+	[GEN_KEY_RAW_MAC_LEN] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac_len",
+	},
+	[GEN_KEY_RAW_MAC_ADDRLEN] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac.addrlen",
+	},
+	[GEN_KEY_OOB_SEQ_LOCAL] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.seq.local",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_seq_local,
+		},
+	},
+	[GEN_KEY_OOB_SEQ_GLOBAL] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.seq.global",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_seq_global,
+		},
+	},
+	[GEN_KEY_OOB_FAMILY] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.family",
+	},
+	[GEN_KEY_OOB_PROTOCOL] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.protocol",
+	},
+	[GEN_KEY_OOB_UID] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.uid",
+	},
+	[GEN_KEY_OOB_GID] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.gid",
+	},
+	[GEN_KEY_RAW_LABEL] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.label",
+	},
+	[GEN_KEY_RAW_TYPE] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.type",
+	},
+	[GEN_KEY_ORIG_IP_SADDR] = {
+		.type 	= ULOGD_RET_IPADDR,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "orig.ip.saddr",
+		.ipfix	= {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_sourceIPv4Address,
+		},
+	},
+	[GEN_KEY_ORIG_IP_DADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "orig.ip.daddr",
+		.ipfix	= {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_destinationIPv4Address,
+		},
+	},
+	[GEN_KEY_ORIG_IP_PROTOCOL] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "orig.ip.protocol",
+		.ipfix	= {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_protocolIdentifier,
+		},
+	},
+	[GEN_KEY_ORIG_L4_SPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "orig.l4.sport",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_sourceTransportPort,
+		},
+	},
+	[GEN_KEY_ORIG_L4_DPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "orig.l4.dport",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_destinationTransportPort,
+		},
+	},
+	[GEN_KEY_ORIG_RAW_PKTLEN] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "orig.raw.pktlen",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_octetTotalCount,
+		},
+	},
+	[GEN_KEY_ORIG_RAW_PKTCOUNT] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "orig.raw.pktcount",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_packetTotalCount,
+		},
+	},
+	[GEN_KEY_REPLY_IP_SADDR] = {
+		.type 	= ULOGD_RET_IPADDR,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "reply.ip.saddr",
+		.ipfix	= {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_sourceIPv4Address,
+		},
+	},
+	[GEN_KEY_REPLY_IP_DADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "reply.ip.daddr",
+		.ipfix	= {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_destinationIPv4Address,
+		},
+	},
+	[GEN_KEY_REPLY_IP_PROTOCOL] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "reply.ip.protocol",
+		.ipfix	= {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_protocolIdentifier,
+		},
+	},
+	[GEN_KEY_REPLY_L4_SPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "reply.l4.sport",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_sourceTransportPort,
+		},
+	},
+	[GEN_KEY_REPLY_L4_DPORT] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "reply.l4.dport",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_destinationTransportPort,
+		},
+	},
+	[GEN_KEY_REPLY_RAW_PKTLEN] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "reply.raw.pktlen",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_octetTotalCount,
+		},
+	},
+	[GEN_KEY_REPLY_RAW_PKTCOUNT] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "reply.raw.pktcount",
+		.ipfix	= {
+			.vendor 	= IPFIX_VENDOR_IETF,
+			.field_id 	= IPFIX_packetTotalCount,
+		},
+	},
+	[GEN_KEY_ICMP_CODE] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "icmp.code",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_IETF,
+			.field_id	= IPFIX_icmpCodeIPv4,
+		},
+	},
+	[GEN_KEY_ICMP_TYPE] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "icmp.type",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_IETF,
+			.field_id	= IPFIX_icmpTypeIPv4,
+		},
+	},
+	[GEN_KEY_CT_MARK] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "ct.mark",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_NETFILTER,
+			.field_id	= IPFIX_NF_mark,
+		},
+	},
+	[GEN_KEY_CT_ID] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "ct.id",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_NETFILTER,
+			.field_id	= IPFIX_NF_conntrack_id,
+		},
+	},
+	[GEN_KEY_CT_EVENT] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "ct.event",
+	},
+	[GEN_KEY_FLOW_START_SEC] = {
+		.type 	= ULOGD_RET_UINT32,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "flow.start.sec",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_IETF,
+			.field_id	= IPFIX_flowStartSeconds,
+		},
+	},
+	[GEN_KEY_FLOW_START_USEC] = {
+		.type 	= ULOGD_RET_UINT32,
+		.flags 	= ULOGD_RETF_NONE,
+		.name	= "flow.start.usec",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_IETF,
+			.field_id	= IPFIX_flowStartMicroSeconds,
+		},
+	},
+	[GEN_KEY_FLOW_END_SEC] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "flow.end.sec",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_IETF,
+			.field_id	= IPFIX_flowEndSeconds,
+		},
+	},
+	[GEN_KEY_FLOW_END_USEC] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "flow.end.usec",
+		.ipfix	= {
+			.vendor		= IPFIX_VENDOR_IETF,
+			.field_id	= IPFIX_flowEndSeconds,
+		},
+	},
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, fast and good enough to spread the records */
+static uint64_t gen_random(struct gen_input *gi)
+{
+	gi->seed ^= gi->seed >> 12;
+	gi->seed ^= gi->seed << 25;
+	gi->seed ^= gi->seed >> 27;
+	return gi->seed * 0x2545f4914f6cdd1dULL;
+}
+
+static void gen_pick_addr(const struct gen_net *net, int ipv6, uint32_t r,
+			  uint32_t *addr)
+{
+	uint32_t host = r % net->count;
+
+	if (ipv6) {
+		memcpy(addr, net->addr, 16);
+		addr[3] = htonl(ntohl(addr[3]) + host);
+	} else
+		addr[0] = htonl(ntohl(net->addr[0]) + host);
+}
+
+/* make up the next record */
+static void gen_make_event(struct gen_input *gi)
+{
+	struct gen_event *ev = &gi->ev;
+	uint64_t r = gen_random(gi);
+	unsigned int i, w;
+	int ipv6;
+
+	w = r % gi->protos[gi->num_protos - 1].weight;
+	for (i = 0; w >= gi->protos[i].weight; i++)
+		;
+	ev->proto = gi->protos[i].proto;
+
+	ipv6 = (r >> 8) % 100 < gi->ipv6;
+	ev->family = ipv6 ? AF_INET6 : AF_INET;
+	if (ipv6 && ev->proto == IPPROTO_ICMP)
+		ev->proto = IPPROTO_ICMPV6;
+
+	r = gen_random(gi);
+	gen_pick_addr(&gi->saddr[ipv6], ipv6, r, ev->saddr);
+	gen_pick_addr(&gi->daddr[ipv6], ipv6, r >> 32, ev->daddr);
+	/* the same source always comes from the same host */
+	ev->host = r % gi->saddr[ipv6].count;
+
+	r = gen_random(gi);
+	ev->sport = 1024 + r % 64512;
+	ev->dport = gi->dports[(r >> 16) % gi->num_dports];
+	ev->prefix = gi->num_prefixes ?
+		     gi->prefixes[(r >> 24) % gi->num_prefixes] : NULL;
+	ev->mark = (r >> 32) & 0xf;
+
+	if (gi->mode == GEN_MODE_FLOW) {
+		r = gen_random(gi);
+		ev->pkts[0] = 1 + r % 64;
+		ev->pkts[1] = (r >> 8) % 64;
+		ev->duration = (r >> 16) % 30000;
+	}
+}
+
+static void gen_put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+/* the packet of the record, an Ethernet header and the IP packet */
+static void gen_build_packet(struct gen_input *gi, uint8_t *mac,
+			     uint8_t *pkt)
+{
+	struct gen_event *ev = &gi->ev;
+	unsigned int l3len, len = gi->pktlen;
+	uint8_t *l4;
+
+	memcpy(mac, "\x52\x54\x00\x12\x34\x56\x02\x00", 8);
+	mac[8] = ev->host >> 24;
+	mac[9] = ev->host >> 16;
+	mac[10] = ev->host >> 8;
+	mac[11] = ev->host;
+	gen_put16(mac + 12, ev->family == AF_INET6 ? 0x86dd : 0x0800);
+
+	memset(pkt, 0, len);
+	if (ev->family == AF_INET6) {
+		l3len = 40;
+		pkt[0] = 0x60;
+		gen_put16(pkt + 4, len - l3len);
+		pkt[6] = ev->proto;
+		pkt[7] = 64;
+		memcpy(pkt + 8, ev->saddr, 16);
+		memcpy(pkt + 24, ev->daddr, 16);
+	} else {
+		l3len = 20;
+		pkt[0] = 0x45;
+		gen_put16(pkt + 2, len);
+		gen_put16(pkt + 4, gi->count & 0xffff);
+		pkt[6] = 0x40;		/* don't fragment */
+		pkt[8] = 64;
+		pkt[9] = ev->proto;
+		memcpy(pkt + 12, ev->saddr, 4);
+		memcpy(pkt + 16, ev->daddr, 4);
+	}
+
+	l4 = pkt + l3len;
+	switch (ev->proto) {
+	case IPPROTO_TCP:
+		gen_put16(l4, ev->sport);
+		gen_put16(l4 + 2, ev->dport);
+		gen_put16(l4 + 4, gi->count >> 16);
+		gen_put16(l4 + 6, gi->count & 0xffff);
+		l4[12] = 0x50;
+		l4[13] = 0x02;		/* SYN */
+		gen_put16(l4 + 14, 29200);
+		break;
+	case IPPROTO_UDP:
+		gen_put16(l4, ev->sport);
+		gen_put16(l4 + 2, ev->dport);
+		gen_put16(l4 + 4, len - l3len);
+		break;
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		/* echo request */
+		l4[0] = ev->proto == IPPROTO_ICMP ? 8 : 128;
+		gen_put16(l4 + 4, ev->sport);
+		gen_put16(l4 + 6, gi->count & 0xffff);
+		break;
+	}
+}
+
+static void interp_packet(struct ulogd_pluginstance *upi,
+			  struct gen_input *gi)
+{
+	struct ulogd_key *ret = upi->output.keys;
+	struct gen_event *ev = &gi->ev;
+	uint8_t *mac;
+
+	/* the record may be deferred, it has to live as long as the others
+	 * of the batch */
+	mac = ulogd_alloc(upi, 14 + gi->pktlen);
+	if (mac == NULL)
+		return;
+	gen_build_packet(gi, mac, mac + 14);
+
+	okey_set_raw(&ret[GEN_KEY_RAW_MAC], mac, 14);
+	okey_set_u16(&ret[GEN_KEY_RAW_MAC_LEN], 14);
+	okey_set_u16(&ret[GEN_KEY_RAW_TYPE], ARPHRD_ETHER);
+	okey_set_raw(&ret[GEN_KEY_RAW_MAC_SADDR], mac + 6, 6);
+	okey_set_u16(&ret[GEN_KEY_RAW_MAC_ADDRLEN], 6);
+	okey_set_raw(&ret[GEN_KEY_RAW_PCKT], mac + 14, gi->pktlen);
+	okey_set_u32(&ret[GEN_KEY_RAW_PCKTLEN], gi->pktlen);
+	okey_set_u32(&ret[GEN_KEY_RAW_PCKTCOUNT], 1);
+
+	okey_set_u8(&ret[GEN_KEY_OOB_FAMILY], ev->family);
+	okey_set_u16(&ret[GEN_KEY_OOB_PROTOCOL],
+		     ev->family == AF_INET6 ? 0x86dd : 0x0800);
+	okey_set_u8(&ret[GEN_KEY_OOB_HOOK], GEN_HOOK_LOCAL_IN);
+	okey_set_u32(&ret[GEN_KEY_OOB_IFINDEX_IN], 2);
+	okey_set_u32(&ret[GEN_KEY_OOB_MARK], ev->mark);
+	if (ev->prefix)
+		okey_set_ptr(&ret[GEN_KEY_OOB_PREFIX], (void *)ev->prefix);
+	okey_set_u32(&ret[GEN_KEY_OOB_TIME_SEC], gi->now.tv_sec);
+	okey_set_u32(&ret[GEN_KEY_OOB_TIME_USEC], gi->now.tv_nsec / 1000);
+	okey_set_u32(&ret[GEN_KEY_OOB_SEQ_LOCAL], gi->count);
+	okey_set_u8(&ret[GEN_KEY_RAW_LABEL],
+		    label_ce(upi->config_kset).u.value);
+
+	ulogd_propagate_results(upi);
+}
+
+static void interp_flow(struct ulogd_pluginstance *upi, struct gen_input *gi)
+{
+	struct ulogd_key *ret = upi->output.keys;
+	struct gen_event *ev = &gi->ev;
+	struct timespec start = gi->now;
+
+	okey_set_u32(&ret[GEN_KEY_CT_EVENT], GEN_CT_DESTROY);
+	okey_set_u8(&ret[GEN_KEY_OOB_FAMILY], ev->family);
+	okey_set_u16(&ret[GEN_KEY_OOB_PROTOCOL], 0);
+
+	/* no NAT, the reply goes back the same way */
+	if (ev->family == AF_INET6) {
+		okey_set_u128(&ret[GEN_KEY_ORIG_IP_SADDR], ev->saddr);
+		okey_set_u128(&ret[GEN_KEY_ORIG_IP_DADDR], ev->daddr);
+		okey_set_u128(&ret[GEN_KEY_REPLY_IP_SADDR], ev->daddr);
+		okey_set_u128(&ret[GEN_KEY_REPLY_IP_DADDR], ev->saddr);
+	} else {
+		okey_set_u32(&ret[GEN_KEY_ORIG_IP_SADDR], ev->saddr[0]);
+		okey_set_u32(&ret[GEN_KEY_ORIG_IP_DADDR], ev->daddr[0]);
+		okey_set_u32(&ret[GEN_KEY_REPLY_IP_SADDR], ev->daddr[0]);
+		okey_set_u32(&ret[GEN_KEY_REPLY_IP_DADDR], ev->saddr[0]);
+	}
+	okey_set_u8(&ret[GEN_KEY_ORIG_IP_PROTOCOL], ev->proto);
+	okey_set_u8(&ret[GEN_KEY_REPLY_IP_PROTOCOL], ev->proto);
+
+	switch (ev->proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+		okey_set_u16(&ret[GEN_KEY_ORIG_L4_SPORT], ev->sport);
+		okey_set_u16(&ret[GEN_KEY_ORIG_L4_DPORT], ev->dport);
+		okey_set_u16(&ret[GEN_KEY_REPLY_L4_SPORT], ev->dport);
+		okey_set_u16(&ret[GEN_KEY_REPLY_L4_DPORT], ev->sport);
+		break;
+	case IPPROTO_ICMP:
+		okey_set_u8(&ret[GEN_KEY_ICMP_CODE], 0);
+		okey_set_u8(&ret[GEN_KEY_ICMP_TYPE], 8);
+		break;
+	}
+
+	okey_set_u64(&ret[GEN_KEY_ORIG_RAW_PKTLEN], ev->pkts[0] * gi->pktlen);
+	okey_set_u64(&ret[GEN_KEY_ORIG_RAW_PKTCOUNT], ev->pkts[0]);
+	okey_set_u64(&ret[GEN_KEY_REPLY_RAW_PKTLEN], ev->pkts[1] * gi->pktlen);
+	okey_set_u64(&ret[GEN_KEY_REPLY_RAW_PKTCOUNT], ev->pkts[1]);
+
+	okey_set_u32(&ret[GEN_KEY_CT_MARK], ev->mark);
+	okey_set_u32(&ret[GEN_KEY_CT_ID], gi->count);
+
+	start.tv_sec -= ev->duration / 1000;
+	start.tv_nsec -= (ev->duration % 1000) * 1000000;
+	if (start.tv_nsec < 0) {
+		start.tv_sec--;
+		start.tv_nsec += 1000000000;
+	}
+	okey_set_u32(&ret[GEN_KEY_FLOW_START_SEC], start.tv_sec);
+	okey_set_u32(&ret[GEN_KEY_FLOW_START_USEC], start.tv_nsec / 1000);
+	okey_set_u32(&ret[GEN_KEY_FLOW_END_SEC], gi->now.tv_sec);
+	okey_set_u32(&ret[GEN_KEY_FLOW_END_USEC], gi->now.tv_nsec / 1000);
+
+	ulogd_propagate_results(upi);
+}
+
+static void interp_event(struct ulogd_pluginstance *upi,
+			 struct gen_input *gi)
+{
+	if (gi->mode == GEN_MODE_FLOW)
+		interp_flow(upi, gi);
+	else
+		interp_packet(upi, gi);
+}
+
+/* when the next record is due, in monotonic nanoseconds */
+static uint64_t gen_due(struct ulogd_pluginstance *upi)
+{
+	struct gen_input *gi = (struct gen_input *) upi->private;
+	int rate = rate_ce(upi->config_kset).u.value;
+
+	if (rate == 0)
+		return 0;
+	return gi->begin + gi->count * 1000000000ULL / rate;
+}
+
+static void gen_arm(struct gen_input *gi, uint64_t due)
+{
+	struct itimerspec its = {};
+
+	/* a time in the past lets the timer expire right away */
+	if (due == 0)
+		due = 1;
+	its.it_value.tv_sec = due / 1000000000;
+	its.it_value.tv_nsec = due % 1000000000;
+	timerfd_settime(gi->timer_fd.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void gen_report(struct gen_input *gi)
+{
+	uint64_t elapsed;
+
+	if (gi->begin == 0)
+		return;
+
+	elapsed = now_ns() - gi->begin;
+	ulogd_log(ULOGD_NOTICE, "generated %"PRIu64" records in %"PRIu64
+		  ".%03"PRIu64" seconds, %"PRIu64" records/s\n", gi->count,
+		  elapsed / 1000000000, elapsed / 1000000 % 1000,
+		  elapsed ? gi->count * 1000000000ULL / elapsed : 0);
+}
+
+static int gen_timer_cb(int fd, unsigned int what, void *param)
+{
+	struct ulogd_pluginstance *upi = param;
+	struct gen_input *gi = (struct gen_input *) upi->private;
+	struct ulogd_pluginstance *npi;
+	uint64_t expirations, now, due;
+	uint64_t limit = count_ce(upi->config_kset).u.value;
+	unsigned int i;
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		return -1;
+
+	now = now_ns();
+	if (gi->begin == 0)
+		gi->begin = now;
+	clock_gettime(CLOCK_REALTIME, &gi->now);
+
+	for (i = 0; i < GEN_CHUNK; i++) {
+		if ((limit && gi->count >= limit) || gen_due(upi) > now ||
+		    ulogd_backpressure_paused(upi))
+			break;
+
+		gen_make_event(gi);
+		llist_for_each_entry(npi, &upi->plist, plist)
+			interp_event(npi, gi);
+		interp_event(upi, gi);
+
+		gi->count++;
+	}
+
+	llist_for_each_entry(npi, &upi->plist, plist)
+		ulogd_propagate_flush(npi);
+	ulogd_propagate_flush(upi);
+
+	if (limit && gi->count >= limit) {
+		gi->done = 1;
+		ulogd_unregister_fd(&gi->timer_fd);
+		gen_report(gi);
+		if (exit_ce(upi->config_kset).u.value)
+			kill(getpid(), SIGTERM);
+		return 0;
+	}
+
+	due = gen_due(upi);
+	gen_arm(gi, due > now ? due : 0);
+
+	return 0;
+}
+
+static int parse_protocols(struct gen_input *gi, const char *s)
+{
+	static const struct {
+		const char	*name;
+		uint8_t		proto;
+	} names[] = {
+		{ "tcp",	IPPROTO_TCP },
+		{ "udp",	IPPROTO_UDP },
+		{ "icmp",	IPPROTO_ICMP },
+	};
+	unsigned int total = 0, i;
+	unsigned long weight;
+	size_t len;
+	char *end;
+
+	gi->num_protos = 0;
+	while (*s) {
+		len = strcspn(s, ":");
+		for (i = 0; i < ARRAY_SIZE(names); i++) {
+			if (strlen(names[i].name) == len &&
+			    !strncmp(s, names[i].name, len))
+				break;
+		}
+		if (i == ARRAY_SIZE(names) || s[len] != ':' ||
+		    gi->num_protos == ARRAY_SIZE(gi->protos))
+			return -1;
+
+		weight = strtoul(s + len + 1, &end, 10);
+		if (end == s + len + 1 || (*end && *end != ','))
+			return -1;
+
+		if (weight) {
+			total += weight;
+			gi->protos[gi->num_protos].proto = names[i].proto;
+			gi->protos[gi->num_protos].weight = total;
+			gi->num_protos++;
+		}
+		s = *end ? end + 1 : end;
+	}
+	return gi->num_protos ? 0 : -1;
+}
+
+static int parse_dports(struct gen_input *gi, const char *s)
+{
+	unsigned long port;
+	char *end;
+
+	gi->num_dports = 0;
+	while (*s) {
+		port = strtoul(s, &end, 10);
+		if (end == s || port > 65535 || (*end && *end != ',') ||
+		    gi->num_dports == GEN_MAX_PORTS)
+			return -1;
+		gi->dports[gi->num_dports++] = port;
+		s = *end ? end + 1 : end;
+	}
+	return gi->num_dports ? 0 : -1;
+}
+
+static int parse_prefixes(struct gen_input *gi, const char *s)
+{
+	char *p;
+
+	gi->num_prefixes = 0;
+	if (*s == '\0')
+		return 0;
+
+	gi->prefix_buf = strdup(s);
+	if (gi->prefix_buf == NULL)
+		return -1;
+
+	for (p = gi->prefix_buf; p; p = strchr(p, ',')) {
+		if (*p == ',')
+			*p++ = '\0';
+		if (gi->num_prefixes == GEN_MAX_PREFIXES)
+			return -1;
+		gi->prefixes[gi->num_prefixes++] = p;
+	}
+	return 0;
+}
+
+/* network 'name' of the family 'ipv6' with 'count' addresses */
+static int parse_net(struct gen_net *net, char *name, int ipv6,
+		     unsigned int count)
+{
+	struct ulogd_addr addr;
+	uint32_t mask[4];
+	unsigned int bits, i;
+
+	switch (ulogd_parse_addr(name, strlen(name), &addr)) {
+	case AF_INET:
+		if (ipv6)
+			return -1;
+		if (addr.netmask > 32)
+			return -1;
+		net->addr[0] = addr.in.ipv4 & htonl(ulogd_bits2netmask(
+							addr.netmask));
+		bits = 32 - addr.netmask;
+		break;
+	case AF_INET6:
+		if (!ipv6)
+			return -1;
+		if (addr.netmask == 0 || addr.netmask > 128)
+			return -1;
+		ulogd_ipv6_cidr2mask_host(addr.netmask, mask);
+		for (i = 0; i < 4; i++)
+			net->addr[i] = addr.in.ipv6[i] & htonl(mask[i]);
+		/* the addresses only differ in the last 32 bits */
+		bits = addr.netmask < 96 ? 32 : 128 - addr.netmask;
+		break;
+	default:
+		return -1;
+	}
+
+	net->count = count ? count : 1;
+	if (bits < 32 && net->count > 1U << bits)
+		net->count = 1U << bits;
+	return 0;
+}
+
+static int configure(struct ulogd_pluginstance *upi,
+		     struct ulogd_pluginstance_stack *stack)
+{
+	struct gen_input *gi = (struct gen_input *) upi->private;
+	struct config_keyset *kset = upi->config_kset;
+	const char *mode;
+	int ret;
+
+	ulogd_log(ULOGD_DEBUG, "parsing config file section `%s', "
+		  "plugin `%s'\n", upi->id, upi->plugin->name);
+
+	ret = config_parse_file(upi->id, kset);
+	if (ret < 0)
+		return ret;
+
+	mode = mode_ce(kset).u.string;
+	if (!strcmp(mode, "packet"))
+		gi->mode = GEN_MODE_PACKET;
+	else if (!strcmp(mode, "flow"))
+		gi->mode = GEN_MODE_FLOW;
+	else {
+		ulogd_log(ULOGD_ERROR, "unknown mode `%s'\n", mode);
+		return -1;
+	}
+
+	if (rate_ce(kset).u.value < 0 || count_ce(kset).u.value < 0) {
+		ulogd_log(ULOGD_ERROR, "rate and count can't be negative\n");
+		return -1;
+	}
+	if (ipv6_ce(kset).u.value < 0 || ipv6_ce(kset).u.value > 100) {
+		ulogd_log(ULOGD_ERROR, "ipv6 has to be a percentage\n");
+		return -1;
+	}
+	gi->ipv6 = ipv6_ce(kset).u.value;
+	if (parse_protocols(gi, protocols_ce(kset).u.string) < 0) {
+		ulogd_log(ULOGD_ERROR, "invalid protocols `%s'\n",
+			  protocols_ce(kset).u.string);
+		return -1;
+	}
+	if (parse_dports(gi, dports_ce(kset).u.string) < 0) {
+		ulogd_log(ULOGD_ERROR, "invalid dports `%s'\n",
+			  dports_ce(kset).u.string);
+		return -1;
+	}
+	if (saddr_count_ce(kset).u.value < 0 ||
+	    daddr_count_ce(kset).u.value < 0 ||
+	    parse_net(&gi->saddr[0], saddr_ce(kset).u.string, 0,
+		      saddr_count_ce(kset).u.value) < 0 ||
+	    parse_net(&gi->daddr[0], daddr_ce(kset).u.string, 0,
+		      daddr_count_ce(kset).u.value) < 0 ||
+	    parse_net(&gi->saddr[1], saddr6_ce(kset).u.string, 1,
+		      saddr_count_ce(kset).u.value) < 0 ||
+	    parse_net(&gi->daddr[1], daddr6_ce(kset).u.string, 1,
+		      daddr_count_ce(kset).u.value) < 0) {
+		ulogd_log(ULOGD_ERROR, "invalid networks\n");
+		return -1;
+	}
+
+	/* room for the IP and the transport header */
+	gi->pktlen = pktlen_ce(kset).u.value;
+	if (gi->pktlen < 64)
+		gi->pktlen = 64;
+	if (gi->pktlen > 65535)
+		gi->pktlen = 65535;
+
+	return 0;
+}
+
+static int start(struct ulogd_pluginstance *upi)
+{
+	struct gen_input *gi = (struct gen_input *) upi->private;
+
+	if (parse_prefixes(gi, prefix_ce(upi->config_kset).u.string) < 0) {
+		ulogd_log(ULOGD_ERROR, "invalid prefix `%s'\n",
+			  prefix_ce(upi->config_kset).u.string);
+		goto err;
+	}
+
+	/* xorshift never leaves 0 */
+	gi->seed = seed_ce(upi->config_kset).u.value;
+	if (gi->seed == 0)
+		gi->seed = 1;
+	gi->done = 0;
+	gi->count = 0;
+	gi->begin = 0;
+
+	gi->timer_fd.fd = timerfd_create(CLOCK_MONOTONIC,
+					 TFD_NONBLOCK | TFD_CLOEXEC);
+	if (gi->timer_fd.fd < 0) {
+		ulogd_log(ULOGD_ERROR, "can't create timer: %s\n",
+			  strerror(errno));
+		goto err;
+	}
+	gi->timer_fd.cb = &gen_timer_cb;
+	gi->timer_fd.data = upi;
+	gi->timer_fd.when = ULOGD_FD_READ;
+
+	if (ulogd_register_fd(&gi->timer_fd) < 0) {
+		ulogd_log(ULOGD_ERROR, "unable to register fd to ulogd\n");
+		goto err_timer;
+	}
+	ulogd_backpressure_fd(upi, &gi->timer_fd);
+
+	/* the records are made once the main loop runs */
+	gen_arm(gi, 0);
+
+	return 0;
+
+err_timer:
+	close(gi->timer_fd.fd);
+err:
+	free(gi->prefix_buf);
+	gi->prefix_buf = NULL;
+	return -1;
+}
+
+static int stop(struct ulogd_pluginstance *upi)
+{
+	struct gen_input *gi = (struct gen_input *) upi->private;
+
+	if (!gi->done) {
+		ulogd_unregister_fd(&gi->timer_fd);
+		gen_report(gi);
+	}
+	close(gi->timer_fd.fd);
+
+	free(gi->prefix_buf);
+	gi->prefix_buf = NULL;
+
+	return 0;
+}
+
+static struct ulogd_plugin gen_plugin = {
+	.name = "GENERATOR",
+	.input = {
+		.type = ULOGD_DTYPE_SOURCE,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_RAW | ULOGD_DTYPE_FLOW,
+		.keys = output_keys,
+		.num_keys = ARRAY_SIZE(output_keys),
+	},
+	.priv_size 	= sizeof(struct gen_input),
+	.configure 	= &configure,
+	.start 		= &start,
+	.stop 		= &stop,
+	.config_kset 	= &gen_kset,
+	.flags		= ULOGD_PLUGINF_BATCH,
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&gen_plugin);
+}
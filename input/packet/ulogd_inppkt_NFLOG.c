@@ -3,15 +3,30 @@
  * (C) 2004-2005 by Harald Welte <laforge@gnumonks.org>
  */
 
+#define _GNU_SOURCE	/* recvmmsg() */
 #include <unistd.h>
 #include <stdlib.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <endian.h>
+#include <arpa/inet.h>
 
 #include <ulogd/ulogd.h>
+#include <ulogd/sched.h>
 #include <libnfnetlink/libnfnetlink.h>
 #include <libnetfilter_log/libnetfilter_log.h>
+#ifdef HAVE_LIBMNL
+#include <libmnl/libmnl.h>
+#endif
 
 #ifndef NFLOG_GROUP_DEFAULT
 #define NFLOG_GROUP_DEFAULT	0
@@ -21,19 +36,75 @@
  * RMEM_DEFAULT size.  */
 #define NFLOG_BUFSIZE_DEFAULT	150000
 
-struct nflog_input {
+/* datagrams read at once, and at most per wakeup of the main loop */
+#define NFLOG_RECV_BATCH_DEFAULT	8
+#define NFLOG_RECV_BUDGET_DEFAULT	64
+
+/* log groups one instance may bind, see groups */
+#define NFLOG_MAX_GROUPS	32
+
+/* loss rate histogram: intervals without loss, and with up to 0.01%, 0.1%,
+ * 1%, 10% and 100% of the packets lost */
+#define NFLOG_LOSS_BUCKETS	6
+
+/* a netlink socket bound to one log group */
+struct nflog_group {
+	struct ulogd_pluginstance *upi;
+	uint16_t num;
 	struct nflog_handle *nful_h;
 	struct nflog_g_handle *nful_gh;
-	unsigned char *nfulog_buf;
+	/* parser=mnl */
+	bool mnl;
+	/* the netlink socket, or the eventfd of the reader thread */
 	struct ulogd_fd nful_fd;
 	int nlbufsiz;
 	bool nful_overrun_warned;
+
+	/* one buffer of bufsize bytes per datagram, recv_batch of them, or
+	 * reader_queue with a reader thread */
+	unsigned int nslots;
+	unsigned char *nfulog_buf;
+	struct mmsghdr *nful_msgs;
+	struct iovec *nful_iov;
+
+	/* with reader_threads=1, the thread fills the buffers as a ring and
+	 * wakes the main loop through nful_fd, the main loop wakes it
+	 * through ctlfd once there is room again or it has to stop */
+	pthread_t thread;
+	bool threaded;
+	int ctlfd;
+	unsigned int head;	/* written by the reader thread */
+	unsigned int tail;	/* written by the main loop */
+	int waiting;
+	int stop;
+
+	/* loss accounting from the local sequence numbers, see seq_local */
+	bool seq_valid;
+	uint32_t seq_next;
+	uint64_t received;
+	uint64_t lost;
+	/* the same in the current loss_interval */
+	uint64_t ival_received;
+	uint64_t ival_lost;
+	uint64_t loss_hist[NFLOG_LOSS_BUCKETS];
+};
+
+struct nflog_input {
+	struct nflog_group groups[NFLOG_MAX_GROUPS];
+	unsigned int num_groups;
+	struct ulogd_timer loss_timer;
+	/* derived from the config by configure(), which leaves the config
+	 * values as they were parsed so that a reload compares them */
+	unsigned int recv_budget;
+	unsigned int recv_budget_usec;
+	/* slots of the ring of each reader thread, a power of two */
+	unsigned int reader_queue;
 };
 
 /* configuration entries */
 
 static struct config_keyset libulog_kset = {
-	.num_ces = 11,
+	.num_ces = 20,
 	.ces = {
 		{
 			.key 	 = "bufsize",
@@ -102,6 +173,60 @@ static struct config_keyset libulog_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u.value = 0,
 		},
+		{
+			.key     = "recv_batch",
+			.type    = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = NFLOG_RECV_BATCH_DEFAULT,
+		},
+		{
+			.key     = "recv_budget",
+			.type    = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = NFLOG_RECV_BUDGET_DEFAULT,
+		},
+		{
+			.key     = "recv_budget_usec",
+			.type    = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key     = "groups",
+			.type    = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "",
+		},
+		{
+			.key     = "reader_threads",
+			.type    = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key     = "reader_queue",
+			.type    = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key     = "loss_interval",
+			.type    = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		{
+			.key     = "loss_events",
+			.type    = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key     = "parser",
+			.type    = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "libnetfilter_log",
+		},
 	}
 };
 
@@ -116,6 +241,15 @@ static struct config_keyset libulog_kset = {
 #define nlsockbufmaxsize_ce(x) (x->ces[8])
 #define nlthreshold_ce(x) (x->ces[9])
 #define nltimeout_ce(x) (x->ces[10])
+#define recv_batch_ce(x) (x->ces[11])
+#define recv_budget_ce(x) (x->ces[12])
+#define recv_budget_usec_ce(x) (x->ces[13])
+#define groups_ce(x) (x->ces[14])
+#define reader_threads_ce(x) (x->ces[15])
+#define reader_queue_ce(x) (x->ces[16])
+#define loss_interval_ce(x) (x->ces[17])
+#define loss_events_ce(x) (x->ces[18])
+#define parser_ce(x) (x->ces[19])
 
 enum nflog_keys {
 	NFLOG_KEY_RAW_MAC = 0,
@@ -141,6 +275,8 @@ enum nflog_keys {
 	NFLOG_KEY_RAW_MAC_SADDR,
 	NFLOG_KEY_RAW_MAC_ADDRLEN,
 	NFLOG_KEY_RAW,
+	NFLOG_KEY_OOB_GROUP,
+	NFLOG_KEY_OOB_LOST,
 };
 
 static struct ulogd_key output_keys[] = {
@@ -309,14 +445,24 @@ static struct ulogd_key output_keys[] = {
 	},
 	[NFLOG_KEY_RAW] = {
 		.type = ULOGD_RET_RAW,
-		.flags = ULOGD_RETF_NONE,
+		.flags = ULOGD_KEYF_VOLATILE,
 		.name = "raw",
 	},
+	[NFLOG_KEY_OOB_GROUP] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.group",
+	},
+	[NFLOG_KEY_OOB_LOST] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.lost",
+	},
 };
 
 static inline int
 interp_packet(struct ulogd_pluginstance *upi, uint8_t pf_family,
-	      struct nflog_data *ldata)
+	      uint16_t group, struct nflog_data *ldata)
 {
 	struct ulogd_key *ret = upi->output.keys;
 
@@ -337,6 +483,7 @@ interp_packet(struct ulogd_pluginstance *upi, uint8_t pf_family,
 		    pf_family);
 	okey_set_u8(&ret[NFLOG_KEY_RAW_LABEL],
 		    label_ce(upi->config_kset).u.value);
+	okey_set_u16(&ret[NFLOG_KEY_OOB_GROUP], group);
 
 	if (ph) {
 		okey_set_u8(&ret[NFLOG_KEY_OOB_HOOK], ph->hook);
@@ -345,22 +492,24 @@ interp_packet(struct ulogd_pluginstance *upi, uint8_t pf_family,
 	}
 
 	if (nflog_get_msg_packet_hwhdrlen(ldata)) {
-		okey_set_ptr(&ret[NFLOG_KEY_RAW_MAC], 
-			     nflog_get_msg_packet_hwhdr(ldata));
+		okey_set_raw(&ret[NFLOG_KEY_RAW_MAC],
+			     nflog_get_msg_packet_hwhdr(ldata),
+			     nflog_get_msg_packet_hwhdrlen(ldata));
 		okey_set_u16(&ret[NFLOG_KEY_RAW_MAC_LEN],
 			     nflog_get_msg_packet_hwhdrlen(ldata));
 		okey_set_u16(&ret[NFLOG_KEY_RAW_TYPE], nflog_get_hwtype(ldata));
 	}
 
 	if (hw) {
-		okey_set_ptr(&ret[NFLOG_KEY_RAW_MAC_SADDR], hw->hw_addr);
+		okey_set_raw(&ret[NFLOG_KEY_RAW_MAC_SADDR], hw->hw_addr,
+			     ntohs(hw->hw_addrlen));
 		okey_set_u16(&ret[NFLOG_KEY_RAW_MAC_ADDRLEN], 
 			     ntohs(hw->hw_addrlen));
 	}
 
 	if (payload_len >= 0) {
 		/* include pointer to raw packet */
-		okey_set_ptr(&ret[NFLOG_KEY_RAW_PCKT], payload);
+		okey_set_raw(&ret[NFLOG_KEY_RAW_PCKT], payload, payload_len);
 		okey_set_u32(&ret[NFLOG_KEY_RAW_PCKTLEN], payload_len);
 	}
 
@@ -401,12 +550,12 @@ interp_packet(struct ulogd_pluginstance *upi, uint8_t pf_family,
 	return 0;
 }
 
-static int setnlbufsiz(struct ulogd_pluginstance *upi, int size)
+static int setnlbufsiz(struct nflog_group *g, int size)
 {
-	struct nflog_input *ui = (struct nflog_input *)upi->private;
+	struct ulogd_pluginstance *upi = g->upi;
 
 	if (size < nlsockbufmaxsize_ce(upi->config_kset).u.value) {
-		ui->nlbufsiz = nfnl_rcvbufsiz(nflog_nfnlh(ui->nful_h), size);
+		g->nlbufsiz = nfnl_rcvbufsiz(nflog_nfnlh(g->nful_h), size);
 		return 1;
 	}
 
@@ -414,94 +563,701 @@ static int setnlbufsiz(struct ulogd_pluginstance *upi, int size)
 				"reached. Please, consider rising "
 				"`netlink_socket_buffer_size` and "
 				"`netlink_socket_buffer_maxsize` "
-				"clauses.\n", ui->nlbufsiz);
+				"clauses.\n", g->nlbufsiz);
 	return 0;
 }
 
+/* may be called by the reader thread of the group */
+static void nful_overrun(struct nflog_group *g)
+{
+	struct ulogd_pluginstance *upi = g->upi;
+
+	__atomic_add_fetch(&upi->stats.overrun, 1, __ATOMIC_RELAXED);
+	if (g->nful_overrun_warned)
+		return;
+
+	if (nlsockbufmaxsize_ce(upi->config_kset).u.value) {
+		int s = g->nlbufsiz * 2;
+		if (setnlbufsiz(g, s)) {
+			ulogd_log(ULOGD_NOTICE,
+				  "We are losing events, "
+				  "increasing buffer size "
+				  "to %d\n", g->nlbufsiz);
+		} else {
+			/* we have reached the maximum buffer
+			 * limit size, don't perform any
+			 * further treatments on overruns. */
+			g->nful_overrun_warned = true;
+		}
+	} else {
+		ulogd_log(ULOGD_NOTICE,
+			  "We are losing events. Please, "
+			  "consider using the clauses "
+			  "`netlink_socket_buffer_size' and "
+			  "`netlink_socket_buffer_maxsize'\n");
+		/* display the previous log message once. */
+		g->nful_overrun_warned = true;
+	}
+}
+
+static void nful_count_read(struct nflog_group *g, int n)
+{
+	struct ulogd_pluginstance *upi = g->upi;
+
+	__atomic_add_fetch(&upi->stats.reads, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&upi->stats.msgs, n, __ATOMIC_RELAXED);
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* the deferred records refer to the buffers, which are about to be
+ * overwritten */
+static void nful_flush(struct ulogd_pluginstance *upi)
+{
+	struct ulogd_pluginstance *npi;
+
+	llist_for_each_entry(npi, &upi->plist, plist)
+		ulogd_propagate_flush(npi);
+	ulogd_propagate_flush(upi);
+}
+
+static void nful_handle(struct nflog_group *g, void *buf, int len);
+
 /* callback called from ulogd core when fd is readable */
 static int nful_read_cb(int fd, unsigned int what, void *param)
 {
-	struct ulogd_pluginstance *upi = (struct ulogd_pluginstance *)param;
-	struct nflog_input *ui = (struct nflog_input *)upi->private;
-	int len;
+	struct nflog_group *g = param;
+	struct ulogd_pluginstance *upi = g->upi;
+	struct nflog_input *ui = (struct nflog_input *) upi->private;
+	unsigned int batch = recv_batch_ce(upi->config_kset).u.value;
+	unsigned int budget = ui->recv_budget;
+	unsigned int usec = ui->recv_budget_usec;
+	unsigned int done = 0;
+	uint64_t deadline = 0;
+	int n, i;
 
 	if (!(what & ULOGD_FD_READ))
 		return 0;
 
-	/* we don't have a while loop here, since we don't want to
-	 * grab all the processing time just for us.  there might be other
-	 * sockets that have pending work */
-	len = recv(fd, ui->nfulog_buf, bufsiz_ce(upi->config_kset).u.value, 0);
-	if (len < 0) {
-		if (errno == ENOBUFS && !ui->nful_overrun_warned) {
-			if (nlsockbufmaxsize_ce(upi->config_kset).u.value) {
-				int s = ui->nlbufsiz * 2;
-				if (setnlbufsiz(upi, s)) {
-					ulogd_log(ULOGD_NOTICE,
-						  "We are losing events, "
-						  "increasing buffer size "
-						  "to %d\n", ui->nlbufsiz);
-				} else {
-					/* we have reached the maximum buffer
-					 * limit size, don't perform any
-					 * further treatments on overruns. */
-					ui->nful_overrun_warned = true;
-				}
-			} else {
-				ulogd_log(ULOGD_NOTICE,
-					  "We are losing events. Please, "
-					  "consider using the clauses "
-					  "`netlink_socket_buffer_size' and "
-					  "`netlink_socket_buffer_maxsize'\n");
-				/* display the previous log message once. */
-				ui->nful_overrun_warned = true;
+	if (usec)
+		deadline = now_usec() + usec;
+
+	/* read until the socket is empty, but no more than the budget since
+	 * we don't want to grab all the processing time just for us.  there
+	 * might be other sockets that have pending work */
+	do {
+		unsigned int want = batch;
+
+		if (want > budget - done)
+			want = budget - done;
+
+		n = recvmmsg(fd, g->nful_msgs, want, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == ENOBUFS)
+				nful_overrun(g);
+			return -1;
+		}
+		nful_count_read(g, n);
+
+		for (i = 0; i < n; i++)
+			nful_handle(g, g->nful_iov[i].iov_base,
+				    g->nful_msgs[i].msg_len);
+		nful_flush(upi);
+
+		done += n;
+		/* less than asked for, the socket is empty */
+		if ((unsigned int)n < want)
+			break;
+	} while (done < budget && !ulogd_backpressure_paused(upi) &&
+		 (deadline == 0 || now_usec() < deadline));
+
+	return 0;
+}
+
+static void nful_wakeup(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		ulogd_log(ULOGD_ERROR, "can't write to eventfd: %s\n",
+			  strerror(errno));
+}
+
+static void nful_drain(int fd)
+{
+	uint64_t cnt;
+
+	if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+		ulogd_log(ULOGD_ERROR, "can't read from eventfd: %s\n",
+			  strerror(errno));
+}
+
+/* reader thread of a group, it only receives the datagrams into the ring,
+ * they are handed to libnetfilter_log by nful_ring_cb() */
+static void *nful_reader(void *data)
+{
+	struct nflog_group *g = data;
+	unsigned int batch = recv_batch_ce(g->upi->config_kset).u.value;
+	struct pollfd pfd[2] = {
+		{ .fd = nflog_fd(g->nful_h), .events = POLLIN },
+		{ .fd = g->ctlfd, .events = POLLIN },
+	};
+
+	while (!__atomic_load_n(&g->stop, __ATOMIC_ACQUIRE)) {
+		unsigned int tail = __atomic_load_n(&g->tail, __ATOMIC_ACQUIRE);
+		unsigned int slot = g->head & (g->nslots - 1);
+		unsigned int want = g->nslots - (g->head - tail);
+		int n;
+
+		if (want == 0) {
+			/* the ring is full, the datagrams wait in the kernel
+			 * until the main loop has made room */
+			__atomic_store_n(&g->waiting, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&g->tail, __ATOMIC_SEQ_CST) == tail)
+				poll(&pfd[1], 1, -1);
+			__atomic_store_n(&g->waiting, 0, __ATOMIC_SEQ_CST);
+			nful_drain(g->ctlfd);
+			continue;
+		}
+		if (want > batch)
+			want = batch;
+		/* the vector can't wrap around */
+		if (want > g->nslots - slot)
+			want = g->nslots - slot;
+
+		n = recvmmsg(pfd[0].fd, &g->nful_msgs[slot], want,
+			     MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				poll(pfd, 2, -1);
+				if (pfd[1].revents)
+					nful_drain(g->ctlfd);
+			} else if (errno == ENOBUFS)
+				nful_overrun(g);
+			else if (errno != EINTR) {
+				ulogd_log(ULOGD_ERROR, "can't read from log "
+					  "group %u: %s\n", g->num,
+					  strerror(errno));
+				break;
 			}
+			continue;
+		}
+		nful_count_read(g, n);
+
+		__atomic_store_n(&g->head, g->head + n, __ATOMIC_RELEASE);
+		nful_wakeup(g->nful_fd.fd);
+	}
+	return NULL;
+}
+
+/* callback called from ulogd core when the reader thread has filled some
+ * buffers of the ring */
+static int nful_ring_cb(int fd, unsigned int what, void *param)
+{
+	struct nflog_group *g = param;
+	struct ulogd_pluginstance *upi = g->upi;
+	struct nflog_input *ui = (struct nflog_input *) upi->private;
+	unsigned int batch = recv_batch_ce(upi->config_kset).u.value;
+	unsigned int budget = ui->recv_budget;
+	unsigned int usec = ui->recv_budget_usec;
+	unsigned int head, done = 0;
+	uint64_t deadline = 0;
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	nful_drain(fd);
+
+	if (usec)
+		deadline = now_usec() + usec;
+
+	head = __atomic_load_n(&g->head, __ATOMIC_ACQUIRE);
+	while (g->tail != head) {
+		unsigned int n;
+
+		for (n = 0; n < batch && g->tail + n != head; n++) {
+			unsigned int slot = (g->tail + n) & (g->nslots - 1);
+
+			nful_handle(g, g->nful_iov[slot].iov_base,
+				    g->nful_msgs[slot].msg_len);
 		}
-		return len;
+		/* give the buffers back to the thread */
+		nful_flush(upi);
+		__atomic_store_n(&g->tail, g->tail + n, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&g->waiting, __ATOMIC_SEQ_CST))
+			nful_wakeup(g->ctlfd);
+
+		done += n;
+		if (done >= budget || ulogd_backpressure_paused(upi) ||
+		    (deadline && now_usec() >= deadline))
+			break;
+		head = __atomic_load_n(&g->head, __ATOMIC_ACQUIRE);
 	}
 
-	nflog_handle_packet(ui->nful_h, (char *)ui->nfulog_buf, len);
+	/* the counter has been reset, come back for the rest */
+	if (g->tail != __atomic_load_n(&g->head, __ATOMIC_ACQUIRE))
+		nful_wakeup(fd);
 
 	return 0;
 }
 
+/* a record telling the stack that 'lost' packets of the group are missing,
+ * with no packet so that the packet filters have nothing to parse */
+static void interp_loss(struct ulogd_pluginstance *upi, struct nflog_group *g,
+			uint32_t lost)
+{
+	struct ulogd_key *ret = upi->output.keys;
+	struct timeval ts;
+
+	gettimeofday(&ts, NULL);
+
+	okey_set_u8(&ret[NFLOG_KEY_OOB_FAMILY], AF_UNSPEC);
+	okey_set_u8(&ret[NFLOG_KEY_RAW_LABEL],
+		    label_ce(upi->config_kset).u.value);
+	okey_set_u16(&ret[NFLOG_KEY_OOB_GROUP], g->num);
+	okey_set_u32(&ret[NFLOG_KEY_RAW_PCKTLEN], 0);
+	okey_set_u32(&ret[NFLOG_KEY_OOB_LOST], lost);
+	okey_set_u32(&ret[NFLOG_KEY_OOB_TIME_SEC], ts.tv_sec & 0xffffffff);
+	okey_set_u32(&ret[NFLOG_KEY_OOB_TIME_USEC], ts.tv_usec & 0xffffffff);
+
+	ulogd_propagate_results(upi);
+}
+
+/* the kernel numbers the packets of each group, a gap means that the
+ * packets in between have been lost on their way, usually because the
+ * socket buffer was full */
+static void nful_seq(struct nflog_group *g, uint32_t seq)
+{
+	struct ulogd_pluginstance *upi = g->upi;
+	struct ulogd_pluginstance *npi;
+	uint32_t gap = seq - g->seq_next;
+
+	g->received++;
+	g->ival_received++;
+
+	/* a step back means that the group has been bound anew, e.g. by
+	 * another process, and starts over */
+	if (g->seq_valid && gap != 0 && gap < (1U << 31)) {
+		g->lost += gap;
+		g->ival_lost += gap;
+		upi->stats.lost += gap;
+
+		if (loss_events_ce(upi->config_kset).u.value) {
+			llist_for_each_entry(npi, &upi->plist, plist)
+				interp_loss(npi, g, gap);
+			interp_loss(upi, g, gap);
+		}
+	}
+	g->seq_valid = true;
+	g->seq_next = seq + 1;
+}
+
+static unsigned int loss_bucket(uint64_t lost, uint64_t total)
+{
+	/* parts per million */
+	uint64_t ppm = lost * 1000000 / total;
+
+	if (lost == 0)
+		return 0;
+	if (ppm <= 100)
+		return 1;
+	if (ppm <= 1000)
+		return 2;
+	if (ppm <= 10000)
+		return 3;
+	if (ppm <= 100000)
+		return 4;
+	return 5;
+}
+
+static void loss_timer_cb(struct ulogd_timer *t, void *data)
+{
+	struct ulogd_pluginstance *upi = data;
+	struct nflog_input *ui = (struct nflog_input *) upi->private;
+	unsigned int i;
+
+	for (i = 0; i < ui->num_groups; i++) {
+		struct nflog_group *g = &ui->groups[i];
+		uint64_t total = g->ival_received + g->ival_lost;
+
+		/* nothing to tell about idle intervals */
+		if (total == 0)
+			continue;
+
+		g->loss_hist[loss_bucket(g->ival_lost, total)]++;
+		if (g->ival_lost)
+			ulogd_log(ULOGD_NOTICE, "log group %u lost %"PRIu64
+				  " of %"PRIu64" packets (%.2f%%)\n", g->num,
+				  g->ival_lost, total,
+				  100.0 * g->ival_lost / total);
+		g->ival_received = g->ival_lost = 0;
+	}
+	ulogd_add_timer(&ui->loss_timer, loss_interval_ce(upi->config_kset).u.value);
+}
+
+static void nful_stats(struct ulogd_pluginstance *upi, FILE *f)
+{
+	static const char *buckets[NFLOG_LOSS_BUCKETS] = {
+		"0", "0.01", "0.1", "1", "10", "100",
+	};
+	struct nflog_input *ui = (struct nflog_input *) upi->private;
+	unsigned int i, j;
+
+	if (!upi->started || seq_ce(upi->config_kset).u.value == 0)
+		return;
+
+	fprintf(f, ", \"groups\": [");
+	for (i = 0; i < ui->num_groups; i++) {
+		struct nflog_group *g = &ui->groups[i];
+
+		fprintf(f, "%s{\"group\": %u, \"received\": %"PRIu64", "
+			"\"lost\": %"PRIu64", \"loss_hist\": {", i ? ", " : "",
+			g->num, g->received, g->lost);
+		for (j = 0; j < NFLOG_LOSS_BUCKETS; j++)
+			fprintf(f, "%s\"%s\": %"PRIu64, j ? ", " : "",
+				buckets[j], g->loss_hist[j]);
+		fprintf(f, "}}");
+	}
+	fputc(']', f);
+}
+
 /* callback called by libnfnetlink* for every nlmsg */
 static int msg_cb(struct nflog_g_handle *gh, struct nfgenmsg *nfmsg,
 		  struct nflog_data *nfa, void *data)
 {
-	struct ulogd_pluginstance *upi = data;
+	struct nflog_group *g = data;
+	struct ulogd_pluginstance *upi = g->upi;
 	struct ulogd_pluginstance *npi = NULL;
+	uint32_t seq;
 	int ret = 0;
 
+	if (seq_ce(upi->config_kset).u.value != 0 &&
+	    nflog_get_seq(nfa, &seq) == 0)
+		nful_seq(g, seq);
+
 	/* since we support the re-use of one instance in several 
 	 * different stacks, we duplicate the message to let them know */
 	llist_for_each_entry(npi, &upi->plist, plist) {
-		ret = interp_packet(npi, nfmsg->nfgen_family, nfa);
+		ret = interp_packet(npi, nfmsg->nfgen_family, g->num, nfa);
 		if (ret != 0)
 			return ret;
 	}
-	return interp_packet(upi, nfmsg->nfgen_family, nfa);
+	return interp_packet(upi, nfmsg->nfgen_family, g->num, nfa);
+}
+
+/* smallest payload of the attributes interp_attrs() looks at */
+#ifdef HAVE_LIBMNL
+static const uint16_t nful_attr_len[NFULA_MAX + 1] = {
+	[NFULA_PACKET_HDR]	= sizeof(struct nfulnl_msg_packet_hdr),
+	[NFULA_MARK]		= sizeof(uint32_t),
+	[NFULA_TIMESTAMP]	= sizeof(struct nfulnl_msg_packet_timestamp),
+	[NFULA_IFINDEX_INDEV]	= sizeof(uint32_t),
+	[NFULA_IFINDEX_OUTDEV]	= sizeof(uint32_t),
+	[NFULA_HWADDR]		= sizeof(struct nfulnl_msg_packet_hw),
+	[NFULA_PREFIX]		= 1,
+	[NFULA_UID]		= sizeof(uint32_t),
+	[NFULA_SEQ]		= sizeof(uint32_t),
+	[NFULA_SEQ_GLOBAL]	= sizeof(uint32_t),
+	[NFULA_GID]		= sizeof(uint32_t),
+	[NFULA_HWTYPE]		= sizeof(uint16_t),
+	[NFULA_HWLEN]		= sizeof(uint16_t),
+};
+
+static uint32_t attr_u32(const struct nlattr *attr)
+{
+	return ntohl(mnl_attr_get_u32(attr));
+}
+
+/* the same as interp_packet(), from the attributes of the message, the keys
+ * point into the receive buffer */
+static int interp_attrs(struct ulogd_pluginstance *upi, uint8_t pf_family,
+			uint16_t group, const struct nlattr **tb)
+{
+	struct ulogd_key *ret = upi->output.keys;
+	struct timeval ts;
+
+	okey_set_u8(&ret[NFLOG_KEY_OOB_FAMILY], pf_family);
+	okey_set_u8(&ret[NFLOG_KEY_RAW_LABEL],
+		    label_ce(upi->config_kset).u.value);
+	okey_set_u16(&ret[NFLOG_KEY_OOB_GROUP], group);
+
+	if (tb[NFULA_PACKET_HDR]) {
+		struct nfulnl_msg_packet_hdr *ph =
+			mnl_attr_get_payload(tb[NFULA_PACKET_HDR]);
+
+		okey_set_u8(&ret[NFLOG_KEY_OOB_HOOK], ph->hook);
+		okey_set_u16(&ret[NFLOG_KEY_OOB_PROTOCOL],
+			     ntohs(ph->hw_protocol));
+	}
+
+	if (tb[NFULA_HWLEN] && tb[NFULA_HWHEADER]) {
+		uint16_t len = ntohs(mnl_attr_get_u16(tb[NFULA_HWLEN]));
+
+		if (len > mnl_attr_get_payload_len(tb[NFULA_HWHEADER]))
+			len = mnl_attr_get_payload_len(tb[NFULA_HWHEADER]);
+		if (len) {
+			okey_set_raw(&ret[NFLOG_KEY_RAW_MAC],
+				     mnl_attr_get_payload(tb[NFULA_HWHEADER]),
+				     len);
+			okey_set_u16(&ret[NFLOG_KEY_RAW_MAC_LEN], len);
+			okey_set_u16(&ret[NFLOG_KEY_RAW_TYPE], tb[NFULA_HWTYPE] ?
+				     ntohs(mnl_attr_get_u16(tb[NFULA_HWTYPE])) :
+				     0);
+		}
+	}
+
+	if (tb[NFULA_HWADDR]) {
+		struct nfulnl_msg_packet_hw *hw =
+			mnl_attr_get_payload(tb[NFULA_HWADDR]);
+
+		okey_set_raw(&ret[NFLOG_KEY_RAW_MAC_SADDR], hw->hw_addr,
+			     ntohs(hw->hw_addrlen));
+		okey_set_u16(&ret[NFLOG_KEY_RAW_MAC_ADDRLEN],
+			     ntohs(hw->hw_addrlen));
+	}
+
+	if (tb[NFULA_PAYLOAD]) {
+		/* include pointer to raw packet */
+		okey_set_raw(&ret[NFLOG_KEY_RAW_PCKT],
+			     mnl_attr_get_payload(tb[NFULA_PAYLOAD]),
+			     mnl_attr_get_payload_len(tb[NFULA_PAYLOAD]));
+		okey_set_u32(&ret[NFLOG_KEY_RAW_PCKTLEN],
+			     mnl_attr_get_payload_len(tb[NFULA_PAYLOAD]));
+	}
+
+	/* number of packets */
+	okey_set_u32(&ret[NFLOG_KEY_RAW_PCKTCOUNT], 1);
+
+	if (tb[NFULA_PREFIX])
+		okey_set_ptr(&ret[NFLOG_KEY_OOB_PREFIX],
+			     (void *)mnl_attr_get_str(tb[NFULA_PREFIX]));
+
+	ts.tv_sec = 0;
+	if (tb[NFULA_TIMESTAMP]) {
+		struct nfulnl_msg_packet_timestamp *t =
+			mnl_attr_get_payload(tb[NFULA_TIMESTAMP]);
+
+		ts.tv_sec = be64toh(t->sec);
+		ts.tv_usec = be64toh(t->usec);
+	}
+	if (!ts.tv_sec)
+		gettimeofday(&ts, NULL);
+
+	okey_set_u32(&ret[NFLOG_KEY_OOB_TIME_SEC], ts.tv_sec & 0xffffffff);
+	okey_set_u32(&ret[NFLOG_KEY_OOB_TIME_USEC], ts.tv_usec & 0xffffffff);
+
+	okey_set_u32(&ret[NFLOG_KEY_OOB_MARK],
+		     tb[NFULA_MARK] ? attr_u32(tb[NFULA_MARK]) : 0);
+
+	if (tb[NFULA_IFINDEX_INDEV] && attr_u32(tb[NFULA_IFINDEX_INDEV]))
+		okey_set_u32(&ret[NFLOG_KEY_OOB_IFINDEX_IN],
+			     attr_u32(tb[NFULA_IFINDEX_INDEV]));
+
+	if (tb[NFULA_IFINDEX_OUTDEV] && attr_u32(tb[NFULA_IFINDEX_OUTDEV]))
+		okey_set_u32(&ret[NFLOG_KEY_OOB_IFINDEX_OUT],
+			     attr_u32(tb[NFULA_IFINDEX_OUTDEV]));
+
+	if (tb[NFULA_UID])
+		okey_set_u32(&ret[NFLOG_KEY_OOB_UID], attr_u32(tb[NFULA_UID]));
+	if (tb[NFULA_GID])
+		okey_set_u32(&ret[NFLOG_KEY_OOB_GID], attr_u32(tb[NFULA_GID]));
+	if (tb[NFULA_SEQ])
+		okey_set_u32(&ret[NFLOG_KEY_OOB_SEQ_LOCAL],
+			     attr_u32(tb[NFULA_SEQ]));
+	if (tb[NFULA_SEQ_GLOBAL])
+		okey_set_u32(&ret[NFLOG_KEY_OOB_SEQ_GLOBAL],
+			     attr_u32(tb[NFULA_SEQ_GLOBAL]));
+
+	/* there is no struct nflog_data for the "raw" key */
+
+	ulogd_propagate_results(upi);
+	return 0;
+}
+
+/* one pass over the attributes of a packet message, instead of one lookup
+ * through libnetfilter_log for each of them */
+static void nful_parse(struct nflog_group *g, const struct nlmsghdr *nlh)
+{
+	struct ulogd_pluginstance *upi = g->upi;
+	struct ulogd_pluginstance *npi;
+	const struct nlattr *tb[NFULA_MAX + 1] = {};
+	const struct nlattr *attr;
+	struct nfgenmsg *nfmsg;
+
+	if (nlh->nlmsg_len < MNL_NLMSG_HDRLEN + sizeof(struct nfgenmsg))
+		return;
+	nfmsg = mnl_nlmsg_get_payload(nlh);
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		uint16_t type = mnl_attr_get_type(attr);
+
+		if (type > NFULA_MAX ||
+		    mnl_attr_get_payload_len(attr) < nful_attr_len[type])
+			continue;
+		tb[type] = attr;
+	}
+
+	/* the prefix has to be terminated */
+	if (tb[NFULA_PREFIX] &&
+	    ((char *)mnl_attr_get_payload(tb[NFULA_PREFIX]))
+			[mnl_attr_get_payload_len(tb[NFULA_PREFIX]) - 1] != '\0')
+		tb[NFULA_PREFIX] = NULL;
+
+	if (seq_ce(upi->config_kset).u.value != 0 && tb[NFULA_SEQ])
+		nful_seq(g, attr_u32(tb[NFULA_SEQ]));
+
+	llist_for_each_entry(npi, &upi->plist, plist)
+		interp_attrs(npi, nfmsg->nfgen_family, g->num, tb);
+	interp_attrs(upi, nfmsg->nfgen_family, g->num, tb);
+}
+#endif /* HAVE_LIBMNL */
+
+/* hand the messages of a datagram to the parser */
+static void nful_handle(struct nflog_group *g, void *buf, int len)
+{
+#ifdef HAVE_LIBMNL
+	const struct nlmsghdr *nlh = buf;
+
+	if (g->mnl) {
+		while (mnl_nlmsg_ok(nlh, len)) {
+			if (nlh->nlmsg_type ==
+			    ((NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET))
+				nful_parse(g, nlh);
+			nlh = mnl_nlmsg_next(nlh, &len);
+		}
+		return;
+	}
+#endif
+	nflog_handle_packet(g->nful_h, buf, len);
+}
+
+static int add_group(struct nflog_input *ui, unsigned long num)
+{
+	unsigned int i;
+
+	if (num > UINT16_MAX) {
+		ulogd_log(ULOGD_ERROR, "invalid log group %lu\n", num);
+		return -1;
+	}
+	for (i = 0; i < ui->num_groups; i++) {
+		if (ui->groups[i].num == num)
+			return 0;
+	}
+	if (ui->num_groups == NFLOG_MAX_GROUPS) {
+		ulogd_log(ULOGD_ERROR, "more than %u log groups\n",
+			  NFLOG_MAX_GROUPS);
+		return -1;
+	}
+	ui->groups[ui->num_groups++].num = num;
+	return 0;
+}
+
+/* groups is a list of log groups and ranges of them, e.g. "1-4,8" */
+static int parse_groups(struct ulogd_pluginstance *upi)
+{
+	struct nflog_input *ui = (struct nflog_input *) upi->private;
+	const char *p = groups_ce(upi->config_kset).u.string;
+
+	ui->num_groups = 0;
+	if (p[0] == '\0')
+		return add_group(ui, group_ce(upi->config_kset).u.value);
+
+	while (*p) {
+		unsigned long from, to;
+		char *end;
+
+		from = to = strtoul(p, &end, 10);
+		if (end != p && *end == '-') {
+			p = end + 1;
+			to = strtoul(p, &end, 10);
+		}
+		if (end == p || (*end != ',' && *end != '\0') || from > to) {
+			ulogd_log(ULOGD_ERROR, "invalid groups `%s'\n",
+				  groups_ce(upi->config_kset).u.string);
+			return -1;
+		}
+		for (; from <= to; from++) {
+			if (add_group(ui, from) < 0)
+				return -1;
+		}
+		p = *end ? end + 1 : end;
+	}
+	return 0;
 }
 
 static int configure(struct ulogd_pluginstance *upi,
 		     struct ulogd_pluginstance_stack *stack)
 {
+	struct nflog_input *ui = (struct nflog_input *) upi->private;
+	unsigned int batch, want;
+
 	ulogd_log(ULOGD_DEBUG, "parsing config file section `%s', "
 		  "plugin `%s'\n", upi->id, upi->plugin->name);
 
 	config_parse_file(upi->id, upi->config_kset);
-	return 0;
+
+	if (recv_batch_ce(upi->config_kset).u.value < 1 ||
+	    recv_batch_ce(upi->config_kset).u.value > UIO_MAXIOV) {
+		ulogd_log(ULOGD_ERROR, "recv_batch has to be between 1 and "
+			  "%d\n", UIO_MAXIOV);
+		return -1;
+	}
+	/* a whole batch is read at least */
+	ui->recv_budget = recv_budget_ce(upi->config_kset).u.value;
+	if (recv_budget_ce(upi->config_kset).u.value <
+	    recv_batch_ce(upi->config_kset).u.value)
+		ui->recv_budget = recv_batch_ce(upi->config_kset).u.value;
+	ui->recv_budget_usec = 0;
+	if (recv_budget_usec_ce(upi->config_kset).u.value > 0)
+		ui->recv_budget_usec =
+			recv_budget_usec_ce(upi->config_kset).u.value;
+	if (seq_ce(upi->config_kset).u.value == 0 &&
+	    loss_events_ce(upi->config_kset).u.value != 0)
+		ulogd_log(ULOGD_NOTICE, "loss_events needs seq_local\n");
+
+	if (strcmp(parser_ce(upi->config_kset).u.string, "libnetfilter_log") &&
+	    strcmp(parser_ce(upi->config_kset).u.string, "mnl")) {
+		ulogd_log(ULOGD_ERROR, "unknown parser `%s'\n",
+			  parser_ce(upi->config_kset).u.string);
+		return -1;
+	}
+#ifndef HAVE_LIBMNL
+	if (!strcmp(parser_ce(upi->config_kset).u.string, "mnl"))
+		ulogd_log(ULOGD_NOTICE, "built without libmnl, using the "
+			  "libnetfilter_log parser\n");
+#endif
+
+	/* the ring is indexed with a mask, it holds a power of two of
+	 * datagrams, at least a batch and 4 batches by default */
+	batch = recv_batch_ce(upi->config_kset).u.value;
+	want = 4 * batch;
+	if (reader_queue_ce(upi->config_kset).u.value > 0)
+		want = reader_queue_ce(upi->config_kset).u.value;
+	if (want < batch)
+		want = batch;
+	for (ui->reader_queue = 1;
+	     ui->reader_queue < want && ui->reader_queue < (1U << 16); )
+		ui->reader_queue <<= 1;
+
+	return parse_groups(upi);
 }
 
-static int become_system_logging(struct ulogd_pluginstance *upi, uint8_t pf)
+static int become_system_logging(struct ulogd_pluginstance *upi,
+				 struct nflog_handle *h, uint8_t pf)
 {
-	struct nflog_input *ui = (struct nflog_input *) upi->private;
-
 	if (unbind_ce(upi->config_kset).u.value > 0) {
 		ulogd_log(ULOGD_NOTICE, "forcing unbind of existing log "
 				"handler for protocol %d\n",
 				pf);
-		if (nflog_unbind_pf(ui->nful_h, pf) < 0) {
+		if (nflog_unbind_pf(h, pf) < 0) {
 			ulogd_log(ULOGD_ERROR, "unable to force-unbind "
 					"existing log handler for protocol %d\n",
 					pf);
@@ -510,7 +1266,7 @@ static int become_system_logging(struct ulogd_pluginstance *upi, uint8_t pf)
 	}
 
 	ulogd_log(ULOGD_DEBUG, "binding to protocol family %d\n", pf);
-	if (nflog_bind_pf(ui->nful_h, pf) < 0) {
+	if (nflog_bind_pf(h, pf) < 0) {
 		ulogd_log(ULOGD_ERROR, "unable to bind to"
 				" protocol family %d\n", pf);
 		return -1;
@@ -518,51 +1274,64 @@ static int become_system_logging(struct ulogd_pluginstance *upi, uint8_t pf)
 	return 0;
 }
 
-static int start(struct ulogd_pluginstance *upi)
+static int group_alloc(struct nflog_group *g)
 {
+	struct ulogd_pluginstance *upi = g->upi;
 	struct nflog_input *ui = (struct nflog_input *) upi->private;
-	unsigned int flags;
+	size_t bufsiz = bufsiz_ce(upi->config_kset).u.value;
+	unsigned int i;
+
+	/* recv_batch was checked to be at least 1 by configure */
+	g->nslots = g->threaded ? ui->reader_queue :
+		(unsigned int)recv_batch_ce(upi->config_kset).u.value;
+	g->nfulog_buf = malloc(g->nslots * bufsiz);
+	g->nful_msgs = calloc(g->nslots, sizeof(struct mmsghdr));
+	g->nful_iov = calloc(g->nslots, sizeof(struct iovec));
+	if (!g->nfulog_buf || !g->nful_msgs || !g->nful_iov)
+		return -1;
 
-	ui->nfulog_buf = malloc(bufsiz_ce(upi->config_kset).u.value);
-	if (!ui->nfulog_buf)
-		goto out_buf;
+	for (i = 0; i < g->nslots; i++) {
+		g->nful_iov[i].iov_base = g->nfulog_buf + i * bufsiz;
+		g->nful_iov[i].iov_len = bufsiz;
+		g->nful_msgs[i].msg_hdr.msg_iov = &g->nful_iov[i];
+		g->nful_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return 0;
+}
 
-	ulogd_log(ULOGD_DEBUG, "opening nfnetlink socket\n");
-	ui->nful_h = nflog_open();
-	if (!ui->nful_h)
-		goto out_handle;
+static void group_free(struct nflog_group *g)
+{
+	free(g->nfulog_buf);
+	free(g->nful_msgs);
+	free(g->nful_iov);
+	g->nfulog_buf = NULL;
+	g->nful_msgs = NULL;
+	g->nful_iov = NULL;
+}
 
-	/* This is the system logging (conntrack, ...) facility */
-	if ((group_ce(upi->config_kset).u.value == 0) ||
-			(bind_ce(upi->config_kset).u.value > 0)) {
-		if (become_system_logging(upi, AF_INET) == -1)
-			goto out_handle;
-		if (become_system_logging(upi, AF_INET6) == -1)
-			goto out_handle;
-		if (become_system_logging(upi, AF_BRIDGE) == -1)
-			goto out_handle;
-	}
+static int group_bind(struct nflog_group *g)
+{
+	struct ulogd_pluginstance *upi = g->upi;
+	unsigned int flags;
 
-	ulogd_log(ULOGD_DEBUG, "binding to log group %d\n",
-		  group_ce(upi->config_kset).u.value);
-	ui->nful_gh = nflog_bind_group(ui->nful_h,
-				       group_ce(upi->config_kset).u.value);
-	if (!ui->nful_gh) {
+	ulogd_log(ULOGD_DEBUG, "binding to log group %d\n", g->num);
+	g->nful_gh = nflog_bind_group(g->nful_h, g->num);
+	if (!g->nful_gh) {
 		ulogd_log(ULOGD_ERROR, "unable to bind to log group %d\n",
-			  group_ce(upi->config_kset).u.value);
-		goto out_bind;
+			  g->num);
+		return -1;
 	}
 
-	nflog_set_mode(ui->nful_gh, NFULNL_COPY_PACKET, 0xffff);
+	nflog_set_mode(g->nful_gh, NFULNL_COPY_PACKET, 0xffff);
 
 	if (nlsockbufsize_ce(upi->config_kset).u.value) {
-		setnlbufsiz(upi, nlsockbufsize_ce(upi->config_kset).u.value);
+		setnlbufsiz(g, nlsockbufsize_ce(upi->config_kset).u.value);
 		ulogd_log(ULOGD_NOTICE, "NFLOG netlink buffer size has been "
-					"set to %d\n", ui->nlbufsiz);
+					"set to %d\n", g->nlbufsiz);
 	}
 
 	if (nlthreshold_ce(upi->config_kset).u.value) {
-		if (nflog_set_qthresh(ui->nful_gh,
+		if (nflog_set_qthresh(g->nful_gh,
 				  nlthreshold_ce(upi->config_kset).u.value)
 				>= 0)
 			ulogd_log(ULOGD_NOTICE,
@@ -577,7 +1346,7 @@ static int start(struct ulogd_pluginstance *upi)
 	}
 
 	if (nltimeout_ce(upi->config_kset).u.value) {
-		if (nflog_set_timeout(ui->nful_gh,
+		if (nflog_set_timeout(g->nful_gh,
 				      nltimeout_ce(upi->config_kset).u.value)
 			>= 0)
 			ulogd_log(ULOGD_NOTICE,
@@ -595,50 +1364,216 @@ static int start(struct ulogd_pluginstance *upi)
 	flags = 0;
 	if (seq_ce(upi->config_kset).u.value != 0)
 		flags = NFULNL_CFG_F_SEQ;
-	if (seq_ce(upi->config_kset).u.value != 0)
+	if (seq_global_ce(upi->config_kset).u.value != 0)
 		flags |= NFULNL_CFG_F_SEQ_GLOBAL;
 	if (flags) {
-		if (nflog_set_flags(ui->nful_gh, flags) < 0)
+		if (nflog_set_flags(g->nful_gh, flags) < 0)
 			ulogd_log(ULOGD_ERROR, "unable to set flags 0x%x\n",
 				  flags);
 	}
 
-	nflog_callback_register(ui->nful_gh, &msg_cb, upi);
+	nflog_callback_register(g->nful_gh, &msg_cb, g);
+	return 0;
+}
+
+static int group_start_reader(struct nflog_group *g)
+{
+	sigset_t all, old;
+	int ret;
+
+	g->ctlfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (g->ctlfd < 0)
+		goto err;
+	g->nful_fd.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (g->nful_fd.fd < 0)
+		goto err_ctl;
+	g->nful_fd.cb = &nful_ring_cb;
+	g->head = g->tail = 0;
+	g->waiting = g->stop = 0;
+
+	/* signals are handled by the main loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(&g->thread, NULL, nful_reader, g);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		errno = ret;
+		goto err_fd;
+	}
+	ulogd_thread_register(g->thread);
+	return 0;
+
+err_fd:
+	close(g->nful_fd.fd);
+err_ctl:
+	close(g->ctlfd);
+err:
+	ulogd_log(ULOGD_ERROR, "can't start reader thread of log group "
+		  "%d: %s\n", g->num, strerror(errno));
+	return -1;
+}
+
+static void group_stop_reader(struct nflog_group *g)
+{
+	__atomic_store_n(&g->stop, 1, __ATOMIC_RELEASE);
+	nful_wakeup(g->ctlfd);
+	ulogd_thread_unregister(g->thread);
+	pthread_join(g->thread, NULL);
+	close(g->nful_fd.fd);
+	close(g->ctlfd);
+}
+
+static int group_start(struct nflog_group *g)
+{
+	if (group_bind(g) < 0)
+		return -1;
+
+	if (g->threaded) {
+		if (group_start_reader(g) < 0)
+			goto out_bind;
+	} else {
+		g->nful_fd.fd = nflog_fd(g->nful_h);
+		g->nful_fd.cb = &nful_read_cb;
+	}
+	g->nful_fd.data = g;
+	g->nful_fd.when = ULOGD_FD_READ | ULOGD_FD_BUSY;
+
+	if (ulogd_register_fd(&g->nful_fd) < 0)
+		goto out_reader;
+	ulogd_backpressure_fd(g->upi, &g->nful_fd);
+
+	g->nful_overrun_warned = false;
+	g->seq_valid = false;
+	g->received = g->lost = 0;
+	g->ival_received = g->ival_lost = 0;
+	memset(g->loss_hist, 0, sizeof(g->loss_hist));
+	return 0;
+
+out_reader:
+	if (g->threaded)
+		group_stop_reader(g);
+out_bind:
+	nflog_unbind_group(g->nful_gh);
+	return -1;
+}
+
+static void group_stop(struct nflog_group *g)
+{
+	ulogd_unregister_fd(&g->nful_fd);
+	if (g->threaded)
+		group_stop_reader(g);
+	nflog_unbind_group(g->nful_gh);
+}
+
+/* group 0 is used by the kernel to log invalid conntrack messages */
+static bool has_group0(struct nflog_input *ui)
+{
+	unsigned int i;
+
+	for (i = 0; i < ui->num_groups; i++) {
+		if (ui->groups[i].num == 0)
+			return true;
+	}
+	return false;
+}
+
+static int start(struct ulogd_pluginstance *upi)
+{
+	struct nflog_input *ui = (struct nflog_input *) upi->private;
+	unsigned int i, j;
+
+	for (i = 0; i < ui->num_groups; i++) {
+		struct nflog_group *g = &ui->groups[i];
+
+		g->upi = upi;
+		g->threaded = reader_threads_ce(upi->config_kset).u.value > 0;
+#ifdef HAVE_LIBMNL
+		g->mnl = !strcmp(parser_ce(upi->config_kset).u.string, "mnl");
+#else
+		g->mnl = false;
+#endif
+		if (group_alloc(g) < 0)
+			goto out_handle;
+
+		/* every group has a socket of its own */
+		ulogd_log(ULOGD_DEBUG, "opening nfnetlink socket\n");
+		g->nful_h = nflog_open();
+		if (!g->nful_h)
+			goto out_handle;
+	}
+
+	/* This is the system logging (conntrack, ...) facility */
+	if (has_group0(ui) || (bind_ce(upi->config_kset).u.value > 0)) {
+		struct nflog_handle *h = ui->groups[0].nful_h;
 
-	ui->nful_fd.fd = nflog_fd(ui->nful_h);
-	ui->nful_fd.cb = &nful_read_cb;
-	ui->nful_fd.data = upi;
-	ui->nful_fd.when = ULOGD_FD_READ;
+		if (become_system_logging(upi, h, AF_INET) == -1)
+			goto out_handle;
+		if (become_system_logging(upi, h, AF_INET6) == -1)
+			goto out_handle;
+		if (become_system_logging(upi, h, AF_BRIDGE) == -1)
+			goto out_handle;
+	}
 
-	if (ulogd_register_fd(&ui->nful_fd) < 0)
-		goto out_bind;
+	for (j = 0; j < ui->num_groups; j++) {
+		if (group_start(&ui->groups[j]) < 0)
+			goto out_bind;
+	}
 
-	ui->nful_overrun_warned = false;
+	if (ui->num_groups > 1)
+		ulogd_log(ULOGD_INFO, "%s: logging %u groups%s\n", upi->id,
+			  ui->num_groups, ui->groups[0].threaded ?
+			  " with a reader thread each" : "");
 
+	ulogd_init_timer(&ui->loss_timer, upi, loss_timer_cb);
+	if (seq_ce(upi->config_kset).u.value != 0 &&
+	    loss_interval_ce(upi->config_kset).u.value > 0)
+		ulogd_add_timer(&ui->loss_timer,
+				loss_interval_ce(upi->config_kset).u.value);
 	return 0;
 
 out_bind:
-	if (group_ce(upi->config_kset).u.value == 0) {
-		nflog_unbind_pf(ui->nful_h, AF_INET);
-		nflog_unbind_pf(ui->nful_h, AF_INET6);
-		nflog_unbind_pf(ui->nful_h, AF_BRIDGE);
+	while (j--)
+		group_stop(&ui->groups[j]);
+	if (has_group0(ui)) {
+		nflog_unbind_pf(ui->groups[0].nful_h, AF_INET);
+		nflog_unbind_pf(ui->groups[0].nful_h, AF_INET6);
+		nflog_unbind_pf(ui->groups[0].nful_h, AF_BRIDGE);
 	}
-	nflog_close(ui->nful_h);
 out_handle:
-	free(ui->nfulog_buf);
-out_buf:
+	for (j = 0; j <= i && j < ui->num_groups; j++) {
+		if (ui->groups[j].nful_h)
+			nflog_close(ui->groups[j].nful_h);
+		ui->groups[j].nful_h = NULL;
+		group_free(&ui->groups[j]);
+	}
 	return -1;
 }
 
 static int stop(struct ulogd_pluginstance *pi)
 {
 	struct nflog_input *ui = (struct nflog_input *)pi->private;
+	unsigned int i;
+
+	if (ulogd_timer_pending(&ui->loss_timer))
+		ulogd_del_timer(&ui->loss_timer);
+
+	for (i = 0; i < ui->num_groups; i++) {
+		struct nflog_group *g = &ui->groups[i];
+
+		if (g->lost)
+			ulogd_log(ULOGD_NOTICE, "log group %u lost %"PRIu64
+				  " of %"PRIu64" packets\n", g->num, g->lost,
+				  g->received + g->lost);
+		group_stop(g);
+		nflog_close(g->nful_h);
+		g->nful_h = NULL;
+		group_free(g);
+	}
 
-	ulogd_unregister_fd(&ui->nful_fd);
-	nflog_unbind_group(ui->nful_gh);
-	nflog_close(ui->nful_h);
-
-	free(ui->nfulog_buf);
+	if (pi->stats.reads)
+		ulogd_log(ULOGD_INFO, "%s: %"PRIu64" datagrams in %"PRIu64
+			  " reads\n", pi->id, pi->stats.msgs,
+			  pi->stats.reads);
 
 	return 0;
 }
@@ -657,7 +1592,9 @@ struct ulogd_plugin libulog_plugin = {
 	.configure 	= &configure,
 	.start 		= &start,
 	.stop 		= &stop,
+	.stats		= &nful_stats,
 	.config_kset 	= &libulog_kset,
+	.flags		= ULOGD_PLUGINF_BATCH,
 	.version	= VERSION,
 };
 
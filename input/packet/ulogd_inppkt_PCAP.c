@@ -0,0 +1,1124 @@
+/* ulogd_inppkt_PCAP.c - replay packets from a pcap or pcapng file
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Source plugin for load testing a stack without netfilter.  The packets
+ *  of a capture file are handed over with the same keys NFLOG has, either
+ *  as fast as possible, with the timing of the capture or at a fixed rate,
+ *  once, several times or forever.  Ethernet, Linux cooked, raw IP and
+ *  NFLOG (tcpdump -i nflog:N) captures are supported.  The file is mapped
+ *  into memory, so the packets aren't copied.
+ *
+ *  The replay is driven by a timerfd in the main loop, at most PCAP_CHUNK
+ *  records are handed over per wakeup so the other sockets, signals and
+ *  timers aren't starved.  Once the replay is done, the number of records
+ *  per second is logged.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <byteswap.h>
+#include <netinet/in.h>
+#include <net/if_arp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include <ulogd/ulogd.h>
+
+/* records handed over per wakeup of the main loop */
+#define PCAP_CHUNK		256
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+#define PCAPNG_IDB		1
+#define PCAPNG_PB		2
+#define PCAPNG_SPB		3
+#define PCAPNG_EPB		6
+#define PCAPNG_IF_TSRESOL	9
+
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_IPV6		229
+#define LINKTYPE_NFLOG		239
+
+/* attributes of LINKTYPE_NFLOG records, see linux/netfilter/nfnetlink_log.h */
+#define NFULA_PACKET_HDR	1
+#define NFULA_MARK		2
+#define NFULA_TIMESTAMP		3
+#define NFULA_IFINDEX_INDEV	4
+#define NFULA_IFINDEX_OUTDEV	5
+#define NFULA_HWADDR		8
+#define NFULA_PAYLOAD		9
+#define NFULA_PREFIX		10
+#define NFULA_UID		11
+#define NFULA_SEQ		12
+#define NFULA_SEQ_GLOBAL	13
+#define NFULA_GID		14
+#define NFULA_HWTYPE		15
+#define NFULA_HWHEADER		16
+#define NFULA_HWLEN		17
+
+enum pcap_replay {
+	PCAP_REPLAY_FAST,
+	PCAP_REPLAY_ORIGINAL,
+	PCAP_REPLAY_RATE,
+};
+
+struct pcap_iface {
+	uint16_t linktype;
+	/* length of a timestamp unit in nanoseconds, or units per
+	 * nanosecond if negative */
+	int64_t tsunit;
+};
+
+struct pcap_record {
+	const uint8_t *data;
+	uint32_t caplen;
+	uint16_t linktype;
+	uint64_t ts;			/* nanoseconds */
+};
+
+struct pcap_input {
+	uint8_t *map;
+	size_t size;
+	size_t off;
+	int swap;
+	int ng;
+	/* pcap: the only link type, pcapng: interfaces of the section */
+	struct pcap_iface *ifaces;
+	unsigned int num_ifaces;
+	unsigned int warned_linktype;
+
+	enum pcap_replay replay;
+	unsigned int loops;
+	struct ulogd_fd timer_fd;
+	struct pcap_record next;
+	int have_next;
+	int done;
+
+	/* monotonic nanoseconds, of the first record and of the current
+	 * pass through the file */
+	uint64_t begin;
+	uint64_t start;
+	uint64_t first_ts;
+	uint64_t count;
+	uint64_t pass_count;
+	unsigned int pass;
+};
+
+static struct config_keyset pcap_kset = {
+	.num_ces = 6,
+	.ces = {
+		{
+			.key	 = "file",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_MANDATORY,
+		},
+		{
+			.key	 = "replay",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "fast",
+		},
+		{
+			.key	 = "rate",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1000,
+		},
+		{
+			.key	 = "loop",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		{
+			.key	 = "numeric_label",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "exit_when_done",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	}
+};
+
+#define file_ce(x)	(x->ces[0])
+#define replay_ce(x)	(x->ces[1])
+#define rate_ce(x)	(x->ces[2])
+#define loop_ce(x)	(x->ces[3])
+#define label_ce(x)	(x->ces[4])
+#define exit_ce(x)	(x->ces[5])
+
+enum pcap_keys {
+	PCAP_KEY_RAW_MAC = 0,
+	PCAP_KEY_RAW_PCKT,
+	PCAP_KEY_RAW_PCKTLEN,
+	PCAP_KEY_RAW_PCKTCOUNT,
+	PCAP_KEY_OOB_PREFIX,
+	PCAP_KEY_OOB_TIME_SEC,
+	PCAP_KEY_OOB_TIME_USEC,
+	PCAP_KEY_OOB_MARK,
+	PCAP_KEY_OOB_IFINDEX_IN,
+	PCAP_KEY_OOB_IFINDEX_OUT,
+	PCAP_KEY_OOB_HOOK,
+	PCAP_KEY_RAW_MAC_LEN,
+	PCAP_KEY_OOB_SEQ_LOCAL,
+	PCAP_KEY_OOB_SEQ_GLOBAL,
+	PCAP_KEY_OOB_FAMILY,
+	PCAP_KEY_OOB_PROTOCOL,
+	PCAP_KEY_OOB_UID,
+	PCAP_KEY_OOB_GID,
+	PCAP_KEY_RAW_LABEL,
+	PCAP_KEY_RAW_TYPE,
+	PCAP_KEY_RAW_MAC_SADDR,
+	PCAP_KEY_RAW_MAC_ADDRLEN,
+};
+
+static struct ulogd_key output_keys[] = {
+	[PCAP_KEY_RAW_MAC] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac",
+	},
+	[PCAP_KEY_RAW_MAC_SADDR] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac.saddr",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_sourceMacAddress,
+		},
+	},
+	[PCAP_KEY_RAW_PCKT] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pkt",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_rawpacket,
+		},
+	},
+	[PCAP_KEY_RAW_PCKTLEN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktlen",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_rawpacket_length,
+		},
+	},
+	[PCAP_KEY_RAW_PCKTCOUNT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktcount",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_packetDeltaCount,
+		},
+	},
+	[PCAP_KEY_OOB_PREFIX] = {
+		.type = ULOGD_RET_STRING,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.prefix",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_prefix,
+		},
+	},
+	[PCAP_KEY_OOB_TIME_SEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.sec",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_flowStartSeconds,
+		},
+	},
+	[PCAP_KEY_OOB_TIME_USEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.usec",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_flowStartMicroSeconds,
+		},
+	},
+	[PCAP_KEY_OOB_MARK] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.mark",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_mark,
+		},
+	},
+	[PCAP_KEY_OOB_IFINDEX_IN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.ifindex_in",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_ingressInterface,
+		},
+	},
+	[PCAP_KEY_OOB_IFINDEX_OUT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.ifindex_out",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_egressInterface,
+		},
+	},
+	[PCAP_KEY_OOB_HOOK] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.hook",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_hook,
+		},
+	},
+	[PCAP_KEY_RAW_MAC_LEN] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac_len",
+	},
+	[PCAP_KEY_RAW_MAC_ADDRLEN] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac.addrlen",
+	},
+	[PCAP_KEY_OOB_SEQ_LOCAL] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.seq.local",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_seq_local,
+		},
+	},
+	[PCAP_KEY_OOB_SEQ_GLOBAL] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.seq.global",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_seq_global,
+		},
+	},
+	[PCAP_KEY_OOB_FAMILY] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.family",
+	},
+	[PCAP_KEY_OOB_PROTOCOL] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.protocol",
+	},
+	[PCAP_KEY_OOB_UID] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.uid",
+	},
+	[PCAP_KEY_OOB_GID] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.gid",
+	},
+	[PCAP_KEY_RAW_LABEL] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.label",
+	},
+	[PCAP_KEY_RAW_TYPE] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.type",
+	},
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint16_t rd16(const struct pcap_input *pi, const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return pi->swap ? bswap_16(v) : v;
+}
+
+static uint32_t rd32(const struct pcap_input *pi, const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return pi->swap ? bswap_32(v) : v;
+}
+
+static uint16_t rd16be(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t rd32be(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int linktype_supported(uint16_t linktype)
+{
+	switch (linktype) {
+	case LINKTYPE_ETHERNET:
+	case LINKTYPE_RAW:
+	case LINKTYPE_LINUX_SLL:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+	case LINKTYPE_NFLOG:
+		return 1;
+	}
+	return 0;
+}
+
+static uint64_t ts_to_ns(const struct pcap_iface *iface, uint64_t ts)
+{
+	if (iface->tsunit < 0)
+		return ts / -iface->tsunit;
+	return ts * iface->tsunit;
+}
+
+/* if_tsresol: power of 10, or power of 2 if the top bit is set */
+static int64_t tsresol_to_unit(uint8_t resol)
+{
+	int64_t unit = 1000000000;
+	unsigned int i;
+
+	if (resol & 0x80) {
+		/* approximated, nobody seems to use it */
+		resol &= 0x7f;
+		for (i = 0; i < resol && unit > 1; i++)
+			unit /= 2;
+		return unit;
+	}
+
+	for (i = 0; i < resol && unit > 1; i++)
+		unit /= 10;
+	if (i < resol) {
+		for (unit = -1; i < resol; i++)
+			unit *= 10;
+	}
+	return unit;
+}
+
+static int pcapng_add_iface(struct pcap_input *pi, const uint8_t *body,
+			    uint32_t len)
+{
+	struct pcap_iface *ifaces, *iface;
+	uint32_t off = 8;
+	uint16_t code, olen;
+
+	if (len < 8)
+		return -1;
+
+	ifaces = realloc(pi->ifaces, (pi->num_ifaces + 1) * sizeof(*ifaces));
+	if (ifaces == NULL)
+		return -1;
+	pi->ifaces = ifaces;
+	iface = &ifaces[pi->num_ifaces++];
+	iface->linktype = rd16(pi, body);
+	iface->tsunit = 1000;
+
+	while (off + 4 <= len) {
+		code = rd16(pi, body + off);
+		olen = rd16(pi, body + off + 2);
+		if (code == 0 || off + 4 + olen > len)
+			break;
+		if (code == PCAPNG_IF_TSRESOL && olen >= 1)
+			iface->tsunit = tsresol_to_unit(body[off + 4]);
+		off += 4 + ((olen + 3) & ~3);
+	}
+
+	if (!linktype_supported(iface->linktype) &&
+	    pi->warned_linktype != iface->linktype) {
+		ulogd_log(ULOGD_NOTICE, "skipping packets of link type %u\n",
+			  iface->linktype);
+		pi->warned_linktype = iface->linktype;
+	}
+	return 0;
+}
+
+static int pcapng_section(struct pcap_input *pi, const uint8_t *block)
+{
+	uint32_t magic;
+
+	memcpy(&magic, block + 8, sizeof(magic));
+	if (magic == PCAPNG_BYTE_ORDER)
+		pi->swap = 0;
+	else if (magic == bswap_32(PCAPNG_BYTE_ORDER))
+		pi->swap = 1;
+	else
+		return -1;
+
+	/* interface ids start over in every section */
+	pi->num_ifaces = 0;
+	return 0;
+}
+
+/* next packet of a pcapng file, 0 at the end of the file */
+static int pcapng_next(struct pcap_input *pi, struct pcap_record *rec)
+{
+	const uint8_t *block, *body;
+	uint32_t type, len, id, caplen;
+	const struct pcap_iface *iface;
+
+	while (pi->off + 12 <= pi->size) {
+		block = pi->map + pi->off;
+		memcpy(&type, block, sizeof(type));
+		if (type == PCAPNG_SHB && pcapng_section(pi, block) < 0)
+			return -1;
+		type = rd32(pi, block);
+		len = rd32(pi, block + 4);
+		if (len < 12 || len % 4 || len > pi->size - pi->off)
+			return -1;
+		pi->off += len;
+
+		body = block + 8;
+		len -= 12;
+		switch (type) {
+		case PCAPNG_IDB:
+			if (pcapng_add_iface(pi, body, len) < 0)
+				return -1;
+			continue;
+		case PCAPNG_EPB:
+			if (len < 20)
+				return -1;
+			id = rd32(pi, body);
+			caplen = rd32(pi, body + 12);
+			if (id >= pi->num_ifaces || caplen > len - 20)
+				return -1;
+			iface = &pi->ifaces[id];
+			rec->ts = ts_to_ns(iface, ((uint64_t)rd32(pi, body + 4)
+						  << 32) | rd32(pi, body + 8));
+			rec->data = body + 20;
+			break;
+		case PCAPNG_PB:
+			if (len < 20)
+				return -1;
+			id = rd16(pi, body);
+			caplen = rd32(pi, body + 12);
+			if (id >= pi->num_ifaces || caplen > len - 20)
+				return -1;
+			iface = &pi->ifaces[id];
+			rec->ts = ts_to_ns(iface, ((uint64_t)rd32(pi, body + 4)
+						  << 32) | rd32(pi, body + 8));
+			rec->data = body + 20;
+			break;
+		case PCAPNG_SPB:
+			if (len < 4 || pi->num_ifaces == 0)
+				return -1;
+			iface = &pi->ifaces[0];
+			caplen = rd32(pi, body);
+			if (caplen > len - 4)
+				caplen = len - 4;
+			/* no timestamp, keep the one of the previous packet */
+			rec->data = body + 4;
+			break;
+		default:
+			continue;
+		}
+
+		if (!linktype_supported(iface->linktype))
+			continue;
+		rec->linktype = iface->linktype;
+		rec->caplen = caplen;
+		return 1;
+	}
+	return 0;
+}
+
+/* next packet of a pcap file, 0 at the end of the file */
+static int pcap_next(struct pcap_input *pi, struct pcap_record *rec)
+{
+	const uint8_t *hdr;
+	uint32_t caplen;
+
+	if (pi->off + 16 > pi->size)
+		return 0;
+
+	hdr = pi->map + pi->off;
+	caplen = rd32(pi, hdr + 8);
+	if (caplen > pi->size - pi->off - 16)
+		return -1;
+
+	rec->ts = (uint64_t)rd32(pi, hdr) * 1000000000 +
+		  ts_to_ns(&pi->ifaces[0], rd32(pi, hdr + 4));
+	rec->data = hdr + 16;
+	rec->caplen = caplen;
+	rec->linktype = pi->ifaces[0].linktype;
+	pi->off += 16 + caplen;
+	return 1;
+}
+
+static int pcap_open_file(struct pcap_input *pi, const char *file)
+{
+	struct stat st;
+	uint32_t magic;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "can't open `%s': %s\n", file,
+			  strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < 24) {
+		ulogd_log(ULOGD_ERROR, "`%s' is not a capture file\n", file);
+		close(fd);
+		return -1;
+	}
+	pi->size = st.st_size;
+	pi->map = mmap(NULL, pi->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pi->map == MAP_FAILED) {
+		ulogd_log(ULOGD_ERROR, "can't map `%s': %s\n", file,
+			  strerror(errno));
+		pi->map = NULL;
+		return -1;
+	}
+	madvise(pi->map, pi->size, MADV_SEQUENTIAL);
+
+	memcpy(&magic, pi->map, sizeof(magic));
+	if (magic == PCAPNG_SHB) {
+		pi->ng = 1;
+		return 0;
+	}
+
+	pi->ifaces = calloc(1, sizeof(*pi->ifaces));
+	if (pi->ifaces == NULL)
+		goto err;
+	pi->num_ifaces = 1;
+
+	pi->swap = magic == bswap_32(PCAP_MAGIC) ||
+		   magic == bswap_32(PCAP_MAGIC_NSEC);
+	if (pi->swap)
+		magic = bswap_32(magic);
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC) {
+		ulogd_log(ULOGD_ERROR, "`%s' is not a capture file\n", file);
+		goto err;
+	}
+	/* unit of the fraction of a second */
+	pi->ifaces[0].tsunit = magic == PCAP_MAGIC ? 1000 : 1;
+	pi->ifaces[0].linktype = rd32(pi, pi->map + 20) & 0xffff;
+	if (!linktype_supported(pi->ifaces[0].linktype)) {
+		ulogd_log(ULOGD_ERROR, "link type %u of `%s' not supported\n",
+			  pi->ifaces[0].linktype, file);
+		goto err;
+	}
+	return 0;
+
+err:
+	munmap(pi->map, pi->size);
+	pi->map = NULL;
+	return -1;
+}
+
+static void pcap_rewind(struct pcap_input *pi)
+{
+	pi->off = pi->ng ? 0 : 24;
+}
+
+static int pcap_read(struct pcap_input *pi, struct pcap_record *rec)
+{
+	int ret;
+
+	ret = pi->ng ? pcapng_next(pi, rec) : pcap_next(pi, rec);
+	if (ret < 0) {
+		ulogd_log(ULOGD_ERROR, "capture file truncated or corrupt at "
+			  "offset %zu\n", pi->off);
+		/* give up on the rest, like at the end of the file */
+		ret = 0;
+	}
+	return ret;
+}
+
+static void interp_nflog(struct ulogd_pluginstance *upi,
+			 struct pcap_input *pi, const struct pcap_record *rec)
+{
+	struct ulogd_key *ret = upi->output.keys;
+	const uint8_t *p = rec->data + 4, *end = rec->data + rec->caplen;
+	uint16_t len, type;
+
+	if (rec->caplen < 4)
+		return;
+	okey_set_u8(&ret[PCAP_KEY_OOB_FAMILY], rec->data[0]);
+
+	/* the attributes are in the byte order of the capturing host */
+	while (p + 4 <= end) {
+		len = rd16(pi, p);
+		type = rd16(pi, p + 2) & 0x7fff;
+		if (len < 4 || p + len > end)
+			break;
+
+		switch (type) {
+		case NFULA_PACKET_HDR:
+			if (len >= 8) {
+				okey_set_u16(&ret[PCAP_KEY_OOB_PROTOCOL],
+					     rd16be(p + 4));
+				okey_set_u8(&ret[PCAP_KEY_OOB_HOOK], p[6]);
+			}
+			break;
+		case NFULA_MARK:
+			if (len >= 8)
+				okey_set_u32(&ret[PCAP_KEY_OOB_MARK],
+					     rd32be(p + 4));
+			break;
+		case NFULA_IFINDEX_INDEV:
+			if (len >= 8)
+				okey_set_u32(&ret[PCAP_KEY_OOB_IFINDEX_IN],
+					     rd32be(p + 4));
+			break;
+		case NFULA_IFINDEX_OUTDEV:
+			if (len >= 8)
+				okey_set_u32(&ret[PCAP_KEY_OOB_IFINDEX_OUT],
+					     rd32be(p + 4));
+			break;
+		case NFULA_HWADDR:
+			if (len >= 8 && rd16be(p + 4) <= len - 8) {
+				okey_set_raw(&ret[PCAP_KEY_RAW_MAC_SADDR],
+					     (void *)(p + 8), rd16be(p + 4));
+				okey_set_u16(&ret[PCAP_KEY_RAW_MAC_ADDRLEN],
+					     rd16be(p + 4));
+			}
+			break;
+		case NFULA_PAYLOAD:
+			okey_set_raw(&ret[PCAP_KEY_RAW_PCKT], (void *)(p + 4),
+				     len - 4);
+			okey_set_u32(&ret[PCAP_KEY_RAW_PCKTLEN], len - 4);
+			break;
+		case NFULA_PREFIX:
+			/* the string has to end within the attribute */
+			if (len > 4 && p[len - 1] == '\0')
+				okey_set_ptr(&ret[PCAP_KEY_OOB_PREFIX],
+					     (void *)(p + 4));
+			break;
+		case NFULA_UID:
+			if (len >= 8)
+				okey_set_u32(&ret[PCAP_KEY_OOB_UID],
+					     rd32be(p + 4));
+			break;
+		case NFULA_GID:
+			if (len >= 8)
+				okey_set_u32(&ret[PCAP_KEY_OOB_GID],
+					     rd32be(p + 4));
+			break;
+		case NFULA_SEQ:
+			if (len >= 8)
+				okey_set_u32(&ret[PCAP_KEY_OOB_SEQ_LOCAL],
+					     rd32be(p + 4));
+			break;
+		case NFULA_SEQ_GLOBAL:
+			if (len >= 8)
+				okey_set_u32(&ret[PCAP_KEY_OOB_SEQ_GLOBAL],
+					     rd32be(p + 4));
+			break;
+		case NFULA_HWTYPE:
+			if (len >= 6)
+				okey_set_u16(&ret[PCAP_KEY_RAW_TYPE],
+					     rd16be(p + 4));
+			break;
+		case NFULA_HWHEADER:
+			okey_set_raw(&ret[PCAP_KEY_RAW_MAC], (void *)(p + 4),
+				     len - 4);
+			break;
+		case NFULA_HWLEN:
+			if (len >= 6)
+				okey_set_u16(&ret[PCAP_KEY_RAW_MAC_LEN],
+					     rd16be(p + 4));
+			break;
+		}
+		p += (len + 3) & ~3;
+	}
+}
+
+/* family of the packet, the bridge family for anything but IP */
+static void set_family(struct ulogd_key *ret, uint16_t proto)
+{
+	switch (proto) {
+	case 0x0800:
+		okey_set_u8(&ret[PCAP_KEY_OOB_FAMILY], AF_INET);
+		break;
+	case 0x86dd:
+		okey_set_u8(&ret[PCAP_KEY_OOB_FAMILY], AF_INET6);
+		break;
+	default:
+		okey_set_u8(&ret[PCAP_KEY_OOB_FAMILY], AF_BRIDGE);
+		break;
+	}
+	okey_set_u16(&ret[PCAP_KEY_OOB_PROTOCOL], proto);
+}
+
+static void interp_packet(struct ulogd_pluginstance *upi,
+			  struct pcap_input *pi, const struct pcap_record *rec)
+{
+	struct ulogd_key *ret = upi->output.keys;
+	const uint8_t *data = rec->data;
+	uint32_t hdrlen = 0;
+	uint16_t proto = 0;
+
+	switch (rec->linktype) {
+	case LINKTYPE_ETHERNET:
+		if (rec->caplen < 14)
+			return;
+		hdrlen = 14;
+		proto = rd16be(data + 12);
+		/* skip VLAN tags */
+		while ((proto == 0x8100 || proto == 0x88a8) &&
+		       rec->caplen >= hdrlen + 4) {
+			proto = rd16be(data + hdrlen + 2);
+			hdrlen += 4;
+		}
+		okey_set_raw(&ret[PCAP_KEY_RAW_MAC], (void *)data, hdrlen);
+		okey_set_u16(&ret[PCAP_KEY_RAW_MAC_LEN], hdrlen);
+		okey_set_u16(&ret[PCAP_KEY_RAW_TYPE], ARPHRD_ETHER);
+		okey_set_raw(&ret[PCAP_KEY_RAW_MAC_SADDR], (void *)(data + 6),
+			     6);
+		okey_set_u16(&ret[PCAP_KEY_RAW_MAC_ADDRLEN], 6);
+		set_family(ret, proto);
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (rec->caplen < 16)
+			return;
+		hdrlen = 16;
+		proto = rd16be(data + 14);
+		okey_set_u16(&ret[PCAP_KEY_RAW_TYPE], rd16be(data + 2));
+		if (rd16be(data + 4) <= 8) {
+			okey_set_raw(&ret[PCAP_KEY_RAW_MAC_SADDR],
+				     (void *)(data + 6), rd16be(data + 4));
+			okey_set_u16(&ret[PCAP_KEY_RAW_MAC_ADDRLEN],
+				     rd16be(data + 4));
+		}
+		set_family(ret, proto);
+		break;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		if (rec->caplen < 1)
+			return;
+		set_family(ret, (data[0] >> 4) == 6 ? 0x86dd : 0x0800);
+		break;
+	case LINKTYPE_NFLOG:
+		interp_nflog(upi, pi, rec);
+		break;
+	}
+
+	if (rec->linktype != LINKTYPE_NFLOG) {
+		okey_set_raw(&ret[PCAP_KEY_RAW_PCKT], (void *)(data + hdrlen),
+			     rec->caplen - hdrlen);
+		okey_set_u32(&ret[PCAP_KEY_RAW_PCKTLEN], rec->caplen - hdrlen);
+	}
+
+	okey_set_u32(&ret[PCAP_KEY_RAW_PCKTCOUNT], 1);
+	okey_set_u8(&ret[PCAP_KEY_RAW_LABEL],
+		    label_ce(upi->config_kset).u.value);
+	okey_set_u32(&ret[PCAP_KEY_OOB_TIME_SEC],
+		     (rec->ts / 1000000000) & 0xffffffff);
+	okey_set_u32(&ret[PCAP_KEY_OOB_TIME_USEC],
+		     (rec->ts % 1000000000) / 1000);
+
+	ulogd_propagate_results(upi);
+}
+
+/* when the next record is due, in monotonic nanoseconds */
+static uint64_t pcap_due(struct ulogd_pluginstance *upi)
+{
+	struct pcap_input *pi = (struct pcap_input *) upi->private;
+
+	switch (pi->replay) {
+	case PCAP_REPLAY_ORIGINAL:
+		/* packets out of order are due right away */
+		if (pi->next.ts < pi->first_ts)
+			return pi->start;
+		return pi->start + (pi->next.ts - pi->first_ts);
+	case PCAP_REPLAY_RATE:
+		return pi->start + pi->pass_count * 1000000000ULL /
+				   rate_ce(upi->config_kset).u.value;
+	default:
+		return 0;
+	}
+}
+
+static void pcap_arm(struct pcap_input *pi, uint64_t due)
+{
+	struct itimerspec its = {};
+
+	/* a time in the past lets the timer expire right away */
+	if (due == 0)
+		due = 1;
+	its.it_value.tv_sec = due / 1000000000;
+	its.it_value.tv_nsec = due % 1000000000;
+	timerfd_settime(pi->timer_fd.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void pcap_done(struct ulogd_pluginstance *upi)
+{
+	struct pcap_input *pi = (struct pcap_input *) upi->private;
+	uint64_t elapsed = now_ns() - pi->begin;
+
+	pi->done = 1;
+	ulogd_unregister_fd(&pi->timer_fd);
+
+	ulogd_log(ULOGD_NOTICE, "replayed %"PRIu64" records in %"PRIu64
+		  ".%03"PRIu64" seconds, %"PRIu64" records/s\n", pi->count,
+		  elapsed / 1000000000, elapsed / 1000000 % 1000,
+		  elapsed ? pi->count * 1000000000ULL / elapsed : 0);
+
+	if (exit_ce(upi->config_kset).u.value)
+		kill(getpid(), SIGTERM);
+}
+
+/* fetch the next record, starting over if there are loops left */
+static int pcap_fetch(struct ulogd_pluginstance *upi)
+{
+	struct pcap_input *pi = (struct pcap_input *) upi->private;
+
+	if (pcap_read(pi, &pi->next) > 0)
+		return 1;
+
+	if (pi->loops && ++pi->pass >= pi->loops)
+		return 0;
+
+	pcap_rewind(pi);
+	if (pcap_read(pi, &pi->next) <= 0)
+		return 0;
+
+	/* the capture timing starts over as well */
+	pi->start = now_ns();
+	pi->first_ts = pi->next.ts;
+	pi->pass_count = 0;
+	return 1;
+}
+
+static int pcap_timer_cb(int fd, unsigned int what, void *param)
+{
+	struct ulogd_pluginstance *upi = param;
+	struct pcap_input *pi = (struct pcap_input *) upi->private;
+	struct ulogd_pluginstance *npi;
+	uint64_t expirations, now, due;
+	unsigned int i;
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		return -1;
+
+	now = now_ns();
+	if (pi->begin == 0)
+		pi->begin = pi->start = now;
+
+	for (i = 0; i < PCAP_CHUNK; i++) {
+		if (pcap_due(upi) > now || ulogd_backpressure_paused(upi))
+			break;
+
+		llist_for_each_entry(npi, &upi->plist, plist)
+			interp_packet(npi, pi, &pi->next);
+		interp_packet(upi, pi, &pi->next);
+
+		pi->count++;
+		pi->pass_count++;
+
+		if (!pcap_fetch(upi)) {
+			pi->have_next = 0;
+			break;
+		}
+	}
+
+	/* the deferred records refer to the file, which stays mapped */
+	llist_for_each_entry(npi, &upi->plist, plist)
+		ulogd_propagate_flush(npi);
+	ulogd_propagate_flush(upi);
+
+	if (!pi->have_next) {
+		pcap_done(upi);
+		return 0;
+	}
+
+	due = pcap_due(upi);
+	pcap_arm(pi, due > now ? due : 0);
+
+	return 0;
+}
+
+static int configure(struct ulogd_pluginstance *upi,
+		     struct ulogd_pluginstance_stack *stack)
+{
+	struct pcap_input *pi = (struct pcap_input *) upi->private;
+	const char *replay;
+	int ret;
+
+	ulogd_log(ULOGD_DEBUG, "parsing config file section `%s', "
+		  "plugin `%s'\n", upi->id, upi->plugin->name);
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	replay = replay_ce(upi->config_kset).u.string;
+	if (!strcmp(replay, "fast"))
+		pi->replay = PCAP_REPLAY_FAST;
+	else if (!strcmp(replay, "original"))
+		pi->replay = PCAP_REPLAY_ORIGINAL;
+	else if (!strcmp(replay, "rate"))
+		pi->replay = PCAP_REPLAY_RATE;
+	else {
+		ulogd_log(ULOGD_ERROR, "unknown replay mode `%s'\n", replay);
+		return -1;
+	}
+
+	if (pi->replay == PCAP_REPLAY_RATE &&
+	    rate_ce(upi->config_kset).u.value <= 0) {
+		ulogd_log(ULOGD_ERROR, "rate has to be positive\n");
+		return -1;
+	}
+	if (loop_ce(upi->config_kset).u.value < 0) {
+		ulogd_log(ULOGD_ERROR, "loop can't be negative\n");
+		return -1;
+	}
+	pi->loops = loop_ce(upi->config_kset).u.value;
+
+	return 0;
+}
+
+static int start(struct ulogd_pluginstance *upi)
+{
+	struct pcap_input *pi = (struct pcap_input *) upi->private;
+
+	if (pcap_open_file(pi, file_ce(upi->config_kset).u.string) < 0)
+		return -1;
+
+	pcap_rewind(pi);
+	pi->have_next = 0;
+	pi->done = 0;
+	pi->count = 0;
+	pi->pass = 0;
+
+	if (pcap_read(pi, &pi->next) <= 0) {
+		ulogd_log(ULOGD_ERROR, "no packets to replay in `%s'\n",
+			  file_ce(upi->config_kset).u.string);
+		goto err_map;
+	}
+	pi->have_next = 1;
+	pi->first_ts = pi->next.ts;
+	pi->pass_count = 0;
+	pi->begin = 0;
+
+	pi->timer_fd.fd = timerfd_create(CLOCK_MONOTONIC,
+					 TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pi->timer_fd.fd < 0) {
+		ulogd_log(ULOGD_ERROR, "can't create timer: %s\n",
+			  strerror(errno));
+		goto err_map;
+	}
+	pi->timer_fd.cb = &pcap_timer_cb;
+	pi->timer_fd.data = upi;
+	pi->timer_fd.when = ULOGD_FD_READ;
+
+	if (ulogd_register_fd(&pi->timer_fd) < 0) {
+		ulogd_log(ULOGD_ERROR, "unable to register fd to ulogd\n");
+		goto err_timer;
+	}
+	ulogd_backpressure_fd(upi, &pi->timer_fd);
+
+	/* the replay starts once the main loop runs */
+	pcap_arm(pi, 0);
+
+	return 0;
+
+err_timer:
+	close(pi->timer_fd.fd);
+err_map:
+	munmap(pi->map, pi->size);
+	pi->map = NULL;
+	free(pi->ifaces);
+	pi->ifaces = NULL;
+	pi->num_ifaces = 0;
+	return -1;
+}
+
+static int stop(struct ulogd_pluginstance *upi)
+{
+	struct pcap_input *pi = (struct pcap_input *) upi->private;
+
+	if (!pi->done)
+		ulogd_unregister_fd(&pi->timer_fd);
+	close(pi->timer_fd.fd);
+
+	munmap(pi->map, pi->size);
+	pi->map = NULL;
+	free(pi->ifaces);
+	pi->ifaces = NULL;
+	pi->num_ifaces = 0;
+
+	return 0;
+}
+
+static struct ulogd_plugin pcap_plugin = {
+	.name = "PCAP",
+	.input = {
+		.type = ULOGD_DTYPE_SOURCE,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_RAW,
+		.keys = output_keys,
+		.num_keys = ARRAY_SIZE(output_keys),
+	},
+	.priv_size 	= sizeof(struct pcap_input),
+	.configure 	= &configure,
+	.start 		= &start,
+	.stop 		= &stop,
+	.config_kset 	= &pcap_kset,
+	.flags		= ULOGD_PLUGINF_BATCH,
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&pcap_plugin);
+}
@@ -190,14 +190,14 @@ static int interp_packet(struct ulogd_pluginstance *ip, ulog_packet_msg_t *pkt)
 	struct ulogd_key *ret = ip->output.keys;
 
 	if (pkt->mac_len) {
-		okey_set_ptr(&ret[ULOG_KEY_RAW_MAC], pkt->mac);
+		okey_set_raw(&ret[ULOG_KEY_RAW_MAC], pkt->mac, pkt->mac_len);
 		okey_set_u16(&ret[ULOG_KEY_RAW_MAC_LEN], pkt->mac_len);
 	}
 
 	okey_set_u8(&ret[ULOG_KEY_RAW_LABEL], ip->config_kset->ces[3].u.value);
 
 	/* include pointer to raw ipv4 packet */
-	okey_set_ptr(&ret[ULOG_KEY_RAW_PCKT], pkt->payload);
+	okey_set_raw(&ret[ULOG_KEY_RAW_PCKT], pkt->payload, pkt->data_len);
 	okey_set_u32(&ret[ULOG_KEY_RAW_PCKTLEN], pkt->data_len);
 	okey_set_u32(&ret[ULOG_KEY_RAW_PCKTCOUNT], 1);
 
@@ -208,9 +208,6 @@ static int interp_packet(struct ulogd_pluginstance *ip, ulog_packet_msg_t *pkt)
 	if (pkt->timestamp_sec) {
 		okey_set_u32(&ret[ULOG_KEY_OOB_TIME_SEC], pkt->timestamp_sec);
 		okey_set_u32(&ret[ULOG_KEY_OOB_TIME_USEC], pkt->timestamp_usec);
-	} else {
-		ret[ULOG_KEY_OOB_TIME_SEC].flags &= ~ULOGD_RETF_VALID;
-		ret[ULOG_KEY_OOB_TIME_USEC].flags &= ~ULOGD_RETF_VALID;
 	}
 
 	okey_set_u32(&ret[ULOG_KEY_OOB_MARK], pkt->mark);
@@ -262,6 +259,10 @@ static int ulog_read_cb(int fd, unsigned int what, void *param)
 				interp_packet(npi, upkt);
 			interp_packet(upi, upkt);
 		}
+		/* done before the buffer is read into again */
+		llist_for_each_entry(npi, &upi->plist, plist)
+			ulogd_propagate_flush(npi);
+		ulogd_propagate_flush(upi);
 	}
 	return 0;
 }
@@ -295,6 +296,7 @@ static int init(struct ulogd_pluginstance *upi)
 	ui->ulog_fd.when = ULOGD_FD_READ;
 
 	ulogd_register_fd(&ui->ulog_fd);
+	ulogd_backpressure_fd(upi, &ui->ulog_fd);
 
 	return 0;
 
@@ -328,7 +330,9 @@ struct ulogd_plugin libulog_plugin = {
 	.configure = &configure,
 	.start = &init,
 	.stop = &fini,
+	.priv_size = sizeof(struct ulog_input),
 	.config_kset = &libulog_kset,
+	.flags = ULOGD_PLUGINF_BATCH,
 	.version = VERSION,
 };
 
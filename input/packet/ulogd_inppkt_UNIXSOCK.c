@@ -53,6 +53,7 @@ struct unixsock_input {
 	unsigned int unixsock_buf_size;
 	struct ulogd_fd unixsock_server_fd;
 	struct ulogd_fd unixsock_instance_fd;
+	struct ulogd_timer disconnect_timer;
 };
 
 enum nflog_keys {
@@ -394,7 +395,7 @@ static int handle_packet(struct ulogd_pluginstance *upi, struct ulogd_unixsock_p
 	else oob_family = 0;
 
 	okey_set_u8(&ret[UNIXSOCK_KEY_OOB_FAMILY], oob_family);
-	okey_set_ptr(&ret[UNIXSOCK_KEY_RAW_PCKT], ip);
+	okey_set_raw(&ret[UNIXSOCK_KEY_RAW_PCKT], ip, payload_len);
 	okey_set_u32(&ret[UNIXSOCK_KEY_RAW_PCKTLEN], payload_len);
 
 	/* options */
@@ -579,14 +580,25 @@ static void _timer_unregister_cb(struct ulogd_timer *a, void *param)
 
 static void _disconnect_client(struct unixsock_input *ui)
 {
-	struct ulogd_timer *t = malloc(sizeof(struct ulogd_timer));
-
 	/* we can't call ulogd_unregister_fd fd, it will segfault
 	 * (unable to remove an entry while inside llist_for_each_entry)
 	 * so we schedule removal for next loop
 	 */
-	ulogd_init_timer(t, ui, _timer_unregister_cb);
-	ulogd_add_timer(t, 0);
+	if (!ulogd_timer_pending(&ui->disconnect_timer))
+		ulogd_add_timer(&ui->disconnect_timer, 0);
+}
+
+/* the records of the packets read so far refer to the buffer, they have to
+ * be handled before the first 'len' bytes are dropped */
+static void unixsock_consume(struct ulogd_pluginstance *upi,
+			     struct unixsock_input *ui, unsigned int len)
+{
+	ulogd_propagate_flush(upi);
+
+	ui->unixsock_buf_avail -= len;
+	if (ui->unixsock_buf_avail > 0 && len > 0)
+		memmove(ui->unixsock_buf, ui->unixsock_buf + len,
+			ui->unixsock_buf_avail);
 }
 
 /* callback called from ulogd core when fd is readable */
@@ -598,6 +610,8 @@ static int unixsock_instance_read_cb(int fd, unsigned int what, void *param)
 	uint16_t needed_len;
 	uint32_t packet_sig;
 	struct ulogd_unixsock_packet_t *unixsock_packet;
+	unsigned int off = 0;
+	int ret = 0;
 
 	char buf[4096];
 
@@ -627,8 +641,14 @@ static int unixsock_instance_read_cb(int fd, unsigned int what, void *param)
 	memcpy(ui->unixsock_buf + ui->unixsock_buf_avail, buf, len);
 	ui->unixsock_buf_avail += len;
 
-	while(1) {
-		unixsock_packet = (void*)ui->unixsock_buf;
+	while (off < ui->unixsock_buf_avail) {
+		/* the filters map protocol headers on the packet */
+		if (off & 3) {
+			unixsock_consume(upi, ui, off);
+			off = 0;
+		}
+
+		unixsock_packet = (void*)ui->unixsock_buf + off;
 		packet_sig = ntohl(unixsock_packet->marker);
 		if (packet_sig != ULOGD_SOCKET_MARK) {
 			ulogd_log(ULOGD_ERROR,
@@ -636,42 +656,34 @@ static int unixsock_instance_read_cb(int fd, unsigned int what, void *param)
 				"(read %lx, expected %lx), closing socket.\n",
 				packet_sig, ULOGD_SOCKET_MARK);
 			_disconnect_client(ui);
-			return -1;
+			ret = -1;
+			break;
 
 		}
 
 		needed_len = ntohs(unixsock_packet->total_size);
 
-		if (ui->unixsock_buf_avail >= needed_len + sizeof(uint32_t)) {
-			ulogd_log(ULOGD_DEBUG,
-			"  We have enough data (%d bytes required), handling packet\n",
-					needed_len);
-
-			if (handle_packet(upi, unixsock_packet, needed_len) != 0) {
-				return -1;
-			}
-			/* consume data */
-			ui->unixsock_buf_avail -= (sizeof(uint32_t) + needed_len);
-			if (ui->unixsock_buf_avail > 0) {
-				/* we need to shift data .. */
-				memmove(ui->unixsock_buf,
-						ui->unixsock_buf + (sizeof(uint32_t) + needed_len) ,
-						ui->unixsock_buf_avail);
-			} else {
-				/* input buffer is empty, do not loop */
-				return 0;
-			}
-
-		} else {
+		if (ui->unixsock_buf_avail - off < needed_len + sizeof(uint32_t)) {
 			ulogd_log(ULOGD_DEBUG, "  We have %d bytes, but need %d. Requesting more\n",
-					ui->unixsock_buf_avail, needed_len + sizeof(uint32_t));
-			return 0;
+					ui->unixsock_buf_avail - off, needed_len + sizeof(uint32_t));
+			break;
 		}
 
-		/* handle_packet has shifted data in buffer */
-	};
+		ulogd_log(ULOGD_DEBUG,
+		"  We have enough data (%d bytes required), handling packet\n",
+				needed_len);
 
-	return 0;
+		if (handle_packet(upi, unixsock_packet, needed_len) != 0) {
+			ret = -1;
+			break;
+		}
+		off += sizeof(uint32_t) + needed_len;
+	}
+
+	/* handle the packets and shift the remaining data */
+	unixsock_consume(upi, ui, off);
+
+	return ret;
 }
 
 /* callback called from ulogd core when fd is readable */
@@ -778,6 +790,8 @@ static int start(struct ulogd_pluginstance *upi)
 	ui->unixsock_instance_fd.data = upi;
 	ui->unixsock_instance_fd.when = ULOGD_FD_READ;
 
+	ulogd_init_timer(&ui->disconnect_timer, ui, _timer_unregister_cb);
+
 	if (ulogd_register_fd(&ui->unixsock_server_fd) < 0) {
 		ulogd_log(ULOGD_ERROR, "Unable to register fd to ulogd\n");
 		return -1;
@@ -794,6 +808,17 @@ static int stop(struct ulogd_pluginstance *upi)
 	ulogd_log(ULOGD_DEBUG, "Stopping plugin `%s'\n",
 		  upi->plugin->name);
 
+	/* the instance may be stopped while ulogd keeps running (SIGHUP),
+	 * so release the sockets and the pending disconnection as well */
+	ulogd_del_timer(&ui->disconnect_timer);
+	if (ui->unixsock_instance_fd.fd >= 0) {
+		ulogd_unregister_fd(&ui->unixsock_instance_fd);
+		close(ui->unixsock_instance_fd.fd);
+		ui->unixsock_instance_fd.fd = -1;
+	}
+	ulogd_unregister_fd(&ui->unixsock_server_fd);
+	close(ui->unixsock_server_fd.fd);
+
 	if (unix_path)
 		unlink(unix_path);
 
@@ -817,6 +842,7 @@ struct ulogd_plugin libunixsock_plugin = {
 	.start 		= &start,
 	.stop 		= &stop,
 	.config_kset 	= &libunixsock_kset,
+	.flags		= ULOGD_PLUGINF_BATCH,
 	.version	= VERSION,
 };
 
@@ -174,6 +174,8 @@ static int nfacct_read_cb(int fd, unsigned int what, void *param)
 	if (ret > 0) {
 		ret = mnl_cb_run(buf, ret, cpi->seq,
 				 cpi->portid, nfacct_cb, upi);
+	} else if (ret < 0 && errno == ENOBUFS) {
+		upi->stats.overrun++;
 	}
 	return ret;
 }
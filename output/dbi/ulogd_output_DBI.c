@@ -317,6 +317,7 @@ static struct ulogd_plugin dbi_plugin = {
 	.stop		= &ulogd_db_stop,
 	.signal		= &ulogd_db_signal,
 	.interp		= &ulogd_db_interp,
+	.interp_batch	= &ulogd_db_interp_batch,
 	.version	= VERSION,
 };
 
@@ -140,7 +140,6 @@ static struct ulogd_key pcap_keys[INTR_IDS] = {
 	  .name = "ip6.payloadlen" },
 };
 
-#define GET_FLAGS(res, x)	(res[x].u.source->flags)
 
 static int interp_pcap(struct ulogd_pluginstance *upi)
 {
@@ -163,8 +162,7 @@ static int interp_pcap(struct ulogd_pluginstance *upi)
 		break;
 	}
 
-	if (GET_FLAGS(res, 3) & ULOGD_RETF_VALID
-	    && GET_FLAGS(res, 4) & ULOGD_RETF_VALID) {
+	if (pp_is_valid(res, 3) && pp_is_valid(res, 4)) {
 		pchdr.ts.tv_sec = ikey_get_u32(&res[3]);
 		pchdr.ts.tv_usec = ikey_get_u32(&res[4]);
 	} else {
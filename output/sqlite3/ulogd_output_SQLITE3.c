@@ -273,10 +273,14 @@ sqlite3_createstmt(struct ulogd_pluginstance *pi)
 static struct ulogd_key *
 ulogd_find_key(struct ulogd_pluginstance *pi, const char *name)
 {
+	unsigned int id = ulogd_keyid(name);
 	unsigned int i;
 
+	if (id == 0)
+		return NULL;
+
 	for (i = 0; i < pi->input.num_keys; i++) {
-		if (strcmp(pi->input.keys[i].name, name) == 0)
+		if (pi->input.keys[i].id == id)
 			return &pi->input.keys[i];
 	}
 
@@ -259,6 +259,7 @@ static struct ulogd_plugin gprint_plugin = {
 	.start 	= &gprint_init,
 	.stop	= &gprint_fini,
 	.signal = &sighup_handler_print,
+	.priv_size = sizeof(struct gprint_priv),
 	.config_kset = &gprint_kset,
 	.version = VERSION,
 };
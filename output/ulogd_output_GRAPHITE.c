@@ -88,6 +88,7 @@ static struct config_keyset graphite_kset = {
 
 struct graphite_instance {
 	int sck;
+	char buf[256];
 };
 
 static int _connect_graphite(struct ulogd_pluginstance *pi)
@@ -148,7 +149,7 @@ static int _output_graphite(struct ulogd_pluginstance *upi)
 {
 	struct graphite_instance *li = (struct graphite_instance *) &upi->private;
 	struct ulogd_key *inp = upi->input.keys;
-	static char buf[256];
+	char *buf = li->buf;
 	int ret;
 
 	time_t now;
@@ -159,7 +160,7 @@ static int _output_graphite(struct ulogd_pluginstance *upi)
 	else
 		now = time(NULL);
 
-	msg_size = snprintf(buf, sizeof(buf), "%s.%s.pkts %" PRIu64
+	msg_size = snprintf(buf, sizeof(li->buf), "%s.%s.pkts %" PRIu64
 			    " %" PRIu64 "\n%s.%s.bytes %" PRIu64 " %" PRIu64 "\n",
 		 prefix_ce(upi->config_kset).u.string,
 		 (char *)ikey_get_ptr(&inp[KEY_SUM_NAME]),
@@ -243,7 +243,7 @@ build_template_for_bitmask(struct ulogd_pluginstance *upi,
 		struct ulogd_key *key = &upi->input.keys[i];
 		int length = ulogd_key_size(key);
 
-		if (!(key->u.source->flags & ULOGD_RETF_VALID))
+		if (!pp_is_valid(upi->input.keys, i))
 			continue;
 
 		if (length < 0 || length > 0xfffe) {
@@ -308,17 +308,12 @@ static int output_ipfix(struct ulogd_pluginstance *upi)
 	unsigned int total_size;
 	int i;
 
-	/* FIXME: it would be more cache efficient if the IS_VALID
-	 * flags would be a separate bitmask outside of the array.
-	 * ulogd core could very easily flush it after every packet,
-	 * too. */
-
+	/* the core keeps the valid flags in a bitmap outside of the keys
+	 * and flushes it after every packet, we only have to look them up */
 	bitmask_clear(ii->valid_bitmask);
 
 	for (i = 0; i < upi->input.num_keys; i++) {
-		struct ulogd_key *key = upi->input.keys[i].u.source;
-
-		if (key->flags & ULOGD_RETF_VALID)
+		if (pp_is_valid(upi->input.keys, i))
 			bitmask_set_bit(ii->valid_bitmask, i);
 	}
 	
@@ -42,6 +42,7 @@ struct json_priv {
 	FILE *of;
 	int sec_idx;
 	int usec_idx;
+	unsigned int label_id;
 	long cached_gmtoff;
 	char cached_tz[6];	/* eg +0200 */
 };
@@ -100,7 +101,7 @@ static struct config_keyset json_kset = {
 
 #define MAX_LOCAL_TIME_STRING 38
 
-static int json_interp(struct ulogd_pluginstance *upi)
+static int json_write(struct ulogd_pluginstance *upi, struct ulogd_key *inp)
 {
 	struct json_priv *opi = (struct json_priv *) &upi->private;
 	unsigned int i;
@@ -120,8 +121,6 @@ static int json_interp(struct ulogd_pluginstance *upi)
 		char timestr[MAX_LOCAL_TIME_STRING];
 		struct tm *t;
 		struct tm result;
-		struct ulogd_key *inp = upi->input.keys;
-
 
 		if (pp_is_valid(inp, opi->sec_idx))
 			now = (time_t) ikey_get_u64(&inp[opi->sec_idx]);
@@ -167,7 +166,7 @@ static int json_interp(struct ulogd_pluginstance *upi)
 
 
 	for (i = 0; i < upi->input.num_keys; i++) {
-		struct ulogd_key *key = upi->input.keys[i].u.source;
+		struct ulogd_key *key = inp[i].u.source;
 		char *field_name;
 
 		if (!key)
@@ -194,7 +193,7 @@ static int json_interp(struct ulogd_pluginstance *upi)
 			break;
 		case ULOGD_RET_UINT8:
 			if ((upi->config_kset->ces[JSON_CONF_BOOLEAN_LABEL].u.value != 0)
-					&& (!strcmp(key->name, "raw.label"))) {
+					&& key->id == opi->label_id) {
 				if (key->u.value.ui8)
 					json_object_set_new(msg, "action", json_string("allowed"));
 				else
@@ -223,6 +222,36 @@ static int json_interp(struct ulogd_pluginstance *upi)
 
 	json_decref(msg);
 
+	return ULOGD_IRET_OK;
+}
+
+static int json_interp(struct ulogd_pluginstance *upi)
+{
+	struct json_priv *opi = (struct json_priv *) &upi->private;
+	int ret;
+
+	ret = json_write(upi, upi->input.keys);
+
+	if (upi->config_kset->ces[JSON_CONF_SYNC].u.value != 0)
+		fflush(opi->of);
+
+	return ret;
+}
+
+/* with sync=1, the file is flushed once per batch */
+static int json_interp_batch(struct ulogd_pluginstance *upi,
+			     struct ulogd_batch *batch)
+{
+	struct json_priv *opi = (struct json_priv *) &upi->private;
+	unsigned int i;
+
+	for (i = 0; i < batch->num; i++) {
+		if (batch->ret[i] != ULOGD_IRET_OK)
+			continue;
+
+		batch->ret[i] = json_write(upi, ulogd_batch_ikeys(upi, i));
+	}
+
 	if (upi->config_kset->ces[JSON_CONF_SYNC].u.value != 0)
 		fflush(opi->of);
 
@@ -271,8 +300,17 @@ static int json_configure(struct ulogd_pluginstance *upi,
 static int json_init(struct ulogd_pluginstance *upi)
 {
 	struct json_priv *op = (struct json_priv *) &upi->private;
+	unsigned int sec_id, usec_id;
 	unsigned int i;
 
+	sec_id = ulogd_keyid("oob.time.sec");
+	usec_id = ulogd_keyid("oob.time.usec");
+	op->label_id = ulogd_keyid("raw.label");
+	if (!sec_id || !usec_id || !op->label_id) {
+		ulogd_log(ULOGD_FATAL, "can't allocate key ids\n");
+		return -1;
+	}
+
 	op->of = fopen(upi->config_kset->ces[0].u.string, "a");
 	if (!op->of) {
 		ulogd_log(ULOGD_FATAL, "can't open JSON log file: %s\n",
@@ -285,9 +323,9 @@ static int json_init(struct ulogd_pluginstance *upi)
 	op->usec_idx = -1;
 	for (i = 0; i < upi->input.num_keys; i++) {
 		struct ulogd_key *key = upi->input.keys[i].u.source;
-		if (!strcmp(key->name, "oob.time.sec"))
+		if (key->id == sec_id)
 			op->sec_idx = i;
-		else if (!strcmp(key->name, "oob.time.usec"))
+		else if (key->id == usec_id)
 			op->usec_idx = i;
 	}
 
@@ -316,9 +354,11 @@ static struct ulogd_plugin json_plugin = {
 	},
 	.configure = &json_configure,
 	.interp	= &json_interp,
+	.interp_batch = &json_interp_batch,
 	.start 	= &json_init,
 	.stop	= &json_fini,
 	.signal = &sighup_handler_print,
+	.priv_size = sizeof(struct json_priv),
 	.config_kset = &json_kset,
 	.version = VERSION,
 };
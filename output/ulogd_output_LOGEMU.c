@@ -85,12 +85,12 @@ static int _output_logemu(struct ulogd_pluginstance *upi)
 	struct logemu_instance *li = (struct logemu_instance *) &upi->private;
 	struct ulogd_key *res = upi->input.keys;
 
-	if (res[0].u.source->flags & ULOGD_RETF_VALID) {
+	if (pp_is_valid(res, 0)) {
 		char *timestr;
 		char *tmp;
 		time_t now;
 
-		if (res[1].u.source && (res[1].u.source->flags & ULOGD_RETF_VALID))
+		if (pp_is_valid(res, 1))
 			now = (time_t) res[1].u.source->u.value.ui32;
 		else
 			now = time(NULL);
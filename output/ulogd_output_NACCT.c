@@ -113,6 +113,7 @@ static struct ulogd_key nacct_inp[] = {
 
 struct nacct_priv {
 	FILE *of;
+	char buf[256];
 };
 
 
@@ -121,12 +122,12 @@ nacct_interp(struct ulogd_pluginstance *pi)
 {
 	struct nacct_priv *priv = (struct nacct_priv *)&pi->private;
 	struct ulogd_key *inp = pi->input.keys;
-	static char buf[256];
+	char *buf = priv->buf;
 
 	/* try to be as close to nacct as possible.  Instead of nacct's
 	   'timestamp' value use 'flow.end.sec' */
 	if (ikey_get_u8(&inp[KEY_IP_PROTO]) == IPPROTO_ICMP) {
-		snprintf(buf, sizeof(buf),
+		snprintf(buf, sizeof(priv->buf),
 				 "%u\t%u\t%s\t%u\t%s\t%u\t%" PRIu64 "\t%" PRIu64,
 				 ikey_get_u32(&inp[KEY_FLOW_END]),
 				 ikey_get_u8(&inp[KEY_IP_PROTO]),
@@ -137,7 +138,7 @@ nacct_interp(struct ulogd_pluginstance *pi)
 				 ikey_get_u64(&inp[KEY_RAW_PKTCNT]),
 				 ikey_get_u64(&inp[KEY_RAW_PKTLEN]));
 	} else {
-		snprintf(buf, sizeof(buf),
+		snprintf(buf, sizeof(priv->buf),
 				 "%u\t%u\t%s\t%u\t%s\t%u\t%" PRIu64 "\t%" PRIu64,
 				 ikey_get_u32(&inp[KEY_FLOW_END]),
 				 ikey_get_u8(&inp[KEY_IP_PROTO]),
@@ -248,6 +249,7 @@ static struct ulogd_plugin nacct_plugin = {
 	.start 	= &nacct_init,
 	.stop	= &nacct_fini,
 	.signal = &sighup_handler_print,
+	.priv_size = sizeof(struct nacct_priv),
 	.config_kset = &nacct_kset,
 	.version = VERSION,
 };
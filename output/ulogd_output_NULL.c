@@ -0,0 +1,63 @@
+/* ulogd_output_NULL.c
+ *
+ * ulogd output target discarding the records
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  The end of a stack that is only there to be measured, e.g. by
+ *  "make bench".  It takes every key of the plugins before it, so they
+ *  produce all of them, and does nothing with the records.
+ */
+
+#include <ulogd/ulogd.h>
+
+static int null_interp(struct ulogd_pluginstance *upi)
+{
+	return ULOGD_IRET_OK;
+}
+
+static int null_interp_batch(struct ulogd_pluginstance *upi,
+			     struct ulogd_batch *batch)
+{
+	return ULOGD_IRET_OK;
+}
+
+static int null_configure(struct ulogd_pluginstance *upi,
+			  struct ulogd_pluginstance_stack *stack)
+{
+	return ulogd_wildcard_inputkeys(upi);
+}
+
+static struct ulogd_plugin null_plugin = {
+	.name = "NULL",
+	.input = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW |
+			ULOGD_DTYPE_SUM,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_SINK,
+	},
+	.configure = &null_configure,
+	.interp = &null_interp,
+	.interp_batch = &null_interp_batch,
+	.version = VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&null_plugin);
+}
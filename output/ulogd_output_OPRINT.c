@@ -191,6 +191,7 @@ static struct ulogd_plugin oprint_plugin = {
 	.start 	= &oprint_init,
 	.stop	= &oprint_fini,
 	.signal = &sighup_handler_print,
+	.priv_size = sizeof(struct oprint_priv),
 	.config_kset = &oprint_kset,
 	.version = VERSION,
 };
@@ -73,7 +73,7 @@ static int _output_syslog(struct ulogd_pluginstance *upi)
 	struct syslog_instance *li = (struct syslog_instance *) &upi->private;
 	struct ulogd_key *res = upi->input.keys;
 
-	if (res[0].u.source->flags & ULOGD_RETF_VALID)
+	if (pp_is_valid(res, 0))
 		syslog(li->syslog_level | li->syslog_facility, "%s",
 				(char *) res[0].u.source->u.value.ptr);
 
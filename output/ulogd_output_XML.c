@@ -95,6 +95,7 @@ static struct config_keyset xml_kset = {
 
 struct xml_priv {
         FILE *of;
+	char buf[4096];
 };
 
 static int
@@ -154,15 +155,15 @@ static int xml_output(struct ulogd_pluginstance *upi)
 {
 	struct ulogd_key *inp = upi->input.keys;
 	struct xml_priv *opi = (struct xml_priv *) &upi->private;
-	static char buf[4096];
+	char *buf = opi->buf;
 	int ret = -1;
 
 	if (pp_is_valid(inp, KEY_CT))
-		ret = xml_output_flow(inp, buf, sizeof(buf));
+		ret = xml_output_flow(inp, buf, sizeof(opi->buf));
 	else if (pp_is_valid(inp, KEY_PCKT))
-		ret = xml_output_packet(inp, buf, sizeof(buf));
+		ret = xml_output_packet(inp, buf, sizeof(opi->buf));
 	else if (pp_is_valid(inp, KEY_SUM))
-		ret = xml_output_sum(inp, buf, sizeof(buf));
+		ret = xml_output_sum(inp, buf, sizeof(opi->buf));
 
 	if (ret < 0)
 		return ULOGD_IRET_ERR;
@@ -0,0 +1,109 @@
+/* per record memory arena
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Plugins get the memory for the strings and buffers they return through
+ *  ulogd_alloc().  It comes from the arena of the stack (or of the stack
+ *  thread) and is given back by the core in one go once the record has gone
+ *  through the stack, so there is no malloc()/free() pair per key anymore.
+ *
+ *  If a record needs more than the current chunk, another one is added.  On
+ *  reset, several chunks are merged into a single one big enough for all of
+ *  them, so the arena quickly stops growing.
+ */
+
+#include <stdlib.h>
+#include <ulogd/arena.h>
+
+/* minimum size of a chunk */
+#define ARENA_CHUNK		4096
+
+/* keep the returned memory suitably aligned for any key value */
+#define ARENA_ALIGN(len)	(((len) + 7) & ~7)
+
+struct ulogd_arena_chunk {
+	struct ulogd_arena_chunk	*next;
+	size_t				size;
+	char				data[];
+};
+
+static int arena_grow(struct ulogd_arena *arena, size_t size)
+{
+	struct ulogd_arena_chunk *chunk;
+
+	if (size < ARENA_CHUNK)
+		size = ARENA_CHUNK;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (chunk == NULL)
+		return -1;
+
+	chunk->size = size;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->ptr = chunk->data;
+	arena->end = chunk->data + size;
+
+	return 0;
+}
+
+void *ulogd_arena_alloc(struct ulogd_arena *arena, size_t size)
+{
+	void *ptr;
+
+	size = ARENA_ALIGN(size);
+	if (size > (size_t)(arena->end - arena->ptr) &&
+	    arena_grow(arena, size) < 0)
+		return NULL;
+
+	ptr = arena->ptr;
+	arena->ptr += size;
+
+	return ptr;
+}
+
+/* release everything allocated from 'arena' */
+void ulogd_arena_reset(struct ulogd_arena *arena)
+{
+	struct ulogd_arena_chunk *chunk = arena->chunks;
+	size_t size;
+
+	if (chunk == NULL)
+		return;
+
+	if (chunk->next == NULL) {
+		arena->ptr = chunk->data;
+		return;
+	}
+
+	size = arena->ptr - chunk->data;
+	for (chunk = chunk->next; chunk; chunk = chunk->next)
+		size += chunk->size;
+
+	ulogd_arena_free(arena);
+	arena_grow(arena, size);
+}
+
+void ulogd_arena_free(struct ulogd_arena *arena)
+{
+	struct ulogd_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+	arena->ptr = arena->end = NULL;
+}
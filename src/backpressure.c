@@ -0,0 +1,258 @@
+/* backpressure from the outputs to the sources
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  A stack is busy while one of its pluginstances says so through
+ *  ulogd_backpressure(), e.g. the database plugins while their ring is
+ *  full, or while the queue of its stack thread is filling up.  Without
+ *  backpressure, the records are lost wherever there is no room for them
+ *  anymore, and the sources keep reading until the kernel drops them.
+ *
+ *  The backpressure option decides what happens to the records entering a
+ *  busy stack instead: with "drop", they are shed right after the source,
+ *  with "sample", one out of backpressure_sample still goes through, and
+ *  either way they are counted as "shed" by the source of the stack.  With
+ *  "pause", the descriptors the source has registered with
+ *  ulogd_backpressure_fd() are not polled anymore until none of its stacks
+ *  is busy, so the records wait in the kernel.  Sources without such
+ *  descriptors shed the records instead.
+ *
+ *  Everything but ulogd_backpressure() runs in the main loop, the paused
+ *  sources are looked after by a timer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/backpressure.h>
+#include <ulogd/worker.h>
+
+/* descriptors a source may register, one per NFLOG group */
+#define BP_MAX_FDS	32
+/* milliseconds between two looks at the stacks of the paused sources, the
+ * timers have no finer resolution */
+#define BP_INTERVAL	1
+
+struct bp_source {
+	struct llist_head		list;
+	struct ulogd_pluginstance	*pi;
+	struct ulogd_fd			*fds[BP_MAX_FDS];
+	unsigned int			num_fds;
+	int				paused;
+};
+
+int ulogd_bp_policy = ULOGD_BP_NONE;
+
+static unsigned int bp_sample;
+static struct llist_head *bp_stacks;
+static LLIST_HEAD(bp_sources);
+static unsigned int bp_num_paused;
+static struct ulogd_timer bp_timer;
+
+void ulogd_backpressure(struct ulogd_pluginstance *pi, int busy)
+{
+	busy = !!busy;
+	if (__atomic_exchange_n(&pi->busy, busy, __ATOMIC_SEQ_CST) == busy)
+		return;
+
+	if (busy)
+		__atomic_add_fetch(&pi->stack->busy, 1, __ATOMIC_SEQ_CST);
+	else
+		__atomic_sub_fetch(&pi->stack->busy, 1, __ATOMIC_SEQ_CST);
+}
+
+static struct bp_source *bp_source_find(struct ulogd_pluginstance *pi)
+{
+	struct bp_source *src;
+
+	llist_for_each_entry(src, &bp_sources, list) {
+		if (src->pi == pi)
+			return src;
+	}
+	return NULL;
+}
+
+int ulogd_backpressure_fd(struct ulogd_pluginstance *pi, struct ulogd_fd *ufd)
+{
+	struct bp_source *src = bp_source_find(pi);
+
+	if (src == NULL) {
+		src = calloc(1, sizeof(*src));
+		if (src == NULL)
+			return -ENOMEM;
+		src->pi = pi;
+		llist_add_tail(&src->list, &bp_sources);
+	}
+
+	if (src->num_fds == BP_MAX_FDS)
+		return -ENOSPC;
+	src->fds[src->num_fds++] = ufd;
+
+	if (src->paused)
+		ulogd_pause_fd(ufd, 1);
+	return 0;
+}
+
+int ulogd_backpressure_paused(struct ulogd_pluginstance *pi)
+{
+	struct bp_source *src;
+
+	if (ulogd_bp_policy != ULOGD_BP_PAUSE || bp_num_paused == 0)
+		return 0;
+
+	src = bp_source_find(pi);
+	return src && src->paused;
+}
+
+void ulogd_backpressure_release(struct ulogd_pluginstance *pi)
+{
+	struct bp_source *src = bp_source_find(pi);
+
+	if (pi->busy)
+		ulogd_backpressure(pi, 0);
+
+	if (src == NULL)
+		return;
+
+	/* the descriptors are about to be unregistered by the plugin */
+	if (src->paused)
+		bp_num_paused--;
+	llist_del(&src->list);
+	free(src);
+}
+
+/* the source feeding 'stack', if it has registered descriptors */
+static struct bp_source *bp_source_of(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_pluginstance *pi, *npi;
+	struct bp_source *src;
+
+	while (stack->trunk)
+		stack = stack->trunk;
+	pi = stack->plan.steps[0].pi;
+
+	llist_for_each_entry(src, &bp_sources, list) {
+		if (src->pi == pi)
+			return src;
+		llist_for_each_entry(npi, &pi->plist, plist) {
+			if (src->pi == npi)
+				return src;
+		}
+	}
+	return NULL;
+}
+
+static int bp_stack_busy(struct ulogd_pluginstance_stack *stack)
+{
+	if (__atomic_load_n(&stack->busy, __ATOMIC_RELAXED))
+		return 1;
+	return stack->worker && ulogd_worker_busy(stack->worker);
+}
+
+static void bp_pause(struct bp_source *src, int pause)
+{
+	unsigned int i;
+
+	for (i = 0; i < src->num_fds; i++)
+		ulogd_pause_fd(src->fds[i], pause);
+	src->paused = pause;
+}
+
+static void bp_timer_cb(struct ulogd_timer *t, void *data)
+{
+	struct ulogd_pluginstance_stack *stack;
+	struct bp_source *src;
+
+	llist_for_each_entry(src, &bp_sources, list) {
+		int busy = 0;
+
+		if (!src->paused)
+			continue;
+
+		llist_for_each_entry(stack, bp_stacks, stack_list) {
+			if (bp_source_of(stack) == src &&
+			    bp_stack_busy(stack)) {
+				busy = 1;
+				break;
+			}
+		}
+		if (busy)
+			continue;
+
+		ulogd_log(ULOGD_INFO, "resuming `%s'\n", src->pi->id);
+		bp_pause(src, 0);
+		bp_num_paused--;
+	}
+
+	if (bp_num_paused)
+		ulogd_add_timer_msec(&bp_timer, BP_INTERVAL);
+}
+
+int __ulogd_backpressure_shed(struct ulogd_pluginstance_stack *stack)
+{
+	struct bp_source *src;
+
+	if (!bp_stack_busy(stack))
+		return 0;
+
+	switch (ulogd_bp_policy) {
+	case ULOGD_BP_PAUSE:
+		src = bp_source_of(stack);
+		if (src == NULL)
+			break;
+
+		/* the records already read still go through */
+		if (!src->paused) {
+			ulogd_log(ULOGD_INFO, "pausing `%s', stack `%s' is "
+				  "busy\n", src->pi->id, stack->name);
+			bp_pause(src, 1);
+			src->pi->stats.paused++;
+			if (bp_num_paused++ == 0)
+				ulogd_add_timer_msec(&bp_timer, BP_INTERVAL);
+		}
+		return 0;
+	case ULOGD_BP_SAMPLE:
+		if (stack->bp_seen++ % bp_sample == 0)
+			return 0;
+		break;
+	}
+
+	stack->plan.steps[0].pi->stats.shed++;
+	return 1;
+}
+
+int ulogd_backpressure_start(const char *policy, unsigned int sample,
+			     struct llist_head *stacks)
+{
+	if (!strcmp(policy, "none"))
+		ulogd_bp_policy = ULOGD_BP_NONE;
+	else if (!strcmp(policy, "pause"))
+		ulogd_bp_policy = ULOGD_BP_PAUSE;
+	else if (!strcmp(policy, "sample"))
+		ulogd_bp_policy = ULOGD_BP_SAMPLE;
+	else if (!strcmp(policy, "drop"))
+		ulogd_bp_policy = ULOGD_BP_DROP;
+	else {
+		ulogd_log(ULOGD_FATAL, "unknown backpressure `%s'\n", policy);
+		return -1;
+	}
+
+	bp_sample = sample ? sample : 1;
+	bp_stacks = stacks;
+	ulogd_init_timer(&bp_timer, NULL, bp_timer_cb);
+
+	return 0;
+}
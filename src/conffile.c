@@ -127,6 +127,7 @@ int config_parse_file(const char *section, struct config_keyset *kset)
 
 	pr_debug("%s: section='%s' file='%s'\n", __func__, section, fname);
 
+	config_errce = NULL;
 	cfile = fopen(fname, "r");
 	if (!cfile)
 		return -ERROPEN;
@@ -1,6 +1,6 @@
 /*
  * (C) 2006-2009 by Pablo Neira Ayuso <pablo@netfilter.org>
- * 
+ *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 2 of the License, or
@@ -16,6 +16,19 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  *
  * Description: generic hash table implementation
+ *
+ *  The entries are kept in one array of slots (open addressing) holding
+ *  the hash of the entry next to a pointer to it, so compare() is only
+ *  called for the entries with the same hash.  Collisions are resolved by
+ *  linear probing with Robin Hood hashing: an entry being added takes the
+ *  slot of an entry closer to its home slot, which keeps the probe
+ *  sequences short, and removing an entry shifts the following ones back.
+ *
+ *  The table grows once it is 3/4 full and shrinks below 1/8, down to the
+ *  size it was created with.  Instead of moving all entries at once, the
+ *  old slots are kept and every hashtable_add() and hashtable_del() moves
+ *  a few of their entries, lookups look at both meanwhile.  The limit
+ *  still caps the number of entries.
  */
 
 #include "ulogd/hash.h"
@@ -25,27 +38,175 @@
 #include <string.h>
 #include <limits.h>
 
+#define HASHTABLE_MIN_SIZE	16
+/* slots of the old array looked at by each add and del during a resize */
+#define HASHTABLE_MIGRATE	8
+
+static uint32_t roundup_pow2(uint32_t n)
+{
+	uint32_t size = HASHTABLE_MIN_SIZE;
+
+	while (size < n && size < (1U << 31))
+		size <<= 1;
+	return size;
+}
+
+static int array_init(struct hashtable_array *a, uint32_t size)
+{
+	a->slots = calloc(size, sizeof(struct hashtable_slot));
+	if (a->slots == NULL)
+		return -1;
+	a->mask = size - 1;
+	a->count = 0;
+	return 0;
+}
+
+static void array_insert(struct hashtable_array *a, uint32_t hash,
+			 struct hashtable_node *node)
+{
+	struct hashtable_slot ins = {
+		.dist	= 1,
+		.hash	= hash,
+		.node	= node,
+	};
+	uint32_t i = hash & a->mask;
+
+	for (;;) {
+		struct hashtable_slot *s = &a->slots[i];
+
+		if (s->dist == 0) {
+			*s = ins;
+			break;
+		}
+		/* the entry closer to its home slot moves on */
+		if (s->dist < ins.dist) {
+			struct hashtable_slot tmp = *s;
+
+			*s = ins;
+			ins = tmp;
+		}
+		ins.dist++;
+		i = (i + 1) & a->mask;
+	}
+	a->count++;
+}
+
+/* shift the entries following 's' back, up to an empty slot or an entry
+ * in its home slot */
+static void array_remove(struct hashtable_array *a, struct hashtable_slot *s)
+{
+	uint32_t i = s - a->slots;
+
+	for (;;) {
+		uint32_t next = (i + 1) & a->mask;
+		struct hashtable_slot *n = &a->slots[next];
+
+		if (n->dist <= 1)
+			break;
+		a->slots[i] = *n;
+		a->slots[i].dist--;
+		i = next;
+	}
+	a->slots[i].dist = 0;
+	a->slots[i].node = NULL;
+	a->count--;
+}
+
+static struct hashtable_slot *
+array_find(const struct hashtable *table, const struct hashtable_array *a,
+	   const void *data, uint32_t hash)
+{
+	uint32_t i = hash & a->mask, dist = 1;
+
+	/* an entry can't be further from its home slot than the one there */
+	while (a->slots[i].dist >= dist) {
+		if (a->slots[i].hash == hash &&
+		    table->compare(a->slots[i].node, data))
+			return &a->slots[i];
+		i = (i + 1) & a->mask;
+		dist++;
+	}
+	return NULL;
+}
+
+static struct hashtable_slot *
+array_find_node(const struct hashtable_array *a,
+		const struct hashtable_node *node)
+{
+	uint32_t i = node->hash & a->mask, dist = 1;
+
+	while (a->slots[i].dist >= dist) {
+		if (a->slots[i].node == node)
+			return &a->slots[i];
+		i = (i + 1) & a->mask;
+		dist++;
+	}
+	return NULL;
+}
+
+/* move the entries of the old slots in the first 'steps' slots left, the
+ * slots before old.slots[migrated] are empty */
+static void hashtable_migrate(struct hashtable *table, uint32_t steps)
+{
+	struct hashtable_array *old = &table->old;
+
+	while (old->slots && steps--) {
+		struct hashtable_slot *s;
+
+		if (old->count == 0) {
+			free(old->slots);
+			old->slots = NULL;
+			break;
+		}
+
+		s = &old->slots[table->migrated];
+		if (s->dist == 0) {
+			table->migrated++;
+			continue;
+		}
+		array_insert(&table->cur, s->hash, s->node);
+		array_remove(old, s);
+	}
+}
+
+static int hashtable_resize(struct hashtable *table, uint32_t size)
+{
+	struct hashtable_array cur = table->cur;
+
+	/* the previous resize is done first */
+	while (table->old.slots)
+		hashtable_migrate(table, UINT_MAX);
+
+	if (array_init(&table->cur, size) < 0) {
+		table->cur = cur;
+		return -1;
+	}
+	table->old = cur;
+	table->migrated = 0;
+	return 0;
+}
+
 struct hashtable *
 hashtable_create(int hashsize, int limit,
 		 uint32_t (*hash)(const void *data,
 		 		  const struct hashtable *table),
 		 int (*compare)(const void *data1, const void *data2))
 {
-	int i;
 	struct hashtable *h;
-	int size = sizeof(struct hashtable)
-		   + hashsize * sizeof(struct llist_head);
 
-	h = (struct hashtable *) calloc(size, 1);
+	h = (struct hashtable *) calloc(sizeof(struct hashtable), 1);
 	if (h == NULL) {
 		errno = ENOMEM;
 		return NULL;
 	}
 
-	for (i=0; i<hashsize; i++)
-		INIT_LLIST_HEAD(&h->members[i]);
+	h->hashsize = roundup_pow2(hashsize > 0 ? hashsize : 0);
+	if (array_init(&h->cur, h->hashsize) < 0) {
+		free(h);
+		errno = ENOMEM;
+		return NULL;
+	}
 
-	h->hashsize = hashsize;
 	h->limit = limit;
 	h->hash = hash;
 	h->compare = compare;
@@ -55,89 +216,186 @@ hashtable_create(int hashsize, int limit,
 
 void hashtable_destroy(struct hashtable *h)
 {
+	free(h->old.slots);
+	free(h->cur.slots);
 	free(h);
 }
 
-int hashtable_hash(const struct hashtable *table, const void *data)
+uint32_t hashtable_hash(const struct hashtable *table, const void *data)
 {
 	return table->hash(data, table);
 }
 
 struct hashtable_node *
-hashtable_find(const struct hashtable *table, const void *data, int id)
+hashtable_find(const struct hashtable *table, const void *data, uint32_t id)
 {
-	struct llist_head *e;
-	struct hashtable_node *n;
+	struct hashtable_slot *s;
+
+	s = array_find(table, &table->cur, data, id);
+	if (s == NULL && table->old.slots)
+		s = array_find(table, &table->old, data, id);
+	if (s)
+		return s->node;
 
-	llist_for_each(e, &table->members[id]) {
-		n = llist_entry(e, struct hashtable_node, head);
-		if (table->compare(n, data)) {
-			return n;
-		}
-	}
 	errno = ENOENT;
 	return NULL;
 }
 
-int hashtable_add(struct hashtable *table, struct hashtable_node *n, int id)
+int hashtable_add(struct hashtable *table, struct hashtable_node *n,
+		  uint32_t id)
 {
+	uint32_t size = table->cur.mask + 1;
+
 	/* hash table is full */
 	if (table->count >= table->limit) {
 		errno = ENOSPC;
 		return -1;
 	}
-	llist_add(&n->head, &table->members[id]);
+
+	if (!table->iterating) {
+		hashtable_migrate(table, HASHTABLE_MIGRATE);
+		if (table->cur.count >= size / 4 * 3 && size < (1U << 31))
+			hashtable_resize(table, size * 2);
+	}
+	/* no resize while iterating or out of memory, at least one slot has
+	 * to stay empty */
+	if (table->cur.count >= table->cur.mask) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	n->hash = id;
+	array_insert(&table->cur, id, n);
 	table->count++;
 	return 0;
 }
 
 void hashtable_del(struct hashtable *table, struct hashtable_node *n)
 {
-	llist_del(&n->head);
+	struct hashtable_slot *s;
+	uint32_t size;
+
+	s = array_find_node(&table->cur, n);
+	if (s)
+		array_remove(&table->cur, s);
+	else if (table->old.slots &&
+		 (s = array_find_node(&table->old, n)) != NULL)
+		array_remove(&table->old, s);
+	else
+		return;
 	table->count--;
+
+	if (table->iterating)
+		return;
+
+	hashtable_migrate(table, HASHTABLE_MIGRATE);
+	size = table->cur.mask + 1;
+	if (table->old.slots == NULL && size > table->hashsize &&
+	    table->count < size / 8)
+		hashtable_resize(table, size / 2);
 }
 
-int hashtable_flush(struct hashtable *table)
+static void array_flush(struct hashtable_array *a)
 {
 	uint32_t i;
-	struct llist_head *e, *tmp;
-	struct hashtable_node *n;
 
-	for (i=0; i < table->hashsize; i++) {
-		llist_for_each_safe(e, tmp, &table->members[i]) {
-			n = llist_entry(e, struct hashtable_node, head);
-			free(n);
-		}
+	if (a->slots == NULL)
+		return;
+
+	for (i = 0; i <= a->mask; i++) {
+		if (a->slots[i].dist)
+			free(a->slots[i].node);
 	}
+	memset(a->slots, 0, (a->mask + 1) * sizeof(struct hashtable_slot));
+	a->count = 0;
+}
+
+int hashtable_flush(struct hashtable *table)
+{
+	array_flush(&table->old);
+	array_flush(&table->cur);
+	table->count = 0;
 	return 0;
 }
 
-int
-hashtable_iterate_limit(struct hashtable *table, void *data,
-			uint32_t from, uint32_t steps,
-		        int (*iterate)(void *data1, void *n))
+/* 'iterate' may delete the entry it is called for, but no other one */
+static int array_iterate(struct hashtable_array *a, void *data,
+			 int (*iterate)(void *data1, void *n))
 {
-	uint32_t i;
-	struct llist_head *e, *tmp;
-	struct hashtable_node *n;
+	uint32_t start, i, seen;
+
+	if (a->slots == NULL || a->count == 0)
+		return 0;
 
-	for (i=from; i < table->hashsize && i < from+steps; i++) {
-		llist_for_each_safe(e, tmp, &table->members[i]) {
-			n = llist_entry(e, struct hashtable_node, head);
+	/* start at an empty slot or an entry in its home slot, which the
+	 * deletions don't shift anything to */
+	for (start = 0; a->slots[start].dist > 1; start++)
+		;
+
+	for (seen = 0, i = start; seen <= a->mask; ) {
+		struct hashtable_node *n = a->slots[i].node;
+
+		if (a->slots[i].dist) {
 			if (iterate(data, n) == -1)
 				return -1;
+			/* deleted, the next one may have taken its slot */
+			if (a->slots[i].dist && a->slots[i].node != n)
+				continue;
 		}
+		i = (i + 1) & a->mask;
+		seen++;
 	}
-	return i;
+	return 0;
 }
 
 int hashtable_iterate(struct hashtable *table, void *data,
-		      int (*iterate)(void *data1, void *n))
+		      int (*iterate)(void *data, void *n))
 {
-	return hashtable_iterate_limit(table, data, 0, UINT_MAX, iterate);
+	int ret;
+
+	table->iterating++;
+	ret = array_iterate(&table->old, data, iterate);
+	if (ret == 0)
+		ret = array_iterate(&table->cur, data, iterate);
+	table->iterating--;
+
+	return ret;
 }
 
 unsigned int hashtable_counter(const struct hashtable *table)
 {
 	return table->count;
 }
+
+static void array_stats(const struct hashtable_array *a,
+			struct hashtable_stats *stats, uint64_t *dists)
+{
+	uint32_t i;
+
+	if (a->slots == NULL)
+		return;
+
+	stats->slots += a->mask + 1;
+	for (i = 0; i <= a->mask; i++) {
+		*dists += a->slots[i].dist;
+		if (a->slots[i].dist > stats->probe_max)
+			stats->probe_max = a->slots[i].dist;
+	}
+}
+
+void hashtable_stats(const struct hashtable *table,
+		     struct hashtable_stats *stats)
+{
+	uint64_t dists = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->entries = table->count;
+	stats->resizing = table->old.slots != NULL;
+
+	array_stats(&table->old, stats, &dists);
+	array_stats(&table->cur, stats, &dists);
+
+	stats->load = (uint64_t)stats->entries * 100 / stats->slots;
+	if (stats->entries)
+		stats->probe_avg = (double)dists / stats->entries;
+}
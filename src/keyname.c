@@ -0,0 +1,104 @@
+/* interned key names
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Every key name used by a stack is entered once in a global table and
+ *  gets a small integer id, the same for all plugins.  The core connects
+ *  input and output keys by comparing ids, and plugins looking for a given
+ *  key can do the same instead of calling strcmp() for every record.
+ *
+ *  Ids are never given back, so they stay valid for the lifetime of the
+ *  daemon.  The table is only used from the main thread while stacks are
+ *  built.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/hash.h>
+#include <ulogd/jhash.h>
+
+#define KEYNAME_HASHSIZE	1024
+
+struct keyname {
+	struct hashtable_node	hashnode;
+	unsigned int		id;
+	char			name[ULOGD_MAX_KEYLEN+1];
+};
+
+static struct hashtable *keynames;
+static unsigned int keyid_max;
+
+static uint32_t keyname_hash(const void *data, const struct hashtable *table)
+{
+	const char *name = data;
+
+	return jhash(name, strlen(name), table->initval);
+}
+
+static int keyname_cmp(const void *data1, const void *data2)
+{
+	const struct keyname *k = data1;
+
+	return !strcmp(k->name, data2);
+}
+
+unsigned int ulogd_keyid(const char *name)
+{
+	struct keyname *k;
+	uint32_t id;
+
+	if (keynames == NULL) {
+		keynames = hashtable_create(KEYNAME_HASHSIZE, INT_MAX,
+					    keyname_hash, keyname_cmp);
+		if (keynames == NULL)
+			return 0;
+	}
+
+	id = hashtable_hash(keynames, name);
+	k = (struct keyname *)hashtable_find(keynames, name, id);
+	if (k)
+		return k->id;
+
+	k = calloc(1, sizeof(*k));
+	if (k == NULL)
+		return 0;
+
+	strncpy(k->name, name, ULOGD_MAX_KEYLEN);
+	k->id = keyid_max + 1;
+	if (hashtable_add(keynames, &k->hashnode, id) < 0) {
+		free(k);
+		return 0;
+	}
+	keyid_max = k->id;
+
+	return k->id;
+}
+
+unsigned int ulogd_keyid_max(void)
+{
+	return keyid_max;
+}
+
+void ulogd_keyid_fini(void)
+{
+	if (keynames == NULL)
+		return;
+
+	hashtable_flush(keynames);
+	hashtable_destroy(keynames);
+	keynames = NULL;
+}
@@ -0,0 +1,275 @@
+/* asynchronous logging
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Once ulogd is running, ulogd_log() only formats the message into a ring
+ *  and a thread of its own writes it to the logfile or to syslog, so the
+ *  main loop and the stack threads don't wait for the disk or syslogd.
+ *  Before that, and again on exit, messages are written right away.  If the
+ *  ring is full, messages are dropped and their number is logged later.
+ *
+ *  Each ulogd_log() call site may log log_burst messages every log_interval
+ *  seconds, further ones are counted and summed up as "suppressed N
+ *  messages" once the call site logs again in a later interval.  This keeps
+ *  a message logged for every record from flooding the log.  Fatal
+ *  messages aren't rate limited and the caller waits until they are
+ *  written, since it is usually about to exit.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/log.h>
+#include <ulogd/sched.h>
+
+#define ULOGD_LOG_RING		256
+#define ULOGD_LOG_MSGLEN	1024
+
+struct log_entry {
+	time_t		tm;
+	int		level;
+	int		line;
+	/* copied, the plugin may be unloaded before it is written */
+	char		file[64];
+	char		msg[ULOGD_LOG_MSGLEN];
+};
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_drained = PTHREAD_COND_INITIALIZER;
+static pthread_t log_thread;
+
+static struct log_entry *log_ring;
+static unsigned int log_head;		/* written by the callers */
+static unsigned int log_tail;		/* written by the log thread */
+static unsigned int log_dropped;
+static int log_running;
+static int log_sleeping;
+static int log_stop;
+
+static unsigned int log_burst;
+static unsigned int log_interval;
+
+/* make sure the message ends with a newline even if it was truncated */
+static void log_terminate(char *msg, int len)
+{
+	if (len >= ULOGD_LOG_MSGLEN) {
+		msg[ULOGD_LOG_MSGLEN - 2] = '\n';
+		msg[ULOGD_LOG_MSGLEN - 1] = '\0';
+	}
+}
+
+/* called with log_lock held, returns NULL if the ring is full */
+static struct log_entry *log_enqueue(int level, const char *file, int line,
+				     time_t tm)
+{
+	struct log_entry *e;
+
+	if (log_head - log_tail == ULOGD_LOG_RING) {
+		log_dropped++;
+		return NULL;
+	}
+
+	e = &log_ring[log_head % ULOGD_LOG_RING];
+	e->tm = tm;
+	e->level = level;
+	e->line = line;
+	snprintf(e->file, sizeof(e->file), "%s", file);
+	log_head++;
+
+	if (log_sleeping)
+		pthread_cond_signal(&log_cond);
+
+	return e;
+}
+
+/* called with log_lock held, returns 1 if the message is suppressed */
+static int log_ratelimit(struct ulogd_log_site *site, int level,
+			 const char *file, int line, time_t now)
+{
+	struct log_entry *e;
+
+	if (log_burst == 0 || level >= ULOGD_FATAL)
+		return 0;
+
+	if (now - site->window >= (time_t)log_interval) {
+		if (site->suppressed) {
+			e = log_enqueue(level, file, line, now);
+			if (e)
+				snprintf(e->msg, sizeof(e->msg),
+					 "suppressed %u messages\n",
+					 site->suppressed);
+		}
+		site->window = now;
+		site->count = 0;
+		site->suppressed = 0;
+	}
+
+	if (site->count >= log_burst) {
+		site->suppressed++;
+		return 1;
+	}
+	site->count++;
+	return 0;
+}
+
+void ulogd_log_vqueue(struct ulogd_log_site *site, int level,
+		      const char *file, int line, const char *format,
+		      va_list ap)
+{
+	char msg[ULOGD_LOG_MSGLEN];
+	struct log_entry *e;
+	time_t now = time(NULL);
+	unsigned int pos;
+
+	pthread_mutex_lock(&log_lock);
+
+	if (!log_running) {
+		pthread_mutex_unlock(&log_lock);
+		log_terminate(msg, vsnprintf(msg, sizeof(msg), format, ap));
+		ulogd_log_output(level, file, line, now, msg);
+		return;
+	}
+
+	if (site && log_ratelimit(site, level, file, line, now)) {
+		pthread_mutex_unlock(&log_lock);
+		return;
+	}
+
+	e = log_enqueue(level, file, line, now);
+	if (e)
+		log_terminate(e->msg, vsnprintf(e->msg, sizeof(e->msg),
+						format, ap));
+
+	/* ulogd is about to exit, don't lose the reason */
+	if (e && level >= ULOGD_FATAL) {
+		pos = log_head;
+		while (log_running && (int)(pos - log_tail) > 0)
+			pthread_cond_wait(&log_drained, &log_lock);
+	}
+
+	pthread_mutex_unlock(&log_lock);
+}
+
+static void *log_thread_main(void *arg)
+{
+	struct log_entry *e;
+	char msg[64];
+	unsigned int dropped;
+
+	pthread_mutex_lock(&log_lock);
+	while (1) {
+		while (log_head == log_tail && !log_dropped && !log_stop) {
+			log_sleeping = 1;
+			pthread_cond_wait(&log_cond, &log_lock);
+			log_sleeping = 0;
+		}
+
+		if (log_dropped) {
+			dropped = log_dropped;
+			log_dropped = 0;
+			pthread_mutex_unlock(&log_lock);
+
+			snprintf(msg, sizeof(msg), "dropped %u log messages\n",
+				 dropped);
+			ulogd_log_output(ULOGD_ERROR, __FILE__, __LINE__,
+					 time(NULL), msg);
+
+			pthread_mutex_lock(&log_lock);
+		}
+
+		if (log_head == log_tail) {
+			if (log_stop)
+				break;
+			continue;
+		}
+
+		/* the slot isn't reused before log_tail moves on */
+		e = &log_ring[log_tail % ULOGD_LOG_RING];
+		pthread_mutex_unlock(&log_lock);
+
+		ulogd_log_output(e->level, e->file, e->line, e->tm, e->msg);
+
+		pthread_mutex_lock(&log_lock);
+		log_tail++;
+		pthread_cond_broadcast(&log_drained);
+	}
+
+	/* later messages are written by the callers again */
+	log_running = 0;
+	pthread_cond_broadcast(&log_drained);
+	pthread_mutex_unlock(&log_lock);
+
+	return NULL;
+}
+
+int ulogd_log_start(unsigned int burst, unsigned int interval)
+{
+	sigset_t all, old;
+	int ret;
+
+	log_burst = burst;
+	log_interval = interval ? interval : 1;
+
+	log_ring = calloc(ULOGD_LOG_RING, sizeof(*log_ring));
+	if (log_ring == NULL)
+		return -1;
+
+	pthread_mutex_lock(&log_lock);
+	log_head = log_tail = log_dropped = 0;
+	log_stop = 0;
+	log_running = 1;
+	pthread_mutex_unlock(&log_lock);
+
+	/* signals are handled by the main loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(&log_thread, NULL, log_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret != 0) {
+		pthread_mutex_lock(&log_lock);
+		log_running = 0;
+		pthread_mutex_unlock(&log_lock);
+		free(log_ring);
+		log_ring = NULL;
+		ulogd_log(ULOGD_ERROR, "can't create log thread: %s\n",
+			  strerror(ret));
+		return -1;
+	}
+	ulogd_thread_register(log_thread);
+	return 0;
+}
+
+/* write the pending messages and wait for the log thread to finish */
+void ulogd_log_stop(void)
+{
+	if (log_ring == NULL)
+		return;
+
+	pthread_mutex_lock(&log_lock);
+	log_stop = 1;
+	pthread_cond_signal(&log_cond);
+	pthread_mutex_unlock(&log_lock);
+
+	ulogd_thread_unregister(log_thread);
+	pthread_join(log_thread, NULL);
+
+	free(log_ring);
+	log_ring = NULL;
+}
@@ -0,0 +1,191 @@
+/* per plugin profiling
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  With profile=1, the core measures the time spent in interp() of every
+ *  pluginstance, and if possible the heap allocations and the cache misses
+ *  on the way.  The sums are part of the stats file, dividing them by the
+ *  records handed to the plugin gives the cost per record.
+ *
+ *  Cache misses are counted by a perf event of each thread calling
+ *  interp(), which the kernel may not allow (see perf_event_paranoid).
+ *  Allocations are only counted if something provides
+ *  ulogd_profile_allocs(), which returns the number of allocations made by
+ *  the calling thread so far, e.g. the library bench/ preloads.  The
+ *  counters are read outside of the measured time, but reading them isn't
+ *  free, so the times are only good for comparing plugins and changes to
+ *  them, not for guessing the throughput without profiling.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/profile.h>
+
+int ulogd_profiling;
+
+static unsigned int profile_counters;
+static unsigned long (*profile_allocs)(void);
+static pthread_key_t profile_key;
+
+/* perf event of the thread, -1 if it isn't opened yet, -2 if it failed */
+static __thread int profile_fd = -1;
+
+struct profile_sample {
+	struct timespec	ts;
+	uint64_t	allocs;
+	uint64_t	misses;
+};
+
+static int profile_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	/* the plugins, not the syscalls they make */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void profile_set_fd(int fd)
+{
+	profile_fd = fd;
+	/* closed by profile_close() when the thread exits */
+	pthread_setspecific(profile_key, (void *)(intptr_t)(fd + 1));
+}
+
+static void profile_close(void *data)
+{
+	close((int)(intptr_t)data - 1);
+}
+
+static uint64_t profile_read_misses(void)
+{
+	uint64_t count;
+	int fd;
+
+	if (profile_fd == -1) {
+		/* first interp() called by this thread */
+		fd = profile_open();
+		if (fd < 0)
+			profile_fd = -2;
+		else
+			profile_set_fd(fd);
+	}
+	if (profile_fd < 0)
+		return 0;
+
+	if (read(profile_fd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
+
+static void profile_begin(struct profile_sample *s)
+{
+	if (profile_counters & ULOGD_PROFILE_MISSES)
+		s->misses = profile_read_misses();
+	if (profile_counters & ULOGD_PROFILE_ALLOCS)
+		s->allocs = profile_allocs();
+	clock_gettime(CLOCK_MONOTONIC, &s->ts);
+}
+
+/* called by the thread running 'pi', like the other counters */
+static void profile_end(struct ulogd_pluginstance *pi,
+			const struct profile_sample *s)
+{
+	struct ulogd_pluginstance_stats *st = &pi->stats;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	st->ns += (now.tv_sec - s->ts.tv_sec) * 1000000000LL +
+		  now.tv_nsec - s->ts.tv_nsec;
+	if (profile_counters & ULOGD_PROFILE_ALLOCS)
+		st->allocs += profile_allocs() - s->allocs;
+	if (profile_counters & ULOGD_PROFILE_MISSES)
+		st->cache_misses += profile_read_misses() - s->misses;
+}
+
+int ulogd_profile_interp(struct ulogd_pluginstance *pi,
+			 int (*interp)(struct ulogd_pluginstance *pi))
+{
+	struct profile_sample s;
+	int ret;
+
+	profile_begin(&s);
+	ret = interp(pi);
+	profile_end(pi, &s);
+
+	return ret;
+}
+
+int ulogd_profile_interp_batch(struct ulogd_pluginstance *pi,
+			       int (*interp_batch)(struct ulogd_pluginstance *pi,
+						   struct ulogd_batch *batch),
+			       struct ulogd_batch *batch)
+{
+	struct profile_sample s;
+	int ret;
+
+	profile_begin(&s);
+	ret = interp_batch(pi, batch);
+	profile_end(pi, &s);
+
+	return ret;
+}
+
+unsigned int ulogd_profile_counters(void)
+{
+	return profile_counters;
+}
+
+void ulogd_profile_start(void)
+{
+	int fd;
+
+	profile_counters = ULOGD_PROFILE_TIME;
+
+	profile_allocs = dlsym(RTLD_DEFAULT, "ulogd_profile_allocs");
+	if (profile_allocs)
+		profile_counters |= ULOGD_PROFILE_ALLOCS;
+
+	if (pthread_key_create(&profile_key, profile_close) == 0) {
+		fd = profile_open();
+		if (fd >= 0) {
+			profile_set_fd(fd);
+			profile_counters |= ULOGD_PROFILE_MISSES;
+		} else
+			ulogd_log(ULOGD_NOTICE, "not counting cache misses: "
+				  "%s\n", strerror(errno));
+	}
+
+	ulogd_log(ULOGD_INFO, "profiling plugins%s%s\n",
+		  profile_counters & ULOGD_PROFILE_ALLOCS ?
+		  ", counting allocations" : "",
+		  profile_counters & ULOGD_PROFILE_MISSES ?
+		  ", counting cache misses" : "");
+	ulogd_profiling = 1;
+}
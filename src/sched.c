@@ -0,0 +1,209 @@
+/* CPU affinity and scheduling policy
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  The main loop, which reads the input plugins, can be bound to the CPUs
+ *  listed in cpu_affinity and the stack threads and the threads of the
+ *  plugins (e.g. the ring buffer thread of the database outputs) to the
+ *  ones in thread_cpu_affinity.  Without thread_cpu_affinity, the threads
+ *  keep the CPUs ulogd was started with, so pinning the main loop doesn't
+ *  pin the outputs along with it.
+ *
+ *  Threads are registered by whoever creates them, either before the config
+ *  file is parsed completely or later on, so the settings are applied when
+ *  the thread is registered or by ulogd_sched_setup(), whichever is last.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/sched.h>
+
+struct ulogd_thread {
+	struct llist_head	list;
+	pthread_t		thread;
+};
+
+static LLIST_HEAD(ulogd_threads);
+static int sched_ready;
+static int sched_policy;
+static struct sched_param sched_param;
+/* CPUs of the threads, if they have to be set at all */
+static cpu_set_t thread_set;
+static int thread_set_valid;
+
+static const struct {
+	const char	*name;
+	int		policy;
+} sched_policies[] = {
+	{ "rr",		SCHED_RR },
+	{ "fifo",	SCHED_FIFO },
+	{ "other",	SCHED_OTHER },
+	{ "batch",	SCHED_BATCH },
+	{ "idle",	SCHED_IDLE },
+};
+
+/* parse a list like "0-3,6,8-11" */
+static int parse_cpu_list(const char *s, cpu_set_t *set)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(set);
+	while (*s) {
+		first = strtoul(s, &end, 10);
+		if (end == s)
+			return -1;
+
+		last = first;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtoul(s, &end, 10);
+			if (end == s || last < first)
+				return -1;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+
+		s = end;
+		if (*s == ',')
+			s++;
+		else if (*s)
+			return -1;
+	}
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+static void thread_apply(pthread_t thread)
+{
+	int ret;
+
+	if (thread_set_valid) {
+		ret = pthread_setaffinity_np(thread, sizeof(thread_set),
+					     &thread_set);
+		if (ret != 0)
+			ulogd_log(ULOGD_ERROR, "can't set CPU affinity of "
+				  "thread: %s\n", strerror(ret));
+	}
+
+	/* threads only inherit it if they are created afterwards */
+	pthread_setschedparam(thread, sched_policy, &sched_param);
+}
+
+void ulogd_thread_register(pthread_t thread)
+{
+	struct ulogd_thread *t;
+
+	t = malloc(sizeof(*t));
+	if (t == NULL) {
+		ulogd_log(ULOGD_ERROR, "OOM registering thread\n");
+		return;
+	}
+	t->thread = thread;
+	llist_add_tail(&t->list, &ulogd_threads);
+
+	if (sched_ready)
+		thread_apply(thread);
+}
+
+void ulogd_thread_unregister(pthread_t thread)
+{
+	struct ulogd_thread *t, *tmp;
+
+	llist_for_each_entry_safe(t, tmp, &ulogd_threads, list) {
+		if (pthread_equal(t->thread, thread)) {
+			llist_del(&t->list);
+			free(t);
+			return;
+		}
+	}
+}
+
+int ulogd_sched_setup(const char *policy, int priority, const char *cpus,
+		      const char *thread_cpus)
+{
+	struct ulogd_thread *t;
+	cpu_set_t set;
+	unsigned int i;
+	int min, max;
+
+	for (i = 0; i < ARRAY_SIZE(sched_policies); i++) {
+		if (!strcmp(policy, sched_policies[i].name))
+			break;
+	}
+	if (i == ARRAY_SIZE(sched_policies)) {
+		ulogd_log(ULOGD_FATAL, "unknown scheduler `%s'\n", policy);
+		return -1;
+	}
+	sched_policy = sched_policies[i].policy;
+
+	/* the others only have the static priority 0 */
+	sched_param.sched_priority = 0;
+	if (sched_policy == SCHED_RR || sched_policy == SCHED_FIFO) {
+		min = sched_get_priority_min(sched_policy);
+		max = sched_get_priority_max(sched_policy);
+		if (priority == 0)
+			priority = max;
+		if (priority < min || priority > max) {
+			ulogd_log(ULOGD_FATAL, "scheduler_priority %d not "
+				  "in %d-%d\n", priority, min, max);
+			return -1;
+		}
+		sched_param.sched_priority = priority;
+	}
+
+	if (thread_cpus[0] != '\0') {
+		if (parse_cpu_list(thread_cpus, &thread_set) < 0) {
+			ulogd_log(ULOGD_FATAL, "invalid thread_cpu_affinity "
+				  "`%s'\n", thread_cpus);
+			return -1;
+		}
+		thread_set_valid = 1;
+	} else if (cpus[0] != '\0') {
+		if (sched_getaffinity(0, sizeof(thread_set), &thread_set) == 0)
+			thread_set_valid = 1;
+	}
+
+	if (cpus[0] != '\0') {
+		if (parse_cpu_list(cpus, &set) < 0) {
+			ulogd_log(ULOGD_FATAL, "invalid cpu_affinity `%s'\n",
+				  cpus);
+			return -1;
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+			ulogd_log(ULOGD_FATAL, "can't bind main loop to CPUs "
+				  "%s: %s\n", cpus, strerror(errno));
+			return -1;
+		}
+		ulogd_log(ULOGD_INFO, "main loop bound to CPUs %s\n", cpus);
+	}
+
+	if (sched_setscheduler(0, sched_policy, &sched_param) < 0)
+		fprintf(stderr, "WARNING: scheduler configuration failed:"
+			" %s\n", strerror(errno));
+
+	sched_ready = 1;
+	llist_for_each_entry(t, &ulogd_threads, list)
+		thread_apply(t->thread);
+
+	return 0;
+}
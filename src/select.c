@@ -14,17 +14,32 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program; if not, write to the Free Software
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  Two backends live in this file.  By default, the main loop is driven by
+ *  epoll(), so each wakeup only dispatches the file descriptors that are
+ *  actually ready and there is no FD_SETSIZE limit.  The historical select()
+ *  backend is kept for systems without epoll (./configure --disable-epoll).
+ *
+ *  If busy_poll is set and an input plugin has marked its socket with
+ *  ULOGD_FD_BUSY, the main loop polls without blocking for up to busy_poll
+ *  microseconds before it goes to sleep.  That saves the wakeup latency
+ *  when records arrive back to back, at the cost of a CPU spinning.  All
+ *  descriptors are polled, so the others don't starve under load.
  */
 
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/linuxlist.h>
 
-static int maxfd = 0;
-static fd_set readset, writeset, exceptset;
-static LLIST_HEAD(ulogd_fds);
+static unsigned int busy_poll;
+static unsigned int busy_fds;
+static struct ulogd_busy_poll_stats busy_stats;
 
-int ulogd_register_fd(struct ulogd_fd *fd)
+static int ulogd_fd_nonblock(struct ulogd_fd *fd)
 {
 	int flags;
 
@@ -37,7 +52,173 @@ int ulogd_register_fd(struct ulogd_fd *fd)
 	if (flags < 0)
 		return -1;
 
-	if (fd->when & ULOGD_FD_READ)
+	return 0;
+}
+
+#ifdef USE_EPOLL
+
+#include <sys/epoll.h>
+
+/* maximum number of events collected by a single epoll_wait() call */
+#define ULOGD_EPOLL_MAXEVENTS	64
+
+static int epfd = -1;
+
+/* events being dispatched by ulogd_select_main(), callbacks may unregister
+ * any descriptor, so pending entries referring to it have to be voided. */
+static struct epoll_event events[ULOGD_EPOLL_MAXEVENTS];
+static int nevents;
+
+static uint32_t ulogd_fd_epoll_events(struct ulogd_fd *fd)
+{
+	uint32_t ev = 0;
+
+	if ((fd->when & ULOGD_FD_READ) && !(fd->when & ULOGD_FD_PAUSED))
+		ev |= EPOLLIN;
+
+	if (fd->when & ULOGD_FD_WRITE)
+		ev |= EPOLLOUT;
+
+	if (fd->when & ULOGD_FD_EXCEPT)
+		ev |= EPOLLPRI;
+
+	if (fd->when & ULOGD_FD_EDGE)
+		ev |= EPOLLET;
+
+	return ev;
+}
+
+/* created on first use, the main loop may wait on it before any
+ * descriptor is registered, e.g. with timers only */
+static int ulogd_epoll_init(void)
+{
+	if (epfd < 0)
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+	return epfd;
+}
+
+int ulogd_register_fd(struct ulogd_fd *fd)
+{
+	struct epoll_event ev = {};
+
+	if (ulogd_fd_nonblock(fd) < 0)
+		return -1;
+
+	if (ulogd_epoll_init() < 0)
+		return -1;
+
+	ev.events = ulogd_fd_epoll_events(fd);
+	ev.data.ptr = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd->fd, &ev) < 0)
+		return -1;
+
+	if (fd->when & ULOGD_FD_BUSY)
+		busy_fds++;
+
+	return 0;
+}
+
+void ulogd_unregister_fd(struct ulogd_fd *fd)
+{
+	int i;
+
+	if (epfd >= 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd->fd, NULL);
+
+	if (fd->when & ULOGD_FD_BUSY)
+		busy_fds--;
+
+	for (i = 0; i < nevents; i++) {
+		if (events[i].data.ptr == fd)
+			events[i].data.ptr = NULL;
+	}
+}
+
+int ulogd_pause_fd(struct ulogd_fd *fd, int pause)
+{
+	struct epoll_event ev = {};
+
+	if (pause)
+		fd->when |= ULOGD_FD_PAUSED;
+	else
+		fd->when &= ~ULOGD_FD_PAUSED;
+
+	/* a readable descriptor is reported again once it is resumed */
+	ev.events = ulogd_fd_epoll_events(fd);
+	ev.data.ptr = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, fd->fd, &ev);
+}
+
+static int ulogd_select_wait(struct timeval *tv)
+{
+	int timeout = -1;
+	int i, n;
+
+	if (tv) {
+		/* round up, otherwise we spin until the timer expires */
+		timeout = tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+	}
+
+	if (ulogd_epoll_init() < 0)
+		return -1;
+
+	n = epoll_wait(epfd, events, ULOGD_EPOLL_MAXEVENTS, timeout);
+	if (n <= 0) {
+		/* like select(), tell the main loop that the timer expired */
+		if (n == 0 && tv)
+			timerclear(tv);
+		return n;
+	}
+
+	/* call registered callback functions */
+	nevents = n;
+	for (i = 0; i < n; i++) {
+		struct ulogd_fd *ufd = events[i].data.ptr;
+		unsigned int flags = 0;
+
+		if (ufd == NULL)
+			continue;
+
+		if (events[i].events & EPOLLIN)
+			flags |= ULOGD_FD_READ;
+
+		if (events[i].events & EPOLLOUT)
+			flags |= ULOGD_FD_WRITE;
+
+		if (events[i].events & EPOLLPRI)
+			flags |= ULOGD_FD_EXCEPT;
+
+		/* let the callback notice errors and hangups on its own */
+		if (events[i].events & (EPOLLHUP | EPOLLERR))
+			flags |= ULOGD_FD_READ | ULOGD_FD_WRITE;
+
+		/* report only what the callback has asked for */
+		flags &= ufd->when;
+		if (flags)
+			ufd->cb(ufd->fd, flags, ufd->data);
+	}
+	nevents = 0;
+
+	return n;
+}
+
+#else /* !USE_EPOLL */
+
+static int maxfd = 0;
+static fd_set readset, writeset, exceptset;
+static LLIST_HEAD(ulogd_fds);
+
+int ulogd_register_fd(struct ulogd_fd *fd)
+{
+	if (fd->fd >= FD_SETSIZE) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	if (ulogd_fd_nonblock(fd) < 0)
+		return -1;
+
+	if ((fd->when & ULOGD_FD_READ) && !(fd->when & ULOGD_FD_PAUSED))
 		FD_SET(fd->fd, &readset);
 
 	if (fd->when & ULOGD_FD_WRITE)
@@ -52,6 +233,9 @@ int ulogd_register_fd(struct ulogd_fd *fd)
 
 	llist_add_tail(&fd->list, &ulogd_fds);
 
+	if (fd->when & ULOGD_FD_BUSY)
+		busy_fds++;
+
 	return 0;
 }
 
@@ -68,6 +252,9 @@ void ulogd_unregister_fd(struct ulogd_fd *fd)
 
 	llist_del(&fd->list);
 
+	if (fd->when & ULOGD_FD_BUSY)
+		busy_fds--;
+
 	/* Improvement: recalculate maxfd iif fd->fd == maxfd */
 	maxfd = -1;
 	llist_for_each_entry(fd, &ulogd_fds, list) {
@@ -76,7 +263,30 @@ void ulogd_unregister_fd(struct ulogd_fd *fd)
 	}
 }
 
-int ulogd_select_main(struct timeval *tv)
+int ulogd_pause_fd(struct ulogd_fd *fd, int pause)
+{
+	struct ulogd_fd *ufd;
+
+	if (pause)
+		fd->when |= ULOGD_FD_PAUSED;
+	else
+		fd->when &= ~ULOGD_FD_PAUSED;
+
+	/* only touch the sets if it is still registered */
+	llist_for_each_entry(ufd, &ulogd_fds, list) {
+		if (ufd != fd)
+			continue;
+		if (pause)
+			FD_CLR(fd->fd, &readset);
+		else if (fd->when & ULOGD_FD_READ)
+			FD_SET(fd->fd, &readset);
+		return 0;
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+static int ulogd_select_wait(struct timeval *tv)
 {
 	struct ulogd_fd *ufd;
 	fd_set rds_tmp, wrs_tmp, exs_tmp;
@@ -107,3 +317,78 @@ int ulogd_select_main(struct timeval *tv)
 	}
 	return i;
 }
+
+#endif /* USE_EPOLL */
+
+static long usec_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* poll until something is ready, busy_poll has passed or the next timer is
+ * due, the time spent is taken from tv */
+static int ulogd_select_busy(struct timeval *tv)
+{
+	struct timespec start;
+	struct timeval zero;
+	long budget = busy_poll, spent, left;
+	int n;
+
+	if (tv && tv->tv_sec * 1000000L + tv->tv_usec < budget)
+		budget = tv->tv_sec * 1000000L + tv->tv_usec;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		timerclear(&zero);
+		n = ulogd_select_wait(&zero);
+		if (n != 0) {
+			if (n > 0)
+				busy_stats.hits++;
+			return n;
+		}
+		busy_stats.polls++;
+		spent = usec_since(&start);
+	} while (spent < budget);
+
+	busy_stats.misses++;
+
+	if (tv) {
+		left = tv->tv_sec * 1000000L + tv->tv_usec - spent;
+		timerclear(tv);
+		if (left > 0) {
+			tv->tv_sec = left / 1000000;
+			tv->tv_usec = left % 1000000;
+		}
+	}
+	return 0;
+}
+
+int ulogd_select_main(struct timeval *tv)
+{
+	int n;
+
+	if (busy_poll && busy_fds && (tv == NULL || timerisset(tv))) {
+		n = ulogd_select_busy(tv);
+		if (n != 0)
+			return n;
+
+		/* the next timer is due, let the main loop run it */
+		if (tv && !timerisset(tv))
+			return 0;
+	}
+	return ulogd_select_wait(tv);
+}
+
+void ulogd_select_busy_poll(unsigned int usec)
+{
+	busy_poll = usec;
+}
+
+const struct ulogd_busy_poll_stats *ulogd_select_busy_stats(void)
+{
+	return busy_poll ? &busy_stats : NULL;
+}
@@ -0,0 +1,198 @@
+/* statistics file
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  The core counts, for each pluginstance, the records going in and out,
+ *  the ones stopped or failed, the receive buffer overruns of the sources
+ *  and the records they know they have lost, the records dropped on a full
+ *  queue, and the records shed and the pauses of the sources because of
+ *  backpressure.  Sources reading several datagrams per call also count
+ *  their reads, written with the average number of datagrams per read as
+ *  "batch", and may add counters of their own through the stats callback
+ *  of their plugin.  If stats_file is set, the counters are written there
+ *  as JSON every stats_interval seconds and once more on exit, along with
+ *  the busy polling counters of the main loop if busy_poll is set and the
+ *  profiling counters if profile is set.
+ *  The file is replaced atomically, so it can be read at any time, e.g. by
+ *  a monitoring system alerting on loss.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/stats.h>
+#include <ulogd/profile.h>
+
+static struct ulogd_timer stats_timer;
+static const char *stats_path;
+static unsigned int stats_interval;
+static struct llist_head *stats_stacks;
+static int stats_failed;
+
+static void stats_write_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/* the counters of the thread part of a stack are updated by the thread */
+static uint64_t stats_read(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void stats_write_pluginstance(FILE *f, struct ulogd_pluginstance *pi)
+{
+	struct ulogd_pluginstance_stats *st = &pi->stats;
+	unsigned int counters;
+
+	fprintf(f, "{\"id\": ");
+	stats_write_string(f, pi->id);
+	fprintf(f, ", \"plugin\": ");
+	stats_write_string(f, pi->plugin->name);
+	fprintf(f, ", \"in\": %"PRIu64", \"out\": %"PRIu64", "
+		"\"stop\": %"PRIu64", \"err\": %"PRIu64", "
+		"\"overrun\": %"PRIu64", \"lost\": %"PRIu64", "
+		"\"dropped\": %"PRIu64", "
+		"\"shed\": %"PRIu64", \"paused\": %"PRIu64,
+		stats_read(&st->in), stats_read(&st->out),
+		stats_read(&st->stop), stats_read(&st->err),
+		stats_read(&st->overrun), stats_read(&st->lost),
+		stats_read(&st->dropped),
+		stats_read(&st->shed), stats_read(&st->paused));
+
+	if (stats_read(&st->reads))
+		fprintf(f, ", \"reads\": %"PRIu64", \"msgs\": %"PRIu64", "
+			"\"batch\": %.2f", stats_read(&st->reads),
+			stats_read(&st->msgs),
+			(double)stats_read(&st->msgs) / stats_read(&st->reads));
+
+	counters = ulogd_profile_counters();
+	if (counters & ULOGD_PROFILE_TIME)
+		fprintf(f, ", \"ns\": %"PRIu64, stats_read(&st->ns));
+	if (counters & ULOGD_PROFILE_ALLOCS)
+		fprintf(f, ", \"allocs\": %"PRIu64, stats_read(&st->allocs));
+	if (counters & ULOGD_PROFILE_MISSES)
+		fprintf(f, ", \"cache_misses\": %"PRIu64,
+			stats_read(&st->cache_misses));
+
+	/* written by the main loop, which runs the sources */
+	if (pi->plugin->stats && pi->plugin->input.type == ULOGD_DTYPE_SOURCE)
+		pi->plugin->stats(pi, f);
+	fputc('}', f);
+}
+
+static int stats_write(void)
+{
+	const struct ulogd_busy_poll_stats *busy;
+	struct ulogd_pluginstance_stack *stack;
+	struct ulogd_pluginstance *pi;
+	char tmp[PATH_MAX];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+	f = fopen(tmp, "w");
+	if (f == NULL)
+		return -1;
+
+	fprintf(f, "{\"time\": %lu, \"stacks\": [", (unsigned long)time(NULL));
+	llist_for_each_entry(stack, stats_stacks, stack_list) {
+		fprintf(f, "%s\n  {\"name\": ",
+			stack->stack_list.prev == stats_stacks ? "" : ",");
+		stats_write_string(f, stack->name);
+		fprintf(f, ", \"pluginstances\": [");
+
+		llist_for_each_entry(pi, &stack->list, list) {
+			fprintf(f, "%s\n    ",
+				pi->list.prev == &stack->list ? "" : ",");
+			stats_write_pluginstance(f, pi);
+		}
+		fprintf(f, "\n  ]}");
+	}
+	fprintf(f, "\n]");
+
+	busy = ulogd_select_busy_stats();
+	if (busy)
+		fprintf(f, ", \"busy_poll\": {\"hits\": %"PRIu64", "
+			"\"misses\": %"PRIu64", \"polls\": %"PRIu64"}",
+			busy->hits, busy->misses, busy->polls);
+	fprintf(f, "}\n");
+
+	if (fclose(f) != 0 || rename(tmp, stats_path) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+static void stats_update(void)
+{
+	if (stats_write() < 0) {
+		/* log once until it works again */
+		if (!stats_failed)
+			ulogd_log(ULOGD_ERROR, "can't write stats file `%s': "
+				  "%s\n", stats_path, strerror(errno));
+		stats_failed = 1;
+	} else
+		stats_failed = 0;
+}
+
+static void stats_timer_cb(struct ulogd_timer *t, void *data)
+{
+	stats_update();
+	ulogd_add_timer(&stats_timer, stats_interval);
+}
+
+void ulogd_stats_start(const char *path, unsigned int interval,
+		       struct llist_head *stacks)
+{
+	if (path[0] == '\0')
+		return;
+
+	stats_path = path;
+	stats_interval = interval ? interval : 1;
+	stats_stacks = stacks;
+
+	ulogd_log(ULOGD_INFO, "writing stats to `%s' every %u seconds\n",
+		  stats_path, stats_interval);
+
+	ulogd_init_timer(&stats_timer, NULL, stats_timer_cb);
+	ulogd_add_timer(&stats_timer, stats_interval);
+}
+
+/* write the final counters */
+void ulogd_stats_stop(void)
+{
+	if (stats_path == NULL)
+		return;
+
+	if (ulogd_timer_pending(&stats_timer))
+		ulogd_del_timer(&stats_timer);
+
+	stats_update();
+	stats_path = NULL;
+}
@@ -22,141 +22,293 @@
  *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  *
  * Description:
- *  This is the timer framework for ulogd, it works together with select()
- *  so that the daemon only wakes up when there are timers expired to run.
+ *  This is the timer framework for ulogd, it works together with the main
+ *  loop so that the daemon only wakes up when there are timers expired to run.
  *  This approach is more simple than the previous signal-based implementation
  *  that could wake up the daemon while running at any part of the code.
  *
- * TODO:
- *  - This piece of code has been extracted from conntrackd. Probably
- *    ulogd doesn't require such O(log n) scalable timer framework. Anyhow,
- *    we can simplify this code using the same API later, that would be
- *    quite straight forward.
+ *  Timers are kept in a hierarchical timing wheel driven by CLOCK_MONOTONIC,
+ *  so adding and deleting a timer are O(1) and wall clock changes do not
+ *  affect them.  Level 0 has one slot per millisecond tick, every upper level
+ *  has slots 64 times as wide as the level below it.  When the lower level
+ *  wraps around, the timers of the current upper level slot are cascaded
+ *  down.  A bitmap of non-empty slots per level lets the wheel skip over
+ *  idle ticks and find the next expiry without walking the lists.
+ *
+ *  Every thread has its own set of timers: the main loop uses the default
+ *  base, stack threads attach their own one via ulogd_timer_set_thread_base().
+ *  A timer is always run by the thread that added it, so callbacks never race
+ *  with the plugin code of that thread.
  */
 
 #include <ulogd/timer.h>
 #include <stdlib.h>
-#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#define TIMER_MASK	(ULOGD_TIMER_SLOTS - 1)
+/* longest delay the wheel can hold, later timers are clamped to it */
+#define TIMER_MAX_DELTA	((1ULL << (ULOGD_TIMER_LEVELS * ULOGD_TIMER_BITS)) - 1)
+
+static struct ulogd_timer_base main_base;
+static __thread struct ulogd_timer_base *thread_base = &main_base;
+
+static uint64_t timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * ULOGD_TIMER_HZ +
+	       ts.tv_nsec / (1000000000 / ULOGD_TIMER_HZ);
+}
+
+void ulogd_timer_base_init(struct ulogd_timer_base *base)
+{
+	int i, j;
+
+	for (i = 0; i < ULOGD_TIMER_LEVELS; i++) {
+		for (j = 0; j < ULOGD_TIMER_SLOTS; j++)
+			INIT_LLIST_HEAD(&base->vec[i][j]);
+		base->pending[i] = 0;
+	}
+	INIT_LLIST_HEAD(&base->expired);
+	base->count = 0;
+	base->clk = timer_now();
+	base->initialized = 1;
+}
+
+static struct ulogd_timer_base *timer_base(void)
+{
+	if (!thread_base->initialized)
+		ulogd_timer_base_init(thread_base);
+
+	return thread_base;
+}
 
-static struct rb_root alarm_root = RB_ROOT;
+void ulogd_timer_set_thread_base(struct ulogd_timer_base *base)
+{
+	thread_base = base;
+}
 
 void ulogd_init_timer(struct ulogd_timer *t,
 		      void *data,
 		      void (*cb)(struct ulogd_timer *a, void *data))
 {
-	/* initialize the head to check whether a node is inserted */
-	RB_CLEAR_NODE(&t->node);
-	timerclear(&t->tv);
+	/* initialize the head to check whether a timer is queued */
+	INIT_LLIST_HEAD(&t->entry);
+	t->expires = 0;
+	t->base = NULL;
 	t->data = data;
 	t->cb = cb;
 }
 
-static void __add_timer(struct ulogd_timer *alarm)
+static void __add_timer(struct ulogd_timer_base *base, struct ulogd_timer *t)
 {
-	struct rb_node **new = &(alarm_root.rb_node);
-	struct rb_node *parent = NULL;
+	uint64_t expires = t->expires;
+	int64_t delta = expires - base->clk;
+	unsigned int level = 0, slot;
+
+	if (delta < 0) {
+		/* the wheel is past it already, run it with the next run */
+		llist_add_tail(&t->entry, &base->expired);
+		return;
+	}
 
-	while (*new) {
-		struct ulogd_timer *this;
+	if ((uint64_t)delta > TIMER_MAX_DELTA) {
+		expires = base->clk + TIMER_MAX_DELTA;
+		delta = TIMER_MAX_DELTA;
+	}
+	while (delta >> ((level + 1) * ULOGD_TIMER_BITS))
+		level++;
 
-		this = container_of(*new, struct ulogd_timer, node);
+	slot = (expires >> (level * ULOGD_TIMER_BITS)) & TIMER_MASK;
+	llist_add_tail(&t->entry, &base->vec[level][slot]);
+	base->pending[level] |= 1ULL << slot;
+}
 
-		parent = *new;
-		if (timercmp(&alarm->tv, &this->tv, <))
-			new = &((*new)->rb_left);
-		else
-			new = &((*new)->rb_right);
+static void add_timer_ticks(struct ulogd_timer *alarm, uint64_t ticks)
+{
+	struct ulogd_timer_base *base = timer_base();
+	uint64_t now = timer_now();
+
+	ulogd_del_timer(alarm);
+
+	/* nothing to catch up with, let the wheel jump to the present */
+	if (base->count == 0 && now > base->clk) {
+		memset(base->pending, 0, sizeof(base->pending));
+		base->clk = now;
 	}
 
-	rb_link_node(&alarm->node, parent, new);
-	rb_insert_color(&alarm->node, &alarm_root);
+	/* round up, a timer never runs before its time */
+	alarm->expires = now;
+	if (ticks)
+		alarm->expires += ticks + 1;
+	alarm->base = base;
+	base->count++;
+	__add_timer(base, alarm);
 }
 
 void ulogd_add_timer(struct ulogd_timer *alarm, unsigned long sc)
 {
-	struct timeval tv;
+	add_timer_ticks(alarm, (uint64_t)sc * ULOGD_TIMER_HZ);
+}
 
-	ulogd_del_timer(alarm);
-	alarm->tv.tv_sec = sc;
-	alarm->tv.tv_usec = 0;
-	gettimeofday(&tv, NULL);
-	timeradd(&alarm->tv, &tv, &alarm->tv);
-	__add_timer(alarm);
+void ulogd_add_timer_msec(struct ulogd_timer *alarm, unsigned long msec)
+{
+	add_timer_ticks(alarm, (uint64_t)msec * ULOGD_TIMER_HZ / 1000);
 }
 
 void ulogd_del_timer(struct ulogd_timer *alarm)
 {
-	/* don't remove a non-inserted node */
-	if (!RB_EMPTY_NODE(&alarm->node)) {
-		rb_erase(&alarm->node, &alarm_root);
-		RB_CLEAR_NODE(&alarm->node);
+	/* don't remove a non-queued timer, the pending bit of its slot is
+	 * cleared once the wheel gets there */
+	if (!llist_empty(&alarm->entry)) {
+		llist_del_init(&alarm->entry);
+		alarm->base->count--;
 	}
 }
 
 int ulogd_timer_pending(struct ulogd_timer *alarm)
 {
-	if (RB_EMPTY_NODE(&alarm->node))
-		return 0;
+	return !llist_empty(&alarm->entry);
+}
 
-	return 1;
+/* move the timers of the current slot of @level to the levels below */
+static unsigned int cascade(struct ulogd_timer_base *base, unsigned int level)
+{
+	unsigned int slot;
+	struct ulogd_timer *t, *tmp;
+	LLIST_HEAD(list);
+
+	slot = (base->clk >> (level * ULOGD_TIMER_BITS)) & TIMER_MASK;
+	llist_splice_init(&base->vec[level][slot], &list);
+	base->pending[level] &= ~(1ULL << slot);
+
+	llist_for_each_entry_safe(t, tmp, &list, entry)
+		__add_timer(base, t);
+
+	return slot;
 }
 
-static struct timeval *
-calculate_next_run(struct timeval *cand,
-		   struct timeval *tv,
-		   struct timeval *next_run)
+static void run_wheel(struct ulogd_timer_base *base, uint64_t now,
+		      struct llist_head *queue)
 {
-	if (cand->tv_sec != LONG_MAX) {
-		if (timercmp(cand, tv, >))
-			timersub(cand, tv, next_run);
-		else {
-			/* loop again inmediately */
-			next_run->tv_sec = 0;
-			next_run->tv_usec = 0;
+	llist_splice_init(&base->expired, queue->prev);
+
+	while (base->clk <= now) {
+		unsigned int idx = base->clk & TIMER_MASK;
+		unsigned int level;
+		uint64_t bits, step;
+
+		if (idx == 0) {
+			for (level = 1; level < ULOGD_TIMER_LEVELS; level++) {
+				if (cascade(base, level) != 0)
+					break;
+			}
+		}
+
+		if (base->pending[0] & (1ULL << idx)) {
+			llist_splice_init(&base->vec[0][idx], queue->prev);
+			base->pending[0] &= ~(1ULL << idx);
 		}
-		return next_run;
+
+		/* skip to the next busy slot or to the next cascade */
+		bits = (base->pending[0] >> idx) >> 1;
+		if (bits)
+			step = __builtin_ctzll(bits) + 1;
+		else
+			step = ULOGD_TIMER_SLOTS - idx;
+		if (step > now - base->clk + 1)
+			step = now - base->clk + 1;
+		base->clk += step;
 	}
-	return NULL;
 }
 
-struct timeval *ulogd_get_next_timer_run(struct timeval *next_run)
+/* earliest tick the wheel has to look at, it may be earlier than the
+ * expiry of the first timer if that one still has to be cascaded */
+static int next_expiry(struct ulogd_timer_base *base, uint64_t *next)
 {
-	struct rb_node *node;
-	struct timeval tv;
+	uint64_t best = UINT64_MAX;
+	unsigned int level;
+
+	if (base->count == 0)
+		return 0;
+
+	if (!llist_empty(&base->expired)) {
+		*next = 0;
+		return 1;
+	}
 
-	gettimeofday(&tv, NULL);
+	for (level = 0; level < ULOGD_TIMER_LEVELS; level++) {
+		unsigned int shift = level * ULOGD_TIMER_BITS;
+		uint64_t pos = base->clk >> shift;
+		uint64_t pending = base->pending[level];
+		unsigned int idx = pos & TIMER_MASK;
+		uint64_t d, when;
 
-	node = rb_first(&alarm_root);
-	if (node) {
-		struct ulogd_timer *this;
-		this = container_of(node, struct ulogd_timer, node);
-		return calculate_next_run(&this->tv, &tv, next_run);
+		if (!pending)
+			continue;
+
+		/* distance in slots from the current one */
+		pending = (pending >> idx) |
+			  (pending << ((ULOGD_TIMER_SLOTS - idx) & TIMER_MASK));
+		d = __builtin_ctzll(pending);
+
+		if (level == 0) {
+			when = base->clk + d;
+		} else {
+			/* the current slot was cascaded already, unless the
+			 * wheel is just about to do it */
+			if (d == 0 && (base->clk & ((1ULL << shift) - 1)))
+				d = ULOGD_TIMER_SLOTS;
+			when = (pos + d) << shift;
+		}
+		if (when < best)
+			best = when;
 	}
-	return NULL;
+
+	if (best == UINT64_MAX)
+		return 0;
+
+	*next = best;
+	return 1;
 }
 
-struct timeval *ulogd_do_timer_run(struct timeval *next_run)
+struct timeval *ulogd_get_next_timer_run(struct timeval *next_run)
 {
-	struct llist_head alarm_run_queue;
-	struct rb_node *node;
-	struct ulogd_timer *this;
-	struct timeval tv;
+	uint64_t next, now;
 
-	gettimeofday(&tv, NULL);
+	if (!next_expiry(timer_base(), &next))
+		return NULL;
 
-	INIT_LLIST_HEAD(&alarm_run_queue);
-	for (node = rb_first(&alarm_root); node; node = rb_next(node)) {
-		this = container_of(node, struct ulogd_timer, node);
+	now = timer_now();
+	if (next > now) {
+		next -= now;
+		next_run->tv_sec = next / ULOGD_TIMER_HZ;
+		next_run->tv_usec = (next % ULOGD_TIMER_HZ) *
+				    (1000000 / ULOGD_TIMER_HZ);
+	} else {
+		/* loop again inmediately */
+		next_run->tv_sec = 0;
+		next_run->tv_usec = 0;
+	}
+	return next_run;
+}
 
-		if (timercmp(&this->tv, &tv, >))
-			break;
+struct timeval *ulogd_do_timer_run(struct timeval *next_run)
+{
+	struct ulogd_timer_base *base = timer_base();
+	struct ulogd_timer *this;
+	LLIST_HEAD(alarm_run_queue);
 
-		llist_add(&this->list, &alarm_run_queue);
-	}
+	run_wheel(base, timer_now(), &alarm_run_queue);
 
-	llist_for_each_entry(this, &alarm_run_queue, list) {
-		rb_erase(&this->node, &alarm_root);
-		RB_CLEAR_NODE(&this->node);
+	/* callbacks may add or delete any timer, queued ones included */
+	while (!llist_empty(&alarm_run_queue)) {
+		this = llist_entry(alarm_run_queue.next,
+				   struct ulogd_timer, entry);
+		llist_del_init(&this->entry);
+		base->count--;
 		this->cb(this, this->data);
 	}
 
@@ -64,9 +64,15 @@
 #include <syslog.h>
 #include <sys/time.h>
 #include <sys/stat.h>
-#include <sched.h>
+#include <pthread.h>
 #include <ulogd/conffile.h>
 #include <ulogd/ulogd.h>
+#include <ulogd/worker.h>
+#include <ulogd/stats.h>
+#include <ulogd/profile.h>
+#include <ulogd/backpressure.h>
+#include <ulogd/sched.h>
+#include <ulogd/log.h>
 #ifdef DEBUG
 #define DEBUGP(format, args...) fprintf(stderr, format, ## args)
 #else
@@ -88,6 +94,9 @@ static FILE *syslog_dummy;
 
 static int info_mode = 0;
 
+/* serializes the writes to the logfile and reopening it */
+static pthread_mutex_t ulogd_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int verbose = 0;
 static int created_pidfile = 0;
 
@@ -119,6 +128,8 @@ static LLIST_HEAD(ulogd_plugins);
 /* linked list for all plugins handle */
 static LLIST_HEAD(ulogd_plugins_handle);
 static LLIST_HEAD(ulogd_pi_stacks);
+/* stacks of the previous configuration while reloading it */
+static LLIST_HEAD(ulogd_old_stacks);
 
 
 static int load_plugin(const char *file);
@@ -127,7 +138,7 @@ static int logfile_open(const char *name);
 static void cleanup_pidfile();
 
 static struct config_keyset ulogd_kset = {
-	.num_ces = 4,
+	.num_ces = 19,
 	.ces = {
 		{
 			.key = "logfile",
@@ -153,6 +164,96 @@ static struct config_keyset ulogd_kset = {
 			.options = CONFIG_OPT_MULTI,
 			.u.parser = &create_stack,
 		},
+		{
+			.key = "stack_threads",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key = "stack_queue_len",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1024,
+		},
+		{
+			.key = "batch_size",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		{
+			.key = "stats_file",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "",
+		},
+		{
+			.key = "stats_interval",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 10,
+		},
+		{
+			.key = "scheduler",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "rr",
+		},
+		{
+			.key = "scheduler_priority",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key = "cpu_affinity",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "",
+		},
+		{
+			.key = "thread_cpu_affinity",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "",
+		},
+		{
+			.key = "busy_poll",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key = "log_burst",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 10,
+		},
+		{
+			.key = "log_interval",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 5,
+		},
+		{
+			.key = "profile",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key = "backpressure",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "none",
+		},
+		{
+			.key = "backpressure_sample",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 10,
+		},
 	},
 };
 
@@ -160,6 +261,21 @@ static struct config_keyset ulogd_kset = {
 #define plugin_ce	ulogd_kset.ces[1]
 #define loglevel_ce	ulogd_kset.ces[2]
 #define stack_ce	ulogd_kset.ces[3]
+#define stack_threads_ce	ulogd_kset.ces[4]
+#define stack_queue_len_ce	ulogd_kset.ces[5]
+#define batch_size_ce	ulogd_kset.ces[6]
+#define stats_file_ce	ulogd_kset.ces[7]
+#define stats_interval_ce	ulogd_kset.ces[8]
+#define scheduler_ce	ulogd_kset.ces[9]
+#define scheduler_priority_ce	ulogd_kset.ces[10]
+#define cpu_affinity_ce	ulogd_kset.ces[11]
+#define thread_cpu_affinity_ce	ulogd_kset.ces[12]
+#define busy_poll_ce	ulogd_kset.ces[13]
+#define log_burst_ce	ulogd_kset.ces[14]
+#define log_interval_ce	ulogd_kset.ces[15]
+#define profile_ce	ulogd_kset.ces[16]
+#define backpressure_ce	ulogd_kset.ces[17]
+#define backpressure_sample_ce	ulogd_kset.ces[18]
 
 /***********************************************************************
  * UTILITY FUNCTIONS FOR PLUGINS
@@ -515,54 +631,58 @@ static inline int ulogd2syslog_level(int level)
 }
 
 /* log message to the logfile */
-void __ulogd_log(int level, char *file, int line, const char *format, ...)
+void __ulogd_log(struct ulogd_log_site *site, int level, char *file, int line,
+		 const char *format, ...)
 {
-	char *timestr;
 	va_list ap;
-	time_t tm;
-	FILE *outfd;
 
 	/* log only messages which have level at least as high as loglevel */
 	if (level < loglevel_ce.u.value)
 		return;
 
+	va_start(ap, format);
+	ulogd_log_vqueue(site, level, file, line, format, ap);
+	va_end(ap);
+}
+
+/* write a formatted message, called by the log thread once it runs */
+void ulogd_log_output(int level, const char *file, int line, time_t tm,
+		      const char *msg)
+{
+	char timestr[32];
+	FILE *outfd;
+
+	pthread_mutex_lock(&ulogd_log_lock);
+
 	if (logfile == syslog_dummy) {
 		/* FIXME: this omits the 'file' string */
-		va_start(ap, format);
-		vsyslog(ulogd2syslog_level(level), format, ap);
-		va_end(ap);
+		syslog(ulogd2syslog_level(level), "%s", msg);
 	} else {
 		if (logfile)
 			outfd = logfile;
 		else
 			outfd = stderr;
 
-		tm = time(NULL);
-		timestr = ctime(&tm);
+		ctime_r(&tm, timestr);
 		timestr[strlen(timestr)-1] = '\0';
-		fprintf(outfd, "%s <%1.1d> %s:%d ", timestr, level, file, line);
-		if (verbose && outfd != stderr)
-			fprintf(stderr, "%s <%1.1d> %s:%d ", timestr, level, file, line);
-
-
-		va_start(ap, format);
-		vfprintf(outfd, format, ap);
-		va_end(ap);
+		fprintf(outfd, "%s <%1.1d> %s:%d %s", timestr, level, file,
+			line, msg);
 		/* flush glibc's buffer */
 		fflush(outfd);
 
 		if (verbose && outfd != stderr) {
-			va_start(ap, format);
-			vfprintf(stderr, format, ap);
-			va_end(ap);
+			fprintf(stderr, "%s <%1.1d> %s:%d %s", timestr, level,
+				file, line, msg);
 			fflush(stderr);
 		}
-
 	}
+
+	pthread_mutex_unlock(&ulogd_log_lock);
 }
 
 static void warn_and_exit(int daemonize)
 {
+	ulogd_log_stop();
 	cleanup_pidfile();
 
 	if (!daemonize) {
@@ -577,78 +697,293 @@ static void warn_and_exit(int daemonize)
 exit(1);
 }
 
-/* clean results (set all values to 0 and free pointers) */
-static void ulogd_clean_results(struct ulogd_pluginstance *pi)
+/* set the values of the keys holding a result to 0, the other keys are
+ * already clean */
+static void ulogd_clean_keys(struct ulogd_key *keys, unsigned int num_keys)
 {
-	struct ulogd_pluginstance *cur;
+	unsigned long *valid;
+	unsigned int i;
 
-	DEBUGP("cleaning up results\n");
+	if (num_keys == 0)
+		return;
 
-	/* iterate through plugin stack */
-	llist_for_each_entry(cur, &pi->stack->list, list) {
-		unsigned int i;
-		
-		/* iterate through input keys of pluginstance */
-		for (i = 0; i < cur->output.num_keys; i++) {
-			struct ulogd_key *key = &cur->output.keys[i];
+	valid = keys[0].valid;
+	for (i = 0; i < ULOGD_VALID_WORDS(num_keys); i++) {
+		unsigned long bits = valid[i];
 
-			if (!(key->flags & ULOGD_RETF_VALID))
-				continue;
+		valid[i] = 0;
+		while (bits) {
+			struct ulogd_key *key = &keys[i * ULOGD_BITS_PER_LONG +
+						      __builtin_ctzl(bits)];
 
-			if (key->flags & ULOGD_RETF_FREE) {
-				free(key->u.value.ptr);
-				key->u.value.ptr = NULL;
-			}
+			bits &= bits - 1;
 			memset(&key->u.value, 0, sizeof(key->u.value));
-			key->flags &= ~ULOGD_RETF_VALID;
 		}
 	}
 }
 
+/* clean results of the first 'num' records of the steps from 'start' up to
+ * 'end' (excluded) */
+static void ulogd_clean_results(struct ulogd_plan *plan, unsigned int start,
+				unsigned int end, unsigned int num)
+{
+	unsigned int i;
+
+	DEBUGP("cleaning up results\n");
+
+	for (; start < end; start++) {
+		struct ulogd_pluginstance *pi = plan->steps[start].pi;
+
+		for (i = 0; i < num; i++)
+			ulogd_clean_keys(ulogd_batch_okeys(pi, i),
+					 pi->output.num_keys);
+	}
+}
+
+/* check and account the return value of interp(), returns -1 if the stack
+ * has to be aborted */
+static int ulogd_interp_ret(struct ulogd_pluginstance *pi, int ret)
+{
+	switch (ret) {
+	case ULOGD_IRET_OK:
+		/* we shall continue travelling down the stack */
+		pi->stats.out++;
+		return 0;
+	case ULOGD_IRET_ERR:
+		pi->stats.err++;
+		ulogd_log(ULOGD_NOTICE,
+			  "error during propagate_results\n");
+		return -1;
+	case ULOGD_IRET_STOP:
+		/* we shall abort further iteration of the stack */
+		pi->stats.stop++;
+		return -1;
+	default:
+		pi->stats.err++;
+		ulogd_log(ULOGD_NOTICE,
+			  "unknown return value `%d' from plugin %s\n",
+			  ret, pi->plugin->name);
+		return -1;
+	}
+}
+
+/* batch->ret[] of the records stopped by a previous plugin */
+#define ULOGD_BATCH_DONE	-3
+
+/* call interp() of the steps from 'i' up to 'end' (excluded), returns -1
+ * if the record has been stopped */
+static int ulogd_plan_run(struct ulogd_plan *plan, unsigned int i,
+			  unsigned int end)
+{
+	int stopped = 0;
+
+	while (i < end) {
+		struct ulogd_plan_step *step = &plan->steps[i];
+		int ret;
+
+		step->pi->stats.in++;
+		if (ulogd_profiling)
+			ret = ulogd_profile_interp(step->pi, step->interp);
+		else
+			ret = step->interp(step->pi);
+
+		if (ulogd_interp_ret(step->pi, ret) == 0) {
+			i++;
+			continue;
+		}
+
+		i = step->stop;
+		stopped = 1;
+	}
+
+	return stopped ? -1 : 0;
+}
+
+/* run the current record through the steps from 'i' up to the split of
+ * 'stack', the stacks forking off on the way get it once it has passed the
+ * steps they share */
+static void ulogd_stack_run(struct ulogd_pluginstance_stack *stack,
+			    unsigned int i)
+{
+	struct ulogd_plan *plan = &stack->plan;
+	unsigned int b;
+
+	for (b = 0; b < stack->num_branches; b++) {
+		struct ulogd_pluginstance_stack *br = stack->branches[b];
+
+		/* stopped by a plugin they share */
+		if (ulogd_plan_run(plan, i, br->fork) < 0)
+			return;
+		i = br->fork;
+
+		/* the stacks with branches decide on their own part below */
+		if (br->num_branches == 0 && ulogd_backpressure_shed(br))
+			continue;
+
+		ulogd_stack_run(br, i);
+		ulogd_clean_results(&br->plan, i, br->plan.split, 1);
+		ulogd_arena_reset(&br->arena);
+	}
+
+	if (stack->num_branches && ulogd_backpressure_shed(stack))
+		return;
+
+	/* the part after the split runs in the stack thread, if any */
+	if (ulogd_plan_run(plan, i, plan->split) == 0 && stack->worker)
+		ulogd_worker_enqueue(stack->worker);
+}
+
 /* propagate results to all downstream plugins in the stack */
 void ulogd_propagate_results(struct ulogd_pluginstance *pi)
 {
-	struct ulogd_pluginstance *cur = pi;
-	int abort_stack = 0;
-	/* iterate over remaining plugin stack */
-	llist_for_each_entry_continue(cur, &pi->stack->list, list) {
-		int ret;
-		
-		ret = cur->plugin->interp(cur);
-		switch (ret) {
-		case ULOGD_IRET_ERR:
-			ulogd_log(ULOGD_NOTICE,
-				  "error during propagate_results\n");
-			/* fallthrough */
-		case ULOGD_IRET_STOP:
-			/* we shall abort further iteration of the stack */
-			abort_stack = 1;
-			break;
-		case ULOGD_IRET_OK:
-			/* we shall continue travelling down the stack */
+	struct ulogd_pluginstance_stack *stack = pi->stack;
+	struct ulogd_plan *plan = &stack->plan;
+
+	pi->stats.out++;
+
+	/* shed as early as possible, before the record is even batched */
+	if (stack->num_branches == 0 && ulogd_backpressure_shed(stack)) {
+		ulogd_clean_keys(pi->output.keys, pi->output.num_keys);
+		if (stack->batch.num == 0)
+			ulogd_arena_reset(&stack->arena);
+		return;
+	}
+
+	if (stack->batch_size > 1) {
+		/* the source fills the keys of the next record meanwhile */
+		pi->output.keys += pi->output.num_keys;
+		if (++stack->batch.num == stack->batch_size)
+			ulogd_propagate_flush(pi);
+		return;
+	}
+
+	ulogd_stack_run(stack, 1);
+	ulogd_clean_results(plan, 0, plan->split, 1);
+	ulogd_arena_reset(&stack->arena);
+}
+
+/* exchange the results of record 0 and record 'i' of the steps from the
+ * source up to 'end' (excluded) */
+static void ulogd_batch_swap(struct ulogd_plan *plan, unsigned int end,
+			     unsigned int i)
+{
+	unsigned int s;
+
+	for (s = 0; s < end; s++) {
+		struct ulogd_pluginstance *cur = plan->steps[s].pi;
+		struct ulogd_key *a = cur->output.keys;
+		struct ulogd_key *b = ulogd_batch_okeys(cur, i);
+		unsigned int j;
+
+		if (cur->output.num_keys == 0)
 			continue;
-		default:
-			ulogd_log(ULOGD_NOTICE,
-				  "unknown return value `%d' from plugin %s\n",
-				  ret, cur->plugin->name);
-			abort_stack = 1;
-			break;
+
+		for (j = 0; j < ULOGD_VALID_WORDS(cur->output.num_keys); j++) {
+			unsigned long bits = a[0].valid[j];
+
+			a[0].valid[j] = b[0].valid[j];
+			b[0].valid[j] = bits;
 		}
 
-		if (abort_stack)
-			break;
+		for (j = 0; j < cur->output.num_keys; j++) {
+			union ulogd_key_value value = a[j].u.value;
+			uint32_t len = a[j].len;
+			uint16_t flags = a[j].flags;
+
+			a[j].u.value = b[j].u.value;
+			a[j].len = b[j].len;
+			a[j].flags = b[j].flags;
+			b[j].u.value = value;
+			b[j].len = len;
+			b[j].flags = flags;
+		}
 	}
+}
+
+/* process the records collected by the source plugin 'pi' */
+void ulogd_propagate_flush(struct ulogd_pluginstance *pi)
+{
+	struct ulogd_pluginstance_stack *stack = pi->stack;
+	struct ulogd_plan *plan = &stack->plan;
+	struct ulogd_batch *batch = &stack->batch;
+	unsigned int i, s, live;
+
+	if (batch->num == 0)
+		return;
+
+	pi->output.keys -= batch->num * pi->output.num_keys;
 
-	ulogd_clean_results(pi);
+	for (i = 0; i < batch->num; i++)
+		batch->ret[i] = ULOGD_IRET_OK;
+
+	/* the plugins at the beginning of the stack get all records at once */
+	live = batch->num;
+	for (s = 1; s < plan->batch_end; s++) {
+		struct ulogd_plan_step *step = &plan->steps[s];
+		int err = 0, ret;
+
+		step->pi->stats.in += live;
+		if (ulogd_profiling)
+			ret = ulogd_profile_interp_batch(step->pi,
+							 step->interp_batch,
+							 batch);
+		else
+			ret = step->interp_batch(step->pi, batch);
+		if (ret == ULOGD_IRET_ERR)
+			err = 1;
+
+		for (i = 0; i < batch->num; i++) {
+			if (batch->ret[i] == ULOGD_BATCH_DONE)
+				continue;
+			if (err && batch->ret[i] == ULOGD_IRET_OK)
+				batch->ret[i] = ULOGD_IRET_ERR;
+			if (ulogd_interp_ret(step->pi, batch->ret[i]) < 0) {
+				batch->ret[i] = ULOGD_BATCH_DONE;
+				live--;
+			}
+		}
+	}
+
+	/* the others are called for one record after the other, they may
+	 * keep results in their private data so each record has to reach
+	 * the end of the stack before the next one is handled */
+	for (i = 0; i < batch->num; i++) {
+		if (batch->ret[i] != ULOGD_IRET_OK)
+			continue;
+
+		if (i)
+			ulogd_batch_swap(plan, plan->batch_end, i);
+
+		ulogd_stack_run(stack, plan->batch_end);
+		ulogd_clean_results(plan, plan->batch_end, plan->split, 1);
+
+		if (i)
+			ulogd_batch_swap(plan, plan->batch_end, i);
+	}
+
+	ulogd_clean_results(plan, 0, plan->batch_end, batch->num);
+	ulogd_arena_reset(&stack->arena);
+	batch->num = 0;
 }
 
-static struct ulogd_pluginstance *
-pluginstance_alloc_init(struct ulogd_plugin *pl, char *pi_id,
-			struct ulogd_pluginstance_stack *stack)
+/* called by the stack thread for each record taken from its queue */
+void ulogd_propagate_split(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_plan *plan = &stack->plan;
+
+	ulogd_plan_run(plan, plan->split, plan->num_steps);
+	ulogd_clean_results(plan, plan->split, plan->num_steps, 1);
+	ulogd_arena_reset(&stack->worker->arena);
+}
+
+void *ulogd_alloc(struct ulogd_pluginstance *pi, size_t size)
+{
+	return ulogd_arena_alloc(pi->arena, size);
+}
+
+static unsigned int pluginstance_size(struct ulogd_plugin *pl)
 {
 	unsigned int size;
-	struct ulogd_pluginstance *pi;
-	void *ptr;
 
 	size = sizeof(struct ulogd_pluginstance);
 	size += pl->priv_size;
@@ -660,6 +995,27 @@ pluginstance_alloc_init(struct ulogd_plugin *pl, char *pi_id,
 	}
 	size += pl->input.num_keys * sizeof(struct ulogd_key);
 	size += pl->output.num_keys * sizeof(struct ulogd_key);
+
+	return size;
+}
+
+/* are 'keys' part of the pluginstance allocation or allocated apart? */
+static int pluginstance_embeds(struct ulogd_pluginstance *pi,
+			       struct ulogd_key *keys)
+{
+	return (void *)keys > (void *)pi &&
+	       (void *)keys < (void *)pi + pluginstance_size(pi->plugin);
+}
+
+static struct ulogd_pluginstance *
+pluginstance_alloc_init(struct ulogd_plugin *pl, char *pi_id,
+			struct ulogd_pluginstance_stack *stack)
+{
+	unsigned int size;
+	struct ulogd_pluginstance *pi;
+	void *ptr;
+
+	size = pluginstance_size(pl);
 	pi = malloc(size);
 	if (!pi)
 		return NULL;
@@ -716,6 +1072,12 @@ static int load_plugin(const char *file)
 {
 	void * handle;
 	struct ulogd_plugin_handle *ph;
+
+	llist_for_each_entry(ph, &ulogd_plugins_handle, list) {
+		if (!strcmp(ph->path, file))
+			return 0;
+	}
+
 	if ((handle = dlopen(file, RTLD_NOW)) == NULL) {
 		ulogd_log(ULOGD_ERROR, "load_plugin: '%s': %s\n", file,
 			  dlerror());
@@ -723,6 +1085,13 @@ static int load_plugin(const char *file)
 	}
 
 	ph = (struct ulogd_plugin_handle *) calloc(1, sizeof(*ph));
+	if (ph)
+		ph->path = strdup(file);
+	/* the plugin has registered itself already, it stays loaded */
+	if (!ph || !ph->path) {
+		free(ph);
+		return -1;
+	}
 	ph->handle = handle;
 	llist_add(&ph->list, &ulogd_plugins_handle);
 	return 0;
@@ -763,39 +1132,181 @@ static int load_all_plugins(void)
 	return 0;
 }
 
-/* find an output key in a given stack, starting at 'start' */
-static struct ulogd_key *
-find_okey_in_stack(char *name,
-		   struct ulogd_pluginstance_stack *stack,
-		   struct ulogd_pluginstance *start)
+/* pluginstance running step 'i' of 'stack' */
+static struct ulogd_pluginstance *
+stack_step_pi(struct ulogd_pluginstance_stack *stack, unsigned int i)
 {
+	while (i < stack->fork)
+		stack = stack->trunk;
+	return stack->plan.steps[i].pi;
+}
+
+/* find the step of 'stack' producing the output key 'okey' */
+static int find_okey_step(struct ulogd_pluginstance_stack *stack,
+			  struct ulogd_key *okey)
+{
+	unsigned int i;
+
+	for (i = 0; i < stack->plan.num_steps; i++) {
+		struct ulogd_pluginstance *pi = stack_step_pi(stack, i);
+
+		if (okey >= pi->output.keys &&
+		    okey < pi->output.keys + pi->output.num_keys)
+			return i;
+	}
+	return -1;
+}
+
+/* log the execution plan of a stack */
+static void ulogd_plan_dump(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_plan *plan = &stack->plan;
+	unsigned int i, j;
+
+	ulogd_log(ULOGD_DEBUG, "execution plan of stack `%s':\n", stack->name);
+	if (stack->trunk)
+		ulogd_log(ULOGD_DEBUG, "steps before %u run by stack `%s'\n",
+			  stack->fork, stack->trunk->name);
+
+	for (i = 0; i < plan->num_steps; i++) {
+		struct ulogd_plan_step *step = &plan->steps[i];
+		struct ulogd_pluginstance *pi = step->pi;
+
+		ulogd_log(ULOGD_DEBUG, "%2u: %s(%s)%s%s, stop: %u\n", i,
+			  pi->id, pi->plugin->name,
+			  stack->batch_size > 1 && i < plan->batch_end ?
+			  ", batch" : "",
+			  i >= plan->split ? ", thread" : "", step->stop);
+
+		for (j = 0; j < step->num_src; j++) {
+			struct ulogd_key *src = plan->sources[step->src + j];
+			struct ulogd_stack_worker *w = stack->worker;
+			int owner, queued = 0;
+
+			if (src == NULL)
+				continue;
+
+			/* mirror key filled by the stack thread */
+			if (w && src >= w->mirror &&
+			    src < w->mirror + w->num_keys) {
+				src = w->okeys[src - w->mirror];
+				queued = 1;
+			}
+
+			owner = find_okey_step(stack, src);
+			if (owner < 0)
+				continue;
+
+			ulogd_log(ULOGD_DEBUG, "      %s <- %d: %s%s\n",
+				  pi->input.keys[j].name, owner,
+				  src->name, queued ? " (queued)" : "");
+		}
+	}
+}
+
+/* flatten the stack into its execution plan, this has to be redone each
+ * time the keys of the stack are moved */
+static int create_stack_plan(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_plan *plan = &stack->plan;
+	struct ulogd_plan_step *steps;
+	struct ulogd_key **sources;
 	struct ulogd_pluginstance *pi;
+	unsigned int num_steps = 0, num_src = 0;
+	unsigned int batch_end, split;
+	unsigned int i = 0, j;
 
-	llist_for_each_entry_reverse(pi, &start->list, list) {
-		unsigned int i;
+	llist_for_each_entry(pi, &stack->list, list) {
+		num_steps++;
+		num_src += pi->input.num_keys;
+	}
+
+	steps = calloc(num_steps, sizeof(struct ulogd_plan_step));
+	sources = calloc(num_src + 1, sizeof(struct ulogd_key *));
+	if (!steps || !sources) {
+		free(steps);
+		free(sources);
+		return -ENOMEM;
+	}
 
-		if ((void *)&pi->list == &stack->list)
-			return NULL;
+	batch_end = split = num_steps;
+	num_src = 0;
+	llist_for_each_entry(pi, &stack->list, list) {
+		struct ulogd_plan_step *step = &steps[i];
+
+		step->interp = pi->plugin->interp;
+		step->interp_batch = pi->plugin->interp_batch;
+		step->pi = pi;
+		pi->arena = &stack->arena;
+		/* a stopped record is done with the whole stack */
+		step->stop = num_steps;
+		step->src = num_src;
+		step->num_src = pi->input.num_keys;
+		for (j = 0; j < pi->input.num_keys; j++)
+			sources[num_src++] = pi->input.keys[j].u.source;
+
+		if (pi == stack->batch_end)
+			batch_end = i;
+		if (stack->worker && pi == stack->worker->first)
+			split = i;
+		if (i >= split)
+			pi->arena = &stack->worker->arena;
+		i++;
+	}
 
+	free(plan->steps);
+	free(plan->sources);
+	plan->steps = steps;
+	plan->num_steps = num_steps;
+	plan->sources = sources;
+	plan->batch_end = batch_end < split ? batch_end : split;
+	plan->split = split;
+
+	return 0;
+}
+
+static int keyset_assign_ids(struct ulogd_keyset *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->num_keys; i++) {
+		set->keys[i].id = ulogd_keyid(set->keys[i].name);
+		if (set->keys[i].id == 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* mark the keys read by 'pi' ULOGD_RETF_NEEDED if it needs them: a sink
+ * always does, a filter if one of its own output keys is needed or it may
+ * drop records */
+static void pluginstance_mark_needed(struct ulogd_pluginstance *pi)
+{
+	unsigned int i;
+
+	if (!(pi->plugin->output.type & ULOGD_DTYPE_SINK) &&
+	    !(pi->plugin->flags & ULOGD_PLUGINF_DROP)) {
 		for (i = 0; i < pi->output.num_keys; i++) {
-			struct ulogd_key *okey = &pi->output.keys[i];
-			if (!strcmp(name, okey->name)) {
-				ulogd_log(ULOGD_DEBUG, "%s(%s)\n",
-					  pi->id, pi->plugin->name);
-				return okey;
-			}
+			if (IS_NEEDED(pi->output.keys[i]))
+				break;
 		}
+		if (i == pi->output.num_keys)
+			return;
 	}
 
-	return NULL;
+	for (i = 0; i < pi->input.num_keys; i++) {
+		if (pi->input.keys[i].u.source)
+			SET_NEEDED(*pi->input.keys[i].u.source);
+	}
 }
 
-/* resolve key connections from bottom to top of stack */
+/* resolve key connections from top to bottom of stack */
 static int
 create_stack_resolve_keys(struct ulogd_pluginstance_stack *stack)
 {
-	int i = 0;
 	struct ulogd_pluginstance *pi_cur;
+	struct ulogd_key **producer;
+	int ret;
 
 	/* pre-configuration pass */
 	llist_for_each_entry_reverse(pi_cur, &stack->list, list) {
@@ -803,9 +1314,9 @@ create_stack_resolve_keys(struct ulogd_pluginstance_stack *stack)
 			  pi_cur->plugin->name);
 		/* call plugin to tell us which keys it requires in
 		 * given configuration */
-		if (pi_cur->plugin->configure) {
-			int ret = pi_cur->plugin->configure(pi_cur, 
-							    stack);
+		/* a carried over source keeps its configuration */
+		if (pi_cur->plugin->configure && !pi_cur->started) {
+			ret = pi_cur->plugin->configure(pi_cur, stack);
 			if (ret < 0) {
 				ulogd_log(ULOGD_ERROR, "error during "
 					  "configure of plugin %s\n",
@@ -817,83 +1328,109 @@ create_stack_resolve_keys(struct ulogd_pluginstance_stack *stack)
 
 	/* PASS 2: */
 	ulogd_log(ULOGD_DEBUG, "connecting input/output keys of stack:\n");
-	llist_for_each_entry_reverse(pi_cur, &stack->list, list) {
+
+	/* configure() may have changed the keys, so they get their ids now */
+	llist_for_each_entry(pi_cur, &stack->list, list) {
+		if (keyset_assign_ids(&pi_cur->input) < 0 ||
+		    keyset_assign_ids(&pi_cur->output) < 0)
+			return -ENOMEM;
+	}
+
+	/* walking from the source, 'producer' maps every key id to the
+	 * output key of that name closest upstream */
+	producer = calloc(ulogd_keyid_max() + 1, sizeof(*producer));
+	if (producer == NULL)
+		return -ENOMEM;
+
+	llist_for_each_entry(pi_cur, &stack->list, list) {
 		struct ulogd_pluginstance *pi_prev =
 					llist_entry(pi_cur->list.prev,
 						   struct ulogd_pluginstance,
 						   list);
-		i++;
+		unsigned int j;
+
 		ulogd_log(ULOGD_DEBUG, "traversing plugin `%s'\n",
 			  pi_cur->plugin->name);
 
-		if (i == 1) {
-			/* first round: output plugin */
-			if (!(pi_cur->plugin->output.type & ULOGD_DTYPE_SINK)) {
-				ulogd_log(ULOGD_ERROR, "last plugin in stack "
-					  "has to be output plugin\n");
-				return -EINVAL;
-			}
-			/* continue further down */
-		} /* no "else' since first could be the last one, too ! */
+		if (pi_cur->list.next == &stack->list &&
+		    !(pi_cur->plugin->output.type & ULOGD_DTYPE_SINK)) {
+			ulogd_log(ULOGD_ERROR, "last plugin in stack "
+				  "has to be output plugin\n");
+			ret = -EINVAL;
+			goto out;
+		}
 
 		if (&pi_prev->list == &stack->list) {
-			/* this is the last one in the stack */
-			if (!(pi_cur->plugin->input.type 
+			/* this is the first one in the stack */
+			if (!(pi_cur->plugin->input.type
 						& ULOGD_DTYPE_SOURCE)) {
 				ulogd_log(ULOGD_ERROR, "first plugin in stack "
 					  "has to be source plugin\n");
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			/* no need to match keys */
-		} else {
-			unsigned int j;
-
-			/* not the last one in the stack */
-			if (!(pi_cur->plugin->input.type &
-					pi_prev->plugin->output.type)) {
-				ulogd_log(ULOGD_ERROR, "type mismatch between "
-					  "%s and %s in stack\n",
-					  pi_cur->plugin->name,
-					  pi_prev->plugin->name);
-			}
-	
-			for (j = 0; j < pi_cur->input.num_keys; j++) {
-				struct ulogd_key *okey;
-				struct ulogd_key *ikey = &pi_cur->input.keys[j];
+			goto publish;
+		}
 
-				/* skip those marked as 'inactive' by
-				 * pl->configure() */
-				if (ikey->flags & ULOGD_KEYF_INACTIVE)
-					continue;
+		if (!(pi_cur->plugin->input.type &
+				pi_prev->plugin->output.type)) {
+			ulogd_log(ULOGD_ERROR, "type mismatch between "
+				  "%s and %s in stack\n",
+				  pi_cur->plugin->name,
+				  pi_prev->plugin->name);
+		}
 
-				if (ikey->u.source) { 
-					ulogd_log(ULOGD_ERROR, "input key `%s' "
-						  "already has source\n",
-						  ikey->name);
+		for (j = 0; j < pi_cur->input.num_keys; j++) {
+			struct ulogd_key *okey;
+			struct ulogd_key *ikey = &pi_cur->input.keys[j];
 
-					return -EINVAL;
-				}
+			/* skip those marked as 'inactive' by
+			 * pl->configure() */
+			if (ikey->flags & ULOGD_KEYF_INACTIVE)
+				continue;
 
-				okey = find_okey_in_stack(ikey->name, 
-							  stack, pi_cur);
-				if (!okey) {
-					if (ikey->flags & ULOGD_KEYF_OPTIONAL)
-						continue;
-					ulogd_log(ULOGD_ERROR, "cannot find "
-						  "key `%s' in stack\n",
-						  ikey->name);
-					return -EINVAL;
-				}
+			if (ikey->u.source) {
+				ulogd_log(ULOGD_ERROR, "input key `%s' "
+					  "already has source\n",
+					  ikey->name);
+				ret = -EINVAL;
+				goto out;
+			}
 
-				ulogd_log(ULOGD_DEBUG, "assigning `%s(?)' as "
-					  "source for %s(%s)\n", okey->name,
-					  pi_cur->plugin->name, ikey->name);
-				ikey->u.source = okey;
+			okey = producer[ikey->id];
+			if (!okey) {
+				if (ikey->flags & ULOGD_KEYF_OPTIONAL)
+					continue;
+				ulogd_log(ULOGD_ERROR, "cannot find "
+					  "key `%s' in stack\n",
+					  ikey->name);
+				ret = -EINVAL;
+				goto out;
 			}
+
+			ulogd_log(ULOGD_DEBUG, "assigning `%s(?)' as "
+				  "source for %s(%s)\n", okey->name,
+				  pi_cur->plugin->name, ikey->name);
+			ikey->u.source = okey;
+		}
+
+publish:
+		for (j = 0; j < pi_cur->output.num_keys; j++) {
+			struct ulogd_key *okey = &pi_cur->output.keys[j];
+
+			producer[okey->id] = okey;
 		}
 	}
 
-	return 0;
+	/* the plugins may skip the keys nobody reads */
+	llist_for_each_entry_reverse(pi_cur, &stack->list, list)
+		pluginstance_mark_needed(pi_cur);
+
+	ret = create_stack_plan(stack);
+out:
+	free(producer);
+	return ret;
 }
 
 /* iterate on already defined stack to find a plugininstance matching */
@@ -919,13 +1456,206 @@ static int pluginstance_started(struct ulogd_pluginstance *npi)
 	return 0;
 }
 
-static int pluginstance_stop(struct ulogd_pluginstance *npi)
+/* allocate a copy of 'keys' for each of the 'num' records of a batch */
+static struct ulogd_key *keys_alloc_batch(struct ulogd_key *keys,
+					  unsigned int num_keys,
+					  unsigned int num)
+{
+	struct ulogd_key *batch;
+	unsigned int i;
+
+	batch = malloc(num * num_keys * sizeof(struct ulogd_key));
+	if (!batch)
+		return NULL;
+
+	for (i = 0; i < num; i++)
+		memcpy(batch + i * num_keys, keys,
+		       num_keys * sizeof(struct ulogd_key));
+
+	return batch;
+}
+
+/* find the pluginstance preceding 'upi' whose output contains 'okey' */
+static struct ulogd_pluginstance *
+find_okey_owner(struct ulogd_key *okey, struct ulogd_pluginstance *upi,
+		unsigned int num)
+{
+	struct ulogd_pluginstance *pi;
+
+	llist_for_each_entry(pi, &upi->stack->list, list) {
+		if (pi == upi)
+			break;
+		if (okey >= pi->output.keys &&
+		    okey < pi->output.keys + num * pi->output.num_keys)
+			return pi;
+	}
+	return NULL;
+}
+
+/* give 'pi' one set of keys per record of a batch of 'num' records */
+static int pluginstance_alloc_batch(struct ulogd_pluginstance *pi,
+				    unsigned int num)
+{
+	struct ulogd_pluginstance *cur;
+	struct ulogd_key *keys;
+	unsigned int i, j;
+
+	if (pi->input.num_keys) {
+		keys = keys_alloc_batch(pi->input.keys, pi->input.num_keys,
+					num);
+		if (!keys)
+			return -ENOMEM;
+
+		/* input keys of record i use the output keys of record i */
+		for (i = 1; i < num; i++) {
+			for (j = 0; j < pi->input.num_keys; j++) {
+				struct ulogd_key *ikey =
+					&keys[i * pi->input.num_keys + j];
+				struct ulogd_pluginstance *owner;
+
+				if (!ikey->u.source)
+					continue;
+
+				owner = find_okey_owner(ikey->u.source, pi,
+							num);
+				if (!owner) {
+					free(keys);
+					return -EINVAL;
+				}
+				ikey->u.source += i * owner->output.num_keys;
+			}
+		}
+
+		if (!pluginstance_embeds(pi, pi->input.keys))
+			free(pi->input.keys);
+		pi->input.keys = keys;
+	}
+
+	if (pi->output.num_keys) {
+		keys = keys_alloc_batch(pi->output.keys, pi->output.num_keys,
+					num);
+		if (!keys)
+			return -ENOMEM;
+
+		/* move the sources of the downstream input keys */
+		cur = pi;
+		llist_for_each_entry_continue(cur, &pi->stack->list, list) {
+			for (j = 0; j < cur->input.num_keys; j++) {
+				struct ulogd_key *ikey = &cur->input.keys[j];
+
+				if (ikey->u.source >= pi->output.keys &&
+				    ikey->u.source < pi->output.keys +
+						     pi->output.num_keys)
+					ikey->u.source = keys +
+						(ikey->u.source -
+						 pi->output.keys);
+			}
+		}
+
+		if (!pluginstance_embeds(pi, pi->output.keys))
+			free(pi->output.keys);
+		pi->output.keys = keys;
+	}
+
+	return 0;
+}
+
+/* let the source and the batch capable plugins following it handle
+ * several records at once */
+static int create_stack_batch(struct ulogd_pluginstance_stack *stack)
 {
-	if (--npi->plugin->usage > 0 &&
-	    npi->plugin->input.type == ULOGD_DTYPE_SOURCE) {
+	struct ulogd_pluginstance *src, *pi;
+	unsigned int num = batch_size_ce.u.value;
+	unsigned int i;
+	int ret;
+
+	stack->batch_size = 1;
+
+	src = llist_entry(stack->list.next, struct ulogd_pluginstance, list);
+	if (num <= 1 || !(src->plugin->flags & ULOGD_PLUGINF_BATCH))
 		return 0;
+
+	/* records can't wait if some values vanish once the source is done,
+	 * wildcard input keys (copies of the output keys, see
+	 * ulogd_wildcard_inputkeys()) don't look behind such pointers */
+	llist_for_each_entry(pi, &stack->list, list) {
+		for (i = 0; i < pi->input.num_keys; i++) {
+			struct ulogd_key *ikey = &pi->input.keys[i];
+			struct ulogd_key *okey = ikey->u.source;
+
+			if (okey && (okey->flags & ULOGD_KEYF_VOLATILE) &&
+			    !(ikey->flags & ULOGD_KEYF_VOLATILE)) {
+				ulogd_log(ULOGD_INFO, "`%s' needs key `%s', "
+					  "not batching stack\n", pi->id,
+					  okey->name);
+				return 0;
+			}
+		}
 	}
-	return 1;
+
+	stack->batch.ret = calloc(num, sizeof(int));
+	if (!stack->batch.ret)
+		return -ENOMEM;
+
+	pi = src;
+	llist_for_each_entry_from(pi, &stack->list, list) {
+		if (pi != src && (!pi->plugin->interp_batch ||
+				  pi == stack->split)) {
+			stack->batch_end = pi;
+			break;
+		}
+
+		ret = pluginstance_alloc_batch(pi, num);
+		if (ret < 0)
+			return ret;
+	}
+	stack->batch_size = num;
+
+	ulogd_log(ULOGD_INFO, "`%s' hands over up to %u records at once to "
+		  "`%s'\n", src->id, num, stack->batch_end ?
+		  stack->batch_end->id : "end of stack");
+
+	return 0;
+}
+
+/* hook the output keys of each record up to the valid bitmap of the stack,
+ * this has to be done once the keys won't move anymore */
+static int create_stack_valid(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_pluginstance *pi;
+	unsigned int num = stack->batch_size;
+	unsigned int off = 0;
+	unsigned int i, j;
+
+	llist_for_each_entry(pi, &stack->list, list)
+		stack->valid_words += ULOGD_VALID_WORDS(pi->output.num_keys);
+
+	stack->valid = calloc(stack->batch_size * stack->valid_words + 1,
+			      sizeof(unsigned long));
+	if (!stack->valid)
+		return -ENOMEM;
+
+	llist_for_each_entry(pi, &stack->list, list) {
+		/* only the plugins getting the whole batch have more than
+		 * one set of keys */
+		if (pi == stack->batch_end)
+			num = 1;
+
+		for (i = 0; i < num; i++) {
+			struct ulogd_key *keys = ulogd_batch_okeys(pi, i);
+			unsigned long *valid = stack->valid + off +
+					       i * stack->valid_words;
+
+			for (j = 0; j < pi->output.num_keys; j++) {
+				keys[j].valid = valid + j / ULOGD_BITS_PER_LONG;
+				keys[j].valid_mask =
+					1UL << (j % ULOGD_BITS_PER_LONG);
+			}
+		}
+		off += ULOGD_VALID_WORDS(pi->output.num_keys);
+	}
+
+	return 0;
 }
 
 static int create_stack_start_instances(struct ulogd_pluginstance_stack *stack)
@@ -935,19 +1665,202 @@ static int create_stack_start_instances(struct ulogd_pluginstance_stack *stack)
 
 	/* start from input to output plugin */
 	llist_for_each_entry(pi, &stack->list, list) {
-		if (!pi->plugin->start)
+		/* carried over from the previous configuration */
+		if (pi->started)
+			continue;
+
+		if (!pi->plugin->start) {
+			pi->started = 1;
+			continue;
+		}
+
+		/* only call start if a plugin with same ID was not started */
+		if (!pluginstance_started(pi)) {
+			ret = pi->plugin->start(pi);
+			if (ret < 0) {
+				ulogd_log(ULOGD_ERROR, 
+					  "error starting `%s'\n",
+					  pi->id);
+				return ret;
+			}
+			pi->started = 1;
+		}
+	}
+	return 0;
+}
+
+/* has the section of 'pi' in the config file changed since it was read */
+static int pluginstance_config_changed(struct ulogd_pluginstance *pi)
+{
+	struct config_keyset *kset;
+	unsigned int i;
+	size_t size;
+	int ret, changed = 0;
+
+	if (!pi->plugin->config_kset)
+		return 0;
+
+	/* parse it again over the defaults of the plugin */
+	size = sizeof(struct config_keyset) +
+	       pi->plugin->config_kset->num_ces * sizeof(struct config_entry);
+	kset = malloc(size);
+	if (!kset)
+		return 1;
+	memcpy(kset, pi->plugin->config_kset, size);
+	for (i = 0; i < kset->num_ces; i++)
+		kset->ces[i].hit = 0;
+
+	ret = config_parse_file(pi->id, kset);
+	if (ret < 0 && ret != -ERRSECTION)
+		changed = 1;
+
+	for (i = 0; i < kset->num_ces && !changed; i++) {
+		struct config_entry *ce = &kset->ces[i];
+		struct config_entry *cur = &pi->config_kset->ces[i];
+
+		switch (ce->type) {
+		case CONFIG_TYPE_INT:
+			changed = ce->u.value != cur->u.value;
+			break;
+		case CONFIG_TYPE_STRING:
+			changed = strcmp(ce->u.string, cur->u.string) != 0;
+			break;
+		}
+	}
+
+	free(kset);
+	return changed;
+}
+
+static int stack_config_changed(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_pluginstance *pi;
+
+	llist_for_each_entry(pi, &stack->list, list) {
+		if (pluginstance_config_changed(pi))
+			return 1;
+	}
+	return 0;
+}
+
+/* stop 'pi' if it was started and free it, reload_stacks() makes sure no
+ * stack that is kept shares a source being stopped */
+static void pluginstance_destroy(struct ulogd_pluginstance *pi)
+{
+	ulogd_backpressure_release(pi);
+
+	llist_del(&pi->plist);
+	INIT_LLIST_HEAD(&pi->plist);
+
+	if (pi->started && pi->plugin->stop) {
+		ulogd_log(ULOGD_DEBUG, "calling stop for %s\n",
+			  pi->plugin->name);
+		pi->plugin->stop(pi);
+	}
+
+	pi->plugin->usage--;
+	if (!pluginstance_embeds(pi, pi->input.keys))
+		free(pi->input.keys);
+	if (!pluginstance_embeds(pi, pi->output.keys))
+		free(pi->output.keys);
+	free(pi);
+}
+
+static void stack_free(struct ulogd_pluginstance_stack *stack)
+{
+	free(stack->batch.ret);
+	free(stack->valid);
+	free(stack->plan.steps);
+	free(stack->plan.sources);
+	free(stack->branches);
+	ulogd_arena_free(&stack->arena);
+	free(stack->name);
+	free(stack);
+}
+
+/* tear down a stack of the previous configuration */
+static void retire_stack(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_pluginstance *pi, *npi;
+
+	ulogd_log(ULOGD_NOTICE, "removing stack `%s'\n", stack->name);
+
+	/* the records queued to the stack thread still go through */
+	if (stack->worker) {
+		ulogd_worker_stop(stack->worker);
+		ulogd_worker_destroy(stack->worker);
+		stack->worker = NULL;
+	}
+
+	llist_for_each_entry_safe(pi, npi, &stack->list, list)
+		pluginstance_destroy(pi);
+
+	llist_del(&stack->stack_list);
+	stack_free(stack);
+}
+
+/* on reload, take the running source 'id' out of its old stack so that its
+ * state (netlink socket, hash tables, ...) carries over to the new one */
+static struct ulogd_pluginstance *
+takeover_source(struct ulogd_plugin *pl, const char *id,
+		struct ulogd_pluginstance_stack **donor)
+{
+	struct ulogd_pluginstance_stack *stack, *nstack;
+	struct ulogd_pluginstance *pi;
+
+	if (pl->input.type != ULOGD_DTYPE_SOURCE)
+		return NULL;
+
+	llist_for_each_entry(stack, &ulogd_old_stacks, stack_list) {
+		if (llist_empty(&stack->list))
+			continue;
+
+		pi = llist_entry(stack->list.next, struct ulogd_pluginstance,
+				 list);
+		if (!pi->started || strcmp(pi->id, id))
 			continue;
 
-		/* only call start if a plugin with same ID was not started */
-		if (!pluginstance_started(pi)) {
-			ret = pi->plugin->start(pi);
-			if (ret < 0) {
-				ulogd_log(ULOGD_ERROR, 
-					  "error starting `%s'\n",
-					  pi->id);
-				return ret;
-			}
+		if (pi->plugin == pl && !pluginstance_config_changed(pi)) {
+			ulogd_log(ULOGD_NOTICE, "carrying `%s' over to the "
+				  "new stack\n", id);
+			llist_del(&pi->list);
+			*donor = stack;
+			return pi;
+		}
+
+		/* the old instance has to go before the new one starts,
+		 * along with every stack sharing it */
+		llist_for_each_entry_safe(stack, nstack, &ulogd_old_stacks,
+					  stack_list) {
+			if (llist_empty(&stack->list))
+				continue;
+			pi = llist_entry(stack->list.next,
+					 struct ulogd_pluginstance, list);
+			if (!strcmp(pi->id, id))
+				retire_stack(stack);
+		}
+		break;
+	}
+	return NULL;
+}
+
+/* is the started instance of the source 'pi' shares in a kept stack */
+static int source_owner_kept(struct ulogd_pluginstance *pi)
+{
+	struct ulogd_pluginstance_stack *stack;
+	struct ulogd_pluginstance *owner;
+
+	if (pi->started)
+		return 1;
+
+	llist_for_each_entry(owner, &pi->plist, plist) {
+		if (!owner->started)
+			continue;
+		llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+			if (stack == owner->stack)
+				return 1;
 		}
+		return 0;
 	}
 	return 0;
 }
@@ -956,8 +1869,11 @@ static int create_stack_start_instances(struct ulogd_pluginstance_stack *stack)
 static int create_stack(const char *option)
 {
 	struct ulogd_pluginstance_stack *stack;
+	struct ulogd_pluginstance_stack *donor = NULL;
+	struct ulogd_pluginstance *pi, *npi, *carried = NULL;
 	char *buf = strdup(option);
 	char *tok;
+	int split = 0;
 	int ret;
 
 	if (llist_empty(&ulogd_plugins_handle))
@@ -969,21 +1885,27 @@ static int create_stack(const char *option)
 		goto out_buf;
 	}
 
-	stack = malloc(sizeof(*stack));
+	stack = calloc(1, sizeof(*stack));
 	if (!stack) {
 		ret = -ENOMEM;
 		goto out_stack;
 	}
 	INIT_LLIST_HEAD(&stack->list);
 
+	stack->name = strdup(option);
+	if (!stack->name) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	ulogd_log(ULOGD_NOTICE, "building new pluginstance stack: '%s'\n",
 		  option);
 
-	/* PASS 1: find and instanciate plugins of stack, link them together */
-	for (tok = strtok(buf, ",\n"); tok; tok = strtok(NULL, ",\n")) {
+	/* PASS 1: find and instanciate plugins of stack, link them together,
+	 * a '|' instead of ',' marks the start of the stack thread */
+	for (tok = strtok(buf, ",|\n"); tok; tok = strtok(NULL, ",|\n")) {
 		char *plname, *equals;
 		char pi_id[ULOGD_MAX_KEYLEN];
-		struct ulogd_pluginstance *pi;
 		struct ulogd_plugin *pl;
 
 		ulogd_log(ULOGD_DEBUG, "tok=`%s'\n", tok);
@@ -1008,16 +1930,24 @@ static int create_stack(const char *option)
 			ret = -ENODEV;
 			goto out;
 		}
-		pl->usage++;
-
-		/* allocate */
-		pi = pluginstance_alloc_init(pl, pi_id, stack);
-		if (!pi) {
-			ulogd_log(ULOGD_ERROR, 
-				  "unable to allocate pluginstance for %s\n",
-				  pi_id);
-			ret = -ENOMEM;
-			goto out;
+
+		/* on reload, the running instance of a source is reused */
+		pi = takeover_source(pl, pi_id, &donor);
+		if (pi) {
+			pi->stack = stack;
+			carried = pi;
+		} else {
+			pl->usage++;
+
+			/* allocate */
+			pi = pluginstance_alloc_init(pl, pi_id, stack);
+			if (!pi) {
+				ulogd_log(ULOGD_ERROR,
+					  "unable to allocate pluginstance "
+					  "for %s\n", pi_id);
+				ret = -ENOMEM;
+				goto out;
+			}
 		}
 	
 		/* FIXME: call constructor routine from end to beginning,
@@ -1025,6 +1955,23 @@ static int create_stack(const char *option)
 			
 		ulogd_log(ULOGD_DEBUG, "pushing `%s' on stack\n", pl->name);
 		llist_add_tail(&pi->list, &stack->list);
+
+		if (split) {
+			if (stack->split) {
+				ulogd_log(ULOGD_ERROR, "only one thread split "
+					  "per stack is supported\n");
+				ret = -EINVAL;
+				goto out;
+			}
+			stack->split = pi;
+		}
+		split = (option[tok - buf + strlen(tok)] == '|');
+	}
+
+	if (split) {
+		ulogd_log(ULOGD_ERROR, "stack can't end with a thread split\n");
+		ret = -EINVAL;
+		goto out;
 	}
 
 	/* PASS 2: resolve key connections from bottom to top of stack */
@@ -1034,7 +1981,25 @@ static int create_stack(const char *option)
 		goto out;
 	}
 
-	/* PASS 3: start each plugin in stack */
+	/* PASS 3: set up batches before plugins get hold of their keys */
+	ret = create_stack_batch(stack);
+	if (ret < 0) {
+		ulogd_log(ULOGD_ERROR, "unable to set up batches\n");
+		goto out;
+	}
+
+	ret = create_stack_valid(stack);
+	if (ret < 0) {
+		ulogd_log(ULOGD_ERROR, "unable to set up valid bitmap\n");
+		goto out;
+	}
+
+	/* the keys may have been moved for the batches */
+	ret = create_stack_plan(stack);
+	if (ret < 0)
+		goto out;
+
+	/* PASS 4: start each plugin in stack */
 	ret = create_stack_start_instances(stack);
 	if (ret < 0) {
 		ulogd_log(ULOGD_DEBUG, "destroying stack\n");
@@ -1047,7 +2012,17 @@ static int create_stack(const char *option)
 	return 0;
 
 out:
-	free(stack);
+	llist_for_each_entry_safe(pi, npi, &stack->list, list) {
+		llist_del(&pi->list);
+		/* a carried over source goes away with its old stack */
+		if (pi == carried) {
+			llist_add(&pi->list, &donor->list);
+			pi->stack = donor;
+			continue;
+		}
+		pluginstance_destroy(pi);
+	}
+	stack_free(stack);
 out_stack:
 	free(buf);
 out_buf:
@@ -1055,6 +2030,297 @@ out_buf:
 }
 	
 
+/* move the part of the stack after the split point to its own thread */
+static int create_stack_worker(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_pluginstance *first = stack->split;
+
+	/* without explicit split, only the source stays in the loop */
+	if (first == NULL && stack_threads_ce.u.value)
+		first = llist_entry(stack->list.next->next,
+				    struct ulogd_pluginstance, list);
+
+	if (first == NULL || &first->list == &stack->list)
+		return 0;
+
+	/* records are handed over to the thread one by one */
+	if (stack->batch_size > 1) {
+		struct ulogd_pluginstance *pi;
+
+		llist_for_each_entry(pi, &stack->list, list) {
+			if (pi == stack->batch_end)
+				break;
+			if (pi == first) {
+				stack->batch_end = first;
+				break;
+			}
+		}
+	}
+
+	stack->worker = ulogd_worker_create(stack, first,
+					    stack_queue_len_ce.u.value);
+	if (stack->worker == NULL) {
+		ulogd_log(ULOGD_ERROR, "unable to create stack "
+			  "thread for `%s'\n", first->id);
+		return -1;
+	}
+	return 0;
+}
+
+/* number of pluginstances both stacks begin with, the sink is never shared
+ * as there may be a reason for writing the same records twice */
+static unsigned int stack_common_prefix(struct ulogd_pluginstance_stack *a,
+					struct ulogd_pluginstance_stack *b)
+{
+	unsigned int i, max;
+
+	max = a->plan.num_steps < b->plan.num_steps ?
+	      a->plan.num_steps : b->plan.num_steps;
+
+	for (i = 0; i + 1 < max; i++) {
+		struct ulogd_pluginstance *pa = a->plan.steps[i].pi;
+		struct ulogd_pluginstance *pb = b->plan.steps[i].pi;
+
+		if (pa->plugin != pb->plugin || strcmp(pa->id, pb->id) ||
+		    pa->output.num_keys != pb->output.num_keys)
+			break;
+	}
+	return i;
+}
+
+/* translate a key of the steps before the fork of 'stack' between its own
+ * pluginstances and the ones of its trunk */
+static struct ulogd_key *
+stack_move_key(struct ulogd_pluginstance_stack *stack, struct ulogd_key *key,
+	       int to_trunk)
+{
+	unsigned int i;
+
+	for (i = 0; i < stack->fork; i++) {
+		struct ulogd_pluginstance *own = stack->plan.steps[i].pi;
+		struct ulogd_pluginstance *shared =
+					stack_step_pi(stack->trunk, i);
+		struct ulogd_pluginstance *from = to_trunk ? own : shared;
+		struct ulogd_pluginstance *to = to_trunk ? shared : own;
+
+		if (key >= from->output.keys &&
+		    key < from->output.keys + from->output.num_keys) {
+			key = to->output.keys + (key - from->output.keys);
+			if (to_trunk)
+				SET_NEEDED(*key);
+			return key;
+		}
+	}
+	return key;
+}
+
+/* make the steps after the fork read the results of the trunk, or their
+ * own ones again */
+static void stack_move_sources(struct ulogd_pluginstance_stack *stack,
+			       int to_trunk)
+{
+	struct ulogd_stack_worker *w = stack->worker;
+	unsigned int i, j;
+
+	for (i = stack->fork; i < stack->plan.split; i++) {
+		struct ulogd_pluginstance *pi = stack->plan.steps[i].pi;
+
+		for (j = 0; j < pi->input.num_keys; j++) {
+			struct ulogd_key *ikey = &pi->input.keys[j];
+
+			ikey->u.source = stack_move_key(stack, ikey->u.source,
+							to_trunk);
+		}
+	}
+
+	/* the stack thread gets a copy of the keys it needs */
+	for (i = 0; w && i < w->num_keys; i++)
+		w->okeys[i] = stack_move_key(stack, w->okeys[i], to_trunk);
+}
+
+/* let 'trunk' run the first 'fork' steps of 'stack' for both of them */
+static int merge_stack(struct ulogd_pluginstance_stack *stack,
+		       struct ulogd_pluginstance_stack *trunk,
+		       unsigned int fork)
+{
+	struct ulogd_pluginstance_stack **branches;
+	struct ulogd_pluginstance *src;
+	unsigned int i;
+
+	branches = realloc(trunk->branches, (trunk->num_branches + 1) *
+			   sizeof(*branches));
+	if (branches == NULL)
+		return -ENOMEM;
+	trunk->branches = branches;
+
+	for (i = trunk->num_branches; i > 0; i--) {
+		if (branches[i - 1]->fork <= fork)
+			break;
+		branches[i] = branches[i - 1];
+	}
+	branches[i] = stack;
+	trunk->num_branches++;
+
+	stack->trunk = trunk;
+	stack->fork = fork;
+	stack_move_sources(stack, 1);
+	/* the shared steps may have to produce more for this stack */
+	for (i = fork; i > 0; i--)
+		pluginstance_mark_needed(stack_step_pi(trunk, i - 1));
+
+	/* the source doesn't hand the records to this stack anymore */
+	src = stack->plan.steps[0].pi;
+	llist_del(&src->plist);
+	INIT_LLIST_HEAD(&src->plist);
+
+	ulogd_log(ULOGD_INFO, "stack `%s' shares %u pluginstances with `%s'\n",
+		  stack->name, fork, trunk->name);
+
+	return create_stack_plan(stack);
+}
+
+/* undo merge_stack() for 'stack' and the stacks forking off it */
+static void unmerge_stack(struct ulogd_pluginstance_stack *stack)
+{
+	struct ulogd_pluginstance_stack *root = stack;
+	struct ulogd_pluginstance *src;
+	unsigned int i;
+
+	for (i = stack->num_branches; i > 0; i--)
+		unmerge_stack(stack->branches[i - 1]);
+	stack->num_branches = 0;
+
+	if (stack->trunk == NULL)
+		return;
+
+	while (root->trunk)
+		root = root->trunk;
+
+	/* the source feeds this stack again */
+	src = stack->plan.steps[0].pi;
+	llist_add_tail(&src->plist, &root->plan.steps[0].pi->plist);
+
+	stack_move_sources(stack, 0);
+	stack->trunk = NULL;
+	stack->fork = 0;
+	create_stack_plan(stack);
+}
+
+/* stacks sharing a source are turned into a tree, so the pluginstances they
+ * begin with are run once per record instead of once per stack */
+static int merge_stacks(void)
+{
+	struct ulogd_pluginstance_stack *stack, *trunk, *cur;
+	struct ulogd_pluginstance *src, *pi, *npi;
+	unsigned int fork, n;
+
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+		src = stack->plan.steps[0].pi;
+		if (!src->started || stack->trunk)
+			continue;
+
+		llist_for_each_entry_safe(pi, npi, &src->plist, plist) {
+			struct ulogd_pluginstance_stack *peer = pi->stack;
+
+			/* the stack of the group it has most in common with,
+			 * the source being already shared */
+			trunk = stack;
+			fork = stack_common_prefix(stack, peer);
+			llist_for_each_entry(cur, &ulogd_pi_stacks, stack_list) {
+				struct ulogd_pluginstance_stack *root = cur;
+
+				while (root->trunk)
+					root = root->trunk;
+				if (cur == stack || root != stack)
+					continue;
+
+				n = stack_common_prefix(cur, peer);
+				if (n > fork) {
+					trunk = cur;
+					fork = n;
+				}
+			}
+
+			/* the shared steps run in the main loop */
+			if (fork > peer->plan.split)
+				fork = peer->plan.split;
+			while (fork < trunk->fork)
+				trunk = trunk->trunk;
+			if (fork > trunk->plan.split)
+				fork = trunk->plan.split;
+
+			/* and they must not be called with the whole batch */
+			if (fork == 0 || peer->batch_size != trunk->batch_size ||
+			    (peer->batch_size > 1 &&
+			     (fork < peer->plan.batch_end ||
+			      fork < trunk->plan.batch_end)))
+				continue;
+
+			if (merge_stack(peer, trunk, fork) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static void unmerge_stacks(void)
+{
+	struct ulogd_pluginstance_stack *stack;
+
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+		if (stack->trunk == NULL)
+			unmerge_stack(stack);
+	}
+}
+
+static int create_stack_workers(void)
+{
+	struct ulogd_pluginstance_stack *stack;
+
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+		if (create_stack_worker(stack) < 0)
+			return -1;
+
+		/* the thread part consumes the keys queued to it */
+		if (create_stack_plan(stack) < 0)
+			return -1;
+	}
+
+	if (merge_stacks() < 0)
+		return -1;
+
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list)
+		ulogd_plan_dump(stack);
+
+	return 0;
+}
+
+static int start_stack_workers(void)
+{
+	struct ulogd_pluginstance_stack *stack;
+
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+		if (stack->worker && ulogd_worker_start(stack->worker) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* let the stack threads drain their queue and join them */
+static void stop_stack_workers(void)
+{
+	struct ulogd_pluginstance_stack *stack;
+
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+		if (stack->worker == NULL)
+			continue;
+
+		ulogd_worker_stop(stack->worker);
+		ulogd_worker_destroy(stack->worker);
+		stack->worker = NULL;
+	}
+}
+
 static void ulogd_main_loop(void)
 {
 	int ret;
@@ -1135,7 +2401,7 @@ static int parse_conffile(const char *section, struct config_keyset *ce)
 				"section \"%s\" not found\n", section);
 			break;
 		case -ERRTOOLONG:
-			if (config_errce->key)
+			if (config_errce)
 				ulogd_log(ULOGD_ERROR,
 					  "string value too long for key \"%s\"\n",
 					  config_errce->key);
@@ -1315,6 +2581,11 @@ static void deliver_signal_pluginstances(int signal)
 
 	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
 		llist_for_each_entry(pi, &stack->list, list) {
+			/* the stack thread signals its own plugins */
+			if (stack->worker && pi == stack->worker->first) {
+				ulogd_worker_signal(stack->worker, signal);
+				break;
+			}
 			if (pi->plugin->signal)
 				(*pi->plugin->signal)(pi, signal);
 		}
@@ -1328,13 +2599,20 @@ static void stop_pluginstances()
 
 	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
 		llist_for_each_entry_safe(pi, npi, &stack->list, list) {
-			if ((pi->plugin->priv_size > 0 || *pi->plugin->stop) &&
-			    pluginstance_stop(pi)) {
+			ulogd_backpressure_release(pi);
+
+			/* the peers sharing the source of a stack were not
+			 * started themselves */
+			if (pi->started && pi->plugin->stop) {
 				ulogd_log(ULOGD_DEBUG, "calling stop for %s\n",
 					  pi->plugin->name);
 				(*pi->plugin->stop)(pi);
 				pi->private[0] = 0;
 			}
+			if (!pluginstance_embeds(pi, pi->input.keys))
+				free(pi->input.keys);
+			if (!pluginstance_embeds(pi, pi->output.keys))
+				free(pi->output.keys);
 			free(pi);
 		}
 	}
@@ -1346,6 +2624,7 @@ static void unload_plugins()
 	struct ulogd_plugin_handle *ph, *nph;
 	llist_for_each_entry_safe(ph, nph, &ulogd_plugins_handle, list) {
 		dlclose(ph->handle);
+		free(ph->path);
 		free(ph);
 	}
 }
@@ -1355,9 +2634,157 @@ static void stop_stack()
 {
 	struct ulogd_pluginstance_stack *stack, *nstack;
 
-	llist_for_each_entry_safe(stack, nstack, &ulogd_pi_stacks, stack_list) {
-		free(stack);
+	llist_for_each_entry_safe(stack, nstack, &ulogd_pi_stacks, stack_list)
+		stack_free(stack);
+}
+
+/* stack lines of the config file being reloaded */
+static char **reload_lines;
+static unsigned int reload_num;
+
+static int reload_stack_line(const char *option)
+{
+	char **lines;
+
+	lines = realloc(reload_lines, (reload_num + 1) * sizeof(char *));
+	if (!lines)
+		return -ENOMEM;
+	reload_lines = lines;
+
+	reload_lines[reload_num] = strdup(option);
+	if (!reload_lines[reload_num])
+		return -ENOMEM;
+	reload_num++;
+
+	return 0;
+}
+
+static struct config_keyset ulogd_reload_kset = {
+	.num_ces = 2,
+	.ces = {
+		{
+			.key = "plugin",
+			.type = CONFIG_TYPE_CALLBACK,
+			.options = CONFIG_OPT_MULTI,
+			.u.parser = &load_plugin,
+		},
+		{
+			.key = "stack",
+			.type = CONFIG_TYPE_CALLBACK,
+			.options = CONFIG_OPT_MULTI,
+			.u.parser = &reload_stack_line,
+		},
+	},
+};
+
+/* read the stacks from the config file again: the stacks whose line and
+ * plugin sections are unchanged keep running, the other ones are built
+ * anew and the stacks that are gone are removed.  Everything happens in
+ * the main loop, so no record is lost during the swap. */
+static void reload_stacks(void)
+{
+	struct ulogd_pluginstance_stack *stack, *nstack;
+	struct llist_head *kept;
+	unsigned char *keep;
+	unsigned int i;
+
+	ulogd_log(ULOGD_NOTICE, "reloading stacks from %s\n",
+		  ulogd_configfile);
+
+	if (parse_conffile("global", &ulogd_reload_kset)) {
+		ulogd_log(ULOGD_ERROR, "keeping the running stacks\n");
+		goto out;
+	}
+
+	keep = calloc(reload_num ? reload_num : 1, 1);
+	if (!keep) {
+		ulogd_log(ULOGD_ERROR, "keeping the running stacks\n");
+		goto out;
+	}
+
+	/* the stacks are merged again once the new ones are built */
+	unmerge_stacks();
+	llist_splice_init(&ulogd_pi_stacks, &ulogd_old_stacks);
+
+	for (i = 0; i < reload_num; i++) {
+		llist_for_each_entry(stack, &ulogd_old_stacks, stack_list) {
+			if (strcmp(stack->name, reload_lines[i]) ||
+			    stack_config_changed(stack))
+				continue;
+
+			llist_del(&stack->stack_list);
+			llist_add_tail(&stack->stack_list, &ulogd_pi_stacks);
+			keep[i] = 1;
+			break;
+		}
+	}
+
+	/* a kept stack sharing the source of a stack that goes away is built
+	 * anew, the new one takes the running source over */
+	for (i = 0; i < reload_num; i++) {
+		if (!keep[i])
+			continue;
+		llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+			if (strcmp(stack->name, reload_lines[i]))
+				continue;
+			if (!source_owner_kept(llist_entry(stack->list.next,
+						struct ulogd_pluginstance,
+						list))) {
+				llist_del(&stack->stack_list);
+				llist_add_tail(&stack->stack_list,
+					       &ulogd_old_stacks);
+				keep[i] = 0;
+			}
+			break;
+		}
+	}
+	for (i = 0; i < reload_num; i++) {
+		if (keep[i]) {
+			free(reload_lines[i]);
+			reload_lines[i] = NULL;
+		}
+	}
+	free(keep);
+
+	/* create_stack() adds the new stacks in front of the kept ones */
+	kept = ulogd_pi_stacks.next;
+	for (i = 0; i < reload_num; i++) {
+		if (reload_lines[i] && create_stack(reload_lines[i]) < 0)
+			ulogd_log(ULOGD_ERROR, "unable to build stack `%s'\n",
+				  reload_lines[i]);
+	}
+
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list) {
+		if (&stack->stack_list == kept)
+			break;
+
+		create_stack_worker(stack);
+		if (create_stack_plan(stack) < 0)
+			ulogd_log(ULOGD_ERROR, "unable to set up stack `%s'\n",
+				  stack->name);
+
+		if (stack->worker && ulogd_worker_start(stack->worker) < 0)
+			ulogd_log(ULOGD_ERROR, "can't start stack thread "
+				  "of `%s'\n", stack->name);
 	}
+
+	llist_for_each_entry_safe(stack, nstack, &ulogd_old_stacks, stack_list)
+		retire_stack(stack);
+
+	if (merge_stacks() < 0)
+		ulogd_log(ULOGD_ERROR, "unable to merge stacks\n");
+	llist_for_each_entry(stack, &ulogd_pi_stacks, stack_list)
+		ulogd_plan_dump(stack);
+
+	if (llist_empty(&ulogd_pi_stacks))
+		ulogd_log(ULOGD_ERROR, "not even a single working plugin "
+			  "stack\n");
+out:
+	for (i = 0; i < reload_num; i++)
+		free(reload_lines[i]);
+	free(reload_lines);
+	reload_lines = NULL;
+	reload_num = 0;
 }
 
 
@@ -1375,19 +2802,34 @@ static void signal_handler(int signal)
  */
 static void sigterm_handler_task(int signal)
 {
+	const struct ulogd_busy_poll_stats *busy;
 
 	ulogd_log(ULOGD_NOTICE, "Terminal signal received, exiting\n");
 
+	stop_stack_workers();
+
+	busy = ulogd_select_busy_stats();
+	if (busy)
+		ulogd_log(ULOGD_INFO, "busy polling: %"PRIu64" hits, %"PRIu64
+			  " misses, %"PRIu64" empty polls\n", busy->hits,
+			  busy->misses, busy->polls);
+
+	ulogd_stats_stop();
+
 	deliver_signal_pluginstances(signal);
 
 	stop_pluginstances();
 
 	stop_stack();
 
+	ulogd_keyid_fini();
+
 #ifndef DEBUG_VALGRIND
 	unload_plugins();
 #endif
 
+	ulogd_log_stop();
+
 	if (logfile != NULL  && logfile != stdout) {
 		fclose(logfile);
 		logfile = NULL;
@@ -1416,8 +2858,10 @@ static void signal_handler_task(int signal)
 	case SIGHUP:
 		/* reopen logfile */
 		if (logfile != stdout && logfile != syslog_dummy) {
+			pthread_mutex_lock(&ulogd_log_lock);
 			fclose(logfile);
 			logfile = fopen(ulogd_logfile, "a");
+			pthread_mutex_unlock(&ulogd_log_lock);
  			if (!logfile) {
 				fprintf(stderr, 
 					"ERROR: can't open logfile %s: %s\n", 
@@ -1432,19 +2876,10 @@ static void signal_handler_task(int signal)
 	}
 
 	deliver_signal_pluginstances(signal);
-}
 
-static void set_scheduler(void)
-{
-	struct sched_param schedparam;
-	int sched_type;
-
-	schedparam.sched_priority = sched_get_priority_max(SCHED_RR);
-	sched_type = SCHED_RR;
-
-	if (sched_setscheduler(0, sched_type, &schedparam) < 0)
-		fprintf(stderr, "WARNING: scheduler configuration failed:"
-			" %s\n", strerror(errno));
+	/* rebuild the stacks that have changed in the config file */
+	if (signal == SIGHUP)
+		reload_stacks();
 }
 
 static void print_usage(void)
@@ -1597,6 +3032,22 @@ int main(int argc, char* argv[])
 		warn_and_exit(daemonize);
 	}
 
+	if (create_stack_workers() < 0) {
+		ulogd_log(ULOGD_FATAL, "unable to set up stack threads\n");
+		warn_and_exit(daemonize);
+	}
+
+	if (profile_ce.u.value)
+		ulogd_profile_start();
+
+	if (ulogd_backpressure_start(backpressure_ce.u.string,
+				     backpressure_sample_ce.u.value,
+				     &ulogd_pi_stacks) < 0)
+		warn_and_exit(daemonize);
+
+	ulogd_stats_start(stats_file_ce.u.string, stats_interval_ce.u.value,
+			  &ulogd_pi_stacks);
+
 	errno = 0;
 	if (nice(-1) == -1) {
 		if (errno != 0)
@@ -1641,7 +3092,22 @@ int main(int argc, char* argv[])
 	signal(SIGALRM, &signal_handler);
 	signal(SIGUSR1, &signal_handler);
 	signal(SIGUSR2, &signal_handler);
-	set_scheduler();
+	if (ulogd_sched_setup(scheduler_ce.u.string,
+			      scheduler_priority_ce.u.value,
+			      cpu_affinity_ce.u.string,
+			      thread_cpu_affinity_ce.u.string) < 0)
+		warn_and_exit(daemonize);
+
+	ulogd_select_busy_poll(busy_poll_ce.u.value);
+
+	/* from now on, the messages are written by the log thread */
+	if (ulogd_log_start(log_burst_ce.u.value, log_interval_ce.u.value) < 0)
+		ulogd_log(ULOGD_ERROR, "logging synchronously\n");
+
+	if (start_stack_workers() < 0) {
+		ulogd_log(ULOGD_FATAL, "can't start stack threads\n");
+		warn_and_exit(daemonize);
+	}
 
 	ulogd_log(ULOGD_INFO, 
 		  "initialization finished, entering main loop\n");
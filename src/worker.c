@@ -0,0 +1,466 @@
+/* stack threads
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Description:
+ *  A stack can be split in two parts: the input plugin and the filters up to
+ *  the split point keep running in the main loop, everything after it runs
+ *  in a thread of its own.  ulogd_propagate_results() hands every record
+ *  over through a bounded single producer / single consumer ring, so a slow
+ *  output cannot stall the netlink sockets anymore.
+ *
+ *  Only the keys consumed by the thread part are copied into the ring.
+ *  Strings and raw data are duplicated since they usually point into the
+ *  receive buffer of the input plugin.  Raw keys that do not announce their
+ *  length (see okey_set_raw()) can't be copied and are passed as invalid.
+ *
+ *  If the ring is full, the record is dropped and accounted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/worker.h>
+#include <ulogd/sched.h>
+
+/* number of records processed before looking at timers and signals */
+#define WORKER_BUDGET	64
+
+/* alignment of copied data, filters cast raw.pkt to protocol headers */
+#define WORKER_ALIGN(len)	(((len) + 7) & ~7)
+
+static int key_in_pluginstance(struct ulogd_key *key,
+			       struct ulogd_pluginstance *pi)
+{
+	return key >= pi->output.keys &&
+	       key < pi->output.keys + pi->output.num_keys;
+}
+
+/* is 'key' produced by the part of the stack running in the main loop? */
+static int key_before_split(struct ulogd_key *key,
+			    struct ulogd_pluginstance_stack *stack,
+			    struct ulogd_pluginstance *first)
+{
+	struct ulogd_pluginstance *pi;
+
+	llist_for_each_entry(pi, &stack->list, list) {
+		if (pi == first)
+			break;
+		if (key_in_pluginstance(key, pi))
+			return 1;
+	}
+	return 0;
+}
+
+struct ulogd_stack_worker *
+ulogd_worker_create(struct ulogd_pluginstance_stack *stack,
+		    struct ulogd_pluginstance *first, unsigned int qlen)
+{
+	struct ulogd_stack_worker *w;
+	pthread_condattr_t attr;
+	struct ulogd_pluginstance *pi;
+	unsigned int max_keys = 0;
+	unsigned int i;
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL)
+		return NULL;
+
+	w->stack = stack;
+	w->first = pi = first;
+	llist_for_each_entry_from(pi, &stack->list, list)
+		max_keys += pi->input.num_keys;
+
+	w->okeys = calloc(max_keys + 1, sizeof(struct ulogd_key *));
+	w->mirror = calloc(max_keys + 1, sizeof(struct ulogd_key));
+	if (w->okeys == NULL || w->mirror == NULL)
+		goto err;
+
+	/* redirect input keys of the thread part to the mirror keys */
+	pi = first;
+	llist_for_each_entry_from(pi, &stack->list, list) {
+		for (i = 0; i < pi->input.num_keys; i++) {
+			struct ulogd_key *ikey = &pi->input.keys[i];
+			struct ulogd_key *okey = ikey->u.source;
+			unsigned int j;
+
+			if (okey == NULL || !key_before_split(okey, stack, first))
+				continue;
+
+			for (j = 0; j < w->num_keys; j++) {
+				if (w->okeys[j] == okey)
+					break;
+			}
+			if (j == w->num_keys) {
+				w->okeys[j] = okey;
+				w->mirror[j] = *okey;
+				memset(&w->mirror[j].u, 0,
+				       sizeof(w->mirror[j].u));
+				w->num_keys++;
+			}
+			ikey->u.source = &w->mirror[j];
+		}
+	}
+
+	/* the mirror keys have a valid bitmap of their own */
+	w->valid = calloc(ULOGD_VALID_WORDS(w->num_keys) + 1,
+			  sizeof(unsigned long));
+	if (w->valid == NULL)
+		goto err;
+
+	for (i = 0; i < w->num_keys; i++) {
+		w->mirror[i].valid = w->valid + i / ULOGD_BITS_PER_LONG;
+		w->mirror[i].valid_mask = 1UL << (i % ULOGD_BITS_PER_LONG);
+	}
+
+	for (w->size = 2; w->size < qlen; w->size <<= 1);
+
+	w->ring = calloc(w->size, sizeof(struct ulogd_worker_slot));
+	if (w->ring == NULL)
+		goto err;
+
+	for (i = 0; i < w->size; i++) {
+		w->ring[i].kval = calloc(w->num_keys + 1,
+					 sizeof(struct ulogd_worker_kval));
+		w->ring[i].valid = calloc(ULOGD_VALID_WORDS(w->num_keys) + 1,
+					  sizeof(unsigned long));
+		if (w->ring[i].kval == NULL || w->ring[i].valid == NULL)
+			goto err;
+	}
+
+	/* wait on the same clock the timers are using */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	ulogd_timer_base_init(&w->timers);
+
+	ulogd_log(ULOGD_INFO, "stack thread starting at `%s', %u keys "
+		  "handed over, queue of %u records\n", first->id,
+		  w->num_keys, w->size);
+
+	return w;
+err:
+	ulogd_worker_destroy(w);
+	return NULL;
+}
+
+/* returns the number of bytes to copy for the value of 'key', -1 if the
+ * value cannot be handed over to another thread */
+static int kval_copy_len(struct ulogd_key *key)
+{
+	if (key->u.value.ptr == NULL)
+		return 0;
+
+	switch (key->type) {
+	case ULOGD_RET_STRING:
+		return strlen(key->u.value.ptr) + 1;
+	case ULOGD_RET_RAWSTR:
+		if (key->len)
+			return key->len;
+		return strlen(key->u.value.ptr) + 1;
+	case ULOGD_RET_RAW:
+		if (key->len)
+			return key->len;
+		return -1;
+	default:
+		return 0;
+	}
+}
+
+/* called from the main loop once the part before the split is done */
+void ulogd_worker_enqueue(struct ulogd_stack_worker *w)
+{
+	struct ulogd_pluginstance_stats *stats = &w->first->stats;
+	struct ulogd_worker_slot *slot;
+	unsigned int head = w->head;
+	size_t need = 0, off = 0;
+	unsigned int i;
+
+	if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == w->size) {
+		stats->dropped++;
+		/* don't flood the log, report 1, 2, 4, 8... dropped */
+		if ((stats->dropped & (stats->dropped - 1)) == 0)
+			ulogd_log(ULOGD_NOTICE, "queue of stack thread `%s' "
+				  "is full, %"PRIu64" records dropped\n",
+				  w->first->id, stats->dropped);
+		return;
+	}
+	slot = &w->ring[head & (w->size - 1)];
+
+	for (i = 0; i < w->num_keys; i++) {
+		struct ulogd_key *okey = w->okeys[i];
+		int len;
+
+		if (!okey_is_valid(okey))
+			continue;
+
+		len = kval_copy_len(okey);
+		if (len > 0)
+			need += WORKER_ALIGN(len);
+	}
+
+	if (need > slot->buflen) {
+		char *buf = realloc(slot->buf, need);
+
+		if (buf == NULL) {
+			stats->dropped++;
+			return;
+		}
+		slot->buf = buf;
+		slot->buflen = need;
+	}
+
+	memset(slot->valid, 0,
+	       ULOGD_VALID_WORDS(w->num_keys) * sizeof(unsigned long));
+
+	for (i = 0; i < w->num_keys; i++) {
+		struct ulogd_key *okey = w->okeys[i];
+		struct ulogd_worker_kval *kval = &slot->kval[i];
+		int len;
+
+		kval->flags = okey->flags;
+		kval->len = okey->len;
+		kval->value = okey->u.value;
+
+		if (!okey_is_valid(okey))
+			continue;
+
+		len = kval_copy_len(okey);
+		if (len < 0)
+			continue;
+
+		slot->valid[i / ULOGD_BITS_PER_LONG] |=
+			1UL << (i % ULOGD_BITS_PER_LONG);
+		if (len > 0) {
+			memcpy(slot->buf + off, okey->u.value.ptr, len);
+			kval->value.ptr = slot->buf + off;
+			off += WORKER_ALIGN(len);
+		}
+	}
+
+	__atomic_store_n(&w->head, head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&w->lock);
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+/* is the queue more than 3/4 full, then until it is down to 1/4, so the
+ * sources aren't paused and resumed for every record (main loop only) */
+int ulogd_worker_busy(struct ulogd_stack_worker *w)
+{
+	unsigned int used = w->head - __atomic_load_n(&w->tail,
+						      __ATOMIC_ACQUIRE);
+
+	if (w->busy)
+		w->busy = used > w->size / 4;
+	else
+		w->busy = used >= w->size - w->size / 4;
+	return w->busy;
+}
+
+static void worker_run_slot(struct ulogd_stack_worker *w,
+			    struct ulogd_worker_slot *slot)
+{
+	unsigned int i;
+
+	for (i = 0; i < w->num_keys; i++) {
+		w->mirror[i].u.value = slot->kval[i].value;
+		w->mirror[i].flags = slot->kval[i].flags;
+		w->mirror[i].len = slot->kval[i].len;
+	}
+	memcpy(w->valid, slot->valid,
+	       ULOGD_VALID_WORDS(w->num_keys) * sizeof(unsigned long));
+
+	ulogd_propagate_split(w->stack);
+}
+
+static void worker_deliver_signals(struct ulogd_stack_worker *w,
+				   uint64_t signals)
+{
+	struct ulogd_pluginstance *pi;
+	int sig;
+
+	for (sig = 1; sig < 64; sig++) {
+		if (!(signals & (1ULL << sig)))
+			continue;
+
+		pi = w->first;
+		llist_for_each_entry_from(pi, &w->stack->list, list) {
+			if (pi->plugin->signal)
+				(*pi->plugin->signal)(pi, sig);
+		}
+	}
+}
+
+/* wait for records, signals or the next timer */
+static void worker_wait(struct ulogd_stack_worker *w, struct timeval *next)
+{
+	struct timespec abstime;
+
+	if (next) {
+		clock_gettime(CLOCK_MONOTONIC, &abstime);
+		abstime.tv_sec += next->tv_sec;
+		abstime.tv_nsec += next->tv_usec * 1000;
+		if (abstime.tv_nsec >= 1000000000) {
+			abstime.tv_sec++;
+			abstime.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&w->lock);
+	__atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+	while (!w->stop && !w->signals &&
+	       __atomic_load_n(&w->head, __ATOMIC_SEQ_CST) == w->tail) {
+		if (next == NULL)
+			pthread_cond_wait(&w->cond, &w->lock);
+		else if (pthread_cond_timedwait(&w->cond, &w->lock,
+						&abstime) == ETIMEDOUT)
+			break;
+	}
+	__atomic_store_n(&w->sleeping, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void *worker_thread(void *data)
+{
+	struct ulogd_stack_worker *w = data;
+
+	ulogd_timer_set_thread_base(&w->timers);
+
+	while (1) {
+		struct timeval next_alarm, *next;
+		uint64_t signals;
+		unsigned int n = 0;
+		int stop;
+
+		while (n++ < WORKER_BUDGET &&
+		       w->tail != __atomic_load_n(&w->head, __ATOMIC_ACQUIRE)) {
+			worker_run_slot(w, &w->ring[w->tail & (w->size - 1)]);
+			__atomic_store_n(&w->tail, w->tail + 1,
+					 __ATOMIC_RELEASE);
+		}
+
+		pthread_mutex_lock(&w->lock);
+		signals = w->signals;
+		w->signals = 0;
+		stop = w->stop;
+		pthread_mutex_unlock(&w->lock);
+
+		if (signals)
+			worker_deliver_signals(w, signals);
+
+		next = ulogd_do_timer_run(&next_alarm);
+
+		if (w->tail != __atomic_load_n(&w->head, __ATOMIC_ACQUIRE))
+			continue;
+
+		/* the queue is drained, we can leave now */
+		if (stop)
+			break;
+
+		worker_wait(w, next);
+	}
+
+	return NULL;
+}
+
+int ulogd_worker_start(struct ulogd_stack_worker *w)
+{
+	sigset_t all, old;
+	int ret;
+
+	/* signals are handled by the main loop, see ulogd_worker_signal() */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(&w->thread, NULL, worker_thread, w);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret != 0) {
+		ulogd_log(ULOGD_ERROR, "can't create stack thread: %s\n",
+			  strerror(ret));
+		return -1;
+	}
+	ulogd_thread_register(w->thread);
+	return 0;
+}
+
+/* signals for the plugins run by the thread are delivered by the thread */
+void ulogd_worker_signal(struct ulogd_stack_worker *w, int signal)
+{
+	if (signal <= 0 || signal >= 64)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->signals |= 1ULL << signal;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* process the pending records and wait for the thread to finish */
+void ulogd_worker_stop(struct ulogd_stack_worker *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	ulogd_thread_unregister(w->thread);
+	pthread_join(w->thread, NULL);
+
+	if (w->first->stats.dropped)
+		ulogd_log(ULOGD_NOTICE, "stack thread `%s' dropped %"PRIu64
+			  " records\n", w->first->id, w->first->stats.dropped);
+}
+
+void ulogd_worker_destroy(struct ulogd_stack_worker *w)
+{
+	struct ulogd_pluginstance *pi;
+	unsigned int i;
+
+	/* give the input keys their original source back */
+	pi = w->first;
+	llist_for_each_entry_from(pi, &w->stack->list, list) {
+		for (i = 0; i < pi->input.num_keys; i++) {
+			struct ulogd_key *ikey = &pi->input.keys[i];
+
+			if (w->mirror && ikey->u.source >= w->mirror &&
+			    ikey->u.source < w->mirror + w->num_keys)
+				ikey->u.source =
+					w->okeys[ikey->u.source - w->mirror];
+		}
+	}
+
+	if (w->ring) {
+		for (i = 0; i < w->size; i++) {
+			free(w->ring[i].kval);
+			free(w->ring[i].valid);
+			free(w->ring[i].buf);
+		}
+		free(w->ring);
+	}
+	free(w->okeys);
+	free(w->mirror);
+	free(w->valid);
+	ulogd_arena_free(&w->arena);
+	free(w);
+}
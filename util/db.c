@@ -35,23 +35,49 @@
 #include <pthread.h>
 
 #include <ulogd/ulogd.h>
+#include <ulogd/sched.h>
 #include <ulogd/db.h>
 
 
 /* generic db layer */
 
-static int __interp_db(struct ulogd_pluginstance *upi);
+static int __interp_db(struct ulogd_pluginstance *upi,
+		       struct ulogd_key *inp);
 
 /* this is a wrapper that just calls the current real
  * interp function */
 int ulogd_db_interp(struct ulogd_pluginstance *upi)
 {
 	struct db_instance *dbi = (struct db_instance *) &upi->private;
-	return dbi->interp(upi);
+	int ret;
+
+	ret = dbi->interp(upi, upi->input.keys);
+	if (dbi->ring.size)
+		pthread_cond_signal(&dbi->ring.cond);
+	return ret;
+}
+
+/* same for a batch, the injection thread is woken up once per batch */
+int ulogd_db_interp_batch(struct ulogd_pluginstance *upi,
+			  struct ulogd_batch *batch)
+{
+	struct db_instance *dbi = (struct db_instance *) &upi->private;
+	unsigned int i;
+
+	for (i = 0; i < batch->num; i++) {
+		if (batch->ret[i] != ULOGD_IRET_OK)
+			continue;
+
+		batch->ret[i] = dbi->interp(upi, ulogd_batch_ikeys(upi, i));
+	}
+	if (dbi->ring.size)
+		pthread_cond_signal(&dbi->ring.cond);
+	return ULOGD_IRET_OK;
 }
 
 /* no connection, plugin disabled */
-static int disabled_interp_db(struct ulogd_pluginstance *upi)
+static int disabled_interp_db(struct ulogd_pluginstance *upi,
+			      struct ulogd_key *inp)
 {
 	return 0;
 }
@@ -138,7 +164,7 @@ static int sql_createstmt(struct ulogd_pluginstance *upi)
 	return 0;
 }
 
-static int _init_db(struct ulogd_pluginstance *upi);
+static int _init_db(struct ulogd_pluginstance *upi, struct ulogd_key *inp);
 
 static void *__inject_thread(void *gdi);
 
@@ -241,6 +267,7 @@ int ulogd_db_start(struct ulogd_pluginstance *upi)
 		ret = pthread_create(&di->db_thread_id, NULL, __inject_thread, upi);
 		if (ret != 0)
 			goto mutex_error;
+		ulogd_thread_register(di->db_thread_id);
 	}
 
 	di->interp = &_init_db;
@@ -270,6 +297,7 @@ static int ulogd_db_instance_stop(struct ulogd_pluginstance *upi)
 		di->stmt = NULL;
 	}
 	if (di->ring.size > 0) {
+		ulogd_thread_unregister(di->db_thread_id);
 		pthread_cancel(di->db_thread_id);
 		free(di->ring.ring);
 		pthread_cond_destroy(&di->ring.cond);
@@ -318,7 +346,8 @@ static int _init_reconnect(struct ulogd_pluginstance *upi)
 	return 0;
 }
 
-static void __format_query_db(struct ulogd_pluginstance *upi, char *start)
+static void __format_query_db(struct ulogd_pluginstance *upi,
+			      struct ulogd_key *inp, char *start)
 {
 	struct db_instance *di = (struct db_instance *) &upi->private;
 
@@ -327,14 +356,14 @@ static void __format_query_db(struct ulogd_pluginstance *upi, char *start)
 	char *stmt_ins = start + di->stmt_offset;
 
 	for (i = 0; i < upi->input.num_keys; i++) {
-		struct ulogd_key *res = upi->input.keys[i].u.source;
+		struct ulogd_key *res = inp[i].u.source;
 
-		if (upi->input.keys[i].flags & ULOGD_KEYF_INACTIVE)
+		if (inp[i].flags & ULOGD_KEYF_INACTIVE)
 			continue;
 
 		if (!res)
 			ulogd_log(ULOGD_NOTICE, "no source for `%s' ?!?\n",
-				  upi->input.keys[i].name);
+				  inp[i].name);
 
 		if (!res || !IS_VALID(*res)) {
 			/* no result, we have to fake something */
@@ -391,7 +420,7 @@ static void __format_query_db(struct ulogd_pluginstance *upi, char *start)
 		default:
 			ulogd_log(ULOGD_NOTICE,
 				"unknown type %d for %s\n",
-				res->type, upi->input.keys[i].name);
+				res->type, inp[i].name);
 			break;
 		}
 		stmt_ins = start + strlen(start);
@@ -437,14 +466,14 @@ static int __add_to_backlog(struct ulogd_pluginstance *upi, const char *stmt, un
 	return 0;
 }
 
-static int _init_db(struct ulogd_pluginstance *upi)
+static int _init_db(struct ulogd_pluginstance *upi, struct ulogd_key *inp)
 {
 	struct db_instance *di = (struct db_instance *) upi->private;
 
 	if (di->reconnect && di->reconnect > time(NULL)) {
 		/* store entry to backlog if it is active */
 		if (di->backlog_memcap && !di->backlog_full) {
-			__format_query_db(upi, di->stmt);
+			__format_query_db(upi, inp, di->stmt);
 			__add_to_backlog(upi, di->stmt,
 						strlen(di->stmt));
 		}
@@ -454,7 +483,7 @@ static int _init_db(struct ulogd_pluginstance *upi)
 	if (di->driver->open_db(upi)) {
 		ulogd_log(ULOGD_ERROR, "can't establish database connection\n");
 		if (di->backlog_memcap && !di->backlog_full) {
-			__format_query_db(upi, di->stmt);
+			__format_query_db(upi, inp, di->stmt);
 			__add_to_backlog(upi, di->stmt, strlen(di->stmt));
 		}
 		return _init_reconnect(upi);
@@ -467,7 +496,7 @@ static int _init_db(struct ulogd_pluginstance *upi)
 
 	/* call the interpreter function to actually write the
 	 * log line that we wanted to write */
-	return __interp_db(upi);
+	return __interp_db(upi, inp);
 }
 
 static int __treat_backlog(struct ulogd_pluginstance *upi)
@@ -498,21 +527,25 @@ static int __treat_backlog(struct ulogd_pluginstance *upi)
 	return 0;
 }
 
-static int __add_to_ring(struct ulogd_pluginstance *upi, struct db_instance *di)
+static int __add_to_ring(struct ulogd_pluginstance *upi, struct db_instance *di,
+			 struct ulogd_key *inp)
 {
 	if (*di->ring.wr_place == RING_QUERY_READY) {
+		upi->stats.dropped++;
 		if (di->ring.full == 0) {
 			ulogd_log(ULOGD_ERROR, "No place left in ring\n");
 			di->ring.full = 1;
 		}
+		/* until the injection thread has caught up */
+		__atomic_store_n(&di->ring.busy, 1, __ATOMIC_SEQ_CST);
+		ulogd_backpressure(upi, 1);
 		return ULOGD_IRET_OK;
 	} else if (di->ring.full) {
 		ulogd_log(ULOGD_NOTICE, "Recovered some place in ring\n");
 		di->ring.full = 0;
 	}
-	__format_query_db(upi, di->ring.wr_place + 1);
+	__format_query_db(upi, inp, di->ring.wr_place + 1);
 	*di->ring.wr_place = RING_QUERY_READY;
-	pthread_cond_signal(&di->ring.cond);
 	di->ring.wr_item ++;
 	di->ring.wr_place += di->ring.length;
 	if (di->ring.wr_item == di->ring.size) {
@@ -523,14 +556,15 @@ static int __add_to_ring(struct ulogd_pluginstance *upi, struct db_instance *di)
 }
 
 /* our main output function, called by ulogd */
-static int __interp_db(struct ulogd_pluginstance *upi)
+static int __interp_db(struct ulogd_pluginstance *upi,
+		       struct ulogd_key *inp)
 {
 	struct db_instance *di = (struct db_instance *) &upi->private;
 
 	if (di->ring.size)
-		return __add_to_ring(upi, di);
+		return __add_to_ring(upi, di, inp);
 
-	__format_query_db(upi, di->stmt);
+	__format_query_db(upi, inp, di->stmt);
 
 	/* if backup log is not empty we add current query to it */
 	if (!llist_empty(&di->backlog)) {
@@ -570,6 +604,28 @@ static int __loop_reconnect_db(struct ulogd_pluginstance * upi) {
 	return 0;
 }
 
+/* the sources may go on once half of the ring is free again */
+static void __ring_release(struct ulogd_pluginstance *upi,
+			   struct db_instance *di)
+{
+	uint32_t used;
+
+	if (!__atomic_load_n(&di->ring.busy, __ATOMIC_SEQ_CST))
+		return;
+
+	used = (__atomic_load_n(&di->ring.wr_item, __ATOMIC_RELAXED) +
+		di->ring.size - di->ring.rd_item) % di->ring.size;
+	/* same place to read and to write, either empty or full */
+	if (used == 0 && di->ring.ring[di->ring.rd_item * di->ring.length] ==
+			 RING_QUERY_READY)
+		used = di->ring.size;
+	if (used > di->ring.size / 2)
+		return;
+
+	__atomic_store_n(&di->ring.busy, 0, __ATOMIC_SEQ_CST);
+	ulogd_backpressure(upi, 0);
+}
+
 static void *__inject_thread(void *gdi)
 {
 	struct ulogd_pluginstance *upi = (struct ulogd_pluginstance *) gdi;
@@ -600,7 +656,9 @@ static void *__inject_thread(void *gdi)
 				wr_place = di->ring.ring;
 			} else
 				wr_place += di->ring.length;
+			__ring_release(upi, di);
 		}
+		__ring_release(upi, di);
 	}
 
 	return NULL;
@@ -623,7 +681,10 @@ void ulogd_db_signal(struct ulogd_pluginstance *upi, int signal)
 	case SIGTERM:
 	case SIGINT:
 		if (di->ring.size) {
-			int s = pthread_cancel(di->db_thread_id);
+			int s;
+
+			ulogd_thread_unregister(di->db_thread_id);
+			s = pthread_cancel(di->db_thread_id);
 			if (s != 0) {
 				ulogd_log(ULOGD_ERROR,
 					  "Can't cancel injection thread\n");